@@ -0,0 +1,85 @@
+// Throughput of the SUM and VAR kernels for each instruction set this CPU
+// supports, in GB/s of doubles read.
+//
+//   AggregateKernelsBench [values]
+//
+// Data is fed in 1024-value blocks, the way the formula engine gathers a
+// range. "cached" repeats one block that stays in L1, "streamed" walks an
+// array of 'values' doubles (default 16M, 128 MB) that doesn't fit in cache.
+#include "AggregateKernels.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static constexpr size_t kBlock = 1024;
+
+// Best of several passes, in GB/s; 'result' keeps the work observable
+template <typename Pass>
+static double bestGbPerSecond(size_t bytesPerPass, Pass pass, double& result) {
+    double best = 0.0;
+    for (int i = 0; i < 5; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        result = pass();
+        double seconds = timer.nsecsElapsed() / 1e9;
+        if (seconds > 0.0) best = std::max(best, bytesPerPass / seconds / 1e9);
+    }
+    return best;
+}
+
+static double sumBlocks(const std::vector<double>& data) {
+    AggregateKernels::Sum acc;
+    for (size_t i = 0; i < data.size(); i += kBlock) {
+        AggregateKernels::sum(data.data() + i, std::min(kBlock, data.size() - i), acc);
+    }
+    return acc.value();
+}
+
+static double varianceBlocks(const std::vector<double>& data) {
+    AggregateKernels::Moments moments;
+    for (size_t i = 0; i < data.size(); i += kBlock) {
+        moments.add(data.data() + i, std::min(kBlock, data.size() - i));
+    }
+    return moments.sampleVariance();
+}
+
+int main(int argc, char* argv[]) {
+    const size_t values = argc > 1 ? std::max(1L, std::atol(argv[1])) : 16 * 1024 * 1024;
+    const size_t cachedRepeats = std::max<size_t>(1, values / kBlock);
+
+    std::vector<double> streamed(values);
+    for (size_t i = 0; i < values; ++i) streamed[i] = static_cast<double>(i % 977) * 0.25 + 1.0;
+    std::vector<double> block(streamed.begin(), streamed.begin() + std::min(kBlock, values));
+
+    const size_t streamedBytes = values * sizeof(double);
+    const size_t cachedBytes = cachedRepeats * block.size() * sizeof(double);
+
+    std::printf("default: %s, %zu values\n", AggregateKernels::instructionSet(), values);
+    std::printf("%-7s %-9s %10s %10s %20s\n", "set", "kernel", "cached", "streamed", "result");
+
+    for (const char* set : {"avx2", "sse2", "scalar"}) {
+        if (!AggregateKernels::useInstructionSet(set)) {
+            std::printf("%-7s (not supported here)\n", set);
+            continue;
+        }
+        double result = 0.0;
+        double cached = bestGbPerSecond(cachedBytes, [&] {
+            double total = 0.0;
+            for (size_t r = 0; r < cachedRepeats; ++r) total += sumBlocks(block);
+            return total;
+        }, result);
+        double streaming = bestGbPerSecond(streamedBytes, [&] { return sumBlocks(streamed); }, result);
+        std::printf("%-7s %-9s %7.2f GB/s %7.2f GB/s %20.10g\n", set, "sum", cached, streaming, result);
+
+        cached = bestGbPerSecond(cachedBytes, [&] {
+            double total = 0.0;
+            for (size_t r = 0; r < cachedRepeats; ++r) total += varianceBlocks(block);
+            return total;
+        }, result);
+        streaming = bestGbPerSecond(streamedBytes, [&] { return varianceBlocks(streamed); }, result);
+        std::printf("%-7s %-9s %7.2f GB/s %7.2f GB/s %20.10g\n", set, "variance", cached, streaming, result);
+    }
+    return 0;
+}
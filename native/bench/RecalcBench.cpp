@@ -0,0 +1,68 @@
+// Full recalculation time against the number of recalc worker threads.
+//
+//   RecalcBench [rows] [max threads]
+//
+// Three formula columns of 'rows' cells each all read $F$1, so editing F1
+// recalculates every one of them in three wide levels. Each thread count
+// runs the same edits, and the results are checked to match the serial run.
+#include "Spreadsheet.h"
+#include <QElapsedTimer>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static double columnTotal(Spreadsheet& sheet, int rows, int col) {
+    double total = 0.0;
+    for (int r = 0; r < rows; ++r) total += sheet.getCellValue(CellAddress(r, col)).toDouble();
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    const int rows = argc > 1 ? std::max(1, std::atoi(argv[1])) : 100000;
+    const int maxThreads = argc > 2 ? std::max(1, std::atoi(argv[2])) : QThread::idealThreadCount();
+    const int repeats = 3;
+    const CellAddress input(0, 5);
+
+    Spreadsheet sheet;
+    sheet.beginBatch();
+    sheet.setCellValue(input, 1.0);
+    for (int r = 0; r < rows; ++r) {
+        QString row = QString::number(r + 1);
+        sheet.setCellValue(CellAddress(r, 0), r % 1000 + 1.0);
+        sheet.setCellFormula(CellAddress(r, 1), "=A" + row + "*$F$1");
+        sheet.setCellFormula(CellAddress(r, 2), "=SQRT(B" + row + ")+SUM(A" + row + ":B" + row + ")");
+        sheet.setCellFormula(CellAddress(r, 3), "=IF(C" + row + ">B" + row + ",C" + row + "*C" + row + "-B" + row + ",ROUND(B" + row + ",2))");
+    }
+    sheet.endBatch();
+
+    std::printf("%d formula cells in 3 levels\n", rows * 3);
+    std::printf("%8s %12s %9s\n", "threads", "best ms", "speedup");
+
+    double serialMs = 0.0;
+    double serialTotal = 0.0;
+    for (int threads = 1; threads <= maxThreads; ++threads) {
+        sheet.setRecalcThreadCount(threads);
+        double bestMs = 0.0;
+        for (int i = 0; i < repeats; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            sheet.setCellValue(input, i % 2 ? 2.0 : 3.0);
+            double ms = timer.nsecsElapsed() / 1e6;
+            if (i == 0 || ms < bestMs) bestMs = ms;
+        }
+        // Settle on the same input, so every thread count must agree
+        sheet.setCellValue(input, 2.0);
+        double total = columnTotal(sheet, rows, 3);
+        if (threads == 1) {
+            serialMs = bestMs;
+            serialTotal = total;
+        } else if (total != serialTotal) {
+            std::printf("%d threads: results differ from the serial run (%.17g vs %.17g)\n",
+                        threads, total, serialTotal);
+            return 1;
+        }
+        std::printf("%8d %12.2f %8.2fx\n", threads, bestMs, serialMs / bestMs);
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include "AggregateKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define AGGREGATE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+using Sum = AggregateKernels::Sum;
+
+void AggregateKernels::Sum::add(double x) {
+    // Neumaier's variant of Kahan: also exact when x outweighs the sum
+    double t = sum + x;
+    if (std::abs(sum) >= std::abs(x)) compensation += (sum - t) + x;
+    else compensation += (x - t) + sum;
+    sum = t;
+}
+
+void AggregateKernels::Moments::add(const double* data, size_t n) {
+    if (n == 0) return;
+    Sum blockSum;
+    AggregateKernels::sum(data, n, blockSum);
+    double blockMean = blockSum.value() / n;
+    Sum blockM2;
+    AggregateKernels::squaredDeviations(data, n, blockMean, blockM2);
+
+    // Chan et al.: merge the block's moments into the running ones
+    long long total = count + static_cast<long long>(n);
+    double delta = blockMean - mean;
+    mean += delta * static_cast<double>(n) / total;
+    m2 += blockM2.value() + delta * delta * (static_cast<double>(count) * n / total);
+    count = total;
+}
+
+// ---- Scalar ----
+
+static void sumScalar(const double* data, size_t n, Sum& acc) {
+    for (size_t i = 0; i < n; ++i) acc.add(data[i]);
+}
+
+static void dotScalar(const double* a, const double* b, size_t n, Sum& acc) {
+    for (size_t i = 0; i < n; ++i) acc.add(a[i] * b[i]);
+}
+
+static void squaredDeviationsScalar(const double* data, size_t n, double mean, Sum& acc) {
+    for (size_t i = 0; i < n; ++i) {
+        double d = data[i] - mean;
+        acc.add(d * d);
+    }
+}
+
+static void minMaxScalar(const double* data, size_t n, double& min, double& max) {
+    for (size_t i = 0; i < n; ++i) {
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+    }
+}
+
+#ifdef AGGREGATE_X86
+
+// Each lane keeps its own Kahan sum; lane totals are folded into the
+// caller's accumulator at the end of the block.
+
+// ---- SSE2 (baseline on x86-64) ----
+
+static inline void kahanStep(__m128d& s, __m128d& c, __m128d x) {
+    __m128d y = _mm_sub_pd(x, c);
+    __m128d t = _mm_add_pd(s, y);
+    c = _mm_sub_pd(_mm_sub_pd(t, s), y);
+    s = t;
+}
+
+static void foldLanes(__m128d s, __m128d c, Sum& acc) {
+    alignas(16) double sums[2], comps[2];
+    _mm_store_pd(sums, s);
+    _mm_store_pd(comps, c);
+    for (int i = 0; i < 2; ++i) { acc.add(sums[i]); acc.add(-comps[i]); }
+}
+
+static void sumSse2(const double* data, size_t n, Sum& acc) {
+    __m128d s = _mm_setzero_pd(), c = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) kahanStep(s, c, _mm_loadu_pd(data + i));
+    foldLanes(s, c, acc);
+    sumScalar(data + i, n - i, acc);
+}
+
+static void dotSse2(const double* a, const double* b, size_t n, Sum& acc) {
+    __m128d s = _mm_setzero_pd(), c = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) kahanStep(s, c, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    foldLanes(s, c, acc);
+    dotScalar(a + i, b + i, n - i, acc);
+}
+
+static void squaredDeviationsSse2(const double* data, size_t n, double mean, Sum& acc) {
+    __m128d s = _mm_setzero_pd(), c = _mm_setzero_pd();
+    __m128d m = _mm_set1_pd(mean);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d d = _mm_sub_pd(_mm_loadu_pd(data + i), m);
+        kahanStep(s, c, _mm_mul_pd(d, d));
+    }
+    foldLanes(s, c, acc);
+    squaredDeviationsScalar(data + i, n - i, mean, acc);
+}
+
+static void minMaxSse2(const double* data, size_t n, double& min, double& max) {
+    __m128d lo = _mm_set1_pd(min), hi = _mm_set1_pd(max);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(data + i);
+        lo = _mm_min_pd(lo, x);
+        hi = _mm_max_pd(hi, x);
+    }
+    alignas(16) double los[2], his[2];
+    _mm_store_pd(los, lo);
+    _mm_store_pd(his, hi);
+    minMaxScalar(los, 2, min, max);
+    minMaxScalar(his, 2, min, max);
+    minMaxScalar(data + i, n - i, min, max);
+}
+
+// ---- AVX2 ----
+
+AVX2_TARGET static inline void kahanStep(__m256d& s, __m256d& c, __m256d x) {
+    __m256d y = _mm256_sub_pd(x, c);
+    __m256d t = _mm256_add_pd(s, y);
+    c = _mm256_sub_pd(_mm256_sub_pd(t, s), y);
+    s = t;
+}
+
+AVX2_TARGET static void foldLanes(__m256d s, __m256d c, Sum& acc) {
+    alignas(32) double sums[4], comps[4];
+    _mm256_store_pd(sums, s);
+    _mm256_store_pd(comps, c);
+    for (int i = 0; i < 4; ++i) { acc.add(sums[i]); acc.add(-comps[i]); }
+}
+
+AVX2_TARGET static void sumAvx2(const double* data, size_t n, Sum& acc) {
+    __m256d s = _mm256_setzero_pd(), c = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) kahanStep(s, c, _mm256_loadu_pd(data + i));
+    foldLanes(s, c, acc);
+    sumScalar(data + i, n - i, acc);
+}
+
+AVX2_TARGET static void dotAvx2(const double* a, const double* b, size_t n, Sum& acc) {
+    __m256d s = _mm256_setzero_pd(), c = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) kahanStep(s, c, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    foldLanes(s, c, acc);
+    dotScalar(a + i, b + i, n - i, acc);
+}
+
+AVX2_TARGET static void squaredDeviationsAvx2(const double* data, size_t n, double mean, Sum& acc) {
+    __m256d s = _mm256_setzero_pd(), c = _mm256_setzero_pd();
+    __m256d m = _mm256_set1_pd(mean);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_sub_pd(_mm256_loadu_pd(data + i), m);
+        kahanStep(s, c, _mm256_mul_pd(d, d));
+    }
+    foldLanes(s, c, acc);
+    squaredDeviationsScalar(data + i, n - i, mean, acc);
+}
+
+AVX2_TARGET static void minMaxAvx2(const double* data, size_t n, double& min, double& max) {
+    __m256d lo = _mm256_set1_pd(min), hi = _mm256_set1_pd(max);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(data + i);
+        lo = _mm256_min_pd(lo, x);
+        hi = _mm256_max_pd(hi, x);
+    }
+    alignas(32) double los[4], his[4];
+    _mm256_store_pd(los, lo);
+    _mm256_store_pd(his, hi);
+    minMaxScalar(los, 4, min, max);
+    minMaxScalar(his, 4, min, max);
+    minMaxScalar(data + i, n - i, min, max);
+}
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    // The OS must save the YMM registers on context switch
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // AGGREGATE_X86
+
+struct KernelTable {
+    void (*sum)(const double*, size_t, Sum&);
+    void (*dot)(const double*, const double*, size_t, Sum&);
+    void (*squaredDeviations)(const double*, size_t, double, Sum&);
+    void (*minMax)(const double*, size_t, double&, double&);
+    const char* name;
+};
+
+static const KernelTable kScalarKernels = {sumScalar, dotScalar, squaredDeviationsScalar, minMaxScalar, "scalar"};
+#ifdef AGGREGATE_X86
+static const KernelTable kSse2Kernels = {sumSse2, dotSse2, squaredDeviationsSse2, minMaxSse2, "sse2"};
+static const KernelTable kAvx2Kernels = {sumAvx2, dotAvx2, squaredDeviationsAvx2, minMaxAvx2, "avx2"};
+#endif
+
+static KernelTable selectKernels() {
+#ifdef AGGREGATE_X86
+    return cpuHasAvx2() ? kAvx2Kernels : kSse2Kernels;
+#else
+    return kScalarKernels;
+#endif
+}
+
+static KernelTable& kernels() {
+    static KernelTable table = selectKernels();
+    return table;
+}
+
+void AggregateKernels::sum(const double* data, size_t count, Sum& acc) {
+    kernels().sum(data, count, acc);
+}
+
+void AggregateKernels::dot(const double* a, const double* b, size_t count, Sum& acc) {
+    kernels().dot(a, b, count, acc);
+}
+
+void AggregateKernels::squaredDeviations(const double* data, size_t count, double mean, Sum& acc) {
+    kernels().squaredDeviations(data, count, mean, acc);
+}
+
+void AggregateKernels::minMax(const double* data, size_t count, double& min, double& max) {
+    kernels().minMax(data, count, min, max);
+}
+
+const char* AggregateKernels::instructionSet() {
+    return kernels().name;
+}
+
+bool AggregateKernels::useInstructionSet(const char* name) {
+    if (std::strcmp(name, "scalar") == 0) {
+        kernels() = kScalarKernels;
+        return true;
+    }
+#ifdef AGGREGATE_X86
+    if (std::strcmp(name, "sse2") == 0) {
+        kernels() = kSse2Kernels;
+        return true;
+    }
+    if (std::strcmp(name, "avx2") == 0 && cpuHasAvx2()) {
+        kernels() = kAvx2Kernels;
+        return true;
+    }
+#endif
+    return false;
+}
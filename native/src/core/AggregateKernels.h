@@ -0,0 +1,49 @@
+#ifndef AGGREGATEKERNELS_H
+#define AGGREGATEKERNELS_H
+
+#include <cstddef>
+
+// Numeric kernels behind SUM/AVERAGE/MIN/MAX/SUMPRODUCT/STDEV/VAR. They run
+// over contiguous blocks of doubles that the formula engine gathers from a
+// range's numeric cells (blanks and skipped values never reach them). The
+// AVX2, SSE2 or scalar implementation is picked once at startup from what
+// the CPU supports; all of them produce compensated (Kahan) sums, so long
+// columns don't drift.
+class AggregateKernels {
+public:
+    // Running compensated sum carried across blocks
+    struct Sum {
+        double sum = 0.0;
+        double compensation = 0.0;
+
+        void add(double x);
+        double value() const { return sum + compensation; }
+    };
+
+    // Count, mean and sum of squared deviations, merged block by block
+    // (the parallel form of Welford's update)
+    struct Moments {
+        long long count = 0;
+        double mean = 0.0;
+        double m2 = 0.0;
+
+        void add(const double* data, size_t count);
+        double sampleVariance() const { return count > 1 ? m2 / (count - 1) : 0.0; }
+    };
+
+    static void sum(const double* data, size_t count, Sum& acc);
+    // Sum of a[i] * b[i]
+    static void dot(const double* a, const double* b, size_t count, Sum& acc);
+    // Sum of (data[i] - mean)^2
+    static void squaredDeviations(const double* data, size_t count, double mean, Sum& acc);
+    // Folds the block into min/max; callers seed them with the first value
+    static void minMax(const double* data, size_t count, double& min, double& max);
+
+    // "avx2", "sse2" or "scalar"
+    static const char* instructionSet();
+    // Switches to the named implementation; false if this CPU or build lacks
+    // it. Not synchronized: for benchmarks, before anything is evaluated.
+    static bool useInstructionSet(const char* name);
+};
+
+#endif // AGGREGATEKERNELS_H
@@ -1,45 +1,50 @@
 #include "Cell.h"
-#include <QDateTime>
+#include "StyleTable.h"
 
 Cell::Cell() : m_type(CellType::Empty), m_dirty(false) {
-    // m_customStyle is nullptr by default — uses shared static defaultStyle()
 }
 
 const CellStyle& Cell::defaultStyle() {
-    static const CellStyle s_default;
-    return s_default;
+    return StyleTable::shared().style(StyleTable::kDefaultStyle);
 }
 
 void Cell::setValue(const QVariant& value) {
-    if (m_value != value) {
+    setValue(Value::fromVariant(value));
+}
+
+void Cell::setValue(const Value& value) {
+    m_spilled = false;
+    if (m_value.get() != value) {
         m_value = value;
         m_dirty = true;
 
         // Detect type
-        if (value.isNull() || !value.isValid()) {
-            m_type = CellType::Empty;
-        } else if (value.type() == QVariant::Bool) {
-            m_type = CellType::Boolean;
-        } else if (value.type() == QVariant::Int || value.type() == QVariant::Double) {
-            m_type = CellType::Number;
-        } else if (value.type() == QVariant::Date || value.type() == QVariant::DateTime) {
-            m_type = CellType::Date;
-        } else {
-            m_type = CellType::Text;
+        switch (value.type()) {
+            case Value::Type::Empty: m_type = CellType::Empty; break;
+            case Value::Type::Number: m_type = CellType::Number; break;
+            case Value::Type::Boolean: m_type = CellType::Boolean; break;
+            case Value::Type::Error: m_type = CellType::Error; break;
+            default: m_type = CellType::Text; break;
         }
     }
 }
 
 void Cell::setFormula(const QString& formula) {
+    m_spilled = false;
     if (m_formula != formula) {
         m_formula = formula;
+        m_compiled.reset();
         m_type = CellType::Formula;
         m_dirty = true;
     }
 }
 
+void Cell::setTextId(uint32_t textId) {
+    setValue(Value::text(textId));
+}
+
 QVariant Cell::getValue() const {
-    return m_value;
+    return m_value.get().toVariant();
 }
 
 QString Cell::getFormula() const {
@@ -51,19 +56,15 @@ CellType Cell::getType() const {
 }
 
 void Cell::setStyle(const CellStyle& style) {
-    m_customStyle = std::make_unique<CellStyle>(style);
+    m_styleId = StyleTable::shared().intern(style);
 }
 
 const CellStyle& Cell::getStyle() const {
-    return m_customStyle ? *m_customStyle : defaultStyle();
-}
-
-void Cell::setComputedValue(const QVariant& value) {
-    m_computedValue = value;
+    return StyleTable::shared().style(m_styleId);
 }
 
 QVariant Cell::getComputedValue() const {
-    return m_computedValue;
+    return m_computedValue.get().toVariant();
 }
 
 bool Cell::isDirty() const {
@@ -92,26 +93,27 @@ QString Cell::toString() const {
         case CellType::Formula:
             return m_formula;
         case CellType::Date:
-            return m_value.toDateTime().toString(Qt::ISODate);
         case CellType::Number:
-            return m_value.toString();
+            return m_value.get().toString();
         case CellType::Boolean:
-            return m_value.toBool() ? "TRUE" : "FALSE";
+            return m_value.get().asBoolean() ? "TRUE" : "FALSE";
         case CellType::Error:
-            return "#" + m_error;
+            return m_error.isEmpty() ? m_value.get().toString() : "#" + m_error;
         case CellType::Text:
         case CellType::Empty:
         default:
-            return m_value.toString();
+            return getValue().toString();
     }
 }
 
 void Cell::clear() {
-    m_value = QVariant();
+    m_value = HeldValue();
     m_formula = QString();
-    m_computedValue = QVariant();
+    m_compiled.reset();
+    m_computedValue = HeldValue();
     m_type = CellType::Empty;
-    m_customStyle.reset();
+    m_styleId = StyleTable::kDefaultStyle;
     m_error = QString();
+    m_spilled = false;
     m_dirty = true;
 }
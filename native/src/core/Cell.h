@@ -6,6 +6,10 @@
 #include <vector>
 #include <memory>
 #include <unordered_map>
+#include "StringPool.h"
+#include "Value.h"
+
+class CompiledFormula;
 
 enum class CellType {
     Empty,
@@ -34,6 +38,8 @@ struct BorderStyle {
     bool enabled = false;
     QString color = "#000000";
     int width = 1; // 1=thin, 2=medium, 3=thick
+
+    bool operator==(const BorderStyle&) const = default;
 };
 
 struct CellStyle {
@@ -61,32 +67,62 @@ struct CellStyle {
     BorderStyle borderRight;
     // Indent
     int indentLevel = 0;
+
+    bool operator==(const CellStyle&) const = default;
 };
 
 class Cell {
 public:
     Cell();
     ~Cell() = default;
+    Cell(Cell&&) = default;
+    Cell& operator=(Cell&&) = default;
 
     // Value management
     void setValue(const QVariant& value);
+    void setValue(const Value& value);
     void setFormula(const QString& formula);
     QVariant getValue() const;
+    // Text values live in StringPool::shared(); kNoString for non-text cells
+    void setTextId(uint32_t textId);
+    uint32_t getTextId() const { return m_value.get().isText() ? m_value.get().textId() : StringPool::kNoString; }
     QString getFormula() const;
     CellType getType() const;
 
-    // Styling — lazy: default style shared across all cells, custom allocated on demand
+    // Compiled form of the formula text; reset whenever the text changes
+    const std::shared_ptr<const CompiledFormula>& getCompiledFormula() const { return m_compiled; }
+    void setCompiledFormula(std::shared_ptr<const CompiledFormula> compiled) { m_compiled = std::move(compiled); }
+
+    // Styling — cells hold an id into StyleTable::shared(); 0 is the default style
     void setStyle(const CellStyle& style);
     const CellStyle& getStyle() const;
-    bool hasCustomStyle() const { return m_customStyle != nullptr; }
+    bool hasCustomStyle() const { return m_styleId != 0; }
+    void setStyleId(uint32_t styleId) { m_styleId = styleId; }
+    uint32_t getStyleId() const { return m_styleId; }
 
     // Computed value (for formulas)
-    void setComputedValue(const QVariant& value);
+    void setComputedValue(const Value& value) { if (m_computedValue.get() != value) m_computedValue = value; }
     QVariant getComputedValue() const;
 
+    // What formulas see: the computed value of a formula cell, else the value
+    const Value& getResult() const { return m_type == CellType::Formula ? m_computedValue.get() : m_value.get(); }
+
+    // Part of an array formula's result, written there by the sheet rather
+    // than entered; any other write to the cell clears the flag
+    bool isSpilled() const { return m_spilled; }
+    void setSpilled(bool spilled) { m_spilled = spilled; }
+
     // State
     bool isDirty() const;
     void setDirty(bool dirty);
+    // Counted in the sheet's row/column occupancy, and listed among its
+    // dirty and formula cells; kept by the sheet
+    bool isCounted() const { return m_counted; }
+    void setCounted(bool counted) { m_counted = counted; }
+    bool isDirtyListed() const { return m_dirtyListed; }
+    void setDirtyListed(bool listed) { m_dirtyListed = listed; }
+    bool isFormulaListed() const { return m_formulaListed; }
+    void setFormulaListed(bool listed) { m_formulaListed = listed; }
 
     bool hasError() const;
     void setError(const QString& error);
@@ -96,16 +132,21 @@ public:
     QString toString() const;
     void clear();
 
-    // Shared default style (single allocation, reused by all cells)
+    // Shared default style (style id 0)
     static const CellStyle& defaultStyle();
 
 private:
-    QVariant m_value;
+    HeldValue m_value;
     QString m_formula;
-    QVariant m_computedValue;
+    std::shared_ptr<const CompiledFormula> m_compiled;
+    HeldValue m_computedValue;
     CellType m_type;
-    std::unique_ptr<CellStyle> m_customStyle; // null = default style
+    uint32_t m_styleId = 0;
     bool m_dirty;
+    bool m_spilled = false;
+    bool m_counted = false;
+    bool m_dirtyListed = false;
+    bool m_formulaListed = false;
     QString m_error;
 };
 
@@ -130,3 +130,39 @@ bool CellRange::isSingleRow() const {
 bool CellRange::isSingleColumn() const {
     return m_start.col == m_end.col;
 }
+
+bool StructuralEdit::apply(CellAddress& addr) const {
+    int& pos = rows ? addr.row : addr.col;
+    int cross = rows ? addr.col : addr.row;
+    if (cross < bandStart || cross > bandEnd) return true;
+    int end = pos;
+    return apply(pos, end);
+}
+
+bool StructuralEdit::apply(int& start, int& end) const {
+    if (count > 0) {
+        if (start >= at) start += count;
+        if (end >= at) end += count;
+        return true;
+    }
+    int stop = at - count;  // first index past the deleted ones
+    if (start >= stop) start += count;
+    else if (start >= at) start = at;
+    if (end >= stop) end += count;
+    else if (end >= at) end = at - 1;
+    return start <= end;
+}
+
+bool StructuralEdit::touches(const CellRange& range) const {
+    CellAddress start = range.getStart(), end = range.getEnd();
+    int last = rows ? std::max(start.row, end.row) : std::max(start.col, end.col);
+    int crossStart = rows ? std::min(start.col, end.col) : std::min(start.row, end.row);
+    int crossEnd = rows ? std::max(start.col, end.col) : std::max(start.row, end.row);
+    if (crossStart < 0) crossEnd = INT32_MAX;  // whole column (A:A)
+    return last >= at && crossEnd >= bandStart && crossStart <= bandEnd;
+}
+
+CellRange StructuralEdit::region() const {
+    int crossStart = bandStart <= 0 ? INT32_MIN : bandStart;
+    return rows ? CellRange(at, crossStart, INT32_MAX, bandEnd) : CellRange(crossStart, at, bandEnd, INT32_MAX);
+}
@@ -2,6 +2,7 @@
 #define CELLRANGE_H
 
 #include <QString>
+#include <cstdint>
 #include <vector>
 
 struct CellAddress {
@@ -53,4 +54,27 @@ private:
     void normalize();
 };
 
+// Rows (or columns) inserted before index 'at' (count > 0) or deleted
+// starting at it (count < 0). Shift-cells edits only move cells whose
+// column (row) lies in [bandStart, bandEnd]; whole-row and whole-column
+// edits cover every one.
+struct StructuralEdit {
+    bool rows = true;
+    int at = 0;
+    int count = 0;
+    int bandStart = 0;
+    int bandEnd = INT32_MAX;
+
+    // Where the cell ends up; false if it was deleted
+    bool apply(CellAddress& addr) const;
+    // A reference's [start, end] along the edited axis afterwards: inserts
+    // inside it widen it, deletes narrow it; false once none of it is left
+    bool apply(int& start, int& end) const;
+    // Whether some of range lies at or past 'at' within the band
+    bool touches(const CellRange& range) const;
+    // The cells at or past 'at' within the band, which the edit moves or
+    // deletes; a whole-line edit's band also takes in A:A style references
+    CellRange region() const;
+};
+
 #endif // CELLRANGE_H
@@ -0,0 +1,260 @@
+#include "CellStore.h"
+#include <iterator>
+
+CellStore::Chunk::~Chunk() {
+    for (int slot = 0; slot < kChunkRows; ++slot) {
+        if (has(slot)) cell(slot)->~Cell();
+    }
+}
+
+int CellStore::physicalRow(const Column& column, int row) {
+    if (column.runs.empty()) return row;
+    auto it = std::upper_bound(column.runs.begin(), column.runs.end(), row,
+                               [](int r, const RowRun& run) { return r < run.logical; });
+    if (it == column.runs.begin()) return -1;
+    --it;
+    if (row >= it->logical + it->length) return -1;
+    return it->physical + row - it->logical;
+}
+
+int CellStore::physicalRowForWrite(Column& column, int row) {
+    if (column.runs.empty()) return row;
+    auto next = std::upper_bound(column.runs.begin(), column.runs.end(), row,
+                                 [](int r, const RowRun& run) { return r < run.logical; });
+    // Unmapped rows between runs get physical rows for the whole gap at once,
+    // so filling an inserted block in any order still adds a single run
+    int gapStart = 0;
+    int gapEnd = next == column.runs.end() ? row + 1 : next->logical;
+    if (next != column.runs.begin()) {
+        RowRun& prev = *(next - 1);
+        int prevEnd = prev.logical + prev.length;
+        if (row < prevEnd) return prev.physical + row - prev.logical;
+        if (prev.physical + prev.length == column.physicalEnd) {
+            prev.length = gapEnd - prev.logical;
+            column.physicalEnd = prev.physical + prev.length;
+            return prev.physical + row - prev.logical;
+        }
+        gapStart = prevEnd;
+    }
+    RowRun run{gapStart, column.physicalEnd, gapEnd - gapStart};
+    column.physicalEnd += run.length;
+    column.runs.insert(next, run);
+    return run.physical + row - run.logical;
+}
+
+const std::unique_ptr<CellStore::Chunk>* CellStore::chunkFor(int row, int col, int& slot) const {
+    if (row < 0 || col < 0 || col >= static_cast<int>(m_columns.size())) return nullptr;
+    const Column& column = m_columns[col];
+    int physical = physicalRow(column, row);
+    if (physical < 0) return nullptr;
+    size_t ci = static_cast<size_t>(physical / kChunkRows);
+    if (ci >= column.chunks.size() || !column.chunks[ci]) return nullptr;
+    slot = physical % kChunkRows;
+    return &column.chunks[ci];
+}
+
+std::unique_ptr<CellStore::Chunk>& CellStore::chunkForWrite(int row, int col, int& slot) {
+    if (col >= static_cast<int>(m_columns.size())) m_columns.resize(col + 1);
+    Column& column = m_columns[col];
+    int physical = physicalRowForWrite(column, row);
+    size_t ci = static_cast<size_t>(physical / kChunkRows);
+    if (ci >= column.chunks.size()) column.chunks.resize(ci + 1);
+    if (!column.chunks[ci]) column.chunks[ci] = std::make_unique<Chunk>();
+    slot = physical % kChunkRows;
+    return column.chunks[ci];
+}
+
+Cell* CellStore::peek(int row, int col) const {
+    int slot = 0;
+    auto* chunk = chunkFor(row, col, slot);
+    if (!chunk || !(*chunk)->has(slot)) return nullptr;
+    return (*chunk)->cell(slot);
+}
+
+Cell* CellStore::getOrCreate(int row, int col) {
+    if (row < 0 || col < 0) {
+        m_detached = Cell();
+        return &m_detached;
+    }
+
+    int slot = 0;
+    auto& chunk = chunkForWrite(row, col, slot);
+    if (!chunk->has(slot)) {
+        new (chunk->cell(slot)) Cell();
+        chunk->occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+        chunk->count++;
+        m_size++;
+    }
+    return chunk->cell(slot);
+}
+
+void CellStore::destroySlot(Column& column, int physical) {
+    auto& chunk = column.chunks[physical / kChunkRows];
+    int slot = physical % kChunkRows;
+    chunk->cell(slot)->~Cell();
+    chunk->occupied[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    m_size--;
+    if (--chunk->count == 0) chunk.reset();
+}
+
+bool CellStore::erase(int row, int col) {
+    if (!peek(row, col)) return false;
+    destroySlot(m_columns[col], physicalRow(m_columns[col], row));
+    return true;
+}
+
+void CellStore::clear() {
+    m_columns.clear();
+    m_size = 0;
+}
+
+std::optional<Cell> CellStore::take(int row, int col) {
+    Cell* cell = peek(row, col);
+    if (!cell) return std::nullopt;
+    std::optional<Cell> out(std::move(*cell));
+    destroySlot(m_columns[col], physicalRow(m_columns[col], row));
+    return out;
+}
+
+void CellStore::put(int row, int col, Cell&& cell) {
+    if (row < 0 || col < 0) return;
+    int slot = 0;
+    auto& chunk = chunkForWrite(row, col, slot);
+    if (chunk->has(slot)) {
+        *chunk->cell(slot) = std::move(cell);
+        return;
+    }
+    new (chunk->cell(slot)) Cell(std::move(cell));
+    chunk->occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+    chunk->count++;
+    m_size++;
+}
+
+void CellStore::relocate(int fromRow, int fromCol, int toRow, int toCol) {
+    if (auto cell = take(fromRow, fromCol)) put(toRow, toCol, std::move(*cell));
+}
+
+void CellStore::shiftRows(int col, int fromRow, int delta) {
+    if (delta == 0 || col < 0 || col >= static_cast<int>(m_columns.size())) return;
+    if (fromRow < 0) fromRow = 0;
+    Column& column = m_columns[col];
+
+    if (column.runs.empty()) {
+        // Nothing stored at or below the edit
+        int extent = static_cast<int>(column.chunks.size()) * kChunkRows;
+        if (std::max(0, fromRow + std::min(delta, 0)) >= extent) return;
+        column.runs.push_back({0, 0, extent});
+        column.physicalEnd = extent;
+    }
+    auto& runs = column.runs;
+
+    if (delta > 0) {
+        // Split the run holding fromRow, then move every run from there down
+        auto it = std::upper_bound(runs.begin(), runs.end(), fromRow,
+                                   [](int r, const RowRun& run) { return r < run.logical; });
+        if (it != runs.begin()) {
+            RowRun& run = *(it - 1);
+            int head = fromRow - run.logical;
+            if (head == 0) {
+                --it;
+            } else if (head < run.length) {
+                RowRun tail{fromRow, run.physical + head, run.length - head};
+                run.length = head;
+                it = runs.insert(it, tail);
+            }
+        }
+        for (; it != runs.end(); ++it) it->logical += delta;
+    } else {
+        // Rows [lo, hi) are dropped and everything below moves up over them
+        int lo = std::max(0, fromRow + delta);
+        int hi = lo - delta;
+        std::vector<RowRun> kept;
+        kept.reserve(runs.size() + 1);
+        std::vector<int> dropped;
+        auto collect = [&](int physical, int, Cell&) { dropped.push_back(physical); };
+        for (const RowRun& run : runs) {
+            int end = run.logical + run.length;
+            if (end <= lo) {
+                kept.push_back(run);
+                continue;
+            }
+            if (run.logical >= hi) {
+                kept.push_back({run.logical + delta, run.physical, run.length});
+                continue;
+            }
+            int offset = run.physical - run.logical;
+            int cutStart = std::max(run.logical, lo) + offset;
+            int cutEnd = std::min(end, hi) + offset;
+            scanPhysical(column, col, cutStart, cutEnd - 1, 0, collect);
+            if (run.logical < lo) kept.push_back({run.logical, run.physical, lo - run.logical});
+            if (end > hi) kept.push_back({lo, hi + offset, end - hi});
+        }
+        // Collected first; destroying a slot may free its chunk
+        for (int physical : dropped) destroySlot(column, physical);
+        runs = std::move(kept);
+    }
+
+    mergeRuns(column);
+    if (column.runs.size() > kMaxRuns) compact(col);
+}
+
+void CellStore::mergeRuns(Column& column) {
+    auto& runs = column.runs;
+    size_t out = 0;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (out > 0) {
+            RowRun& last = runs[out - 1];
+            if (last.logical + last.length == runs[i].logical && last.physical + last.length == runs[i].physical) {
+                last.length += runs[i].length;
+                continue;
+            }
+        }
+        runs[out++] = runs[i];
+    }
+    runs.resize(out);
+    // Physical rows outside the runs are empty, so a single run from row 0
+    // in place is the same as no mapping at all
+    if (runs.size() == 1 && runs[0].logical == 0 && runs[0].physical == 0) runs.clear();
+}
+
+void CellStore::compact(int col) {
+    std::vector<std::pair<int, Cell>> cells;
+    forEachInRange(0, INT32_MAX, col, col, [&](int row, int, Cell& cell) { cells.emplace_back(row, std::move(cell)); });
+    m_columns[col] = Column();
+    m_size -= cells.size();
+    for (auto& [row, cell] : cells) put(row, col, std::move(cell));
+}
+
+void CellStore::shiftColumns(int row, int fromCol, int delta) {
+    if (delta == 0 || row < 0) return;
+    if (fromCol < 0) fromCol = 0;
+    int lastCol = static_cast<int>(m_columns.size()) - 1;
+
+    if (delta > 0) {
+        for (int col = lastCol; col >= fromCol; --col) relocate(row, col, row, col + delta);
+    } else {
+        for (int col = std::max(0, fromCol + delta); col < fromCol; ++col) erase(row, col);
+        for (int col = fromCol; col <= lastCol; ++col) {
+            if (col + delta < 0) erase(row, col);
+            else relocate(row, col, row, col + delta);
+        }
+    }
+}
+
+void CellStore::insertColumns(int col, int count) {
+    if (count <= 0 || col < 0 || col >= static_cast<int>(m_columns.size())) return;
+    std::vector<Column> added(count);
+    m_columns.insert(m_columns.begin() + col, std::make_move_iterator(added.begin()),
+                     std::make_move_iterator(added.end()));
+}
+
+void CellStore::removeColumns(int col, int count) {
+    if (count <= 0 || col < 0 || col >= static_cast<int>(m_columns.size())) return;
+    int end = std::min(col + count, static_cast<int>(m_columns.size()));
+    for (int c = col; c < end; ++c) {
+        for (const auto& chunk : m_columns[c].chunks) {
+            if (chunk) m_size -= chunk->count;
+        }
+    }
+    m_columns.erase(m_columns.begin() + col, m_columns.begin() + end);
+}
@@ -0,0 +1,172 @@
+#ifndef CELLSTORE_H
+#define CELLSTORE_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <vector>
+#include "Cell.h"
+
+// Column-oriented cell storage. Each column is a vector of fixed-height row
+// chunks; a chunk holds its Cells by value plus an occupancy bitmap, so there
+// is no per-cell heap node or control block and scans down a column walk
+// contiguous memory.
+//
+// Cells are handed out as plain Cell* into their chunk, and the store alone
+// decides how long a cell lives. A pointer stays valid until the next erase,
+// take, put, shift, column insert/remove or clear, any of which may destroy
+// the cell or reuse its slot for another one; callers must not keep it
+// across those.
+//
+// Rows are stored by physical position. A column starts out with physical
+// row == logical row; inserting or deleting rows instead edits a short list
+// of runs mapping logical rows to physical ones, so row shifts cost
+// O(runs) per column rather than moving every cell below the edit. Once a
+// column collects too many runs it is rewritten in logical order again.
+class CellStore {
+public:
+    static constexpr int kChunkRows = 256;
+
+    CellStore() = default;
+    CellStore(const CellStore&) = delete;
+    CellStore& operator=(const CellStore&) = delete;
+
+    // nullptr when the cell was never created
+    Cell* peek(int row, int col) const;
+    // Out-of-sheet coordinates get a blank scratch cell, reset on each call
+    Cell* getOrCreate(int row, int col);
+
+    bool erase(int row, int col);
+    void clear();
+    size_t size() const { return m_size; }
+
+    // Moves the cell out, leaving the slot empty
+    std::optional<Cell> take(int row, int col);
+    // Stores the cell, replacing any existing one
+    void put(int row, int col, Cell&& cell);
+
+    // Structural edits. A negative delta first drops the cells it shifts over.
+    // shiftRows only remaps rows; shiftColumns moves the cells of one row.
+    void shiftRows(int col, int fromRow, int delta);
+    void shiftColumns(int row, int fromCol, int delta);
+    void insertColumns(int col, int count);
+    void removeColumns(int col, int count);
+    int columnSpan() const { return static_cast<int>(m_columns.size()); }
+
+    // fn(row, col, Cell&) for every stored cell, column by column
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        forEachInRange(0, INT32_MAX, 0, INT32_MAX, fn);
+    }
+
+    // fn(row, col, Cell&) for stored cells inside the rectangle, column by
+    // column and top to bottom within a column. fn may return bool; false
+    // stops the scan.
+    template <typename Fn>
+    void forEachInRange(int rowStart, int rowEnd, int colStart, int colEnd, Fn&& fn) const {
+        if (rowStart < 0) rowStart = 0;
+        if (colStart < 0) colStart = 0;
+        if (rowEnd < rowStart) return;
+        int lastCol = std::min(colEnd, static_cast<int>(m_columns.size()) - 1);
+        for (int col = colStart; col <= lastCol; ++col) {
+            const Column& column = m_columns[col];
+            if (column.runs.empty()) {
+                if (!scanPhysical(column, col, rowStart, rowEnd, 0, fn)) return;
+                continue;
+            }
+            for (const RowRun& run : column.runs) {
+                if (run.logical > rowEnd) break;
+                int first = std::max(rowStart, run.logical);
+                int last = std::min(rowEnd, run.logical + run.length - 1);
+                if (first > last) continue;
+                int offset = run.logical - run.physical;
+                if (!scanPhysical(column, col, first - offset, last - offset, offset, fn)) return;
+            }
+        }
+    }
+
+private:
+    static constexpr int kWords = kChunkRows / 64;
+
+    struct Chunk {
+        std::array<uint64_t, kWords> occupied{};
+        int count = 0;
+        alignas(Cell) unsigned char storage[kChunkRows * sizeof(Cell)];
+
+        Chunk() = default;
+        Chunk(const Chunk&) = delete;
+        Chunk& operator=(const Chunk&) = delete;
+        ~Chunk();
+
+        Cell* cell(int slot) { return std::launder(reinterpret_cast<Cell*>(storage) + slot); }
+        bool has(int slot) const { return (occupied[slot / 64] >> (slot % 64)) & 1u; }
+    };
+
+    // Logical rows [logical, logical + length) live in physical rows
+    // [physical, physical + length)
+    struct RowRun {
+        int logical;
+        int physical;
+        int length;
+    };
+
+    // More runs than this and a column is compacted back to logical order
+    static constexpr size_t kMaxRuns = 128;
+
+    struct Column {
+        std::vector<std::unique_ptr<Chunk>> chunks;  // by physical row
+        std::vector<RowRun> runs;  // sorted by logical row; empty: physical == logical
+        int physicalEnd = 0;       // with runs: first physical row not handed out
+    };
+
+    std::vector<Column> m_columns;
+    size_t m_size = 0;
+    Cell m_detached;
+
+    // Physical row of logical 'row'; -1 when no cell can be stored there yet
+    static int physicalRow(const Column& column, int row);
+    // Assigns a physical row to an unmapped logical one
+    int physicalRowForWrite(Column& column, int row);
+    // Chunk and slot of a logical cell; null when its chunk doesn't exist
+    const std::unique_ptr<Chunk>* chunkFor(int row, int col, int& slot) const;
+    std::unique_ptr<Chunk>& chunkForWrite(int row, int col, int& slot);
+    void destroySlot(Column& column, int physical);
+    void relocate(int fromRow, int fromCol, int toRow, int toCol);
+    void mergeRuns(Column& column);
+    void compact(int col);
+
+    // Visits occupied physical rows [first, last] of column as logical row
+    // physical + offset; false once fn stops the scan
+    template <typename Fn>
+    static bool scanPhysical(const Column& column, int col, int first, int last, int offset, Fn& fn) {
+        int lastChunk = std::min(last / kChunkRows, static_cast<int>(column.chunks.size()) - 1);
+        for (int ci = first / kChunkRows; ci <= lastChunk; ++ci) {
+            Chunk* chunk = column.chunks[ci].get();
+            if (!chunk) continue;
+            int base = ci * kChunkRows;
+            for (int w = 0; w < kWords; ++w) {
+                uint64_t bits = chunk->occupied[w];
+                while (bits) {
+                    int slot = w * 64 + std::countr_zero(bits);
+                    bits &= bits - 1;
+                    int row = base + slot;
+                    if (row < first) continue;
+                    if (row > last) return true;
+                    if constexpr (std::is_same_v<std::invoke_result_t<Fn&, int, int, Cell&>, bool>) {
+                        if (!fn(row + offset, col, *chunk->cell(slot))) return false;
+                    } else {
+                        fn(row + offset, col, *chunk->cell(slot));
+                    }
+                }
+            }
+        }
+        return true;
+    }
+};
+
+#endif // CELLSTORE_H
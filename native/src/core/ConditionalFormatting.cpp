@@ -1,4 +1,5 @@
 #include "ConditionalFormatting.h"
+#include "StyleTable.h"
 
 ConditionalFormat::ConditionalFormat(const CellRange& range, ConditionType type)
     : m_range(range), m_type(type) {
@@ -13,7 +14,7 @@ ConditionType ConditionalFormat::getType() const {
 }
 
 const CellStyle& ConditionalFormat::getStyle() const {
-    return m_style;
+    return StyleTable::shared().style(m_styleId);
 }
 
 void ConditionalFormat::setValue1(const QVariant& value) {
@@ -29,7 +30,7 @@ void ConditionalFormat::setFormula(const QString& formula) {
 }
 
 void ConditionalFormat::setStyle(const CellStyle& style) {
-    m_style = style;
+    m_styleId = StyleTable::shared().intern(style);
 }
 
 bool ConditionalFormat::matches(const QVariant& cellValue) const {
@@ -78,25 +79,40 @@ std::vector<std::shared_ptr<ConditionalFormat>> ConditionalFormatting::getRulesF
     return result;
 }
 
-CellStyle ConditionalFormatting::getEffectiveStyle(const CellAddress& addr, const QVariant& cellValue, const CellStyle& baseStyle) const {
-    CellStyle effective = baseStyle;
+uint32_t ConditionalFormatting::getEffectiveStyleId(const CellAddress& addr, const QVariant& cellValue, uint32_t baseStyleId) const {
+    uint32_t effective = baseStyleId;
 
     for (const auto& rule : m_rules) {
         if (rule->getRange().contains(addr) && rule->matches(cellValue)) {
-            const CellStyle& ruleStyle = rule->getStyle();
-            if (ruleStyle.bold) effective.bold = true;
-            if (ruleStyle.italic) effective.italic = true;
-            if (ruleStyle.underline) effective.underline = true;
-            if (ruleStyle.foregroundColor != "#000000") effective.foregroundColor = ruleStyle.foregroundColor;
-            if (ruleStyle.backgroundColor != "#FFFFFF") effective.backgroundColor = ruleStyle.backgroundColor;
-            if (ruleStyle.fontName != "Arial") effective.fontName = ruleStyle.fontName;
-            if (ruleStyle.fontSize != 11) effective.fontSize = ruleStyle.fontSize;
+            effective = mergedStyle(effective, rule->getStyleId());
         }
     }
 
     return effective;
 }
 
+// Overlaying a rule's style is resolved once per (style, rule style) pair
+uint32_t ConditionalFormatting::mergedStyle(uint32_t baseId, uint32_t ruleId) const {
+    uint64_t key = (static_cast<uint64_t>(baseId) << 32) | ruleId;
+    auto it = m_mergedStyles.find(key);
+    if (it != m_mergedStyles.end()) return it->second;
+
+    StyleTable& table = StyleTable::shared();
+    CellStyle effective = table.style(baseId);
+    const CellStyle& ruleStyle = table.style(ruleId);
+    if (ruleStyle.bold) effective.bold = true;
+    if (ruleStyle.italic) effective.italic = true;
+    if (ruleStyle.underline) effective.underline = true;
+    if (ruleStyle.foregroundColor != "#000000") effective.foregroundColor = ruleStyle.foregroundColor;
+    if (ruleStyle.backgroundColor != "#FFFFFF") effective.backgroundColor = ruleStyle.backgroundColor;
+    if (ruleStyle.fontName != "Arial") effective.fontName = ruleStyle.fontName;
+    if (ruleStyle.fontSize != 11) effective.fontSize = ruleStyle.fontSize;
+
+    uint32_t merged = table.intern(effective);
+    m_mergedStyles.emplace(key, merged);
+    return merged;
+}
+
 const std::vector<std::shared_ptr<ConditionalFormat>>& ConditionalFormatting::getAllRules() const {
     return m_rules;
 }
@@ -5,6 +5,7 @@
 #include <QVariant>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include "CellRange.h"
 #include "Cell.h"
 
@@ -27,6 +28,7 @@ public:
     const CellRange& getRange() const;
     ConditionType getType() const;
     const CellStyle& getStyle() const;
+    uint32_t getStyleId() const { return m_styleId; }
 
     void setValue1(const QVariant& value);
     void setValue2(const QVariant& value);
@@ -41,7 +43,7 @@ private:
     QVariant m_value1;
     QVariant m_value2;
     QString m_formula;
-    CellStyle m_style;
+    uint32_t m_styleId = 0;   // StyleTable id
 };
 
 class ConditionalFormatting {
@@ -58,8 +60,8 @@ public:
     // Get rules for a specific range
     std::vector<std::shared_ptr<ConditionalFormat>> getRulesForRange(const CellRange& range) const;
 
-    // Get style for a cell
-    CellStyle getEffectiveStyle(const CellAddress& addr, const QVariant& cellValue, const CellStyle& baseStyle) const;
+    // Get style (StyleTable id) for a cell
+    uint32_t getEffectiveStyleId(const CellAddress& addr, const QVariant& cellValue, uint32_t baseStyleId) const;
 
     // Get all rules
     const std::vector<std::shared_ptr<ConditionalFormat>>& getAllRules() const;
@@ -69,6 +71,10 @@ public:
 
 private:
     std::vector<std::shared_ptr<ConditionalFormat>> m_rules;
+
+    // (base style id << 32 | rule style id) -> merged style id
+    mutable std::unordered_map<uint64_t, uint32_t> m_mergedStyles;
+    uint32_t mergedStyle(uint32_t baseId, uint32_t ruleId) const;
 };
 
 #endif // CONDITIONALFORMATTING_H
@@ -0,0 +1,192 @@
+#include "CriteriaMatcher.h"
+#include "Spreadsheet.h"
+#include <QLocale>
+
+static const QChar kKeySeparator(0x1F);
+static const QChar kNumberTag(0x01);
+
+// Numbers and numeric text take part in numeric criteria; booleans don't
+static bool numericValue(const Value& value, double& number) {
+    if (value.isNumber()) { number = value.asNumber(); return true; }
+    if (!value.isText()) return false;
+    bool ok = false;
+    number = value.toString().toDouble(&ok);
+    return ok;
+}
+
+static QString numberKey(double number) {
+    if (number == 0.0) number = 0.0; // -0 groups with 0
+    return kNumberTag + QString::number(number, 'g', QLocale::FloatingPointShortest);
+}
+
+CriteriaMatcher::CriteriaMatcher(const Value& criteria) {
+    if (criteria.isNumber()) {
+        m_numeric = true;
+        m_number = criteria.asNumber();
+        m_key = numberKey(m_number);
+        return;
+    }
+
+    QString text = criteria.toString();
+    int opLength = 0;
+    if (text.startsWith(">=")) { m_op = Op::Ge; opLength = 2; }
+    else if (text.startsWith("<=")) { m_op = Op::Le; opLength = 2; }
+    else if (text.startsWith("<>")) { m_op = Op::Ne; opLength = 2; }
+    else if (text.startsWith(">")) { m_op = Op::Gt; opLength = 1; }
+    else if (text.startsWith("<")) { m_op = Op::Lt; opLength = 1; }
+    else if (text.startsWith("=")) { m_op = Op::Eq; opLength = 1; }
+    QString operand = text.mid(opLength);
+
+    bool ok = false;
+    double number = operand.toDouble(&ok);
+    if (ok) {
+        m_numeric = true;
+        m_number = number;
+        m_key = numberKey(number);
+        m_matchesBlank = m_op == Op::Ne;
+        return;
+    }
+
+    operand = operand.toCaseFolded();
+    bool wildcards = (m_op == Op::Eq || m_op == Op::Ne) &&
+                     (operand.contains('*') || operand.contains('?') || operand.contains('~'));
+    if (wildcards) {
+        for (int i = 0; i < operand.size(); ++i) {
+            QChar ch = operand[i];
+            if (ch == '~' && i + 1 < operand.size()) {
+                m_text += operand[++i];
+                m_glob.push_back(Glob::Literal);
+            } else {
+                m_text += ch;
+                m_glob.push_back(ch == '*' ? Glob::AnySequence : ch == '?' ? Glob::AnyChar : Glob::Literal);
+            }
+        }
+    } else {
+        m_text = operand;
+    }
+    m_key = m_text;
+    bool emptyOperand = m_text.isEmpty();
+    if (m_op == Op::Eq) m_matchesBlank = emptyOperand;
+    else if (m_op == Op::Ne) m_matchesBlank = !emptyOperand;
+}
+
+bool CriteriaMatcher::isGroupable() const {
+    return m_op == Op::Eq && m_glob.empty() && !m_matchesBlank;
+}
+
+QString CriteriaMatcher::groupKey(const Value& value) {
+    if (value.isEmpty()) return QString();
+    double number;
+    if (numericValue(value, number)) return numberKey(number);
+    return value.toString().toCaseFolded();
+}
+
+bool CriteriaMatcher::matches(const Value& value) const {
+    if (!value.isText()) return matchValue(value);
+    auto it = m_textResults.find(value.textId());
+    if (it != m_textResults.end()) return it->second;
+    bool result = matchValue(value);
+    m_textResults.emplace(value.textId(), result);
+    return result;
+}
+
+bool CriteriaMatcher::matchValue(const Value& value) const {
+    if (value.isEmpty()) return m_matchesBlank;
+
+    if (m_numeric) {
+        double number;
+        bool isNumber = numericValue(value, number);
+        switch (m_op) {
+            case Op::Eq: return isNumber && number == m_number;
+            case Op::Ne: return !(isNumber && number == m_number);
+            case Op::Lt: return isNumber && number < m_number;
+            case Op::Le: return isNumber && number <= m_number;
+            case Op::Gt: return isNumber && number > m_number;
+            case Op::Ge: return isNumber && number >= m_number;
+        }
+        return false;
+    }
+
+    // Text operand: numbers never compare equal or ordered against it
+    if (value.isNumber()) return m_op == Op::Ne;
+    QString text = value.toString().toCaseFolded();
+    bool equal = m_glob.empty() ? text == m_text : globMatch(text);
+    switch (m_op) {
+        case Op::Eq: return equal;
+        case Op::Ne: return !equal;
+        case Op::Lt: return text.compare(m_text) < 0;
+        case Op::Le: return text.compare(m_text) <= 0;
+        case Op::Gt: return text.compare(m_text) > 0;
+        case Op::Ge: return text.compare(m_text) >= 0;
+    }
+    return false;
+}
+
+// Greedy match with backtracking to the last '*'
+bool CriteriaMatcher::globMatch(const QString& text) const {
+    const int n = static_cast<int>(m_glob.size());
+    int p = 0, i = 0, star = -1, resume = 0;
+    while (i < text.size()) {
+        if (p < n && (m_glob[p] == Glob::AnyChar || (m_glob[p] == Glob::Literal && m_text[p] == text[i]))) {
+            ++p; ++i;
+        } else if (p < n && m_glob[p] == Glob::AnySequence) {
+            star = p++;
+            resume = i;
+        } else if (star >= 0) {
+            p = star + 1;
+            i = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < n && m_glob[p] == Glob::AnySequence) ++p;
+    return p == n;
+}
+
+void ConditionalIndex::Group::add(const Value& value) {
+    if (value.isEmpty()) return;
+    values++;
+    sum.add(value.toNumber());
+    if (value.isNumber()) {
+        double d = value.asNumber();
+        if (numbers == 0 || d < min) min = d;
+        if (numbers == 0 || d > max) max = d;
+        numbers++;
+    }
+}
+
+ConditionalIndex::ConditionalIndex(const Spreadsheet& sheet, const std::vector<CellRange>& criteriaRanges,
+                                   const CellRange* valueRange) {
+    if (criteriaRanges.empty()) return;
+    CellAddress start = criteriaRanges[0].getStart();
+    // Groupable criteria never match a blank, so rows whose first criteria
+    // cell was never created can't be in any group
+    sheet.forEachCellInRange(criteriaRanges[0], [&](int row, int col, const Cell& cell) {
+        QString key = CriteriaMatcher::groupKey(cell.getResult());
+        if (key.isEmpty()) return;
+        int rowOffset = row - start.row, colOffset = col - start.col;
+        for (size_t i = 1; i < criteriaRanges.size(); ++i) {
+            const CellAddress& origin = criteriaRanges[i].getStart();
+            QString part = CriteriaMatcher::groupKey(sheet.getCellResult(CellAddress(origin.row + rowOffset, origin.col + colOffset)));
+            if (part.isEmpty()) return;
+            key += kKeySeparator;
+            key += part;
+        }
+        Group& group = m_groups[key];
+        group.rows++;
+        if (valueRange) {
+            const CellAddress& origin = valueRange->getStart();
+            group.add(sheet.getCellResult(CellAddress(origin.row + rowOffset, origin.col + colOffset)));
+        }
+    });
+}
+
+const ConditionalIndex::Group* ConditionalIndex::find(const std::vector<CriteriaMatcher>& criteria) const {
+    QString key;
+    for (size_t i = 0; i < criteria.size(); ++i) {
+        if (i > 0) key += kKeySeparator;
+        key += criteria[i].groupKey();
+    }
+    auto it = m_groups.find(key);
+    return it != m_groups.end() ? &it->second : nullptr;
+}
@@ -0,0 +1,80 @@
+#ifndef CRITERIAMATCHER_H
+#define CRITERIAMATCHER_H
+
+#include <QString>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "AggregateKernels.h"
+#include "CellRange.h"
+#include "Value.h"
+
+class Spreadsheet;
+
+// A COUNTIF/SUMIFS criterion ("apple", ">=10", "<>", "a*b?"), parsed once
+// into an operator and a typed operand. Numeric operands only match numbers
+// (or numeric text); text operands compare case-insensitively and =/<>
+// support the * and ? wildcards (~ escapes them). Results for pooled text
+// cells are memoized by string id, so repeated values cost one hash probe.
+// Not thread-safe: each evaluation builds its own matchers.
+class CriteriaMatcher {
+public:
+    explicit CriteriaMatcher(const Value& criteria);
+
+    bool matches(const Value& value) const;
+    bool matchesBlank() const { return m_matchesBlank; }
+
+    // Plain equality to a non-blank operand without wildcards. Such criteria
+    // can be answered from a ConditionalIndex by groupKey().
+    bool isGroupable() const;
+    QString groupKey() const { return m_key; }
+    // Key a cell value is grouped under: canonical number or folded text
+    static QString groupKey(const Value& value);
+
+private:
+    enum class Op : uint8_t { Eq, Ne, Lt, Le, Gt, Ge };
+    enum class Glob : uint8_t { Literal, AnyChar, AnySequence };
+
+    Op m_op = Op::Eq;
+    bool m_numeric = false;
+    double m_number = 0.0;
+    QString m_text;             // folded operand, wildcards resolved into m_glob
+    std::vector<Glob> m_glob;   // empty when the operand has no wildcards
+    QString m_key;
+    bool m_matchesBlank = false;
+    mutable std::unordered_map<uint32_t, bool> m_textResults;
+
+    bool matchValue(const Value& value) const;
+    bool globMatch(const QString& text) const;
+};
+
+// Group-by over the criteria ranges of a SUMIFS/COUNTIFS family call: one
+// scan buckets every row by the keys of its criteria cells and aggregates
+// the value range per bucket. A summary grid of formulas over the same
+// ranges with different equality criteria is then one hash probe per cell.
+// Cached per sheet by LookupCache and dropped when a covered cell changes.
+class ConditionalIndex {
+public:
+    struct Group {
+        long long rows = 0;     // matching rows
+        long long values = 0;   // non-empty values (AVERAGEIFS divisor)
+        long long numbers = 0;  // numeric values (MAXIFS/MINIFS)
+        AggregateKernels::Sum sum;
+        double min = 0.0;
+        double max = 0.0;
+
+        void add(const Value& value);
+    };
+
+    // valueRange may be null (COUNTIFS); all ranges have the same shape
+    ConditionalIndex(const Spreadsheet& sheet, const std::vector<CellRange>& criteriaRanges,
+                     const CellRange* valueRange);
+
+    // criteria must all be groupable, one per criteria range
+    const Group* find(const std::vector<CriteriaMatcher>& criteria) const;
+
+private:
+    std::unordered_map<QString, Group> m_groups;
+};
+
+#endif // CRITERIAMATCHER_H
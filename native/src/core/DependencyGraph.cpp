@@ -1,103 +1,339 @@
 #include "DependencyGraph.h"
-#include <queue>
+#include <algorithm>
 
-std::string DependencyGraph::key(const CellAddress& addr) {
-    return addr.toString().toStdString();
+DependencyGraph::NodeId DependencyGraph::findNode(const CellAddress& addr) const {
+    auto it = m_index.find(key(addr));
+    return it != m_index.end() ? it->second : kNoNode;
+}
+
+DependencyGraph::NodeId DependencyGraph::acquireNode(const CellAddress& addr) {
+    uint64_t k = key(addr);
+    auto it = m_index.find(k);
+    if (it != m_index.end()) return it->second;
+
+    NodeId id;
+    if (!m_freeNodes.empty()) {
+        id = m_freeNodes.back();
+        m_freeNodes.pop_back();
+    } else {
+        id = static_cast<NodeId>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+    m_nodes[id].key = k;
+    m_index.emplace(k, id);
+    return id;
+}
+
+void DependencyGraph::releaseNodeIfUnused(NodeId id) {
+    Node& node = m_nodes[id];
+    if (!node.dependents.empty() || !node.dependencies.empty() || !node.ranges.empty()) return;
+    if (m_spills.count(id)) return;
+    auto it = m_index.find(node.key);
+    if (it == m_index.end() || it->second != id) return; // already released
+    m_index.erase(it);
+    node.dependents.shrink_to_fit();
+    node.dependencies.shrink_to_fit();
+    node.ranges.shrink_to_fit();
+    m_freeNodes.push_back(id);
+}
+
+uint32_t DependencyGraph::beginVisit() const {
+    if (m_visitMark.size() < m_nodes.size()) m_visitMark.resize(m_nodes.size(), 0);
+    if (++m_visitEpoch == 0) {
+        std::fill(m_visitMark.begin(), m_visitMark.end(), 0);
+        m_visitEpoch = 1;
+    }
+    return m_visitEpoch;
 }
 
 void DependencyGraph::addDependency(const CellAddress& dependent, const CellAddress& dependency) {
-    std::string depKey = key(dependent);
-    std::string depOnKey = key(dependency);
+    NodeId from = acquireNode(dependent);
+    NodeId to = acquireNode(dependency);
+    m_generation++;
 
-    m_dependencies[depKey].insert(depOnKey);
-    m_dependents[depOnKey].insert(depKey);
+    auto& deps = m_nodes[from].dependencies;
+    auto& rdeps = m_nodes[to].dependents;
+    if (rdeps.empty()) m_precedents.insert(m_nodes[to].key);
+    deps.push_back({to, static_cast<uint32_t>(rdeps.size())});
+    rdeps.push_back({from, static_cast<uint32_t>(deps.size() - 1)});
+    countSpillReader(from, to, 1);
 }
 
-void DependencyGraph::removeDependencies(const CellAddress& cell) {
-    std::string cellKey = key(cell);
-
-    // Remove this cell from all its dependencies' dependent lists
-    auto it = m_dependencies.find(cellKey);
-    if (it != m_dependencies.end()) {
-        for (const auto& depOn : it->second) {
-            auto dit = m_dependents.find(depOn);
-            if (dit != m_dependents.end()) {
-                dit->second.erase(cellKey);
-            }
+void DependencyGraph::countSpillReader(NodeId dependent, NodeId dependency, int delta) {
+    if (m_spills.empty()) return;
+    CellAddress cell = address(m_nodes[dependency].key);
+    m_spillRanges.query(cell.row, cell.col, [&](NodeId anchor) {
+        if (anchor == dependency) return;
+        auto& readers = m_spills.at(anchor).readers;
+        if (delta > 0) readers[dependent]++;
+        else if (auto it = readers.find(dependent); it != readers.end() && --it->second == 0) readers.erase(it);
+    });
+}
+
+void DependencyGraph::addRangeDependency(const CellAddress& dependent, const CellRange& range) {
+    NodeId from = acquireNode(dependent);
+    m_generation++;
+    m_nodes[from].ranges.push_back(m_ranges.insert(range, from));
+}
+
+template <typename Visitor>
+void DependencyGraph::forEachDependent(const CellAddress& addr, NodeId id, Visitor&& visit) const {
+    if (id != kNoNode) {
+        for (const auto& e : m_nodes[id].dependents) visit(e.node);
+    }
+    auto spill = id != kNoNode && !m_spills.empty() ? m_spills.find(id) : m_spills.end();
+    if (spill == m_spills.end()) {
+        m_ranges.query(addr.row, addr.col, visit);
+        return;
+    }
+    // A spill anchor: one overlap query for ranges reading its block, and the
+    // point readers kept with the spill
+    CellAddress start = spill->second.range.getStart(), end = spill->second.range.getEnd();
+    m_ranges.queryOverlap(start.row, end.row, start.col, end.col, visit);
+    for (const auto& [reader, edges] : spill->second.readers) visit(reader);
+}
+
+// Point precedents are ordered by row, then column: skip to the region's
+// columns on each row that has any
+template <typename Visitor>
+void DependencyGraph::forEachPrecedent(const CellRange& region, Visitor&& visit) const {
+    CellAddress start = region.getStart(), end = region.getEnd();
+    int top = std::max(start.row, 0), left = std::max(start.col, 0);
+    auto it = m_precedents.lower_bound(key(CellAddress(top, left)));
+    while (it != m_precedents.end()) {
+        CellAddress cell = address(*it);
+        if (cell.row > end.row || cell.row < top) break;  // negative indexes sort last
+        if (cell.col >= left && cell.col <= end.col) {
+            visit(m_index.at(*it));
+            ++it;
+        } else if (cell.col >= 0 && cell.col < left) {
+            it = m_precedents.lower_bound(key(CellAddress(cell.row, left)));
+        } else {
+            if (cell.row == INT32_MAX) break;
+            it = m_precedents.lower_bound(key(CellAddress(cell.row + 1, left)));
         }
-        m_dependencies.erase(it);
     }
 }
 
+void DependencyGraph::setSpillRange(const CellAddress& anchor, const CellRange& range) {
+    NodeId id = acquireNode(anchor);
+    auto [it, inserted] = m_spills.try_emplace(id);
+    if (!inserted) {
+        const CellRange& current = it->second.range;
+        if (current.getStart() == range.getStart() && current.getEnd() == range.getEnd()) return;
+        m_spillRanges.remove(it->second.handle);
+    }
+    it->second.range = range;
+    it->second.handle = m_spillRanges.insert(range, id);
+    auto& readers = it->second.readers;
+    readers.clear();
+    forEachPrecedent(range, [&](NodeId cell) {
+        if (cell == id) return;
+        for (const auto& e : m_nodes[cell].dependents) readers[e.node]++;
+    });
+    m_generation++;
+}
+
+void DependencyGraph::removeSpillRange(const CellAddress& anchor) {
+    NodeId id = findNode(anchor);
+    if (id == kNoNode) return;
+    auto it = m_spills.find(id);
+    if (it == m_spills.end()) return;
+    m_spillRanges.remove(it->second.handle);
+    m_spills.erase(it);
+    m_generation++;
+    releaseNodeIfUnused(id);
+}
+
+const CellRange* DependencyGraph::getSpillRange(const CellAddress& anchor) const {
+    if (m_spills.empty()) return nullptr;
+    auto it = m_spills.find(findNode(anchor));
+    return it != m_spills.end() ? &it->second.range : nullptr;
+}
+
+std::vector<CellAddress> DependencyGraph::getSpillAnchors(const CellAddress& cell) const {
+    std::vector<CellAddress> anchors;
+    if (m_spills.empty()) return anchors;
+    m_spillRanges.query(cell.row, cell.col, [&](NodeId id) {
+        CellAddress anchor = address(m_nodes[id].key);
+        if (!(anchor == cell)) anchors.push_back(anchor);
+    });
+    return anchors;
+}
+
+// Swap-and-pop the entry at 'pos' of target's dependents list, fixing the
+// mirror index of the edge that moved into its place.
+void DependencyGraph::eraseDependentEntry(NodeId target, uint32_t pos) {
+    auto& list = m_nodes[target].dependents;
+    uint32_t last = static_cast<uint32_t>(list.size() - 1);
+    if (pos != last) {
+        list[pos] = list[last];
+        m_nodes[list[pos].node].dependencies[list[pos].mirror].mirror = pos;
+    }
+    list.pop_back();
+    if (list.empty()) m_precedents.erase(m_nodes[target].key);
+}
+
+void DependencyGraph::removeDependencies(const CellAddress& cell) {
+    NodeId id = findNode(cell);
+    if (id == kNoNode) return;
+    m_generation++;
+
+    // Remove this cell from all its dependencies' dependent lists. Swaps in
+    // a target list may move one of our own not-yet-visited edges; their
+    // mirror indices are patched in place, so 'deps' stays consistent.
+    auto& deps = m_nodes[id].dependencies;
+    for (size_t i = 0; i < deps.size(); ++i) {
+        eraseDependentEntry(deps[i].node, deps[i].mirror);
+        countSpillReader(id, deps[i].node, -1);
+    }
+    for (RangeIndex::Handle h : m_nodes[id].ranges) m_ranges.remove(h);
+    m_nodes[id].ranges.clear();
+
+    std::vector<Edge> released;
+    released.swap(deps);
+    for (const auto& e : released) releaseNodeIfUnused(e.node);
+    releaseNodeIfUnused(id);
+}
+
 std::vector<CellAddress> DependencyGraph::getDependents(const CellAddress& cell) const {
     std::vector<CellAddress> result;
-    auto it = m_dependents.find(key(cell));
-    if (it != m_dependents.end()) {
-        for (const auto& k : it->second) {
-            result.push_back(CellAddress::fromString(QString::fromStdString(k)));
-        }
-    }
+    uint32_t epoch = beginVisit();
+    forEachDependent(cell, findNode(cell), [&](NodeId dep) {
+        if (m_visitMark[dep] == epoch) return;
+        m_visitMark[dep] = epoch;
+        result.push_back(address(m_nodes[dep].key));
+    });
     return result;
 }
 
-// BFS to find all cells that need recalculation, in topological order
-std::vector<CellAddress> DependencyGraph::getRecalcOrder(const CellAddress& changed) const {
-    std::vector<CellAddress> order;
-    std::unordered_set<std::string> visited;
-    std::queue<std::string> queue;
-
-    std::string startKey = key(changed);
-    auto it = m_dependents.find(startKey);
-    if (it == m_dependents.end()) return order;
-
-    for (const auto& dep : it->second) {
-        if (visited.find(dep) == visited.end()) {
-            queue.push(dep);
-            visited.insert(dep);
+std::vector<CellAddress> DependencyGraph::getReaders(const CellRange& region) const {
+    std::vector<CellAddress> result;
+    uint32_t epoch = beginVisit();
+    auto visit = [&](NodeId dep) {
+        if (m_visitMark[dep] == epoch) return;
+        m_visitMark[dep] = epoch;
+        result.push_back(address(m_nodes[dep].key));
+    };
+    CellAddress start = region.getStart(), end = region.getEnd();
+    m_ranges.queryOverlap(start.row, end.row, start.col, end.col, visit);
+    forEachPrecedent(region, [&](NodeId cell) {
+        for (const auto& e : m_nodes[cell].dependents) visit(e.node);
+    });
+    return result;
+}
+
+DependencyGraph::RecalcPlan DependencyGraph::getRecalcPlan(const std::vector<CellAddress>& changed,
+                                                           bool includeChanged) const {
+    RecalcPlan plan;
+    uint32_t epoch = beginVisit();
+    if (m_localIndex.size() < m_nodes.size()) m_localIndex.resize(m_nodes.size());
+
+    // Collect the dirty subgraph, recording its edges as local CSR adjacency
+    // so range lookups run once per dirty cell rather than once per pass
+    std::vector<NodeId> dirty;
+    std::vector<uint32_t> adjStart;
+    std::vector<uint32_t> adj;
+    auto mark = [&](NodeId n) {
+        if (m_visitMark[n] != epoch) {
+            m_visitMark[n] = epoch;
+            m_localIndex[n] = static_cast<uint32_t>(dirty.size());
+            dirty.push_back(n);
         }
+    };
+    for (const auto& addr : changed) {
+        NodeId id = findNode(addr);
+        if (includeChanged && id != kNoNode) {
+            mark(id);
+        } else {
+            // A changed cell without a node has no inputs, so it can go first
+            if (includeChanged) plan.order.push_back(addr);
+            forEachDependent(addr, id, mark);
+        }
+    }
+    for (size_t i = 0; i < dirty.size(); ++i) {
+        adjStart.push_back(static_cast<uint32_t>(adj.size()));
+        forEachDependent(address(m_nodes[dirty[i]].key), dirty[i], [&](NodeId dep) {
+            mark(dep);
+            adj.push_back(m_localIndex[dep]);
+        });
     }
+    adjStart.push_back(static_cast<uint32_t>(adj.size()));
 
-    while (!queue.empty()) {
-        std::string current = queue.front();
-        queue.pop();
-        order.push_back(CellAddress::fromString(QString::fromStdString(current)));
-
-        auto dit = m_dependents.find(current);
-        if (dit != m_dependents.end()) {
-            for (const auto& dep : dit->second) {
-                if (visited.find(dep) == visited.end()) {
-                    queue.push(dep);
-                    visited.insert(dep);
-                }
-            }
+    // Kahn: in-degrees count only edges inside the dirty subgraph; whatever
+    // never reaches zero sits on a cycle or downstream of one
+    std::vector<uint32_t> inDegree(dirty.size(), 0);
+    for (uint32_t target : adj) inDegree[target]++;
+
+    std::vector<uint32_t> ready;
+    for (uint32_t i = 0; i < dirty.size(); ++i) {
+        if (inDegree[i] == 0) ready.push_back(i);
+    }
+    plan.order.reserve(plan.order.size() + dirty.size());
+    // Processed in rounds, so each round is exactly one level. Node-less
+    // changed cells form their own level, ahead of dependents reading them.
+    plan.levelStarts.push_back(0);
+    if (!plan.order.empty()) plan.levelStarts.push_back(plan.order.size());
+    size_t levelEnd = ready.size();
+    for (size_t head = 0; head < ready.size(); ++head) {
+        if (head == levelEnd) {
+            plan.levelStarts.push_back(plan.order.size());
+            levelEnd = ready.size();
+        }
+        uint32_t current = ready[head];
+        plan.order.push_back(address(m_nodes[dirty[current]].key));
+        for (uint32_t e = adjStart[current]; e < adjStart[current + 1]; ++e) {
+            if (--inDegree[adj[e]] == 0) ready.push_back(adj[e]);
         }
     }
-
-    return order;
+    plan.levelStarts.push_back(plan.order.size());
+    if (ready.size() < dirty.size()) {
+        for (uint32_t i = 0; i < dirty.size(); ++i) {
+            if (inDegree[i] > 0) plan.circular.push_back(address(m_nodes[dirty[i]].key));
+        }
+    }
+    return plan;
 }
 
-bool DependencyGraph::hasCircularDependency(const CellAddress& cell) const {
-    std::unordered_set<std::string> visited;
-    std::string cellKey = key(cell);
-    return detectCycle(cellKey, cellKey, visited);
+std::vector<CellAddress> DependencyGraph::getRecalcOrder(const CellAddress& changed) const {
+    return getRecalcPlan({changed}, false).order;
 }
 
-bool DependencyGraph::detectCycle(const std::string& start, const std::string& current,
-                                   std::unordered_set<std::string>& visited) const {
-    auto it = m_dependencies.find(current);
-    if (it == m_dependencies.end()) return false;
+bool DependencyGraph::hasCircularDependency(const CellAddress& cell) const {
+    NodeId start = findNode(cell);
+    if (start == kNoNode) return false;
 
-    for (const auto& dep : it->second) {
-        if (dep == start) return true;
-        if (visited.find(dep) == visited.end()) {
-            visited.insert(dep);
-            if (detectCycle(start, dep, visited)) return true;
+    // Walk downstream (range edges are only indexed in that direction) and
+    // see whether we come back to the start cell
+    uint32_t epoch = beginVisit();
+    std::vector<NodeId> stack;
+    bool found = false;
+    auto push = [&](NodeId dep) {
+        if (dep == start) found = true;
+        if (m_visitMark[dep] != epoch) {
+            m_visitMark[dep] = epoch;
+            stack.push_back(dep);
         }
+    };
+    forEachDependent(cell, start, push);
+    while (!stack.empty() && !found) {
+        NodeId current = stack.back();
+        stack.pop_back();
+        forEachDependent(address(m_nodes[current].key), current, push);
     }
-    return false;
+    return found;
 }
 
 void DependencyGraph::clear() {
-    m_dependents.clear();
-    m_dependencies.clear();
+    m_index.clear();
+    m_nodes.clear();
+    m_freeNodes.clear();
+    m_ranges.clear();
+    m_precedents.clear();
+    m_spills.clear();
+    m_spillRanges.clear();
+    m_visitMark.clear();
+    m_visitEpoch = 0;
+    m_localIndex.clear();
+    m_generation++;
 }
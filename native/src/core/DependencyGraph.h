@@ -1,34 +1,116 @@
 #ifndef DEPENDENCYGRAPH_H
 #define DEPENDENCYGRAPH_H
 
-#include <QString>
-#include <string>
+#include <cstdint>
+#include <set>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include "CellRange.h"
+#include "RangeIndex.h"
 
 class DependencyGraph {
 public:
     DependencyGraph() = default;
 
     void addDependency(const CellAddress& dependent, const CellAddress& dependency);
+    // One edge per range regardless of its size; found by spatial lookup
+    void addRangeDependency(const CellAddress& dependent, const CellRange& range);
     void removeDependencies(const CellAddress& cell);
     std::vector<CellAddress> getDependents(const CellAddress& cell) const;
+    // Cells with a reference reaching into region, each once
+    std::vector<CellAddress> getReaders(const CellRange& region) const;
+
+    // Array formulas: the block an anchor's result spills into (or would,
+    // when blocked). Cells reading any cell of the block are dependents of
+    // the anchor, so one spill adds no per-cell edges.
+    void setSpillRange(const CellAddress& anchor, const CellRange& range);
+    void removeSpillRange(const CellAddress& anchor);
+    const CellRange* getSpillRange(const CellAddress& anchor) const;
+    // Anchors whose block covers cell, other than cell itself; an edit there
+    // has to re-run them
+    std::vector<CellAddress> getSpillAnchors(const CellAddress& cell) const;
+
+    struct RecalcPlan {
+        std::vector<CellAddress> order;     // every dirty cell once, inputs before dependents
+        std::vector<CellAddress> circular;  // cells on a cycle or fed by one
+        // order[levelStarts[i] .. levelStarts[i+1]) is level i: cells whose longest
+        // input chain has length i. Cells within a level never depend on each other.
+        std::vector<size_t> levelStarts;
+    };
+    // Topological sort (Kahn) of everything downstream of 'changed'. With
+    // includeChanged the changed cells themselves are part of the plan.
+    RecalcPlan getRecalcPlan(const std::vector<CellAddress>& changed, bool includeChanged) const;
     std::vector<CellAddress> getRecalcOrder(const CellAddress& changed) const;
     bool hasCircularDependency(const CellAddress& cell) const;
     void clear();
+    // Changes whenever an edge is added or removed, so callers can tell
+    // whether a plan they cached is still valid
+    uint64_t generation() const { return m_generation; }
 
 private:
-    static std::string key(const CellAddress& addr);
+    using NodeId = uint32_t;
+    static constexpr NodeId kNoNode = UINT32_MAX;
+
+    // Cells are keyed by packed (row, col) instead of A1 strings
+    static uint64_t key(const CellAddress& addr) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(addr.row)) << 32) | static_cast<uint32_t>(addr.col);
+    }
+    static CellAddress address(uint64_t key) {
+        return CellAddress(static_cast<int32_t>(key >> 32), static_cast<int32_t>(key & 0xFFFFFFFFu));
+    }
+
+    // Adjacency entry. 'mirror' is the position of the reverse entry in the
+    // other node's list, which makes edge removal O(1) via swap-and-pop.
+    struct Edge {
+        NodeId node;
+        uint32_t mirror;
+    };
+
+    struct Node {
+        uint64_t key = 0;
+        std::vector<Edge> dependents;    // cells that depend on this one
+        std::vector<Edge> dependencies;  // cells this one depends on
+        std::vector<RangeIndex::Handle> ranges; // ranges this one depends on
+    };
+
+    std::unordered_map<uint64_t, NodeId> m_index;
+    std::vector<Node> m_nodes;
+    std::vector<NodeId> m_freeNodes;
+    RangeIndex m_ranges;  // owner = dependent NodeId
+    std::set<uint64_t> m_precedents;  // keys of nodes with point dependents, row-major
+    struct Spill {
+        CellRange range;
+        RangeIndex::Handle handle;
+        // Point dependents of the block's cells other than the anchor, with
+        // how many of their edges land in the block
+        std::unordered_map<NodeId, uint32_t> readers;
+    };
+    std::unordered_map<NodeId, Spill> m_spills;  // by anchor
+    RangeIndex m_spillRanges;  // owner = anchor NodeId
+    uint64_t m_generation = 0;
+
+    // Per-node visit stamps reused across traversals (no per-call allocation)
+    mutable std::vector<uint32_t> m_visitMark;
+    mutable uint32_t m_visitEpoch = 0;
+    mutable std::vector<uint32_t> m_localIndex;  // NodeId -> slot in the current plan
+
+    NodeId findNode(const CellAddress& addr) const;
+    NodeId acquireNode(const CellAddress& addr);
+    void releaseNodeIfUnused(NodeId id);
+    void eraseDependentEntry(NodeId target, uint32_t pos);
+    uint32_t beginVisit() const;
+    // Counts (or, with delta -1, uncounts) an edge from dependent to
+    // dependency with the spills whose block holds the dependency
+    void countSpillReader(NodeId dependent, NodeId dependency, int delta);
 
-    // cell -> set of cells that depend on it
-    std::unordered_map<std::string, std::unordered_set<std::string>> m_dependents;
-    // cell -> set of cells it depends on
-    std::unordered_map<std::string, std::unordered_set<std::string>> m_dependencies;
+    // Visits nodes with point dependents inside region
+    template <typename Visitor>
+    void forEachPrecedent(const CellRange& region, Visitor&& visit) const;
 
-    bool detectCycle(const std::string& start, const std::string& current,
-                     std::unordered_set<std::string>& visited) const;
+    // Visits point dependents of the node plus owners of ranges covering
+    // addr; for a spill anchor, also the readers of any cell it fills
+    template <typename Visitor>
+    void forEachDependent(const CellAddress& addr, NodeId id, Visitor&& visit) const;
 };
 
 #endif // DEPENDENCYGRAPH_H
@@ -0,0 +1,512 @@
+#include "FormulaAST.h"
+#include "FormulaFunctions.h"
+#include <QReadWriteLock>
+#include <algorithm>
+#include <unordered_map>
+
+// One end of a reference token ("B$2") as seen from the cell at 'at'
+static RelativeRef parseRef(const QString& text, const CellAddress& at) {
+    QString plain = text;
+    plain.remove('$');
+    CellAddress addr = CellAddress::fromString(plain);
+    RelativeRef ref;
+    ref.colAbsolute = text.startsWith('$') || addr.col < 0;
+    ref.rowAbsolute = text.indexOf('$', 1) > 0 || addr.row < 0;
+    ref.row = ref.rowAbsolute ? addr.row : addr.row - at.row;
+    ref.col = ref.colAbsolute ? addr.col : addr.col - at.col;
+    return ref;
+}
+
+static bool isTokenStart(QChar ch) { return ch.isLetter() || ch == '$'; }
+static bool isTokenChar(QChar ch) { return ch.isLetterOrNumber() || ch == ':' || ch == '$' || ch == '_'; }
+
+// End of the quoted sheet name starting at pos ('It''s'!A1), past the quote
+static int quotedNameEnd(const QString& text, int pos) {
+    for (++pos; pos < text.size(); ++pos) {
+        if (text[pos] != '\'') continue;
+        if (pos + 1 < text.size() && text[pos + 1] == '\'') ++pos;
+        else return pos + 1;
+    }
+    return text.size();
+}
+
+// End of the error literal starting at pos (#REF!, #DIV/0!, #N/A)
+static int errorLiteralEnd(const QString& text, int pos) {
+    for (++pos; pos < text.size(); ++pos) {
+        QChar ch = text[pos];
+        if (ch == '!' || ch == '?') return pos + 1;
+        if (!ch.isLetterOrNumber() && ch != '/') break;
+    }
+    return pos;
+}
+
+// Copies formula, passing each reference token ("B$2", "A1:C9") through
+// fn(sheet, token), where sheet is the name qualifying it (Sheet2!A1) or
+// empty. Tokens are split the way FormulaCompiler reads them, so string
+// literals, function names and TRUE/FALSE are left alone.
+template <typename Fn>
+static QString mapReferenceTokens(const QString& formula, Fn&& fn) {
+    QString out;
+    out.reserve(formula.size() + 16);
+    const int n = formula.size();
+    int pos = 0;
+    QString sheet;
+    while (pos < n) {
+        QChar ch = formula[pos];
+        if (ch == '"') {
+            int close = formula.indexOf('"', pos + 1);
+            int stop = close < 0 ? n : close + 1;
+            out += formula.mid(pos, stop - pos);
+            pos = stop;
+        } else if (ch == '\'') {
+            // Quoted sheet name
+            int stop = quotedNameEnd(formula, pos);
+            out += formula.mid(pos, stop - pos);
+            QString name = formula.mid(pos + 1, stop - pos - 2).replace("''", "'");
+            pos = stop;
+            if (pos < n && formula[pos] == '!') {
+                out += '!';
+                pos++;
+                sheet = name;
+                continue;
+            }
+        } else if (ch == '#') {
+            int stop = errorLiteralEnd(formula, pos);
+            out += formula.mid(pos, stop - pos);
+            pos = stop;
+        } else if (ch.isDigit()) {
+            // Numbers; a letter run glued to them is not a reference either
+            int start = pos;
+            while (pos < n && (formula[pos].isLetterOrNumber() || formula[pos] == '.')) pos++;
+            out += formula.mid(start, pos - start);
+        } else if (isTokenStart(ch)) {
+            int start = pos;
+            while (pos < n && isTokenChar(formula[pos])) pos++;
+            QString token = formula.mid(start, pos - start);
+            if (pos < n && formula[pos] == '!') {
+                // Sheet name; the reference after it is mapped on its own
+                out += token;
+                out += '!';
+                pos++;
+                sheet = token;
+                continue;
+            }
+            int next = pos;
+            while (next < n && formula[next].isSpace()) next++;
+            QString upper = token.toUpper();
+            if ((next < n && formula[next] == '(') || upper == "TRUE" || upper == "FALSE") {
+                out += token;
+            } else {
+                out += fn(sheet, token);
+            }
+        } else {
+            out += ch;
+            pos++;
+        }
+        sheet.clear();
+    }
+    return out;
+}
+
+// Same, passing each cell reference (or end of a range) through fn
+template <typename Fn>
+static QString mapReferences(const QString& formula, Fn&& fn) {
+    return mapReferenceTokens(formula, [&fn](const QString&, const QString& token) {
+        QString out;
+        bool first = true;
+        for (const QString& part : token.split(':')) {
+            if (!first) out += ':';
+            out += fn(part);
+            first = false;
+        }
+        return out;
+    });
+}
+
+// Recursive-descent compiler producing a CompiledFormula. Mirrors the grammar
+// FormulaEngine used to interpret directly from the formula text.
+class FormulaCompiler {
+public:
+    FormulaCompiler(const QString& expr, const CellAddress& at) : m_expr(expr), m_at(at) {}
+
+    std::shared_ptr<CompiledFormula> run() {
+        m_out = std::make_shared<CompiledFormula>();
+        m_out->m_root = parseComparison();
+        return std::move(m_out);
+    }
+
+private:
+    const QString& m_expr;
+    CellAddress m_at;
+    int m_pos = 0;
+    std::shared_ptr<CompiledFormula> m_out;
+
+    bool atEnd() const { return m_pos >= m_expr.length(); }
+    QChar peek(int offset = 0) const {
+        return m_pos + offset < m_expr.length() ? m_expr[m_pos + offset] : QChar();
+    }
+    void skipWhitespace() {
+        while (m_pos < m_expr.length() && m_expr[m_pos].isSpace()) m_pos++;
+    }
+
+    int emit(FormulaOp op, int lhs = -1, int rhs = -1, int operand = -1) {
+        FormulaNode n;
+        n.op = op;
+        n.lhs = lhs;
+        n.rhs = rhs;
+        n.operand = operand;
+        m_out->m_nodes.push_back(n);
+        return static_cast<int>(m_out->m_nodes.size()) - 1;
+    }
+
+    // Slot of a sheet name for RelativeRef::sheet; names compare case-insensitively
+    uint8_t sheetSlot(const QString& name) {
+        auto& names = m_out->m_sheetNames;
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i].compare(name, Qt::CaseInsensitive) == 0) return static_cast<uint8_t>(i + 1);
+        }
+        if (names.size() >= 255) return 255;
+        names.push_back(name);
+        return static_cast<uint8_t>(names.size());
+    }
+
+    QString readToken() {
+        int start = m_pos;
+        while (!atEnd() && isTokenChar(peek())) m_pos++;
+        return m_expr.mid(start, m_pos - start);
+    }
+
+    int emitConstant(const Value& value) {
+        m_out->m_constants.push_back(value);
+        return emit(FormulaOp::Constant, -1, -1, static_cast<int>(m_out->m_constants.size()) - 1);
+    }
+
+    int parseComparison() {
+        int left = parseTerm();
+        skipWhitespace();
+        while (!atEnd()) {
+            FormulaOp op;
+            if (peek() == '<' && peek(1) == '>') { op = FormulaOp::Ne; m_pos += 2; }
+            else if (peek() == '<' && peek(1) == '=') { op = FormulaOp::Le; m_pos += 2; }
+            else if (peek() == '>' && peek(1) == '=') { op = FormulaOp::Ge; m_pos += 2; }
+            else if (peek() == '<') { op = FormulaOp::Lt; m_pos++; }
+            else if (peek() == '>') { op = FormulaOp::Gt; m_pos++; }
+            else if (peek() == '=') { op = FormulaOp::Eq; m_pos++; }
+            else break;
+            int right = parseTerm();
+            left = emit(op, left, right);
+            skipWhitespace();
+        }
+        return left;
+    }
+
+    int parseTerm() {
+        int left = parseMultiplicative();
+        skipWhitespace();
+        while (!atEnd()) {
+            FormulaOp op;
+            if (peek() == '+') op = FormulaOp::Add;
+            else if (peek() == '-') op = FormulaOp::Sub;
+            else break;
+            m_pos++;
+            int right = parseMultiplicative();
+            left = emit(op, left, right);
+            skipWhitespace();
+        }
+        return left;
+    }
+
+    int parseMultiplicative() {
+        int left = parseUnary();
+        skipWhitespace();
+        while (!atEnd()) {
+            FormulaOp op;
+            if (peek() == '*') op = FormulaOp::Mul;
+            else if (peek() == '/') op = FormulaOp::Div;
+            else break;
+            m_pos++;
+            int right = parseUnary();
+            left = emit(op, left, right);
+            skipWhitespace();
+        }
+        return left;
+    }
+
+    int parseUnary() {
+        skipWhitespace();
+        if (peek() == '-') {
+            m_pos++;
+            return emit(FormulaOp::Negate, parseUnary());
+        }
+        return parsePower();
+    }
+
+    int parsePower() {
+        int base = parseFactor();
+        skipWhitespace();
+        if (peek() == '^') {
+            m_pos++;
+            int exponent = parseUnary();
+            return emit(FormulaOp::Pow, base, exponent);
+        }
+        return base;
+    }
+
+    int parseFactor() {
+        skipWhitespace();
+        if (atEnd()) return emit(FormulaOp::Empty);
+
+        // Numbers
+        if (peek().isDigit() || (peek() == '.' && peek(1).isDigit())) {
+            int start = m_pos;
+            while (!atEnd() && (peek().isDigit() || peek() == '.')) m_pos++;
+            return emitConstant(Value::number(m_expr.mid(start, m_pos - start).toDouble()));
+        }
+
+        // Strings
+        if (peek() == '"') {
+            m_pos++;
+            int start = m_pos;
+            while (!atEnd() && peek() != '"') m_pos++;
+            QString text = m_expr.mid(start, m_pos - start);
+            if (!atEnd()) m_pos++;
+            return emitConstant(Value::text(text));
+        }
+
+        // References into other sheets: Sheet2!A1, 'Q1 Data'!A1:B5
+        uint8_t sheet = 0;
+        if (peek() == '\'') {
+            int end = quotedNameEnd(m_expr, m_pos);
+            sheet = sheetSlot(m_expr.mid(m_pos + 1, end - m_pos - 2).replace("''", "'"));
+            m_pos = end;
+            if (peek() == '!') m_pos++;
+        }
+
+        // Error literals, left by references whose cells were deleted
+        if (peek() == '#') return parseErrorLiteral();
+
+        // Letter tokens: functions, cell refs, ranges
+        if (isTokenStart(peek())) {
+            QString token = readToken();
+            if (sheet == 0 && peek() == '!') {
+                m_pos++;
+                sheet = sheetSlot(token);
+                if (peek() == '#') return parseErrorLiteral();
+                token = readToken();
+            }
+            skipWhitespace();
+
+            if (sheet == 0 && peek() == '(') return parseCall(token.toUpper());
+
+            if (token.contains(':')) {
+                QStringList parts = token.split(':');
+                RelativeRange range{parseRef(parts[0], m_at), parseRef(parts[1], m_at)};
+                range.start.sheet = range.end.sheet = sheet;
+                m_out->m_rangeRefs.push_back(range);
+                return emit(FormulaOp::RangeRef, -1, -1, static_cast<int>(m_out->m_rangeRefs.size()) - 1);
+            }
+
+            QString upper = token.toUpper();
+            if (sheet == 0 && upper == "TRUE") return emitConstant(Value::boolean(true));
+            if (sheet == 0 && upper == "FALSE") return emitConstant(Value::boolean(false));
+
+            RelativeRef ref = parseRef(token, m_at);
+            ref.sheet = sheet;
+            m_out->m_cellRefs.push_back(ref);
+            return emit(FormulaOp::CellRef, -1, -1, static_cast<int>(m_out->m_cellRefs.size()) - 1);
+        }
+
+        // Parentheses
+        if (peek() == '(') {
+            m_pos++;
+            int inner = parseComparison();
+            skipWhitespace();
+            if (peek() == ')') m_pos++;
+            return inner;
+        }
+
+        return emit(FormulaOp::Empty);
+    }
+
+    int parseErrorLiteral() {
+        int end = errorLiteralEnd(m_expr, m_pos);
+        QString text = m_expr.mid(m_pos, end - m_pos).toUpper();
+        m_pos = end;
+        ErrorCode code = ErrorCode::Error;
+        for (ErrorCode candidate : {ErrorCode::Div0, ErrorCode::Value, ErrorCode::Ref, ErrorCode::Name,
+                                    ErrorCode::Num, ErrorCode::NA, ErrorCode::Circular, ErrorCode::Spill}) {
+            if (Value::errorText(candidate) == text) code = candidate;
+        }
+        return emitConstant(Value::error(code));
+    }
+
+    int parseCall(const QString& name) {
+        m_pos++; // '('
+        std::vector<int32_t> args;
+        skipWhitespace();
+        while (!atEnd() && peek() != ')') {
+            int before = m_pos;
+            args.push_back(parseComparison());
+            skipWhitespace();
+            if (peek() == ',') m_pos++;
+            skipWhitespace();
+            if (m_pos == before) break; // unparseable character, avoid spinning
+        }
+        if (peek() == ')') m_pos++;
+
+        // Argument slots are contiguous so Call nodes only need (first, count)
+        int first = static_cast<int>(m_out->m_argList.size());
+        m_out->m_argList.insert(m_out->m_argList.end(), args.begin(), args.end());
+        m_out->m_functionNames.push_back(name);
+        const FunctionInfo* fn = FormulaFunctions::find(name);
+        m_out->m_functions.push_back(fn);
+        if (fn && fn->isVolatile) m_out->m_volatile = true;
+        return emit(FormulaOp::Call, first, static_cast<int>(args.size()),
+                    static_cast<int>(m_out->m_functionNames.size()) - 1);
+    }
+};
+
+// Marks rewritten references in keys so they can't collide with formula text
+static const QChar kRefMark(0x1F);
+
+// R1C1 text of one reference end: R[-1]C2 style, 1-based when absolute
+static QString r1c1Text(const RelativeRef& ref) {
+    auto part = [](QChar axis, int value, bool absolute) {
+        return absolute ? axis + QString::number(value + 1) : axis + ('[' + QString::number(value) + ']');
+    };
+    return kRefMark + part('R', ref.row, ref.rowAbsolute) + part('C', ref.col, ref.colAbsolute);
+}
+
+QString CompiledFormula::r1c1Key(const QString& formula, const CellAddress& at) {
+    if (formula.contains(kRefMark)) return QString();
+    return mapReferences(formula, [&at](const QString& ref) { return r1c1Text(parseRef(ref, at)); });
+}
+
+QString CompiledFormula::rebase(const QString& formula, const CellAddress& from, const CellAddress& to) {
+    return mapReferences(formula, [&](const QString& text) {
+        RelativeRef ref = parseRef(text, from);
+        CellAddress addr = ref.resolve(to);
+        // Unparseable parts and references pushed off the sheet stay as written
+        if (ref.rowAbsolute && ref.colAbsolute) return text;
+        if (addr.row < 0 || addr.col < 0) return text;
+        QString a1 = addr.toString();
+        int digits = 0;
+        while (digits < a1.size() && a1[digits].isLetter()) digits++;
+        return (ref.colAbsolute ? "$" : "") + a1.left(digits) + (ref.rowAbsolute ? "$" : "") + a1.mid(digits);
+    });
+}
+
+// One end of an A1 reference as written; row is -1 for a whole column
+// (either end of A:A)
+struct RefText {
+    int row = -1;
+    int col = -1;
+    bool rowAbsolute = false;
+    bool colAbsolute = false;
+};
+
+static bool parseRefText(const QString& text, RefText& ref) {
+    const int n = text.size();
+    int i = 0;
+    if (i < n && text[i] == '$') { ref.colAbsolute = true; i++; }
+    int letters = i, col = 0;
+    while (i < n && text[i].isLetter() && i - letters < 3) {
+        col = col * 26 + (text[i].toUpper().toLatin1() - 'A' + 1);
+        i++;
+    }
+    if (i == letters) return false;
+    ref.col = col - 1;
+    if (i < n && text[i] == '$') { ref.rowAbsolute = true; i++; }
+    int digits = i, row = 0;
+    while (i < n && text[i].isDigit() && i - digits < 9) row = row * 10 + (text[i++].toLatin1() - '0');
+    if (i != n) return false;
+    if (i == digits) return !ref.rowAbsolute;
+    ref.row = row - 1;
+    return ref.row >= 0;
+}
+
+static QString refText(const RefText& ref) {
+    QString a1 = CellAddress(0, ref.col).toString();
+    QString out = (ref.colAbsolute ? "$" : "") + a1.left(a1.size() - 1);
+    if (ref.row >= 0) out += (ref.rowAbsolute ? "$" : "") + QString::number(ref.row + 1);
+    return out;
+}
+
+QString CompiledFormula::adjustReferences(const QString& formula, const StructuralEdit& edit, const QString& sheet,
+                                          bool ownSheet, bool* resized) {
+    return mapReferenceTokens(formula, [&](const QString& qualifier, const QString& token) {
+        bool target = qualifier.isEmpty() ? ownSheet : qualifier.compare(sheet, Qt::CaseInsensitive) == 0;
+        QStringList parts = token.split(':');
+        if (!target || parts.size() > 2) return token;
+        RefText first, last;
+        if (!parseRefText(parts.front(), first) || !parseRefText(parts.back(), last)) return token;
+        bool wholeColumn = first.row < 0;
+        if (wholeColumn != (last.row < 0) || (wholeColumn && parts.size() == 1)) return token;
+        if (wholeColumn && edit.rows) return token;
+
+        // References reaching outside a shift-cells band stay as they are
+        int crossStart = edit.rows ? std::min(first.col, last.col) : std::min(first.row, last.row);
+        int crossEnd = edit.rows ? std::max(first.col, last.col) : std::max(first.row, last.row);
+        if (wholeColumn) crossEnd = INT32_MAX;
+        if (crossStart < edit.bandStart || crossEnd > edit.bandEnd) return token;
+
+        // B9:A1 names the same cells as A1:B9; order the edited axis first
+        int& start = edit.rows ? first.row : first.col;
+        int& end = edit.rows ? last.row : last.col;
+        if (start > end) {
+            std::swap(start, end);
+            if (edit.rows) std::swap(first.rowAbsolute, last.rowAbsolute);
+            else std::swap(first.colAbsolute, last.colAbsolute);
+        }
+        int span = end - start;
+        if (!edit.apply(start, end)) {
+            if (resized) *resized = true;
+            return QStringLiteral("#REF!");
+        }
+        if (resized && end - start != span) *resized = true;
+        return parts.size() == 1 ? refText(first) : refText(first) + ':' + refText(last);
+    });
+}
+
+// Programs by R1C1 key. Only weak references are kept, so a program lives
+// as long as some cell holds it; expired keys are swept as the table grows.
+struct SharedPrograms {
+    QReadWriteLock lock;
+    std::unordered_map<QString, std::weak_ptr<const CompiledFormula>> programs;
+    size_t sweepAt = 1024;
+};
+
+static SharedPrograms& sharedPrograms() {
+    static SharedPrograms instance;
+    return instance;
+}
+
+std::shared_ptr<const CompiledFormula> CompiledFormula::compile(const QString& formula, const CellAddress& at) {
+    QString expr = formula.startsWith('=') ? formula.mid(1) : formula;
+    QString key = r1c1Key(formula, at);
+    if (key.isEmpty()) return FormulaCompiler(expr, at).run();
+
+    SharedPrograms& shared = sharedPrograms();
+    {
+        QReadLocker locker(&shared.lock);
+        auto it = shared.programs.find(key);
+        if (it != shared.programs.end()) {
+            if (auto program = it->second.lock()) return program;
+        }
+    }
+
+    std::shared_ptr<const CompiledFormula> program = FormulaCompiler(expr, at).run();
+
+    QWriteLocker locker(&shared.lock);
+    std::weak_ptr<const CompiledFormula>& slot = shared.programs[key];
+    if (auto existing = slot.lock()) return existing;
+    slot = program;
+    if (shared.programs.size() >= shared.sweepAt) {
+        for (auto it = shared.programs.begin(); it != shared.programs.end();) {
+            if (it->second.expired()) it = shared.programs.erase(it);
+            else ++it;
+        }
+        shared.sweepAt = std::max<size_t>(1024, shared.programs.size() * 2);
+    }
+    return program;
+}
@@ -0,0 +1,122 @@
+#ifndef FORMULAAST_H
+#define FORMULAAST_H
+
+#include <QString>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "CellRange.h"
+#include "Value.h"
+
+struct FunctionInfo;
+
+// Node kinds of a compiled formula. Operators keep the precedence of the
+// original recursive-descent grammar: comparison < additive < multiplicative
+// < unary minus < power < factor.
+enum class FormulaOp : uint8_t {
+    Empty,      // missing operand, evaluates to an empty Value
+    Constant,   // number / string / boolean literal -> constants[operand]
+    CellRef,    // single cell reference -> cellRefs[operand]
+    RangeRef,   // A1:B10 style reference -> rangeRefs[operand]
+    Negate,     // unary minus of lhs
+    Add, Sub, Mul, Div, Pow,
+    Eq, Ne, Lt, Le, Gt, Ge,
+    Call        // function call: functions[operand], args = argList[lhs .. lhs+rhs)
+};
+
+struct FormulaNode {
+    FormulaOp op = FormulaOp::Empty;
+    int32_t lhs = -1;       // left operand node / first argument slot
+    int32_t rhs = -1;       // right operand node / argument count
+    int32_t operand = -1;   // index into the constant/reference/name tables
+};
+
+// A reference as R1C1 sees it: offsets from the cell holding the formula,
+// or fixed indexes for the parts marked with $ (B$2 in C5 is R2C[-1]).
+// Parts that don't parse (no digits, no letters) are kept fixed.
+struct RelativeRef {
+    int row = 0;
+    int col = 0;
+    bool rowAbsolute = false;
+    bool colAbsolute = false;
+    uint8_t sheet = 0;  // 0: the formula's sheet, n: CompiledFormula::sheetNames()[n - 1]
+
+    CellAddress resolve(const CellAddress& at) const {
+        return CellAddress(rowAbsolute ? row : at.row + row, colAbsolute ? col : at.col + col);
+    }
+};
+
+struct RelativeRange {
+    RelativeRef start;
+    RelativeRef end;
+
+    uint8_t sheet() const { return start.sheet; }
+
+    CellRange resolve(const CellAddress& at) const { return CellRange(start.resolve(at), end.resolve(at)); }
+};
+
+// A formula parsed once into a flat node array. Nodes are stored in post-order,
+// so children always precede their parent and the root is the last node.
+// References are relative to the cell the formula is evaluated for, so every
+// cell of a filled column (=B2*C2, =B3*C3, ...) shares one instance.
+// Instances are immutable after compile().
+class CompiledFormula {
+public:
+    // Formula as written in the cell at 'at'. Formulas with the same R1C1
+    // form are compiled once and the instance is shared while any cell
+    // holds it. The default anchor (A1) leaves references as written.
+    static std::shared_ptr<const CompiledFormula> compile(const QString& formula, const CellAddress& at = CellAddress());
+    // The formula with its references in R1C1 terms: equal for every cell
+    // that can share one program. A cache key, not meant for display.
+    static QString r1c1Key(const QString& formula, const CellAddress& at);
+    // Rewrites formula as written in 'from' to what it reads in 'to' (XLSX
+    // shared formulas store the text once, for the top-left cell)
+    static QString rebase(const QString& formula, const CellAddress& from, const CellAddress& to);
+    // Rewrites formula for rows or columns inserted or deleted on a sheet:
+    // references into it (unqualified ones when ownSheet, else those naming
+    // 'sheet') follow the cells they point at, ranges grow or shrink with
+    // edits inside them and references to deleted cells become #REF!.
+    // resized is set when any reference changed size or was deleted.
+    static QString adjustReferences(const QString& formula, const StructuralEdit& edit, const QString& sheet,
+                                    bool ownSheet, bool* resized = nullptr);
+
+    int root() const { return m_root; }
+    const FormulaNode& node(int index) const { return m_nodes[index]; }
+    const std::vector<FormulaNode>& nodes() const { return m_nodes; }
+    int argNode(int slot) const { return m_argList[slot]; }
+
+    const Value& constant(int index) const { return m_constants[index].get(); }
+    const RelativeRef& cellRef(int index) const { return m_cellRefs[index]; }
+    const RelativeRange& rangeRef(int index) const { return m_rangeRefs[index]; }
+    const QString& functionName(int index) const { return m_functionNames[index]; }
+    // Resolved at compile time; nullptr for unknown functions (#NAME?)
+    const FunctionInfo* function(int index) const { return m_functions[index]; }
+
+    // Static references, known without evaluating the formula; resolve()
+    // them against the cell's address
+    const std::vector<RelativeRef>& cellRefs() const { return m_cellRefs; }
+    const std::vector<RelativeRange>& rangeRefs() const { return m_rangeRefs; }
+    // Sheets named by qualified references (Sheet2!A1, 'Q1 Data'!B2:B9),
+    // looked up by name when the formula is evaluated
+    const std::vector<QString>& sheetNames() const { return m_sheetNames; }
+
+    // Calls a function whose result can change with no input changing
+    // (NOW, RAND), so the cell must be recalculated on every recalc request
+    bool isVolatile() const { return m_volatile; }
+
+private:
+    friend class FormulaCompiler;
+
+    int m_root = -1;
+    std::vector<FormulaNode> m_nodes;
+    std::vector<int32_t> m_argList;
+    std::vector<HeldValue> m_constants;  // text literals hold their strings
+    std::vector<RelativeRef> m_cellRefs;
+    std::vector<RelativeRange> m_rangeRefs;
+    std::vector<QString> m_functionNames;
+    std::vector<const FunctionInfo*> m_functions;
+    std::vector<QString> m_sheetNames;
+    bool m_volatile = false;
+};
+
+#endif // FORMULAAST_H
@@ -1,14 +1,25 @@
 #include "FormulaEngine.h"
 #include "Spreadsheet.h"
+#include "AggregateKernels.h"
+#include "CriteriaMatcher.h"
+#include "FormulaFunctions.h"
+#include "RangeAggregate.h"
+#include "Workbook.h"
 #include <cmath>
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <limits>
 #include <numeric>
 #include <random>
 #include <QDateTime>
+#include <QHash>
 #include <QRegularExpression>
 
+static long long rangeSize(const CellRange& range) {
+    return static_cast<long long>(std::max(0, range.getRowCount())) * std::max(0, range.getColumnCount());
+}
+
 FormulaEngine::FormulaEngine(Spreadsheet* spreadsheet)
     : m_spreadsheet(spreadsheet) {
 }
@@ -17,20 +28,68 @@ void FormulaEngine::setSpreadsheet(Spreadsheet* spreadsheet) {
     m_spreadsheet = spreadsheet;
 }
 
-QVariant FormulaEngine::evaluate(const QString& formula) {
-    m_lastError.clear();
-    m_lastDependencies.clear();
-    m_lastRangeArgs.clear();
+Value FormulaEngine::evaluate(const QString& formula) {
+    if (formula.isEmpty()) {
+        m_lastError.clear();
+        return Value();
+    }
+    return evaluate(*CompiledFormula::compile(formula), CellAddress(0, 0));
+}
+
+// An array result is spilled after later evaluations on this engine have
+// released their text, so it holds its own
+static std::shared_ptr<const ValueArray> holdText(std::shared_ptr<const ValueArray> array) {
+    if (std::none_of(array->values.begin(), array->values.end(), [](const Value& v) { return v.isText(); })) return array;
+    struct Held {
+        std::shared_ptr<const ValueArray> array;
+        StringPool::Refs texts;
+    };
+    auto held = std::make_shared<Held>();
+    for (const Value& value : array->values) {
+        if (value.isText()) held->texts.hold(value.textId());
+    }
+    const ValueArray* raw = array.get();
+    held->array = std::move(array);
+    return std::shared_ptr<const ValueArray>(std::move(held), raw);
+}
 
-    if (formula.isEmpty()) return QVariant();
+Value FormulaEngine::evaluate(const CompiledFormula& formula, const CellAddress& at) {
+    m_lastError.clear();
 
-    QString expr = formula.startsWith('=') ? formula.mid(1) : formula;
+    if (formula.root() < 0) return Value();
+
+    // The program may be shared along a fill; its references become
+    // concrete only against the cell being evaluated
+    m_at = at;
+    m_ranges.clear();
+    for (const auto& range : formula.rangeRefs()) m_ranges.push_back(range.resolve(at));
+    m_sheets.clear();
+    Workbook* workbook = m_spreadsheet ? m_spreadsheet->getWorkbook() : nullptr;
+    for (const auto& name : formula.sheetNames()) m_sheets.push_back(workbook ? workbook->findSheet(name) : nullptr);
+    m_arrays.clear();
+    m_arrayResult.reset();
+    m_texts.clear();
+    StringPool::Scope scope(m_texts);
 
     try {
-        return parseExpression(expr);
+        Value result = evaluateNode(formula, formula.root());
+        // Ranges and arrays point into this engine and must not be stored.
+        // A single cell is the result itself; anything larger (=A1:A3,
+        // =B2:B9*2) is kept for the sheet to spill and yields its top-left.
+        if (result.isRange() && rangeSize(*result.asRange()) <= 1) return cellAt(result, 0, 0);
+        if (result.isRange() || result.isArray()) {
+            const ValueArray& array = arrayOf(result);
+            if (array.values.empty()) return Value::error(ErrorCode::Value);
+            if (array.values.size() > 1) {
+                if (m_arrays.back().get() == &array) m_arrayResult = holdText(m_arrays.back());
+                else m_arrayResult = holdText(std::make_shared<ValueArray>(array));
+            }
+            result = array.values[0];
+        }
+        return result;
     } catch (const std::exception& e) {
         m_lastError = QString::fromStdString(e.what());
-        return QVariant("#ERROR!");
+        return Value::error(ErrorCode::Error);
     }
 }
 
@@ -39,16 +98,14 @@ bool FormulaEngine::hasError() const { return !m_lastError.isEmpty(); }
 void FormulaEngine::clearCache() { m_cache.clear(); }
 void FormulaEngine::invalidateCell(const CellAddress& addr) { m_cache.erase(addr.toString().toStdString()); }
 
-void FormulaEngine::skipWhitespace(const QString& expr, int& pos) {
-    while (pos < expr.length() && expr[pos].isSpace()) pos++;
-}
-
-std::vector<QVariant> FormulaEngine::flattenArgs(const std::vector<QVariant>& args) {
-    std::vector<QVariant> flat;
+std::vector<Value> FormulaEngine::flattenArgs(const std::vector<Value>& args) {
+    std::vector<Value> flat;
     for (const auto& arg : args) {
-        if (arg.canConvert<std::vector<QVariant>>()) {
-            auto nested = arg.value<std::vector<QVariant>>();
-            for (const auto& v : nested) flat.push_back(v);
+        if (arg.isRange()) {
+            auto values = getRangeValues(arg);
+            flat.insert(flat.end(), values.begin(), values.end());
+        } else if (arg.isArray()) {
+            flat.insert(flat.end(), arg.asArray()->values.begin(), arg.asArray()->values.end());
         } else {
             flat.push_back(arg);
         }
@@ -56,435 +113,439 @@ std::vector<QVariant> FormulaEngine::flattenArgs(const std::vector<QVariant>& ar
     return flat;
 }
 
-QVariant FormulaEngine::parseExpression(const QString& expr) {
-    int pos = 0;
-    QVariant result = evaluateComparison(expr, pos);
-    skipWhitespace(expr, pos);
-    return result;
-}
-
-QVariant FormulaEngine::evaluateComparison(const QString& expr, int& pos) {
-    QVariant left = evaluateTerm(expr, pos);
-    skipWhitespace(expr, pos);
-    while (pos < expr.length()) {
-        if (pos + 1 < expr.length() && expr[pos] == '<' && expr[pos + 1] == '>') {
-            pos += 2; QVariant right = evaluateTerm(expr, pos);
-            left = QVariant(toNumber(left) != toNumber(right));
-        } else if (pos + 1 < expr.length() && expr[pos] == '<' && expr[pos + 1] == '=') {
-            pos += 2; QVariant right = evaluateTerm(expr, pos);
-            left = QVariant(toNumber(left) <= toNumber(right));
-        } else if (pos + 1 < expr.length() && expr[pos] == '>' && expr[pos + 1] == '=') {
-            pos += 2; QVariant right = evaluateTerm(expr, pos);
-            left = QVariant(toNumber(left) >= toNumber(right));
-        } else if (expr[pos] == '<') {
-            pos++; QVariant right = evaluateTerm(expr, pos);
-            left = QVariant(toNumber(left) < toNumber(right));
-        } else if (expr[pos] == '>') {
-            pos++; QVariant right = evaluateTerm(expr, pos);
-            left = QVariant(toNumber(left) > toNumber(right));
-        } else if (expr[pos] == '=') {
-            pos++; QVariant right = evaluateTerm(expr, pos);
-            left = QVariant(toNumber(left) == toNumber(right));
-        } else break;
-        skipWhitespace(expr, pos);
-    }
-    return left;
+// range's top-left corner with the shape of other (SUMIF's sum_range)
+static CellRange sameShapeAt(const CellRange& range, const CellRange& other) {
+    const CellAddress& start = range.getStart();
+    return CellRange(start.row, start.col, start.row + other.getRowCount() - 1, start.col + other.getColumnCount() - 1);
 }
 
-QVariant FormulaEngine::evaluateTerm(const QString& expr, int& pos) {
-    QVariant result = evaluateMultiplicative(expr, pos);
-    skipWhitespace(expr, pos);
-    while (pos < expr.length()) {
-        if (expr[pos] == '+') { pos++; result = toNumber(result) + toNumber(evaluateMultiplicative(expr, pos)); }
-        else if (expr[pos] == '-') { pos++; result = toNumber(result) - toNumber(evaluateMultiplicative(expr, pos)); }
-        else break;
-        skipWhitespace(expr, pos);
-    }
-    return result;
-}
-
-QVariant FormulaEngine::evaluateMultiplicative(const QString& expr, int& pos) {
-    QVariant result = evaluateUnary(expr, pos);
-    skipWhitespace(expr, pos);
-    while (pos < expr.length()) {
-        if (expr[pos] == '*') { pos++; result = toNumber(result) * toNumber(evaluateUnary(expr, pos)); }
-        else if (expr[pos] == '/') {
-            pos++; double d = toNumber(evaluateUnary(expr, pos));
-            if (d == 0.0) { m_lastError = "Division by zero"; return QVariant("#DIV/0!"); }
-            result = toNumber(result) / d;
-        } else break;
-        skipWhitespace(expr, pos);
-    }
-    return result;
+// Blank for COUNTA/COUNTBLANK/ISBLANK: no value or empty text
+static bool isBlank(const Value& v) {
+    return v.isEmpty() || (v.isText() && v.toString().isEmpty());
 }
 
-QVariant FormulaEngine::evaluateUnary(const QString& expr, int& pos) {
-    skipWhitespace(expr, pos);
-    if (pos < expr.length() && expr[pos] == '-') { pos++; return -toNumber(evaluateUnary(expr, pos)); }
-    return evaluatePower(expr, pos);
+template <typename Fn>
+void FormulaEngine::forEachValue(const Value& arg, Fn&& fn) {
+    if (arg.isRange()) {
+        const Spreadsheet* sheet = sheetOf(arg);
+        if (!sheet) return;
+        sheet->forEachCellInRange(*arg.asRange(), [&](int, int, const Cell& cell) {
+            const Value& v = cell.getResult();
+            if (!v.isEmpty()) fn(v);
+        });
+    } else if (arg.isArray()) {
+        for (const auto& v : arg.asArray()->values) {
+            if (!v.isEmpty()) fn(v);
+        }
+    } else if (!arg.isEmpty()) {
+        fn(arg);
+    }
 }
 
-QVariant FormulaEngine::evaluatePower(const QString& expr, int& pos) {
-    QVariant base = evaluateFactor(expr, pos);
-    skipWhitespace(expr, pos);
-    if (pos < expr.length() && expr[pos] == '^') {
-        pos++; return std::pow(toNumber(base), toNumber(evaluateUnary(expr, pos)));
-    }
-    return base;
+template <typename Fn>
+void FormulaEngine::forEachValue(const std::vector<Value>& args, Fn&& fn) {
+    for (const auto& arg : args) forEachValue(arg, fn);
 }
 
-QVariant FormulaEngine::evaluateFactor(const QString& expr, int& pos) {
-    skipWhitespace(expr, pos);
-    if (pos >= expr.length()) return QVariant();
+template <typename Fn>
+void FormulaEngine::forEachNumberBlock(const std::vector<Value>& args, bool numericOnly, Fn&& fn) {
+    std::array<double, 1024> block;
+    size_t n = 0;
+    forEachValue(args, [&](const Value& v) {
+        bool ok;
+        double d = v.toNumber(&ok);
+        if (!ok && numericOnly) return;
+        block[n++] = d;
+        if (n == block.size()) { fn(block.data(), n); n = 0; }
+    });
+    if (n > 0) fn(block.data(), n);
+}
 
-    // Numbers
-    if (expr[pos].isDigit() || (expr[pos] == '.' && pos + 1 < expr.length() && expr[pos + 1].isDigit())) {
-        int start = pos;
-        while (pos < expr.length() && (expr[pos].isDigit() || expr[pos] == '.')) pos++;
-        return expr.mid(start, pos - start).toDouble();
+template <typename Fn>
+std::vector<Value> FormulaEngine::takeAggregatedRanges(const std::vector<Value>& args, Fn&& fn) {
+    std::vector<Value> rest;
+    rest.reserve(args.size());
+    for (const auto& arg : args) {
+        std::shared_ptr<const RangeAggregate> aggregate;
+        if (arg.isRange() && sheetOf(arg)) aggregate = sheetOf(arg)->getRangeAggregate(*arg.asRange());
+        if (aggregate) fn(*aggregate);
+        else rest.push_back(arg);
     }
+    return rest;
+}
 
-    // Strings
-    if (expr[pos] == '"') {
-        pos++; int start = pos;
-        while (pos < expr.length() && expr[pos] != '"') pos++;
-        QString result = expr.mid(start, pos - start);
-        if (pos < expr.length()) pos++;
-        return result;
+std::shared_ptr<const SortedValues> FormulaEngine::sortedValues(const std::vector<Value>& args, std::vector<double>& numbers) {
+    if (args.size() == 1 && args[0].isRange() && sheetOf(args[0])) {
+        if (auto sorted = sheetOf(args[0])->getSortedValues(*args[0].asRange())) return sorted;
     }
+    forEachValue(args, [&](const Value& v) {
+        bool ok; double d = v.toNumber(&ok);
+        if (ok) numbers.push_back(d);
+    });
+    return nullptr;
+}
+
+Value FormulaEngine::cellAt(const Value& range, int rowOffset, int colOffset) {
+    const Spreadsheet* sheet = sheetOf(range);
+    if (!sheet) return Value();
+    const CellAddress& start = range.asRange()->getStart();
+    return sheet->getCellResult(CellAddress(start.row + rowOffset, start.col + colOffset));
+}
+
+Value FormulaEngine::evaluateNode(const CompiledFormula& formula, int index) {
+    const FormulaNode& node = formula.node(index);
+    switch (node.op) {
+        case FormulaOp::Empty:
+            return Value();
+
+        case FormulaOp::Constant:
+            return formula.constant(node.operand);
+
+        case FormulaOp::CellRef: {
+            const RelativeRef& ref = formula.cellRef(node.operand);
+            CellAddress addr = ref.resolve(m_at);
+            if (ref.sheet == 0) return getCellValue(addr);
+            const Spreadsheet* sheet = m_sheets[ref.sheet - 1];
+            return sheet ? sheet->getCellResult(addr) : Value::error(ErrorCode::Ref);
+        }
 
-    // Letter tokens: functions, cell refs, ranges
-    if (pos < expr.length() && (expr[pos].isLetter() || expr[pos] == '$')) {
-        int start = pos;
-        while (pos < expr.length() && (expr[pos].isLetterOrNumber() || expr[pos] == ':' || expr[pos] == '$' || expr[pos] == '_')) pos++;
-        QString token = expr.mid(start, pos - start);
-        skipWhitespace(expr, pos);
-
-        // Function call
-        if (pos < expr.length() && expr[pos] == '(') {
-            pos++;
-            std::vector<QVariant> args;
-            skipWhitespace(expr, pos);
-            while (pos < expr.length() && expr[pos] != ')') {
-                args.push_back(evaluateComparison(expr, pos));
-                skipWhitespace(expr, pos);
-                if (pos < expr.length() && expr[pos] == ',') pos++;
-                skipWhitespace(expr, pos);
-            }
-            if (pos < expr.length() && expr[pos] == ')') pos++;
-            return evaluateFunction(token.toUpper(), args);
+        case FormulaOp::RangeRef: {
+            uint8_t sheet = formula.rangeRef(node.operand).sheet();
+            if (sheet && !m_sheets[sheet - 1]) return Value::error(ErrorCode::Ref);
+            return Value::range(&m_ranges[node.operand], sheet);
         }
 
-        // Range
-        if (token.contains(':')) {
-            CellRange range(token);
-            m_lastRangeArgs.push_back(range);
-            auto cells = range.getCells();
-            for (const auto& c : cells) m_lastDependencies.push_back(c);
-            std::vector<QVariant> values = getRangeValues(range);
-            return QVariant::fromValue(values);
+        case FormulaOp::Negate: {
+            Value v = evaluateNode(formula, node.lhs);
+            if (v.isRange() || v.isArray()) return elementwise(FormulaOp::Sub, Value::number(0.0), v);
+            if (v.isError()) return v;
+            return Value::number(-toNumber(v));
         }
 
-        // Cell ref
-        CellAddress addr = CellAddress::fromString(token);
-        m_lastDependencies.push_back(addr);
-        return getCellValue(addr);
-    }
+        case FormulaOp::Call: {
+            // Resolved when the formula was compiled, no name lookup here
+            const FunctionInfo* fn = formula.function(node.operand);
+            if (!fn) {
+                m_lastError = "Unknown function: " + formula.functionName(node.operand);
+                return Value::error(ErrorCode::Name);
+            }
+            if (node.rhs < fn->minArgs || node.rhs > fn->maxArgs) {
+                m_lastError = "Wrong number of arguments to " + formula.functionName(node.operand);
+                return Value::error(ErrorCode::Value);
+            }
+            std::vector<Value> args;
+            args.reserve(node.rhs);
+            for (int i = 0; i < node.rhs; ++i) {
+                args.push_back(evaluateNode(formula, formula.argNode(node.lhs + i)));
+            }
+            return (this->*fn->impl)(args);
+        }
 
-    // Parentheses
-    if (pos < expr.length() && expr[pos] == '(') {
-        pos++;
-        QVariant result = evaluateComparison(expr, pos);
-        skipWhitespace(expr, pos);
-        if (pos < expr.length() && expr[pos] == ')') pos++;
-        return result;
+        default:
+            break;
     }
 
-    return QVariant();
-}
-
-QVariant FormulaEngine::evaluateFunction(const QString& fn, const std::vector<QVariant>& args) {
-    // Aggregate
-    if (fn == "SUM") return funcSUM(args);
-    if (fn == "AVERAGE") return funcAVERAGE(args);
-    if (fn == "COUNT") return funcCOUNT(args);
-    if (fn == "COUNTA") return funcCOUNTA(args);
-    if (fn == "MIN") return funcMIN(args);
-    if (fn == "MAX") return funcMAX(args);
-    if (fn == "IF") return funcIF(args);
-    if (fn == "CONCAT" || fn == "CONCATENATE") return funcCONCAT(args);
-    if (fn == "LEN") return funcLEN(args);
-    if (fn == "UPPER") return funcUPPER(args);
-    if (fn == "LOWER") return funcLOWER(args);
-    if (fn == "TRIM") return funcTRIM(args);
-    // Math
-    if (fn == "ROUND") return funcROUND(args);
-    if (fn == "ABS") return funcABS(args);
-    if (fn == "SQRT") return funcSQRT(args);
-    if (fn == "POWER") return funcPOWER(args);
-    if (fn == "MOD") return funcMOD(args);
-    if (fn == "INT") return funcINT(args);
-    if (fn == "CEILING") return funcCEILING(args);
-    if (fn == "FLOOR") return funcFLOOR(args);
-    // Logical
-    if (fn == "AND") return funcAND(args);
-    if (fn == "OR") return funcOR(args);
-    if (fn == "NOT") return funcNOT(args);
-    if (fn == "IFERROR") return funcIFERROR(args);
-    // Text
-    if (fn == "LEFT") return funcLEFT(args);
-    if (fn == "RIGHT") return funcRIGHT(args);
-    if (fn == "MID") return funcMID(args);
-    if (fn == "FIND") return funcFIND(args);
-    if (fn == "SUBSTITUTE") return funcSUBSTITUTE(args);
-    if (fn == "TEXT") return funcTEXT(args);
-    // Statistical
-    if (fn == "COUNTIF") return funcCOUNTIF(args);
-    if (fn == "SUMIF") return funcSUMIF(args);
-    // Date
-    if (fn == "NOW") return funcNOW(args);
-    if (fn == "TODAY") return funcTODAY(args);
-    if (fn == "YEAR") return funcYEAR(args);
-    if (fn == "MONTH") return funcMONTH(args);
-    if (fn == "DAY") return funcDAY(args);
-    if (fn == "DATE") return funcDATE(args);
-    if (fn == "HOUR") return funcHOUR(args);
-    if (fn == "MINUTE") return funcMINUTE(args);
-    if (fn == "SECOND") return funcSECOND(args);
-    if (fn == "DATEDIF") return funcDATEDIF(args);
-    if (fn == "NETWORKDAYS") return funcNETWORKDAYS(args);
-    if (fn == "WEEKDAY") return funcWEEKDAY(args);
-    if (fn == "EDATE") return funcEDATE(args);
-    if (fn == "EOMONTH") return funcEOMONTH(args);
-    if (fn == "DATEVALUE") return funcDATEVALUE(args);
-    // Lookup
-    if (fn == "VLOOKUP") return funcVLOOKUP(args);
-    if (fn == "HLOOKUP") return funcHLOOKUP(args);
-    if (fn == "XLOOKUP") return funcXLOOKUP(args);
-    if (fn == "INDEX") return funcINDEX(args);
-    if (fn == "MATCH") return funcMATCH(args);
-    // Additional statistical
-    if (fn == "AVERAGEIF") return funcAVERAGEIF(args);
-    if (fn == "COUNTBLANK") return funcCOUNTBLANK(args);
-    if (fn == "SUMPRODUCT") return funcSUMPRODUCT(args);
-    if (fn == "MEDIAN") return funcMEDIAN(args);
-    if (fn == "MODE") return funcMODE(args);
-    if (fn == "STDEV") return funcSTDEV(args);
-    if (fn == "VAR") return funcVAR(args);
-    if (fn == "LARGE") return funcLARGE(args);
-    if (fn == "SMALL") return funcSMALL(args);
-    if (fn == "RANK") return funcRANK(args);
-    if (fn == "PERCENTILE") return funcPERCENTILE(args);
-    // Additional math
-    if (fn == "ROUNDUP") return funcROUNDUP(args);
-    if (fn == "ROUNDDOWN") return funcROUNDDOWN(args);
-    if (fn == "LOG") return funcLOG(args);
-    if (fn == "LN") return funcLN(args);
-    if (fn == "EXP") return funcEXP(args);
-    if (fn == "RAND") return funcRAND(args);
-    if (fn == "RANDBETWEEN") return funcRANDBETWEEN(args);
-    // Additional text
-    if (fn == "PROPER") return funcPROPER(args);
-    if (fn == "SEARCH") return funcSEARCH(args);
-    if (fn == "REPT") return funcREPT(args);
-    if (fn == "EXACT") return funcEXACT(args);
-    if (fn == "VALUE") return funcVALUE(args);
-    // Additional logical/info
-    if (fn == "ISBLANK") return funcISBLANK(args);
-    if (fn == "ISERROR") return funcISERROR(args);
-    if (fn == "ISNUMBER") return funcISNUMBER(args);
-    if (fn == "ISTEXT") return funcISTEXT(args);
-    if (fn == "CHOOSE") return funcCHOOSE(args);
-    if (fn == "SWITCH") return funcSWITCH(args);
-
-    m_lastError = "Unknown function: " + fn;
-    return QVariant("#NAME?");
-}
-
-// ---- Aggregate functions ----
-
-QVariant FormulaEngine::funcSUM(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args); double sum = 0;
-    for (const auto& a : flat) if (!a.isNull() && a.isValid()) sum += toNumber(a);
-    return sum;
-}
-
-QVariant FormulaEngine::funcAVERAGE(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
-    if (flat.empty()) return QVariant("#DIV/0!");
-    double sum = 0; int count = 0;
-    for (const auto& a : flat) if (!a.isNull() && a.isValid()) { sum += toNumber(a); count++; }
-    return count == 0 ? QVariant("#DIV/0!") : QVariant(sum / count);
-}
+    // Binary operators
+    Value left = evaluateNode(formula, node.lhs);
+    Value right = evaluateNode(formula, node.rhs);
+    if (left.isRange() || left.isArray() || right.isRange() || right.isArray()) {
+        return elementwise(node.op, left, right);
+    }
+    return binaryOp(node.op, left, right);
+}
+
+Value FormulaEngine::binaryOp(FormulaOp op, const Value& left, const Value& right) {
+    switch (op) {
+        case FormulaOp::Eq: return Value::boolean(toNumber(left) == toNumber(right));
+        case FormulaOp::Ne: return Value::boolean(toNumber(left) != toNumber(right));
+        case FormulaOp::Lt: return Value::boolean(toNumber(left) < toNumber(right));
+        case FormulaOp::Le: return Value::boolean(toNumber(left) <= toNumber(right));
+        case FormulaOp::Gt: return Value::boolean(toNumber(left) > toNumber(right));
+        case FormulaOp::Ge: return Value::boolean(toNumber(left) >= toNumber(right));
+        default: break;
+    }
 
-QVariant FormulaEngine::funcCOUNT(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args); int count = 0;
-    for (const auto& a : flat) {
-        if (!a.isNull() && a.isValid()) {
-            bool ok = false; a.toDouble(&ok);
-            if (ok || a.typeId() == QMetaType::Int || a.typeId() == QMetaType::Double) count++;
+    // Errors ("#DIV/0!", "#REF!", ...) propagate through arithmetic
+    if (left.isError()) return left;
+    if (right.isError()) return right;
+    switch (op) {
+        case FormulaOp::Add: return Value::number(toNumber(left) + toNumber(right));
+        case FormulaOp::Sub: return Value::number(toNumber(left) - toNumber(right));
+        case FormulaOp::Mul: return Value::number(toNumber(left) * toNumber(right));
+        case FormulaOp::Div: {
+            double d = toNumber(right);
+            if (d == 0.0) { m_lastError = "Division by zero"; return Value::error(ErrorCode::Div0); }
+            return Value::number(toNumber(left) / d);
+        }
+        case FormulaOp::Pow: return Value::number(std::pow(toNumber(left), toNumber(right)));
+        default: break;
+    }
+    return Value();
+}
+
+// Operands are broadcast to a common shape: a single row or column stretches
+// across the other operand, positions beyond a shorter one are #N/A. Plain
+// numbers, the common case (=B2:B100000*C2:C100000), go through one loop
+// over double columns rather than a Value dispatch per element.
+Value FormulaEngine::elementwise(FormulaOp op, const Value& left, const Value& right) {
+    const ValueArray& a = arrayOf(left);
+    const ValueArray& b = arrayOf(right);
+    ValueArray out;
+    out.rows = std::max(a.rows, b.rows);
+    out.cols = std::max(a.cols, b.cols);
+    size_t n = static_cast<size_t>(out.rows) * out.cols;
+    if (n == 0) return Value::error(ErrorCode::Value);
+    out.values.resize(n);
+
+    auto fits = [&](const ValueArray& in) {
+        return in.values.size() == 1 || (in.rows == out.rows && in.cols == out.cols);
+    };
+    bool arithmetic = op == FormulaOp::Add || op == FormulaOp::Sub || op == FormulaOp::Mul ||
+                      op == FormulaOp::Div || op == FormulaOp::Pow;
+    if (arithmetic && fits(a) && fits(b)) {
+        std::vector<double> x(n), y(n);
+        auto load = [n](const ValueArray& in, std::vector<double>& column) {
+            for (size_t i = 0; i < n; ++i) {
+                const Value& v = in.values.size() == 1 ? in.values[0] : in.values[i];
+                if (v.isNumber()) column[i] = v.asNumber();
+                else if (v.isEmpty()) column[i] = 0.0;
+                else return false;
+            }
+            return true;
+        };
+        if (load(a, x) && load(b, y)) {
+            switch (op) {
+                case FormulaOp::Add: for (size_t i = 0; i < n; ++i) x[i] += y[i]; break;
+                case FormulaOp::Sub: for (size_t i = 0; i < n; ++i) x[i] -= y[i]; break;
+                case FormulaOp::Mul: for (size_t i = 0; i < n; ++i) x[i] *= y[i]; break;
+                case FormulaOp::Div: for (size_t i = 0; i < n; ++i) x[i] /= y[i]; break;
+                default: for (size_t i = 0; i < n; ++i) x[i] = std::pow(x[i], y[i]); break;
+            }
+            for (size_t i = 0; i < n; ++i) out.values[i] = Value::number(x[i]);
+            if (op == FormulaOp::Div) {
+                for (size_t i = 0; i < n; ++i) {
+                    if (y[i] == 0.0) out.values[i] = Value::error(ErrorCode::Div0);
+                }
+            }
+            return makeArray(std::move(out));
         }
     }
-    return count;
-}
-
-QVariant FormulaEngine::funcCOUNTA(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args); int count = 0;
-    for (const auto& a : flat) if (!a.isNull() && a.isValid() && !a.toString().isEmpty()) count++;
-    return count;
-}
 
-QVariant FormulaEngine::funcMIN(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args); double min = std::numeric_limits<double>::max(); bool found = false;
-    for (const auto& a : flat) if (!a.isNull() && a.isValid()) { double v = toNumber(a); if (!found || v < min) { min = v; found = true; } }
-    return found ? QVariant(min) : QVariant();
+    auto element = [](const ValueArray& in, int row, int col) {
+        if (in.rows == 1) row = 0;
+        if (in.cols == 1) col = 0;
+        return row < in.rows && col < in.cols ? in.at(row, col) : Value::error(ErrorCode::NA);
+    };
+    for (int row = 0; row < out.rows; ++row) {
+        for (int col = 0; col < out.cols; ++col) {
+            out.values[static_cast<size_t>(row) * out.cols + col] = binaryOp(op, element(a, row, col), element(b, row, col));
+        }
+    }
+    return makeArray(std::move(out));
 }
 
-QVariant FormulaEngine::funcMAX(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args); double max = std::numeric_limits<double>::lowest(); bool found = false;
-    for (const auto& a : flat) if (!a.isNull() && a.isValid()) { double v = toNumber(a); if (!found || v > max) { max = v; found = true; } }
-    return found ? QVariant(max) : QVariant();
-}
+// ---- Aggregate functions ----
 
-QVariant FormulaEngine::funcIF(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+// Large ranges are read from the sheet's running aggregates, the rest of
+// the arguments are scanned
+
+Value FormulaEngine::funcSUM(const std::vector<Value>& args) {
+    AggregateKernels::Sum sum;
+    auto rest = takeAggregatedRanges(args, [&](const RangeAggregate& a) { sum.add(a.sum()); });
+    forEachNumberBlock(rest, false, [&](const double* data, size_t n) { AggregateKernels::sum(data, n, sum); });
+    return Value::number(sum.value());
+}
+
+Value FormulaEngine::funcAVERAGE(const std::vector<Value>& args) {
+    AggregateKernels::Sum sum; long long count = 0;
+    auto rest = takeAggregatedRanges(args, [&](const RangeAggregate& a) { sum.add(a.sum()); count += a.values(); });
+    forEachNumberBlock(rest, false, [&](const double* data, size_t n) { AggregateKernels::sum(data, n, sum); count += n; });
+    return count == 0 ? Value::error(ErrorCode::Div0) : Value::number(sum.value() / count);
+}
+
+Value FormulaEngine::funcCOUNT(const std::vector<Value>& args) {
+    long long count = 0;
+    auto rest = takeAggregatedRanges(args, [&](const RangeAggregate& a) { count += a.numbers(); });
+    forEachValue(rest, [&](const Value& v) {
+        bool ok = false; v.toNumber(&ok);
+        if (ok) count++;
+    });
+    return Value::number(static_cast<double>(count));
+}
+
+Value FormulaEngine::funcCOUNTA(const std::vector<Value>& args) {
+    long long count = 0;
+    auto rest = takeAggregatedRanges(args, [&](const RangeAggregate& a) { count += a.nonBlank(); });
+    forEachValue(rest, [&](const Value& v) { if (!isBlank(v)) count++; });
+    return Value::number(static_cast<double>(count));
+}
+
+Value FormulaEngine::funcMIN(const std::vector<Value>& args) {
+    double min = 0, max = 0; bool found = false;
+    auto rest = takeAggregatedRanges(args, [&](const RangeAggregate& a) {
+        if (a.values() == 0) return;
+        min = found ? std::min(min, a.min()) : a.min();
+        found = true;
+    });
+    forEachNumberBlock(rest, false, [&](const double* data, size_t n) {
+        if (!found) { min = max = data[0]; found = true; }
+        AggregateKernels::minMax(data, n, min, max);
+    });
+    return found ? Value::number(min) : Value();
+}
+
+Value FormulaEngine::funcMAX(const std::vector<Value>& args) {
+    double min = 0, max = 0; bool found = false;
+    auto rest = takeAggregatedRanges(args, [&](const RangeAggregate& a) {
+        if (a.values() == 0) return;
+        max = found ? std::max(max, a.max()) : a.max();
+        found = true;
+    });
+    forEachNumberBlock(rest, false, [&](const double* data, size_t n) {
+        if (!found) { min = max = data[0]; found = true; }
+        AggregateKernels::minMax(data, n, min, max);
+    });
+    return found ? Value::number(max) : Value();
+}
+
+Value FormulaEngine::funcIF(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     bool cond = toBoolean(args[0]);
     if (cond) return args[1];
-    return args.size() >= 3 ? args[2] : QVariant(false);
+    return args.size() >= 3 ? args[2] : Value::boolean(false);
 }
 
-QVariant FormulaEngine::funcCONCAT(const std::vector<QVariant>& args) {
+Value FormulaEngine::funcCONCAT(const std::vector<Value>& args) {
     auto flat = flattenArgs(args); QString result;
     for (const auto& a : flat) result += toString(a);
-    return result;
+    return Value::text(result);
 }
 
-QVariant FormulaEngine::funcLEN(const std::vector<QVariant>& args) {
-    if (args.empty()) return 0;
-    return static_cast<int>(toString(args[0]).length());
+Value FormulaEngine::funcLEN(const std::vector<Value>& args) {
+    if (args.empty()) return Value::number(0);
+    return Value::number(static_cast<int>(toString(args[0]).length()));
 }
 
-QVariant FormulaEngine::funcUPPER(const std::vector<QVariant>& args) { return args.empty() ? QVariant("") : QVariant(toString(args[0]).toUpper()); }
-QVariant FormulaEngine::funcLOWER(const std::vector<QVariant>& args) { return args.empty() ? QVariant("") : QVariant(toString(args[0]).toLower()); }
-QVariant FormulaEngine::funcTRIM(const std::vector<QVariant>& args) { return args.empty() ? QVariant("") : QVariant(toString(args[0]).trimmed()); }
+Value FormulaEngine::funcUPPER(const std::vector<Value>& args) { return Value::text(args.empty() ? QString() : toString(args[0]).toUpper()); }
+Value FormulaEngine::funcLOWER(const std::vector<Value>& args) { return Value::text(args.empty() ? QString() : toString(args[0]).toLower()); }
+Value FormulaEngine::funcTRIM(const std::vector<Value>& args) { return Value::text(args.empty() ? QString() : toString(args[0]).trimmed()); }
 
 // ---- Math functions ----
 
-QVariant FormulaEngine::funcROUND(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcROUND(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
     int decimals = args.size() >= 2 ? static_cast<int>(toNumber(args[1])) : 0;
     double factor = std::pow(10.0, decimals);
-    return std::round(val * factor) / factor;
+    return Value::number(std::round(val * factor) / factor);
 }
 
-QVariant FormulaEngine::funcABS(const std::vector<QVariant>& args) {
-    return args.empty() ? QVariant("#VALUE!") : QVariant(std::abs(toNumber(args[0])));
+Value FormulaEngine::funcABS(const std::vector<Value>& args) {
+    return args.empty() ? Value::error(ErrorCode::Value) : Value::number(std::abs(toNumber(args[0])));
 }
 
-QVariant FormulaEngine::funcSQRT(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcSQRT(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
-    return val < 0 ? QVariant("#NUM!") : QVariant(std::sqrt(val));
+    return val < 0 ? Value::error(ErrorCode::Num) : Value::number(std::sqrt(val));
 }
 
-QVariant FormulaEngine::funcPOWER(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    return std::pow(toNumber(args[0]), toNumber(args[1]));
+Value FormulaEngine::funcPOWER(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
+    return Value::number(std::pow(toNumber(args[0]), toNumber(args[1])));
 }
 
-QVariant FormulaEngine::funcMOD(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcMOD(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     double d = toNumber(args[1]);
-    return d == 0.0 ? QVariant("#DIV/0!") : QVariant(std::fmod(toNumber(args[0]), d));
+    return d == 0.0 ? Value::error(ErrorCode::Div0) : Value::number(std::fmod(toNumber(args[0]), d));
 }
 
-QVariant FormulaEngine::funcINT(const std::vector<QVariant>& args) {
-    return args.empty() ? QVariant("#VALUE!") : QVariant(std::floor(toNumber(args[0])));
+Value FormulaEngine::funcINT(const std::vector<Value>& args) {
+    return args.empty() ? Value::error(ErrorCode::Value) : Value::number(std::floor(toNumber(args[0])));
 }
 
-QVariant FormulaEngine::funcCEILING(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcCEILING(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
     double sig = args.size() >= 2 ? toNumber(args[1]) : 1.0;
-    if (sig == 0.0) return QVariant(0.0);
-    return std::ceil(val / sig) * sig;
+    if (sig == 0.0) return Value::number(0.0);
+    return Value::number(std::ceil(val / sig) * sig);
 }
 
-QVariant FormulaEngine::funcFLOOR(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcFLOOR(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
     double sig = args.size() >= 2 ? toNumber(args[1]) : 1.0;
-    if (sig == 0.0) return QVariant(0.0);
-    return std::floor(val / sig) * sig;
+    if (sig == 0.0) return Value::number(0.0);
+    return Value::number(std::floor(val / sig) * sig);
 }
 
 // ---- Logical functions ----
 
-QVariant FormulaEngine::funcAND(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
-    for (const auto& a : flat) if (!toBoolean(a)) return QVariant(false);
-    return QVariant(true);
+Value FormulaEngine::funcAND(const std::vector<Value>& args) {
+    bool result = true;
+    forEachValue(args, [&](const Value& a) { if (!toBoolean(a)) result = false; });
+    return Value::boolean(result);
 }
 
-QVariant FormulaEngine::funcOR(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
-    for (const auto& a : flat) if (toBoolean(a)) return QVariant(true);
-    return QVariant(false);
+Value FormulaEngine::funcOR(const std::vector<Value>& args) {
+    bool result = false;
+    forEachValue(args, [&](const Value& a) { if (toBoolean(a)) result = true; });
+    return Value::boolean(result);
 }
 
-QVariant FormulaEngine::funcNOT(const std::vector<QVariant>& args) {
-    return args.empty() ? QVariant("#VALUE!") : QVariant(!toBoolean(args[0]));
+Value FormulaEngine::funcNOT(const std::vector<Value>& args) {
+    return args.empty() ? Value::error(ErrorCode::Value) : Value::boolean(!toBoolean(args[0]));
 }
 
-QVariant FormulaEngine::funcIFERROR(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    QString str = toString(args[0]);
-    if (str.startsWith('#')) return args[1];
+Value FormulaEngine::funcIFERROR(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
+    if (args[0].isError()) return args[1];
     return args[0];
 }
 
 // ---- Text functions ----
 
-QVariant FormulaEngine::funcLEFT(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcLEFT(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     int count = args.size() >= 2 ? static_cast<int>(toNumber(args[1])) : 1;
-    return toString(args[0]).left(count);
+    return Value::text(toString(args[0]).left(count));
 }
 
-QVariant FormulaEngine::funcRIGHT(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcRIGHT(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     int count = args.size() >= 2 ? static_cast<int>(toNumber(args[1])) : 1;
-    return toString(args[0]).right(count);
+    return Value::text(toString(args[0]).right(count));
 }
 
-QVariant FormulaEngine::funcMID(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
+Value FormulaEngine::funcMID(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
     QString str = toString(args[0]);
     int start = static_cast<int>(toNumber(args[1])) - 1; // 1-based to 0-based
     int count = static_cast<int>(toNumber(args[2]));
-    return str.mid(start, count);
+    return Value::text(str.mid(start, count));
 }
 
-QVariant FormulaEngine::funcFIND(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcFIND(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     QString search = toString(args[0]);
     QString text = toString(args[1]);
     int startPos = args.size() >= 3 ? static_cast<int>(toNumber(args[2])) - 1 : 0;
     int idx = text.indexOf(search, startPos);
-    return idx >= 0 ? QVariant(idx + 1) : QVariant("#VALUE!"); // 1-based
+    return idx >= 0 ? Value::number(idx + 1) : Value::error(ErrorCode::Value); // 1-based
 }
 
-QVariant FormulaEngine::funcSUBSTITUTE(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
+Value FormulaEngine::funcSUBSTITUTE(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
     QString text = toString(args[0]);
     QString oldText = toString(args[1]);
     QString newText = toString(args[2]);
-    return text.replace(oldText, newText);
+    return Value::text(text.replace(oldText, newText));
 }
 
-QVariant FormulaEngine::funcTEXT(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcTEXT(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
     QString fmt = toString(args[1]);
     if (fmt.contains('#') || fmt.contains('0')) {
@@ -492,121 +553,103 @@ QVariant FormulaEngine::funcTEXT(const std::vector<QVariant>& args) {
         int decimals = 0;
         int dotPos = fmt.indexOf('.');
         if (dotPos >= 0) decimals = fmt.length() - dotPos - 1;
-        return QString::number(val, 'f', decimals);
+        return Value::text(QString::number(val, 'f', decimals));
     }
-    return QString::number(val);
+    return Value::text(QString::number(val));
 }
 
 // ---- Statistical functions ----
 
-bool FormulaEngine::matchesCriteria(const QVariant& value, const QString& criteria) {
-    if (criteria.startsWith(">=")) return toNumber(value) >= criteria.mid(2).toDouble();
-    if (criteria.startsWith("<=")) return toNumber(value) <= criteria.mid(2).toDouble();
-    if (criteria.startsWith("<>")) return value.toString() != criteria.mid(2);
-    if (criteria.startsWith(">")) return toNumber(value) > criteria.mid(1).toDouble();
-    if (criteria.startsWith("<")) return toNumber(value) < criteria.mid(1).toDouble();
-    if (criteria.startsWith("=")) return value.toString() == criteria.mid(1);
-
-    // Direct comparison
-    bool ok = false;
-    double critNum = criteria.toDouble(&ok);
-    if (ok) return toNumber(value) == critNum;
-    return value.toString() == criteria;
-}
-
-QVariant FormulaEngine::funcCOUNTIF(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    auto flat = flattenArgs({args[0]});
-    QString criteria = toString(args[1]);
-    int count = 0;
-    for (const auto& v : flat) if (matchesCriteria(v, criteria)) count++;
-    return count;
-}
-
-QVariant FormulaEngine::funcSUMIF(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    auto range = flattenArgs({args[0]});
-    QString criteria = toString(args[1]);
-    auto sumRange = args.size() >= 3 ? flattenArgs({args[2]}) : range;
-    double sum = 0;
-    for (size_t i = 0; i < range.size() && i < sumRange.size(); ++i) {
-        if (matchesCriteria(range[i], criteria)) sum += toNumber(sumRange[i]);
-    }
-    return sum;
+Value FormulaEngine::funcCOUNTIF(const std::vector<Value>& args) {
+    if (args.size() != 2) return Value::error(ErrorCode::Value);
+    return conditionalAggregate(ConditionalOp::Count, nullptr, args, 0);
+}
+
+Value FormulaEngine::funcSUMIF(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
+    if (args.size() < 3 || !args[0].isRange() || !args[2].isRange())
+        return conditionalAggregate(ConditionalOp::Sum, &args[args.size() < 3 ? 0 : 2], {args[0], args[1]}, 0);
+    CellRange sumRange = sameShapeAt(*args[2].asRange(), *args[0].asRange());
+    Value values = Value::range(&sumRange, args[2].rangeSheet());
+    return conditionalAggregate(ConditionalOp::Sum, &values, {args[0], args[1]}, 0);
 }
 
 // ---- Date functions ----
 
-QVariant FormulaEngine::funcNOW(const std::vector<QVariant>&) {
-    return QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+Value FormulaEngine::funcNOW(const std::vector<Value>&) {
+    return Value::text(QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"));
 }
 
-QVariant FormulaEngine::funcTODAY(const std::vector<QVariant>&) {
-    return QDate::currentDate().toString("yyyy-MM-dd");
+Value FormulaEngine::funcTODAY(const std::vector<Value>&) {
+    return Value::text(QDate::currentDate().toString("yyyy-MM-dd"));
 }
 
-QVariant FormulaEngine::funcYEAR(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcYEAR(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDate date = QDate::fromString(toString(args[0]), "yyyy-MM-dd");
-    return date.isValid() ? QVariant(date.year()) : QVariant("#VALUE!");
+    return date.isValid() ? Value::number(date.year()) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcMONTH(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcMONTH(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDate date = QDate::fromString(toString(args[0]), "yyyy-MM-dd");
-    return date.isValid() ? QVariant(date.month()) : QVariant("#VALUE!");
+    return date.isValid() ? Value::number(date.month()) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcDAY(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcDAY(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDate date = QDate::fromString(toString(args[0]), "yyyy-MM-dd");
-    return date.isValid() ? QVariant(date.day()) : QVariant("#VALUE!");
+    return date.isValid() ? Value::number(date.day()) : Value::error(ErrorCode::Value);
 }
 
 // ---- Helper functions ----
 
-double FormulaEngine::toNumber(const QVariant& value) {
-    if (value.typeId() == QMetaType::Double || value.typeId() == QMetaType::Int) return value.toDouble();
-    if (value.typeId() == QMetaType::Bool) return value.toBool() ? 1.0 : 0.0;
-    bool ok = false; double r = value.toString().toDouble(&ok);
-    return ok ? r : 0.0;
-}
-
-QString FormulaEngine::toString(const QVariant& value) { return value.toString(); }
-
-bool FormulaEngine::toBoolean(const QVariant& value) {
-    if (value.typeId() == QMetaType::Bool) return value.toBool();
-    return toNumber(value) != 0;
+Value FormulaEngine::getCellValue(const CellAddress& addr) {
+    if (!m_spreadsheet) return Value();
+    return m_spreadsheet->getCellResult(addr);
 }
 
-QVariant FormulaEngine::getCellValue(const CellAddress& addr) {
-    if (!m_spreadsheet) return QVariant();
-    return m_spreadsheet->getCellValue(addr);
-}
-
-std::vector<QVariant> FormulaEngine::getRangeValues(const CellRange& range) {
-    std::vector<QVariant> values;
-    if (!m_spreadsheet) return values;
-    for (const auto& addr : range.getCells()) values.push_back(m_spreadsheet->getCellValue(addr));
+// Ranges are read by scanning stored cells only; absent cells stay invalid
+std::vector<Value> FormulaEngine::getRangeValues(const Value& arg) {
+    std::vector<Value> values;
+    const Spreadsheet* sheet = sheetOf(arg);
+    if (!sheet) return values;
+    const CellRange& range = *arg.asRange();
+    CellAddress start = range.getStart();
+    int rows = range.getRowCount();
+    int cols = range.getColumnCount();
+    if (rows <= 0 || cols <= 0) return values;
+    values.resize(static_cast<size_t>(rows) * cols);
+    sheet->forEachCellInRange(range, [&](int row, int col, const Cell& cell) {
+        values[static_cast<size_t>(row - start.row) * cols + (col - start.col)] = cell.getResult();
+    });
     return values;
 }
 
-std::vector<std::vector<QVariant>> FormulaEngine::getRangeValues2D(const CellRange& range) {
-    std::vector<std::vector<QVariant>> result;
-    if (!m_spreadsheet) return result;
-    CellAddress start = range.getStart();
-    CellAddress end = range.getEnd();
-    for (int r = start.row; r <= end.row; ++r) {
-        std::vector<QVariant> row;
-        for (int c = start.col; c <= end.col; ++c) {
-            row.push_back(m_spreadsheet->getCellValue(CellAddress(r, c)));
+const ValueArray& FormulaEngine::arrayOf(const Value& value) {
+    if (value.isArray()) return *value.asArray();
+    auto array = std::make_shared<ValueArray>();
+    if (value.isRange()) {
+        array->rows = std::max(0, value.asRange()->getRowCount());
+        array->cols = std::max(0, value.asRange()->getColumnCount());
+        array->values = getRangeValues(value);
+        if (array->values.size() != static_cast<size_t>(array->rows) * array->cols) {
+            array->values.assign(static_cast<size_t>(array->rows) * array->cols, Value::error(ErrorCode::Ref));
         }
-        result.push_back(std::move(row));
+    } else {
+        array->rows = array->cols = 1;
+        array->values.push_back(value);
     }
-    return result;
+    m_arrays.push_back(std::move(array));
+    return *m_arrays.back();
+}
+
+Value FormulaEngine::makeArray(ValueArray array) {
+    m_arrays.push_back(std::make_shared<ValueArray>(std::move(array)));
+    return Value::array(m_arrays.back().get());
 }
 
-QDate FormulaEngine::parseDate(const QVariant& value) {
+QDate FormulaEngine::parseDate(const Value& value) {
     QString str = toString(value);
     QDate d = QDate::fromString(str, "yyyy-MM-dd");
     if (d.isValid()) return d;
@@ -620,396 +663,521 @@ QDate FormulaEngine::parseDate(const QVariant& value) {
 
 // ---- Lookup functions ----
 
-QVariant FormulaEngine::funcVLOOKUP(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
-    QVariant lookupVal = args[0];
+Value FormulaEngine::funcVLOOKUP(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
+    Value lookupVal = args[0];
     int colIdx = static_cast<int>(toNumber(args[2]));
     bool rangeLookup = args.size() >= 4 ? toBoolean(args[3]) : true;
 
-    // Find the range from m_lastRangeArgs (second arg should be the table range)
-    if (m_lastRangeArgs.size() < 1) return QVariant("#REF!");
-    // The table range is typically the first range arg encountered
-    CellRange tableRange = m_lastRangeArgs[0];
-    auto table = getRangeValues2D(tableRange);
-
-    if (colIdx < 1 || colIdx > static_cast<int>(table.empty() ? 0 : table[0].size()))
-        return QVariant("#REF!");
-
-    for (size_t r = 0; r < table.size(); ++r) {
-        if (table[r].empty()) continue;
-        QVariant cellVal = table[r][0];
-        bool match = false;
-        if (!rangeLookup) {
-            // Exact match
-            match = (cellVal.toString().compare(lookupVal.toString(), Qt::CaseInsensitive) == 0);
-            if (!match) {
-                bool ok1, ok2;
-                double d1 = cellVal.toDouble(&ok1);
-                double d2 = lookupVal.toDouble(&ok2);
-                if (ok1 && ok2) match = (d1 == d2);
-            }
+    if (!args[1].isRange()) return Value::error(ErrorCode::Ref);
+    const CellRange& table = *args[1].asRange();
+    int rows = table.getRowCount();
+    if (colIdx < 1 || colIdx > table.getColumnCount())
+        return Value::error(ErrorCode::Ref);
+    const Spreadsheet* sheet = sheetOf(args[1]);
+    if (!sheet) return Value::error(ErrorCode::NA);
+
+    CellRange firstColumn(table.getStart().row, table.getStart().col, table.getEnd().row, table.getStart().col);
+    int row = -1;
+    if (!rangeLookup) {
+        // Exact match, down the first column
+        row = static_cast<int>(sheet->getLookupIndex(firstColumn, LookupIndex::Kind::Exact)->findExact(lookupVal));
+    } else {
+        // Approximate match (sorted ascending) - find largest value <= lookup
+        double lv = toNumber(lookupVal);
+        auto index = sheet->getLookupIndex(firstColumn, LookupIndex::Kind::Ordered);
+        if (index && index->isAscending()) {
+            row = static_cast<int>(index->findLastAtMost(lv));
         } else {
-            // Approximate match (sorted ascending) - find largest value <= lookup
-            double cv = toNumber(cellVal);
-            double lv = toNumber(lookupVal);
-            if (cv <= lv) {
+            double next = rows > 0 ? toNumber(cellAt(args[1], 0, 0)) : 0;
+            for (int r = 0; r < rows; ++r) {
+                double cv = next;
+                if (r + 1 < rows) next = toNumber(cellAt(args[1], r + 1, 0));
                 // Check if next row exceeds
-                if (r + 1 >= table.size() || toNumber(table[r + 1][0]) > lv) {
-                    match = true;
-                }
+                if (cv <= lv && (r + 1 >= rows || next > lv)) { row = r; break; }
             }
         }
-        if (match) return table[r][colIdx - 1];
     }
-    return QVariant("#N/A");
+    if (row >= 0) return cellAt(args[1], row, colIdx - 1);
+    return Value::error(ErrorCode::NA);
 }
 
-QVariant FormulaEngine::funcHLOOKUP(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
-    QVariant lookupVal = args[0];
+Value FormulaEngine::funcHLOOKUP(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
+    Value lookupVal = args[0];
     int rowIdx = static_cast<int>(toNumber(args[2]));
     bool rangeLookup = args.size() >= 4 ? toBoolean(args[3]) : true;
 
-    if (m_lastRangeArgs.size() < 1) return QVariant("#REF!");
-    CellRange tableRange = m_lastRangeArgs[0];
-    auto table = getRangeValues2D(tableRange);
-
-    if (table.empty() || rowIdx < 1 || rowIdx > static_cast<int>(table.size()))
-        return QVariant("#REF!");
+    if (!args[1].isRange()) return Value::error(ErrorCode::Ref);
+    const CellRange& table = *args[1].asRange();
+    int cols = table.getColumnCount();
+    if (table.getRowCount() <= 0 || rowIdx < 1 || rowIdx > table.getRowCount())
+        return Value::error(ErrorCode::Ref);
+    const Spreadsheet* sheet = sheetOf(args[1]);
+    if (!sheet) return Value::error(ErrorCode::NA);
 
     // Search first row
-    for (size_t c = 0; c < table[0].size(); ++c) {
-        QVariant cellVal = table[0][c];
-        bool match = false;
-        if (!rangeLookup) {
-            match = (cellVal.toString().compare(lookupVal.toString(), Qt::CaseInsensitive) == 0);
+    CellRange firstRow(table.getStart().row, table.getStart().col, table.getStart().row, table.getEnd().col);
+    int col = -1;
+    if (!rangeLookup) {
+        col = static_cast<int>(sheet->getLookupIndex(firstRow, LookupIndex::Kind::Exact)->findExact(lookupVal));
+    } else {
+        double lv = toNumber(lookupVal);
+        auto index = sheet->getLookupIndex(firstRow, LookupIndex::Kind::Ordered);
+        if (index && index->isAscending()) {
+            col = static_cast<int>(index->findLastAtMost(lv));
         } else {
-            double cv = toNumber(cellVal);
-            double lv = toNumber(lookupVal);
-            if (cv <= lv) {
-                if (c + 1 >= table[0].size() || toNumber(table[0][c + 1]) > lv)
-                    match = true;
+            double next = cols > 0 ? toNumber(cellAt(args[1], 0, 0)) : 0;
+            for (int c = 0; c < cols; ++c) {
+                double cv = next;
+                if (c + 1 < cols) next = toNumber(cellAt(args[1], 0, c + 1));
+                if (cv <= lv && (c + 1 >= cols || next > lv)) { col = c; break; }
             }
         }
-        if (match) return table[rowIdx - 1][c];
     }
-    return QVariant("#N/A");
+    if (col >= 0) return cellAt(args[1], rowIdx - 1, col);
+    return Value::error(ErrorCode::NA);
 }
 
-QVariant FormulaEngine::funcXLOOKUP(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
-    QVariant lookupVal = args[0];
-    QVariant ifNotFound = args.size() >= 4 ? args[3] : QVariant("#N/A");
+Value FormulaEngine::funcXLOOKUP(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
+    Value lookupVal = args[0];
+    Value ifNotFound = args.size() >= 4 ? args[3] : Value::error(ErrorCode::NA);
 
-    if (m_lastRangeArgs.size() < 2) return QVariant("#REF!");
-    CellRange lookupRange = m_lastRangeArgs[0];
-    CellRange returnRange = m_lastRangeArgs[1];
+    if (!args[1].isRange() || !args[2].isRange()) return Value::error(ErrorCode::Ref);
+    const CellRange& lookupRange = *args[1].asRange();
+    const CellRange& returnRange = *args[2].asRange();
+    const Spreadsheet* sheet = sheetOf(args[1]);
+    if (!sheet) return ifNotFound;
 
-    auto lookupVals = getRangeValues(lookupRange);
-    auto returnVals = getRangeValues(returnRange);
-
-    for (size_t i = 0; i < lookupVals.size() && i < returnVals.size(); ++i) {
-        bool match = (lookupVals[i].toString().compare(lookupVal.toString(), Qt::CaseInsensitive) == 0);
-        if (!match) {
-            bool ok1, ok2;
-            double d1 = lookupVals[i].toDouble(&ok1);
-            double d2 = lookupVal.toDouble(&ok2);
-            if (ok1 && ok2) match = (d1 == d2);
-        }
-        if (match) return returnVals[i];
-    }
-    return ifNotFound;
+    long long index = sheet->getLookupIndex(lookupRange, LookupIndex::Kind::Exact)->findExact(lookupVal);
+    if (index < 0 || index >= rangeSize(returnRange)) return ifNotFound;
+    int returnCols = returnRange.getColumnCount();
+    return cellAt(args[2], static_cast<int>(index / returnCols), static_cast<int>(index % returnCols));
 }
 
-QVariant FormulaEngine::funcINDEX(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcINDEX(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     int rowNum = static_cast<int>(toNumber(args[1]));
     int colNum = args.size() >= 3 ? static_cast<int>(toNumber(args[2])) : 1;
 
-    if (m_lastRangeArgs.empty()) return QVariant("#REF!");
-    CellRange range = m_lastRangeArgs[0];
-    auto table = getRangeValues2D(range);
+    if (!args[0].isRange()) return Value::error(ErrorCode::Ref);
+    const CellRange& range = *args[0].asRange();
 
-    if (rowNum < 1 || rowNum > static_cast<int>(table.size())) return QVariant("#REF!");
-    if (colNum < 1 || colNum > static_cast<int>(table[0].size())) return QVariant("#REF!");
-    return table[rowNum - 1][colNum - 1];
+    if (rowNum < 1 || rowNum > range.getRowCount()) return Value::error(ErrorCode::Ref);
+    if (colNum < 1 || colNum > range.getColumnCount()) return Value::error(ErrorCode::Ref);
+    return cellAt(args[0], rowNum - 1, colNum - 1);
 }
 
-QVariant FormulaEngine::funcMATCH(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    QVariant lookupVal = args[0];
+Value FormulaEngine::funcMATCH(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
+    Value lookupVal = args[0];
     int matchType = args.size() >= 3 ? static_cast<int>(toNumber(args[2])) : 1;
 
-    if (m_lastRangeArgs.empty()) return QVariant("#N/A");
-    CellRange range = m_lastRangeArgs[0];
-    auto values = getRangeValues(range);
+    if (!args[1].isRange() || !sheetOf(args[1])) return Value::error(ErrorCode::NA);
+    const Spreadsheet* sheet = sheetOf(args[1]);
+    const CellRange& range = *args[1].asRange();
+    int cols = range.getColumnCount();
+    long long size = rangeSize(range);
 
+    long long match = -1;
     if (matchType == 0) {
         // Exact match
-        for (size_t i = 0; i < values.size(); ++i) {
-            if (values[i].toString().compare(lookupVal.toString(), Qt::CaseInsensitive) == 0)
-                return static_cast<int>(i + 1);
-            bool ok1, ok2;
-            double d1 = values[i].toDouble(&ok1), d2 = lookupVal.toDouble(&ok2);
-            if (ok1 && ok2 && d1 == d2) return static_cast<int>(i + 1);
-        }
-    } else if (matchType == 1) {
-        // Largest value <= lookup (sorted ascending)
-        int lastMatch = -1;
-        for (size_t i = 0; i < values.size(); ++i) {
-            if (toNumber(values[i]) <= toNumber(lookupVal)) lastMatch = static_cast<int>(i);
-        }
-        if (lastMatch >= 0) return lastMatch + 1;
+        match = sheet->getLookupIndex(range, LookupIndex::Kind::Exact)->findExact(lookupVal);
     } else {
-        // Smallest value >= lookup (sorted descending)
-        int lastMatch = -1;
-        for (size_t i = 0; i < values.size(); ++i) {
-            if (toNumber(values[i]) >= toNumber(lookupVal)) lastMatch = static_cast<int>(i);
+        // 1: largest value <= lookup (sorted ascending)
+        // -1: smallest value >= lookup (sorted descending)
+        double lv = toNumber(lookupVal);
+        auto index = sheet->getLookupIndex(range, LookupIndex::Kind::Ordered);
+        if (index && matchType == 1 && index->isAscending()) {
+            match = index->findLastAtMost(lv);
+        } else if (index && matchType != 1 && index->isDescending()) {
+            match = index->findLastAtLeast(lv);
+        } else {
+            for (long long i = 0; i < size; ++i) {
+                double v = toNumber(cellAt(args[1], static_cast<int>(i / cols), static_cast<int>(i % cols)));
+                if (matchType == 1 ? v <= lv : v >= lv) match = i;
+            }
         }
-        if (lastMatch >= 0) return lastMatch + 1;
     }
-    return QVariant("#N/A");
+    if (match >= 0) return Value::number(static_cast<double>(match + 1));
+    return Value::error(ErrorCode::NA);
 }
 
 // ---- Additional statistical functions ----
 
-QVariant FormulaEngine::funcAVERAGEIF(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    auto range = flattenArgs({args[0]});
-    QString criteria = toString(args[1]);
-    auto avgRange = args.size() >= 3 ? flattenArgs({args[2]}) : range;
-    double sum = 0; int count = 0;
-    for (size_t i = 0; i < range.size() && i < avgRange.size(); ++i) {
-        if (matchesCriteria(range[i], criteria)) { sum += toNumber(avgRange[i]); count++; }
-    }
-    return count == 0 ? QVariant("#DIV/0!") : QVariant(sum / count);
+Value FormulaEngine::funcAVERAGEIF(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
+    if (args.size() < 3 || !args[0].isRange() || !args[2].isRange())
+        return conditionalAggregate(ConditionalOp::Average, &args[args.size() < 3 ? 0 : 2], {args[0], args[1]}, 0);
+    CellRange averageRange = sameShapeAt(*args[2].asRange(), *args[0].asRange());
+    Value values = Value::range(&averageRange, args[2].rangeSheet());
+    return conditionalAggregate(ConditionalOp::Average, &values, {args[0], args[1]}, 0);
+}
+
+Value FormulaEngine::funcSUMIFS(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
+    return conditionalAggregate(ConditionalOp::Sum, &args[0], args, 1);
+}
+
+Value FormulaEngine::funcCOUNTIFS(const std::vector<Value>& args) {
+    return conditionalAggregate(ConditionalOp::Count, nullptr, args, 0);
+}
+
+Value FormulaEngine::funcAVERAGEIFS(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
+    return conditionalAggregate(ConditionalOp::Average, &args[0], args, 1);
+}
+
+Value FormulaEngine::funcMAXIFS(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
+    return conditionalAggregate(ConditionalOp::Max, &args[0], args, 1);
+}
+
+Value FormulaEngine::funcMINIFS(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
+    return conditionalAggregate(ConditionalOp::Min, &args[0], args, 1);
 }
 
-QVariant FormulaEngine::funcCOUNTBLANK(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
-    int count = 0;
-    for (const auto& v : flat) {
-        if (v.isNull() || !v.isValid() || v.toString().isEmpty()) count++;
+Value FormulaEngine::conditionalAggregate(ConditionalOp op, const Value* values, const std::vector<Value>& args, size_t firstPair) {
+    if (args.size() < firstPair + 2 || (args.size() - firstPair) % 2 != 0) return Value::error(ErrorCode::Value);
+    auto result = [op](const ConditionalIndex::Group& group) {
+        switch (op) {
+            case ConditionalOp::Count: return Value::number(static_cast<double>(group.rows));
+            case ConditionalOp::Sum: return Value::number(group.sum.value());
+            case ConditionalOp::Average:
+                if (group.values == 0) return Value::error(ErrorCode::Div0);
+                return Value::number(group.sum.value() / group.values);
+            case ConditionalOp::Max: return Value::number(group.numbers > 0 ? group.max : 0.0);
+            case ConditionalOp::Min: return Value::number(group.numbers > 0 ? group.min : 0.0);
+        }
+        return Value();
+    };
+
+    ConditionalIndex::Group group;
+    bool anyRange = values && values->isRange();
+    for (size_t i = firstPair; i < args.size(); i += 2) anyRange = anyRange || args[i].isRange();
+    if (!anyRange) {
+        // Single-cell references arrive as their values
+        bool matched = true;
+        for (size_t i = firstPair; i < args.size() && matched; i += 2) {
+            matched = CriteriaMatcher(args[i + 1]).matches(args[i]);
+        }
+        if (matched) {
+            group.rows = 1;
+            if (values) group.add(*values);
+        }
+        return result(group);
     }
-    return count;
+    if (values && !values->isRange()) return Value::error(ErrorCode::Value);
+    const CellRange* valueRange = values ? values->asRange() : nullptr;
+
+    // Criteria are parsed once per call, not once per cell
+    std::vector<CellRange> ranges;
+    std::vector<CriteriaMatcher> criteria;
+    for (size_t i = firstPair; i < args.size(); i += 2) {
+        if (!args[i].isRange()) return Value::error(ErrorCode::Value);
+        ranges.push_back(*args[i].asRange());
+        criteria.emplace_back(args[i + 1].isRange() ? cellAt(args[i + 1], 0, 0) : args[i + 1]);
+    }
+    int rows = ranges[0].getRowCount();
+    int cols = ranges[0].getColumnCount();
+    auto sameShape = [&](const CellRange& r) { return r.getRowCount() == rows && r.getColumnCount() == cols; };
+    if (!std::all_of(ranges.begin(), ranges.end(), sameShape) || (valueRange && !sameShape(*valueRange)))
+        return Value::error(ErrorCode::Value);
+
+    // The group-by index covers ranges of one sheet; mixed sheets are scanned
+    const Spreadsheet* sheet = sheetOf(args[firstPair]);
+    bool oneSheet = !values || values->rangeSheet() == args[firstPair].rangeSheet();
+    for (size_t i = firstPair; i < args.size(); i += 2) oneSheet = oneSheet && args[i].rangeSheet() == args[firstPair].rangeSheet();
+    bool groupable = oneSheet && std::all_of(criteria.begin(), criteria.end(), [](const CriteriaMatcher& c) { return c.isGroupable(); });
+    if (!sheet) {
+        // Nothing to read
+    } else if (groupable) {
+        auto index = sheet->getConditionalIndex(ranges, valueRange);
+        if (const auto* found = index->find(criteria)) group = *found;
+    } else {
+        // Only stored cells of a range whose criterion rejects blanks can match
+        size_t driver = criteria.size();
+        for (size_t i = 0; i < criteria.size(); ++i) {
+            if (!criteria[i].matchesBlank()) { driver = i; break; }
+        }
+        auto visit = [&](int r, int c) {
+            for (size_t i = 0; i < criteria.size(); ++i) {
+                if (i != driver && !criteria[i].matches(cellAt(args[firstPair + 2 * i], r, c))) return;
+            }
+            group.rows++;
+            if (valueRange) group.add(cellAt(*values, r, c));
+        };
+        if (driver < criteria.size()) {
+            CellAddress start = ranges[driver].getStart();
+            const Spreadsheet* driverSheet = sheetOf(args[firstPair + 2 * driver]);
+            if (driverSheet) driverSheet->forEachCellInRange(ranges[driver], [&](int row, int col, const Cell& cell) {
+                if (criteria[driver].matches(cell.getResult())) visit(row - start.row, col - start.col);
+            });
+        } else {
+            // Every criterion accepts blanks, so every position is a candidate
+            for (int r = 0; r < rows; ++r) {
+                for (int c = 0; c < cols; ++c) visit(r, c);
+            }
+        }
+    }
+    return result(group);
 }
 
-QVariant FormulaEngine::funcSUMPRODUCT(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
-    std::vector<std::vector<QVariant>> arrays;
+Value FormulaEngine::funcCOUNTBLANK(const std::vector<Value>& args) {
+    long long count = 0;
+    for (const auto& arg : args) {
+        if (arg.isRange()) {
+            long long filled = 0;
+            forEachValue(arg, [&](const Value& v) { if (!isBlank(v)) filled++; });
+            count += rangeSize(*arg.asRange()) - filled;
+        } else if (isBlank(arg)) {
+            count++;
+        }
+    }
+    return Value::number(static_cast<double>(count));
+}
+
+Value FormulaEngine::funcSUMPRODUCT(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
+    // Products are formed a block at a time: the first argument's values
+    // against the product of the rest, then summed by the dot kernel
+    AggregateKernels::Sum sum;
+    std::array<double, 1024> lhs, rhs;
+    size_t n = 0;
+    auto flush = [&]() { AggregateKernels::dot(lhs.data(), rhs.data(), n, sum); n = 0; };
+
+    bool allRanges = std::all_of(args.begin(), args.end(), [](const Value& a) { return a.isRange(); });
+    if (allRanges) {
+        // Walk the stored cells of the first range; a blank there makes the
+        // whole product zero. Other ranges are read at the same row-major index.
+        const CellRange& first = *args[0].asRange();
+        long long len = rangeSize(first);
+        for (const auto& arg : args) {
+            if (rangeSize(*arg.asRange()) != len) return Value::error(ErrorCode::Value);
+        }
+        const Spreadsheet* sheet = sheetOf(args[0]);
+        if (!sheet) return Value::number(0.0);
+        CellAddress start = first.getStart();
+        int cols = first.getColumnCount();
+        sheet->forEachCellInRange(first, [&](int row, int col, const Cell& cell) {
+            long long index = static_cast<long long>(row - start.row) * cols + (col - start.col);
+            double value = toNumber(cell.getResult());
+            double product = 1.0;
+            for (size_t i = 1; i < args.size() && value != 0.0; ++i) {
+                const CellRange& range = *args[i].asRange();
+                int rangeCols = range.getColumnCount();
+                product *= toNumber(cellAt(args[i], static_cast<int>(index / rangeCols), static_cast<int>(index % rangeCols)));
+            }
+            lhs[n] = value; rhs[n] = product;
+            if (++n == lhs.size()) flush();
+        });
+        flush();
+        return Value::number(sum.value());
+    }
+
+    std::vector<std::vector<Value>> arrays;
     for (const auto& arg : args) {
-        if (arg.canConvert<std::vector<QVariant>>()) {
-            arrays.push_back(arg.value<std::vector<QVariant>>());
+        if (arg.isRange()) {
+            arrays.push_back(getRangeValues(arg));
+        } else if (arg.isArray()) {
+            arrays.push_back(arg.asArray()->values);
         } else {
             arrays.push_back({arg});
         }
     }
-    if (arrays.empty()) return 0.0;
     size_t len = arrays[0].size();
     for (const auto& arr : arrays) {
-        if (arr.size() != len) return QVariant("#VALUE!");
+        if (arr.size() != len) return Value::error(ErrorCode::Value);
     }
-    double sum = 0;
     for (size_t i = 0; i < len; ++i) {
         double product = 1.0;
-        for (const auto& arr : arrays) {
-            product *= toNumber(arr[i]);
+        for (size_t a = 1; a < arrays.size(); ++a) {
+            product *= toNumber(arrays[a][i]);
         }
-        sum += product;
+        lhs[n] = toNumber(arrays[0][i]); rhs[n] = product;
+        if (++n == lhs.size()) flush();
     }
-    return sum;
+    flush();
+    return Value::number(sum.value());
 }
 
-QVariant FormulaEngine::funcMEDIAN(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
+Value FormulaEngine::funcMEDIAN(const std::vector<Value>& args) {
     std::vector<double> nums;
-    for (const auto& v : flat) {
-        if (!v.isNull() && v.isValid()) {
-            bool ok; double d = v.toDouble(&ok);
-            if (ok) nums.push_back(d);
-        }
+    auto sorted = sortedValues(args, nums);
+    size_t n = sorted ? sorted->size() : nums.size();
+    if (n == 0) return Value::error(ErrorCode::Num);
+    if (sorted) {
+        return Value::number(n % 2 == 1 ? sorted->at(n / 2) : (sorted->at(n / 2 - 1) + sorted->at(n / 2)) / 2.0);
     }
-    if (nums.empty()) return QVariant("#NUM!");
-    std::sort(nums.begin(), nums.end());
-    size_t n = nums.size();
-    if (n % 2 == 1) return nums[n / 2];
-    return (nums[n / 2 - 1] + nums[n / 2]) / 2.0;
+    // Selection, not a sort: the upper middle lands in place with everything
+    // below it in front, so the lower middle is the largest of those
+    std::nth_element(nums.begin(), nums.begin() + n / 2, nums.end());
+    if (n % 2 == 1) return Value::number(nums[n / 2]);
+    double lower = *std::max_element(nums.begin(), nums.begin() + n / 2);
+    return Value::number((lower + nums[n / 2]) / 2.0);
 }
 
-QVariant FormulaEngine::funcMODE(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
+Value FormulaEngine::funcMODE(const std::vector<Value>& args) {
     std::map<double, int> freq;
-    for (const auto& v : flat) {
-        if (!v.isNull() && v.isValid()) {
-            bool ok; double d = v.toDouble(&ok);
-            if (ok) freq[d]++;
-        }
-    }
-    if (freq.empty()) return QVariant("#N/A");
+    forEachValue(args, [&](const Value& v) {
+        bool ok; double d = v.toNumber(&ok);
+        if (ok) freq[d]++;
+    });
+    if (freq.empty()) return Value::error(ErrorCode::NA);
     int maxCount = 0; double modeVal = 0;
     for (const auto& [val, cnt] : freq) {
         if (cnt > maxCount) { maxCount = cnt; modeVal = val; }
     }
-    if (maxCount <= 1) return QVariant("#N/A");
-    return modeVal;
+    if (maxCount <= 1) return Value::error(ErrorCode::NA);
+    return Value::number(modeVal);
 }
 
-QVariant FormulaEngine::funcSTDEV(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
-    std::vector<double> nums;
-    for (const auto& v : flat) {
-        if (!v.isNull() && v.isValid()) {
-            bool ok; double d = v.toDouble(&ok);
-            if (ok) nums.push_back(d);
-        }
-    }
-    if (nums.size() < 2) return QVariant("#DIV/0!");
-    double mean = std::accumulate(nums.begin(), nums.end(), 0.0) / nums.size();
-    double sq_sum = 0;
-    for (double x : nums) sq_sum += (x - mean) * (x - mean);
-    return std::sqrt(sq_sum / (nums.size() - 1)); // sample std dev
+Value FormulaEngine::funcSTDEV(const std::vector<Value>& args) {
+    AggregateKernels::Moments moments;
+    forEachNumberBlock(args, true, [&](const double* data, size_t n) { moments.add(data, n); });
+    if (moments.count < 2) return Value::error(ErrorCode::Div0);
+    return Value::number(std::sqrt(moments.sampleVariance())); // sample std dev
 }
 
-QVariant FormulaEngine::funcVAR(const std::vector<QVariant>& args) {
-    auto flat = flattenArgs(args);
-    std::vector<double> nums;
-    for (const auto& v : flat) {
-        if (!v.isNull() && v.isValid()) {
-            bool ok; double d = v.toDouble(&ok);
-            if (ok) nums.push_back(d);
-        }
-    }
-    if (nums.size() < 2) return QVariant("#DIV/0!");
-    double mean = std::accumulate(nums.begin(), nums.end(), 0.0) / nums.size();
-    double sq_sum = 0;
-    for (double x : nums) sq_sum += (x - mean) * (x - mean);
-    return sq_sum / (nums.size() - 1); // sample variance
+Value FormulaEngine::funcVAR(const std::vector<Value>& args) {
+    AggregateKernels::Moments moments;
+    forEachNumberBlock(args, true, [&](const double* data, size_t n) { moments.add(data, n); });
+    if (moments.count < 2) return Value::error(ErrorCode::Div0);
+    return Value::number(moments.sampleVariance()); // sample variance
 }
 
-QVariant FormulaEngine::funcLARGE(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    auto flat = flattenArgs({args[0]});
+Value FormulaEngine::funcLARGE(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     int k = static_cast<int>(toNumber(args[1]));
     std::vector<double> nums;
-    for (const auto& v : flat) {
-        bool ok; double d = v.toDouble(&ok);
-        if (ok) nums.push_back(d);
-    }
-    if (k < 1 || k > static_cast<int>(nums.size())) return QVariant("#NUM!");
-    std::sort(nums.rbegin(), nums.rend());
-    return nums[k - 1];
+    auto sorted = sortedValues({args[0]}, nums);
+    size_t n = sorted ? sorted->size() : nums.size();
+    if (k < 1 || static_cast<size_t>(k) > n) return Value::error(ErrorCode::Num);
+    if (sorted) return Value::number(sorted->at(n - k));
+    std::nth_element(nums.begin(), nums.begin() + (n - k), nums.end());
+    return Value::number(nums[n - k]);
 }
 
-QVariant FormulaEngine::funcSMALL(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    auto flat = flattenArgs({args[0]});
+Value FormulaEngine::funcSMALL(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     int k = static_cast<int>(toNumber(args[1]));
     std::vector<double> nums;
-    for (const auto& v : flat) {
-        bool ok; double d = v.toDouble(&ok);
-        if (ok) nums.push_back(d);
-    }
-    if (k < 1 || k > static_cast<int>(nums.size())) return QVariant("#NUM!");
-    std::sort(nums.begin(), nums.end());
-    return nums[k - 1];
-}
-
-QVariant FormulaEngine::funcRANK(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+    auto sorted = sortedValues({args[0]}, nums);
+    size_t n = sorted ? sorted->size() : nums.size();
+    if (k < 1 || static_cast<size_t>(k) > n) return Value::error(ErrorCode::Num);
+    if (sorted) return Value::number(sorted->at(k - 1));
+    std::nth_element(nums.begin(), nums.begin() + (k - 1), nums.end());
+    return Value::number(nums[k - 1]);
+}
+
+// Rank is one more than the number of values ahead of 'number'; ties share
+// the best rank
+Value FormulaEngine::funcRANK(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     double number = toNumber(args[0]);
-    auto flat = flattenArgs({args[1]});
     bool ascending = args.size() >= 3 ? toBoolean(args[2]) : false;
     std::vector<double> nums;
-    for (const auto& v : flat) {
-        bool ok; double d = v.toDouble(&ok);
-        if (ok) nums.push_back(d);
+    if (auto sorted = sortedValues({args[1]}, nums)) {
+        if (!sorted->contains(number)) return Value::error(ErrorCode::NA);
+        size_t ahead = ascending ? sorted->countBelow(number) : sorted->countAbove(number);
+        return Value::number(static_cast<double>(ahead + 1));
     }
-    if (ascending) std::sort(nums.begin(), nums.end());
-    else std::sort(nums.rbegin(), nums.rend());
-    for (size_t i = 0; i < nums.size(); ++i) {
-        if (nums[i] == number) return static_cast<int>(i + 1);
+    size_t ahead = 0;
+    bool found = false;
+    for (double d : nums) {
+        if (d == number) found = true;
+        else if (ascending ? d < number : d > number) ahead++;
     }
-    return QVariant("#N/A");
+    if (!found) return Value::error(ErrorCode::NA);
+    return Value::number(static_cast<double>(ahead + 1));
 }
 
-QVariant FormulaEngine::funcPERCENTILE(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    auto flat = flattenArgs({args[0]});
+Value FormulaEngine::funcPERCENTILE(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     double k = toNumber(args[1]);
-    if (k < 0 || k > 1) return QVariant("#NUM!");
+    if (k < 0 || k > 1) return Value::error(ErrorCode::Num);
     std::vector<double> nums;
-    for (const auto& v : flat) {
-        bool ok; double d = v.toDouble(&ok);
-        if (ok) nums.push_back(d);
+    auto sorted = sortedValues({args[0]}, nums);
+    size_t n = sorted ? sorted->size() : nums.size();
+    if (n == 0) return Value::error(ErrorCode::Num);
+    double idx = k * (n - 1);
+    size_t lower = static_cast<size_t>(std::floor(idx));
+    size_t upper = static_cast<size_t>(std::ceil(idx));
+    double lowerValue, upperValue;
+    if (sorted) {
+        lowerValue = sorted->at(lower);
+        upperValue = sorted->at(upper);
+    } else {
+        std::nth_element(nums.begin(), nums.begin() + lower, nums.end());
+        lowerValue = nums[lower];
+        upperValue = upper == lower ? lowerValue : *std::min_element(nums.begin() + upper, nums.end());
     }
-    if (nums.empty()) return QVariant("#NUM!");
-    std::sort(nums.begin(), nums.end());
-    double idx = k * (nums.size() - 1);
-    int lower = static_cast<int>(std::floor(idx));
-    int upper = static_cast<int>(std::ceil(idx));
-    if (lower == upper) return nums[lower];
+    if (lower == upper) return Value::number(lowerValue);
     double frac = idx - lower;
-    return nums[lower] + frac * (nums[upper] - nums[lower]);
+    return Value::number(lowerValue + frac * (upperValue - lowerValue));
 }
 
 // ---- Additional math functions ----
 
-QVariant FormulaEngine::funcROUNDUP(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcROUNDUP(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
     int decimals = args.size() >= 2 ? static_cast<int>(toNumber(args[1])) : 0;
     double factor = std::pow(10.0, decimals);
-    return (val >= 0) ? std::ceil(val * factor) / factor : std::floor(val * factor) / factor;
+    return Value::number((val >= 0) ? std::ceil(val * factor) / factor : std::floor(val * factor) / factor);
 }
 
-QVariant FormulaEngine::funcROUNDDOWN(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcROUNDDOWN(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
     int decimals = args.size() >= 2 ? static_cast<int>(toNumber(args[1])) : 0;
     double factor = std::pow(10.0, decimals);
-    return (val >= 0) ? std::floor(val * factor) / factor : std::ceil(val * factor) / factor;
+    return Value::number((val >= 0) ? std::floor(val * factor) / factor : std::ceil(val * factor) / factor);
 }
 
-QVariant FormulaEngine::funcLOG(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcLOG(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
-    if (val <= 0) return QVariant("#NUM!");
+    if (val <= 0) return Value::error(ErrorCode::Num);
     double base = args.size() >= 2 ? toNumber(args[1]) : 10.0;
-    if (base <= 0 || base == 1) return QVariant("#NUM!");
-    return std::log(val) / std::log(base);
+    if (base <= 0 || base == 1) return Value::error(ErrorCode::Num);
+    return Value::number(std::log(val) / std::log(base));
 }
 
-QVariant FormulaEngine::funcLN(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcLN(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     double val = toNumber(args[0]);
-    return val <= 0 ? QVariant("#NUM!") : QVariant(std::log(val));
+    return val <= 0 ? Value::error(ErrorCode::Num) : Value::number(std::log(val));
 }
 
-QVariant FormulaEngine::funcEXP(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
-    return std::exp(toNumber(args[0]));
+Value FormulaEngine::funcEXP(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
+    return Value::number(std::exp(toNumber(args[0])));
 }
 
-QVariant FormulaEngine::funcRAND(const std::vector<QVariant>&) {
-    static std::mt19937 gen(std::random_device{}());
-    static std::uniform_real_distribution<double> dist(0.0, 1.0);
-    return dist(gen);
+// Generators are per thread so parallel recalc workers don't share state
+Value FormulaEngine::funcRAND(const std::vector<Value>&) {
+    thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    return Value::number(dist(gen));
 }
 
-QVariant FormulaEngine::funcRANDBETWEEN(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcRANDBETWEEN(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     int low = static_cast<int>(toNumber(args[0]));
     int high = static_cast<int>(toNumber(args[1]));
-    if (low > high) return QVariant("#VALUE!");
-    static std::mt19937 gen(std::random_device{}());
+    if (low > high) return Value::error(ErrorCode::Value);
+    thread_local std::mt19937 gen(std::random_device{}());
     std::uniform_int_distribution<int> dist(low, high);
-    return dist(gen);
+    return Value::number(dist(gen));
 }
 
 // ---- Additional text functions ----
 
-QVariant FormulaEngine::funcPROPER(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcPROPER(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QString str = toString(args[0]).toLower();
     bool capitalizeNext = true;
     for (int i = 0; i < str.length(); ++i) {
@@ -1020,133 +1188,256 @@ QVariant FormulaEngine::funcPROPER(const std::vector<QVariant>& args) {
             capitalizeNext = true;
         }
     }
-    return str;
+    return Value::text(str);
 }
 
-QVariant FormulaEngine::funcSEARCH(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcSEARCH(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     QString search = toString(args[0]).toLower();
     QString text = toString(args[1]).toLower();
     int startPos = args.size() >= 3 ? static_cast<int>(toNumber(args[2])) - 1 : 0;
     int idx = text.indexOf(search, startPos);
-    return idx >= 0 ? QVariant(idx + 1) : QVariant("#VALUE!");
+    return idx >= 0 ? Value::number(idx + 1) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcREPT(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcREPT(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     QString str = toString(args[0]);
     int times = static_cast<int>(toNumber(args[1]));
-    if (times < 0) return QVariant("#VALUE!");
-    return str.repeated(times);
+    if (times < 0) return Value::error(ErrorCode::Value);
+    return Value::text(str.repeated(times));
 }
 
-QVariant FormulaEngine::funcEXACT(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
-    return QVariant(toString(args[0]) == toString(args[1]));
+Value FormulaEngine::funcEXACT(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
+    return Value::boolean(toString(args[0]) == toString(args[1]));
 }
 
-QVariant FormulaEngine::funcVALUE(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcVALUE(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QString str = toString(args[0]).trimmed();
     str.remove(',').remove('$').remove('%').remove(' ');
     bool ok; double d = str.toDouble(&ok);
-    return ok ? QVariant(d) : QVariant("#VALUE!");
+    return ok ? Value::number(d) : Value::error(ErrorCode::Value);
 }
 
 // ---- Additional logical/info functions ----
 
-QVariant FormulaEngine::funcISBLANK(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant(true);
-    return QVariant(args[0].isNull() || !args[0].isValid() || args[0].toString().isEmpty());
+Value FormulaEngine::funcISBLANK(const std::vector<Value>& args) {
+    if (args.empty()) return Value::boolean(true);
+    return Value::boolean(isBlank(args[0].isRange() ? cellAt(args[0], 0, 0) : args[0]));
 }
 
-QVariant FormulaEngine::funcISERROR(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant(false);
-    return QVariant(toString(args[0]).startsWith('#'));
+Value FormulaEngine::funcISERROR(const std::vector<Value>& args) {
+    if (args.empty()) return Value::boolean(false);
+    return Value::boolean(args[0].isError());
 }
 
-QVariant FormulaEngine::funcISNUMBER(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant(false);
-    bool ok; args[0].toDouble(&ok);
-    return QVariant(ok || args[0].typeId() == QMetaType::Int || args[0].typeId() == QMetaType::Double);
+Value FormulaEngine::funcISNUMBER(const std::vector<Value>& args) {
+    if (args.empty()) return Value::boolean(false);
+    bool ok; args[0].toNumber(&ok);
+    return Value::boolean(ok);
 }
 
-QVariant FormulaEngine::funcISTEXT(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant(false);
-    if (args[0].isNull() || !args[0].isValid()) return QVariant(false);
-    bool ok; args[0].toDouble(&ok);
-    return QVariant(!ok && args[0].typeId() != QMetaType::Bool);
+Value FormulaEngine::funcISTEXT(const std::vector<Value>& args) {
+    if (args.empty()) return Value::boolean(false);
+    if (!args[0].isText()) return Value::boolean(false);
+    bool ok; args[0].toNumber(&ok);
+    return Value::boolean(!ok);
 }
 
-QVariant FormulaEngine::funcCHOOSE(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcCHOOSE(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     int idx = static_cast<int>(toNumber(args[0]));
-    if (idx < 1 || idx >= static_cast<int>(args.size())) return QVariant("#VALUE!");
+    if (idx < 1 || idx >= static_cast<int>(args.size())) return Value::error(ErrorCode::Value);
     return args[idx];
 }
 
-QVariant FormulaEngine::funcSWITCH(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
-    QVariant expr = args[0];
+Value FormulaEngine::funcSWITCH(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
+    Value expr = args[0];
     // SWITCH(expr, val1, result1, val2, result2, ..., [default])
     for (size_t i = 1; i + 1 < args.size(); i += 2) {
         if (toString(expr) == toString(args[i])) return args[i + 1];
     }
     // If odd number of remaining args, last is default
     if (args.size() % 2 == 0) return args.back();
-    return QVariant("#N/A");
+    return Value::error(ErrorCode::NA);
+}
+
+// ---- Array functions ----
+
+// FILTER(array, include, [if_empty]): the rows of array whose include value
+// is true, or its columns when include is a single row
+Value FormulaEngine::funcFILTER(const std::vector<Value>& args) {
+    const ValueArray& source = arrayOf(args[0]);
+    const ValueArray& include = arrayOf(args[1]);
+    bool byRow = include.cols == 1 && include.rows == source.rows;
+    if (!byRow && !(include.rows == 1 && include.cols == source.cols)) return Value::error(ErrorCode::Value);
+
+    std::vector<int> kept;
+    for (size_t i = 0; i < include.values.size(); ++i) {
+        if (include.values[i].isError()) return include.values[i];
+        if (toBoolean(include.values[i])) kept.push_back(static_cast<int>(i));
+    }
+    if (kept.empty()) return args.size() > 2 ? args[2] : Value::error(ErrorCode::Value);
+
+    ValueArray out;
+    out.rows = byRow ? static_cast<int>(kept.size()) : source.rows;
+    out.cols = byRow ? source.cols : static_cast<int>(kept.size());
+    out.values.reserve(static_cast<size_t>(out.rows) * out.cols);
+    for (int row = 0; row < out.rows; ++row) {
+        for (int col = 0; col < out.cols; ++col) {
+            out.values.push_back(byRow ? source.at(kept[row], col) : source.at(row, kept[col]));
+        }
+    }
+    return makeArray(std::move(out));
+}
+
+// Sort order of SORT: numbers, then text (case-insensitive), booleans, errors
+static int compareForSort(const Value& a, const Value& b) {
+    auto rank = [](const Value& v) {
+        switch (v.type()) {
+            case Value::Type::Number: return 0;
+            case Value::Type::Text: return 1;
+            case Value::Type::Boolean: return 2;
+            default: return 3;
+        }
+    };
+    if (rank(a) != rank(b)) return rank(a) < rank(b) ? -1 : 1;
+    if (a.isNumber()) return a.asNumber() < b.asNumber() ? -1 : (a.asNumber() > b.asNumber() ? 1 : 0);
+    if (a.isText()) return a.toString().compare(b.toString(), Qt::CaseInsensitive);
+    if (a.isBoolean()) return static_cast<int>(a.asBoolean()) - static_cast<int>(b.asBoolean());
+    return 0;
+}
+
+// SORT(array, [sort_index], [sort_order], [by_col]): rows ordered by column
+// sort_index, ascending (1) or descending (-1); blanks go last either way
+Value FormulaEngine::funcSORT(const std::vector<Value>& args) {
+    const ValueArray& source = arrayOf(args[0]);
+    int index = args.size() > 1 && !args[1].isEmpty() ? static_cast<int>(toNumber(args[1])) : 1;
+    int order = args.size() > 2 && !args[2].isEmpty() ? static_cast<int>(toNumber(args[2])) : 1;
+    bool byCol = args.size() > 3 && toBoolean(args[3]);
+    if (index < 1 || index > (byCol ? source.rows : source.cols) || (order != 1 && order != -1)) {
+        return Value::error(ErrorCode::Value);
+    }
+
+    std::vector<int> lines(byCol ? source.cols : source.rows);
+    std::iota(lines.begin(), lines.end(), 0);
+    auto key = [&](int line) -> const Value& {
+        return byCol ? source.at(index - 1, line) : source.at(line, index - 1);
+    };
+    std::stable_sort(lines.begin(), lines.end(), [&](int x, int y) {
+        const Value& a = key(x);
+        const Value& b = key(y);
+        if (a.isEmpty() || b.isEmpty()) return !a.isEmpty() && b.isEmpty();
+        int cmp = compareForSort(a, b);
+        return order > 0 ? cmp < 0 : cmp > 0;
+    });
+
+    ValueArray out;
+    out.rows = source.rows;
+    out.cols = source.cols;
+    out.values.reserve(source.values.size());
+    for (int row = 0; row < out.rows; ++row) {
+        for (int col = 0; col < out.cols; ++col) {
+            out.values.push_back(byCol ? source.at(row, lines[col]) : source.at(lines[row], col));
+        }
+    }
+    return makeArray(std::move(out));
+}
+
+// UNIQUE(array, [by_col], [exactly_once]): distinct rows (or columns) in
+// order of first appearance, text compared case-insensitively; with
+// exactly_once only those that appear once
+Value FormulaEngine::funcUNIQUE(const std::vector<Value>& args) {
+    const ValueArray& source = arrayOf(args[0]);
+    bool byCol = args.size() > 1 && toBoolean(args[1]);
+    bool exactlyOnce = args.size() > 2 && toBoolean(args[2]);
+    int lineCount = byCol ? source.cols : source.rows;
+    int lineLength = byCol ? source.rows : source.cols;
+
+    QHash<QString, int> seen;  // line key -> occurrences
+    std::vector<std::pair<QString, int>> firsts;
+    for (int line = 0; line < lineCount; ++line) {
+        QString key;
+        for (int i = 0; i < lineLength; ++i) {
+            const Value& v = byCol ? source.at(i, line) : source.at(line, i);
+            key += QChar(static_cast<char16_t>('0' + static_cast<int>(v.type())));
+            key += v.toString().toLower();
+            key += QChar(0x1F);
+        }
+        if (seen[key]++ == 0) firsts.emplace_back(key, line);
+    }
+
+    std::vector<int> kept;
+    for (const auto& [key, line] : firsts) {
+        if (!exactlyOnce || seen.value(key) == 1) kept.push_back(line);
+    }
+    if (kept.empty()) return Value::error(ErrorCode::Value);
+
+    ValueArray out;
+    out.rows = byCol ? source.rows : static_cast<int>(kept.size());
+    out.cols = byCol ? static_cast<int>(kept.size()) : source.cols;
+    out.values.reserve(static_cast<size_t>(out.rows) * out.cols);
+    for (int row = 0; row < out.rows; ++row) {
+        for (int col = 0; col < out.cols; ++col) {
+            out.values.push_back(byCol ? source.at(row, kept[col]) : source.at(kept[row], col));
+        }
+    }
+    return makeArray(std::move(out));
 }
 
 // ---- Additional date functions ----
 
-QVariant FormulaEngine::funcDATE(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
+Value FormulaEngine::funcDATE(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
     int year = static_cast<int>(toNumber(args[0]));
     int month = static_cast<int>(toNumber(args[1]));
     int day = static_cast<int>(toNumber(args[2]));
     QDate date(year, month, day);
-    return date.isValid() ? QVariant(date.toString("yyyy-MM-dd")) : QVariant("#VALUE!");
+    return date.isValid() ? Value::text(date.toString("yyyy-MM-dd")) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcHOUR(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcHOUR(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDateTime dt = QDateTime::fromString(toString(args[0]), "yyyy-MM-dd hh:mm:ss");
     if (!dt.isValid()) dt = QDateTime::fromString(toString(args[0]), "hh:mm:ss");
-    return dt.isValid() ? QVariant(dt.time().hour()) : QVariant("#VALUE!");
+    return dt.isValid() ? Value::number(dt.time().hour()) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcMINUTE(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcMINUTE(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDateTime dt = QDateTime::fromString(toString(args[0]), "yyyy-MM-dd hh:mm:ss");
     if (!dt.isValid()) dt = QDateTime::fromString(toString(args[0]), "hh:mm:ss");
-    return dt.isValid() ? QVariant(dt.time().minute()) : QVariant("#VALUE!");
+    return dt.isValid() ? Value::number(dt.time().minute()) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcSECOND(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcSECOND(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDateTime dt = QDateTime::fromString(toString(args[0]), "yyyy-MM-dd hh:mm:ss");
     if (!dt.isValid()) dt = QDateTime::fromString(toString(args[0]), "hh:mm:ss");
-    return dt.isValid() ? QVariant(dt.time().second()) : QVariant("#VALUE!");
+    return dt.isValid() ? Value::number(dt.time().second()) : Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcDATEDIF(const std::vector<QVariant>& args) {
-    if (args.size() < 3) return QVariant("#VALUE!");
+Value FormulaEngine::funcDATEDIF(const std::vector<Value>& args) {
+    if (args.size() < 3) return Value::error(ErrorCode::Value);
     QDate start = parseDate(args[0]);
     QDate end = parseDate(args[1]);
     QString unit = toString(args[2]).toUpper();
-    if (!start.isValid() || !end.isValid()) return QVariant("#VALUE!");
-    if (start > end) return QVariant("#NUM!");
-    if (unit == "D") return static_cast<int>(start.daysTo(end));
-    if (unit == "M") return (end.year() - start.year()) * 12 + end.month() - start.month();
-    if (unit == "Y") return end.year() - start.year() - (end < QDate(end.year(), start.month(), start.day()) ? 1 : 0);
-    return QVariant("#VALUE!");
+    if (!start.isValid() || !end.isValid()) return Value::error(ErrorCode::Value);
+    if (start > end) return Value::error(ErrorCode::Num);
+    if (unit == "D") return Value::number(static_cast<int>(start.daysTo(end)));
+    if (unit == "M") return Value::number((end.year() - start.year()) * 12 + end.month() - start.month());
+    if (unit == "Y") return Value::number(end.year() - start.year() - (end < QDate(end.year(), start.month(), start.day()) ? 1 : 0));
+    return Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcNETWORKDAYS(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcNETWORKDAYS(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     QDate start = parseDate(args[0]);
     QDate end = parseDate(args[1]);
-    if (!start.isValid() || !end.isValid()) return QVariant("#VALUE!");
+    if (!start.isValid() || !end.isValid()) return Value::error(ErrorCode::Value);
     int sign = 1;
     if (start > end) { std::swap(start, end); sign = -1; }
     int days = 0;
@@ -1156,42 +1447,42 @@ QVariant FormulaEngine::funcNETWORKDAYS(const std::vector<QVariant>& args) {
         if (dow != 6 && dow != 7) days++;
         d = d.addDays(1);
     }
-    return days * sign;
+    return Value::number(days * sign);
 }
 
-QVariant FormulaEngine::funcWEEKDAY(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcWEEKDAY(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDate date = parseDate(args[0]);
-    if (!date.isValid()) return QVariant("#VALUE!");
+    if (!date.isValid()) return Value::error(ErrorCode::Value);
     int returnType = args.size() >= 2 ? static_cast<int>(toNumber(args[1])) : 1;
     int dow = date.dayOfWeek(); // Qt: 1=Mon..7=Sun
-    if (returnType == 1) return (dow % 7) + 1; // 1=Sun..7=Sat
-    if (returnType == 2) return dow;             // 1=Mon..7=Sun
-    if (returnType == 3) return dow - 1;         // 0=Mon..6=Sun
-    return QVariant("#VALUE!");
+    if (returnType == 1) return Value::number((dow % 7) + 1); // 1=Sun..7=Sat
+    if (returnType == 2) return Value::number(dow);             // 1=Mon..7=Sun
+    if (returnType == 3) return Value::number(dow - 1);         // 0=Mon..6=Sun
+    return Value::error(ErrorCode::Value);
 }
 
-QVariant FormulaEngine::funcEDATE(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcEDATE(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     QDate date = parseDate(args[0]);
-    if (!date.isValid()) return QVariant("#VALUE!");
+    if (!date.isValid()) return Value::error(ErrorCode::Value);
     int months = static_cast<int>(toNumber(args[1]));
-    return date.addMonths(months).toString("yyyy-MM-dd");
+    return Value::text(date.addMonths(months).toString("yyyy-MM-dd"));
 }
 
-QVariant FormulaEngine::funcEOMONTH(const std::vector<QVariant>& args) {
-    if (args.size() < 2) return QVariant("#VALUE!");
+Value FormulaEngine::funcEOMONTH(const std::vector<Value>& args) {
+    if (args.size() < 2) return Value::error(ErrorCode::Value);
     QDate date = parseDate(args[0]);
-    if (!date.isValid()) return QVariant("#VALUE!");
+    if (!date.isValid()) return Value::error(ErrorCode::Value);
     int months = static_cast<int>(toNumber(args[1]));
     QDate result = date.addMonths(months);
     result = QDate(result.year(), result.month(), result.daysInMonth());
-    return result.toString("yyyy-MM-dd");
+    return Value::text(result.toString("yyyy-MM-dd"));
 }
 
-QVariant FormulaEngine::funcDATEVALUE(const std::vector<QVariant>& args) {
-    if (args.empty()) return QVariant("#VALUE!");
+Value FormulaEngine::funcDATEVALUE(const std::vector<Value>& args) {
+    if (args.empty()) return Value::error(ErrorCode::Value);
     QDate date = parseDate(args[0]);
-    if (!date.isValid()) return QVariant("#VALUE!");
-    return date.toString("yyyy-MM-dd");
+    if (!date.isValid()) return Value::error(ErrorCode::Value);
+    return Value::text(date.toString("yyyy-MM-dd"));
 }
@@ -2,20 +2,26 @@
 #define FORMULAENGINE_H
 
 #include <QString>
-#include <QVariant>
 #include <unordered_map>
 #include <memory>
 #include <functional>
 #include "CellRange.h"
+#include "FormulaAST.h"
+#include "Value.h"
 
 class Spreadsheet;
+class SortedValues;
 
 class FormulaEngine {
 public:
     explicit FormulaEngine(Spreadsheet* spreadsheet = nullptr);
     ~FormulaEngine() = default;
 
-    QVariant evaluate(const QString& formula);
+    Value evaluate(const QString& formula);
+    // at is the cell the formula belongs to; its references are relative to
+    // it. Text in the result is held until the next evaluate(): keep it by
+    // storing it in a cell (or another HeldValue).
+    Value evaluate(const CompiledFormula& formula, const CellAddress& at);
     void setSpreadsheet(Spreadsheet* spreadsheet);
 
     void clearCache();
@@ -24,141 +30,183 @@ public:
     QString getLastError() const;
     bool hasError() const;
 
-    // Get cell references found during last evaluation
-    const std::vector<CellAddress>& getLastDependencies() const { return m_lastDependencies; }
+    // When the last evaluation produced an array (=B2:B9*C2:C9, FILTER, or a
+    // bare range of more than one cell), evaluate() returned its top-left
+    // value and the whole array is taken from here for spilling; else null
+    std::shared_ptr<const ValueArray> takeArrayResult() { return std::move(m_arrayResult); }
 
 private:
+    // The function table points at the func* implementations below
+    friend class FormulaFunctions;
+
     Spreadsheet* m_spreadsheet;
     QString m_lastError;
-    std::unordered_map<std::string, QVariant> m_cache;
-    std::vector<CellAddress> m_lastDependencies;
-
-    // Parser hierarchy
-    QVariant parseExpression(const QString& expr);
-    QVariant evaluateComparison(const QString& expr, int& pos);
-    QVariant evaluateTerm(const QString& expr, int& pos);
-    QVariant evaluateMultiplicative(const QString& expr, int& pos);
-    QVariant evaluateUnary(const QString& expr, int& pos);
-    QVariant evaluatePower(const QString& expr, int& pos);
-    QVariant evaluateFactor(const QString& expr, int& pos);
-
-    QVariant evaluateFunction(const QString& funcName, const std::vector<QVariant>& args);
+    std::unordered_map<std::string, Value> m_cache;
+    CellAddress m_at;                  // cell being evaluated
+    std::vector<CellRange> m_ranges;   // its range references, resolved
+    std::vector<const Spreadsheet*> m_sheets;  // its sheetNames(), resolved (nullptr: no such sheet)
+    std::vector<std::shared_ptr<ValueArray>> m_arrays;  // arrays built while evaluating it
+    std::shared_ptr<const ValueArray> m_arrayResult;
+    StringPool::Refs m_texts;  // strings interned while evaluating it
+
+    // Compiled formula evaluation
+    Value evaluateNode(const CompiledFormula& formula, int index);
+    Value binaryOp(FormulaOp op, const Value& left, const Value& right);
+    // Operators with a range or array operand, element by element
+    Value elementwise(FormulaOp op, const Value& left, const Value& right);
 
     // Aggregate functions
-    QVariant funcSUM(const std::vector<QVariant>& args);
-    QVariant funcAVERAGE(const std::vector<QVariant>& args);
-    QVariant funcCOUNT(const std::vector<QVariant>& args);
-    QVariant funcCOUNTA(const std::vector<QVariant>& args);
-    QVariant funcMIN(const std::vector<QVariant>& args);
-    QVariant funcMAX(const std::vector<QVariant>& args);
-    QVariant funcIF(const std::vector<QVariant>& args);
-    QVariant funcCONCAT(const std::vector<QVariant>& args);
-    QVariant funcLEN(const std::vector<QVariant>& args);
-    QVariant funcUPPER(const std::vector<QVariant>& args);
-    QVariant funcLOWER(const std::vector<QVariant>& args);
-    QVariant funcTRIM(const std::vector<QVariant>& args);
+    Value funcSUM(const std::vector<Value>& args);
+    Value funcAVERAGE(const std::vector<Value>& args);
+    Value funcCOUNT(const std::vector<Value>& args);
+    Value funcCOUNTA(const std::vector<Value>& args);
+    Value funcMIN(const std::vector<Value>& args);
+    Value funcMAX(const std::vector<Value>& args);
+    Value funcIF(const std::vector<Value>& args);
+    Value funcCONCAT(const std::vector<Value>& args);
+    Value funcLEN(const std::vector<Value>& args);
+    Value funcUPPER(const std::vector<Value>& args);
+    Value funcLOWER(const std::vector<Value>& args);
+    Value funcTRIM(const std::vector<Value>& args);
 
     // Math functions
-    QVariant funcROUND(const std::vector<QVariant>& args);
-    QVariant funcABS(const std::vector<QVariant>& args);
-    QVariant funcSQRT(const std::vector<QVariant>& args);
-    QVariant funcPOWER(const std::vector<QVariant>& args);
-    QVariant funcMOD(const std::vector<QVariant>& args);
-    QVariant funcINT(const std::vector<QVariant>& args);
-    QVariant funcCEILING(const std::vector<QVariant>& args);
-    QVariant funcFLOOR(const std::vector<QVariant>& args);
+    Value funcROUND(const std::vector<Value>& args);
+    Value funcABS(const std::vector<Value>& args);
+    Value funcSQRT(const std::vector<Value>& args);
+    Value funcPOWER(const std::vector<Value>& args);
+    Value funcMOD(const std::vector<Value>& args);
+    Value funcINT(const std::vector<Value>& args);
+    Value funcCEILING(const std::vector<Value>& args);
+    Value funcFLOOR(const std::vector<Value>& args);
 
     // Logical functions
-    QVariant funcAND(const std::vector<QVariant>& args);
-    QVariant funcOR(const std::vector<QVariant>& args);
-    QVariant funcNOT(const std::vector<QVariant>& args);
-    QVariant funcIFERROR(const std::vector<QVariant>& args);
+    Value funcAND(const std::vector<Value>& args);
+    Value funcOR(const std::vector<Value>& args);
+    Value funcNOT(const std::vector<Value>& args);
+    Value funcIFERROR(const std::vector<Value>& args);
 
     // Text functions
-    QVariant funcLEFT(const std::vector<QVariant>& args);
-    QVariant funcRIGHT(const std::vector<QVariant>& args);
-    QVariant funcMID(const std::vector<QVariant>& args);
-    QVariant funcFIND(const std::vector<QVariant>& args);
-    QVariant funcSUBSTITUTE(const std::vector<QVariant>& args);
-    QVariant funcTEXT(const std::vector<QVariant>& args);
+    Value funcLEFT(const std::vector<Value>& args);
+    Value funcRIGHT(const std::vector<Value>& args);
+    Value funcMID(const std::vector<Value>& args);
+    Value funcFIND(const std::vector<Value>& args);
+    Value funcSUBSTITUTE(const std::vector<Value>& args);
+    Value funcTEXT(const std::vector<Value>& args);
 
     // Statistical functions
-    QVariant funcCOUNTIF(const std::vector<QVariant>& args);
-    QVariant funcSUMIF(const std::vector<QVariant>& args);
-    QVariant funcAVERAGEIF(const std::vector<QVariant>& args);
-    QVariant funcCOUNTBLANK(const std::vector<QVariant>& args);
-    QVariant funcSUMPRODUCT(const std::vector<QVariant>& args);
-    QVariant funcMEDIAN(const std::vector<QVariant>& args);
-    QVariant funcMODE(const std::vector<QVariant>& args);
-    QVariant funcSTDEV(const std::vector<QVariant>& args);
-    QVariant funcVAR(const std::vector<QVariant>& args);
-    QVariant funcLARGE(const std::vector<QVariant>& args);
-    QVariant funcSMALL(const std::vector<QVariant>& args);
-    QVariant funcRANK(const std::vector<QVariant>& args);
-    QVariant funcPERCENTILE(const std::vector<QVariant>& args);
+    Value funcCOUNTIF(const std::vector<Value>& args);
+    Value funcSUMIF(const std::vector<Value>& args);
+    Value funcAVERAGEIF(const std::vector<Value>& args);
+    Value funcCOUNTBLANK(const std::vector<Value>& args);
+    Value funcSUMPRODUCT(const std::vector<Value>& args);
+    Value funcMEDIAN(const std::vector<Value>& args);
+    Value funcMODE(const std::vector<Value>& args);
+    Value funcSTDEV(const std::vector<Value>& args);
+    Value funcVAR(const std::vector<Value>& args);
+    Value funcLARGE(const std::vector<Value>& args);
+    Value funcSMALL(const std::vector<Value>& args);
+    Value funcRANK(const std::vector<Value>& args);
+    Value funcPERCENTILE(const std::vector<Value>& args);
+    Value funcSUMIFS(const std::vector<Value>& args);
+    Value funcCOUNTIFS(const std::vector<Value>& args);
+    Value funcAVERAGEIFS(const std::vector<Value>& args);
+    Value funcMAXIFS(const std::vector<Value>& args);
+    Value funcMINIFS(const std::vector<Value>& args);
 
     // Date functions
-    QVariant funcNOW(const std::vector<QVariant>& args);
-    QVariant funcTODAY(const std::vector<QVariant>& args);
-    QVariant funcYEAR(const std::vector<QVariant>& args);
-    QVariant funcMONTH(const std::vector<QVariant>& args);
-    QVariant funcDAY(const std::vector<QVariant>& args);
-    QVariant funcDATE(const std::vector<QVariant>& args);
-    QVariant funcHOUR(const std::vector<QVariant>& args);
-    QVariant funcMINUTE(const std::vector<QVariant>& args);
-    QVariant funcSECOND(const std::vector<QVariant>& args);
-    QVariant funcDATEDIF(const std::vector<QVariant>& args);
-    QVariant funcNETWORKDAYS(const std::vector<QVariant>& args);
-    QVariant funcWEEKDAY(const std::vector<QVariant>& args);
-    QVariant funcEDATE(const std::vector<QVariant>& args);
-    QVariant funcEOMONTH(const std::vector<QVariant>& args);
-    QVariant funcDATEVALUE(const std::vector<QVariant>& args);
+    Value funcNOW(const std::vector<Value>& args);
+    Value funcTODAY(const std::vector<Value>& args);
+    Value funcYEAR(const std::vector<Value>& args);
+    Value funcMONTH(const std::vector<Value>& args);
+    Value funcDAY(const std::vector<Value>& args);
+    Value funcDATE(const std::vector<Value>& args);
+    Value funcHOUR(const std::vector<Value>& args);
+    Value funcMINUTE(const std::vector<Value>& args);
+    Value funcSECOND(const std::vector<Value>& args);
+    Value funcDATEDIF(const std::vector<Value>& args);
+    Value funcNETWORKDAYS(const std::vector<Value>& args);
+    Value funcWEEKDAY(const std::vector<Value>& args);
+    Value funcEDATE(const std::vector<Value>& args);
+    Value funcEOMONTH(const std::vector<Value>& args);
+    Value funcDATEVALUE(const std::vector<Value>& args);
 
     // Lookup functions
-    QVariant funcVLOOKUP(const std::vector<QVariant>& args);
-    QVariant funcHLOOKUP(const std::vector<QVariant>& args);
-    QVariant funcXLOOKUP(const std::vector<QVariant>& args);
-    QVariant funcINDEX(const std::vector<QVariant>& args);
-    QVariant funcMATCH(const std::vector<QVariant>& args);
+    Value funcVLOOKUP(const std::vector<Value>& args);
+    Value funcHLOOKUP(const std::vector<Value>& args);
+    Value funcXLOOKUP(const std::vector<Value>& args);
+    Value funcINDEX(const std::vector<Value>& args);
+    Value funcMATCH(const std::vector<Value>& args);
 
     // Additional math functions
-    QVariant funcROUNDUP(const std::vector<QVariant>& args);
-    QVariant funcROUNDDOWN(const std::vector<QVariant>& args);
-    QVariant funcLOG(const std::vector<QVariant>& args);
-    QVariant funcLN(const std::vector<QVariant>& args);
-    QVariant funcEXP(const std::vector<QVariant>& args);
-    QVariant funcRAND(const std::vector<QVariant>& args);
-    QVariant funcRANDBETWEEN(const std::vector<QVariant>& args);
+    Value funcROUNDUP(const std::vector<Value>& args);
+    Value funcROUNDDOWN(const std::vector<Value>& args);
+    Value funcLOG(const std::vector<Value>& args);
+    Value funcLN(const std::vector<Value>& args);
+    Value funcEXP(const std::vector<Value>& args);
+    Value funcRAND(const std::vector<Value>& args);
+    Value funcRANDBETWEEN(const std::vector<Value>& args);
 
     // Additional text functions
-    QVariant funcPROPER(const std::vector<QVariant>& args);
-    QVariant funcSEARCH(const std::vector<QVariant>& args);
-    QVariant funcREPT(const std::vector<QVariant>& args);
-    QVariant funcEXACT(const std::vector<QVariant>& args);
-    QVariant funcVALUE(const std::vector<QVariant>& args);
+    Value funcPROPER(const std::vector<Value>& args);
+    Value funcSEARCH(const std::vector<Value>& args);
+    Value funcREPT(const std::vector<Value>& args);
+    Value funcEXACT(const std::vector<Value>& args);
+    Value funcVALUE(const std::vector<Value>& args);
 
     // Additional logical/info functions
-    QVariant funcISBLANK(const std::vector<QVariant>& args);
-    QVariant funcISERROR(const std::vector<QVariant>& args);
-    QVariant funcISNUMBER(const std::vector<QVariant>& args);
-    QVariant funcISTEXT(const std::vector<QVariant>& args);
-    QVariant funcCHOOSE(const std::vector<QVariant>& args);
-    QVariant funcSWITCH(const std::vector<QVariant>& args);
+    Value funcISBLANK(const std::vector<Value>& args);
+    Value funcISERROR(const std::vector<Value>& args);
+    Value funcISNUMBER(const std::vector<Value>& args);
+    Value funcISTEXT(const std::vector<Value>& args);
+    Value funcCHOOSE(const std::vector<Value>& args);
+    Value funcSWITCH(const std::vector<Value>& args);
+
+    // Array functions (results spill)
+    Value funcFILTER(const std::vector<Value>& args);
+    Value funcSORT(const std::vector<Value>& args);
+    Value funcUNIQUE(const std::vector<Value>& args);
 
     // Helpers
-    double toNumber(const QVariant& value);
-    QString toString(const QVariant& value);
-    bool toBoolean(const QVariant& value);
-    QVariant getCellValue(const CellAddress& addr);
-    std::vector<QVariant> getRangeValues(const CellRange& range);
-    std::vector<std::vector<QVariant>> getRangeValues2D(const CellRange& range);
-    std::vector<QVariant> flattenArgs(const std::vector<QVariant>& args);
-    void skipWhitespace(const QString& expr, int& pos);
-    bool matchesCriteria(const QVariant& value, const QString& criteria);
-    QDate parseDate(const QVariant& value);
-
-    // Range tracking for lookup functions
-    std::vector<CellRange> m_lastRangeArgs;
+    double toNumber(const Value& value) { return value.toNumber(); }
+    QString toString(const Value& value) { return value.toString(); }
+    bool toBoolean(const Value& value) { return value.toBoolean(); }
+    Value getCellValue(const CellAddress& addr);
+    // The sheet a range argument lies on (Value::rangeSheet() slot)
+    const Spreadsheet* sheetOf(const Value& range) const {
+        return range.rangeSheet() ? m_sheets[range.rangeSheet() - 1] : m_spreadsheet;
+    }
+    std::vector<Value> getRangeValues(const Value& range);
+    // Any value as an array: ranges are read, scalars are 1x1. The result
+    // lives until the next evaluate().
+    const ValueArray& arrayOf(const Value& value);
+    Value makeArray(ValueArray array);
+    std::vector<Value> flattenArgs(const std::vector<Value>& args);
+    QDate parseDate(const Value& value);
+
+    // Range arguments are read in place: only stored cells are visited and
+    // nothing is copied. Blank cells are never passed to fn.
+    template <typename Fn> void forEachValue(const Value& arg, Fn&& fn);
+    template <typename Fn> void forEachValue(const std::vector<Value>& args, Fn&& fn);
+    // Numbers of args handed to fn(const double*, size_t) in contiguous
+    // blocks for AggregateKernels. Values that don't parse as numbers count
+    // as 0, or are dropped when numericOnly.
+    template <typename Fn> void forEachNumberBlock(const std::vector<Value>& args, bool numericOnly, Fn&& fn);
+    // Passes each range argument the sheet keeps a RangeAggregate for to fn
+    // and returns the other arguments, which still have to be scanned
+    template <typename Fn> std::vector<Value> takeAggregatedRanges(const std::vector<Value>& args, Fn&& fn);
+    Value cellAt(const Value& range, int rowOffset, int colOffset);
+    // Order statistics (MEDIAN, LARGE, SMALL, RANK, PERCENTILE) over one
+    // large range read the sheet's cached SortedValues; otherwise the numbers
+    // are collected into 'numbers' for a one-off selection and null returned
+    std::shared_ptr<const SortedValues> sortedValues(const std::vector<Value>& args, std::vector<double>& numbers);
+
+    // Shared body of COUNTIF(S)/SUMIF(S)/AVERAGEIF(S)/MAXIFS/MINIFS.
+    // args[firstPair..] are (range, criteria) pairs; valueRange is null for
+    // counts. Equality-only criteria are answered from a cached
+    // ConditionalIndex, anything else by one scan driven by a criteria
+    // range that can't match blanks.
+    enum class ConditionalOp { Count, Sum, Average, Max, Min };
+    Value conditionalAggregate(ConditionalOp op, const Value* valueRange, const std::vector<Value>& args, size_t firstPair);
 };
 
 #endif // FORMULAENGINE_H
@@ -0,0 +1,132 @@
+#include "FormulaFunctions.h"
+#include "FormulaEngine.h"
+#include <QHash>
+#include <algorithm>
+#include <iterator>
+
+static constexpr int kMany = FunctionInfo::kVariadic;
+
+// Argument counts follow Excel; optional trailing arguments the
+// implementation doesn't read yet are accepted and ignored.
+const FunctionInfo FormulaFunctions::s_functions[] = {
+    // Aggregate
+    {"SUM", 1, kMany, false, &FormulaEngine::funcSUM},
+    {"AVERAGE", 1, kMany, false, &FormulaEngine::funcAVERAGE},
+    {"COUNT", 1, kMany, false, &FormulaEngine::funcCOUNT},
+    {"COUNTA", 1, kMany, false, &FormulaEngine::funcCOUNTA},
+    {"MIN", 1, kMany, false, &FormulaEngine::funcMIN},
+    {"MAX", 1, kMany, false, &FormulaEngine::funcMAX},
+    {"IF", 2, 3, false, &FormulaEngine::funcIF},
+    {"CONCAT", 1, kMany, false, &FormulaEngine::funcCONCAT},
+    {"CONCATENATE", 1, kMany, false, &FormulaEngine::funcCONCAT},
+    {"LEN", 1, 1, false, &FormulaEngine::funcLEN},
+    {"UPPER", 1, 1, false, &FormulaEngine::funcUPPER},
+    {"LOWER", 1, 1, false, &FormulaEngine::funcLOWER},
+    {"TRIM", 1, 1, false, &FormulaEngine::funcTRIM},
+    // Math
+    {"ROUND", 1, 2, false, &FormulaEngine::funcROUND},
+    {"ABS", 1, 1, false, &FormulaEngine::funcABS},
+    {"SQRT", 1, 1, false, &FormulaEngine::funcSQRT},
+    {"POWER", 2, 2, false, &FormulaEngine::funcPOWER},
+    {"MOD", 2, 2, false, &FormulaEngine::funcMOD},
+    {"INT", 1, 1, false, &FormulaEngine::funcINT},
+    {"CEILING", 1, 2, false, &FormulaEngine::funcCEILING},
+    {"FLOOR", 1, 2, false, &FormulaEngine::funcFLOOR},
+    // Logical
+    {"AND", 1, kMany, false, &FormulaEngine::funcAND},
+    {"OR", 1, kMany, false, &FormulaEngine::funcOR},
+    {"NOT", 1, 1, false, &FormulaEngine::funcNOT},
+    {"IFERROR", 2, 2, false, &FormulaEngine::funcIFERROR},
+    // Text
+    {"LEFT", 1, 2, false, &FormulaEngine::funcLEFT},
+    {"RIGHT", 1, 2, false, &FormulaEngine::funcRIGHT},
+    {"MID", 3, 3, false, &FormulaEngine::funcMID},
+    {"FIND", 2, 3, false, &FormulaEngine::funcFIND},
+    {"SUBSTITUTE", 3, 4, false, &FormulaEngine::funcSUBSTITUTE},
+    {"TEXT", 2, 2, false, &FormulaEngine::funcTEXT},
+    // Statistical
+    {"COUNTIF", 2, 2, false, &FormulaEngine::funcCOUNTIF},
+    {"SUMIF", 2, 3, false, &FormulaEngine::funcSUMIF},
+    {"AVERAGEIF", 2, 3, false, &FormulaEngine::funcAVERAGEIF},
+    {"SUMIFS", 3, kMany, false, &FormulaEngine::funcSUMIFS},
+    {"COUNTIFS", 2, kMany, false, &FormulaEngine::funcCOUNTIFS},
+    {"AVERAGEIFS", 3, kMany, false, &FormulaEngine::funcAVERAGEIFS},
+    {"MAXIFS", 3, kMany, false, &FormulaEngine::funcMAXIFS},
+    {"MINIFS", 3, kMany, false, &FormulaEngine::funcMINIFS},
+    {"COUNTBLANK", 1, 1, false, &FormulaEngine::funcCOUNTBLANK},
+    {"SUMPRODUCT", 1, kMany, false, &FormulaEngine::funcSUMPRODUCT},
+    {"MEDIAN", 1, kMany, false, &FormulaEngine::funcMEDIAN},
+    {"MODE", 1, kMany, false, &FormulaEngine::funcMODE},
+    {"STDEV", 1, kMany, false, &FormulaEngine::funcSTDEV},
+    {"VAR", 1, kMany, false, &FormulaEngine::funcVAR},
+    {"LARGE", 2, 2, false, &FormulaEngine::funcLARGE},
+    {"SMALL", 2, 2, false, &FormulaEngine::funcSMALL},
+    {"RANK", 2, 3, false, &FormulaEngine::funcRANK},
+    {"PERCENTILE", 2, 2, false, &FormulaEngine::funcPERCENTILE},
+    // Date
+    {"NOW", 0, 0, true, &FormulaEngine::funcNOW},
+    {"TODAY", 0, 0, true, &FormulaEngine::funcTODAY},
+    {"YEAR", 1, 1, false, &FormulaEngine::funcYEAR},
+    {"MONTH", 1, 1, false, &FormulaEngine::funcMONTH},
+    {"DAY", 1, 1, false, &FormulaEngine::funcDAY},
+    {"DATE", 3, 3, false, &FormulaEngine::funcDATE},
+    {"HOUR", 1, 1, false, &FormulaEngine::funcHOUR},
+    {"MINUTE", 1, 1, false, &FormulaEngine::funcMINUTE},
+    {"SECOND", 1, 1, false, &FormulaEngine::funcSECOND},
+    {"DATEDIF", 3, 3, false, &FormulaEngine::funcDATEDIF},
+    {"NETWORKDAYS", 2, 3, false, &FormulaEngine::funcNETWORKDAYS},
+    {"WEEKDAY", 1, 2, false, &FormulaEngine::funcWEEKDAY},
+    {"EDATE", 2, 2, false, &FormulaEngine::funcEDATE},
+    {"EOMONTH", 2, 2, false, &FormulaEngine::funcEOMONTH},
+    {"DATEVALUE", 1, 1, false, &FormulaEngine::funcDATEVALUE},
+    // Lookup
+    {"VLOOKUP", 3, 4, false, &FormulaEngine::funcVLOOKUP},
+    {"HLOOKUP", 3, 4, false, &FormulaEngine::funcHLOOKUP},
+    {"XLOOKUP", 3, 6, false, &FormulaEngine::funcXLOOKUP},
+    {"INDEX", 2, 4, false, &FormulaEngine::funcINDEX},
+    {"MATCH", 2, 3, false, &FormulaEngine::funcMATCH},
+    // Additional math
+    {"ROUNDUP", 1, 2, false, &FormulaEngine::funcROUNDUP},
+    {"ROUNDDOWN", 1, 2, false, &FormulaEngine::funcROUNDDOWN},
+    {"LOG", 1, 2, false, &FormulaEngine::funcLOG},
+    {"LN", 1, 1, false, &FormulaEngine::funcLN},
+    {"EXP", 1, 1, false, &FormulaEngine::funcEXP},
+    {"RAND", 0, 0, true, &FormulaEngine::funcRAND},
+    {"RANDBETWEEN", 2, 2, true, &FormulaEngine::funcRANDBETWEEN},
+    // Additional text
+    {"PROPER", 1, 1, false, &FormulaEngine::funcPROPER},
+    {"SEARCH", 2, 3, false, &FormulaEngine::funcSEARCH},
+    {"REPT", 2, 2, false, &FormulaEngine::funcREPT},
+    {"EXACT", 2, 2, false, &FormulaEngine::funcEXACT},
+    {"VALUE", 1, 1, false, &FormulaEngine::funcVALUE},
+    // Additional logical/info
+    {"ISBLANK", 1, 1, false, &FormulaEngine::funcISBLANK},
+    {"ISERROR", 1, 1, false, &FormulaEngine::funcISERROR},
+    {"ISNUMBER", 1, 1, false, &FormulaEngine::funcISNUMBER},
+    {"ISTEXT", 1, 1, false, &FormulaEngine::funcISTEXT},
+    {"CHOOSE", 2, kMany, false, &FormulaEngine::funcCHOOSE},
+    {"SWITCH", 3, kMany, false, &FormulaEngine::funcSWITCH},
+    // Array
+    {"FILTER", 2, 3, false, &FormulaEngine::funcFILTER},
+    {"SORT", 1, 4, false, &FormulaEngine::funcSORT},
+    {"UNIQUE", 1, 3, false, &FormulaEngine::funcUNIQUE},
+};
+
+const size_t FormulaFunctions::s_count = std::size(FormulaFunctions::s_functions);
+
+const FunctionInfo* FormulaFunctions::find(const QString& name) {
+    // Built once; lookups only happen while compiling formulas
+    static const QHash<QString, const FunctionInfo*> byName = [] {
+        QHash<QString, const FunctionInfo*> map;
+        for (size_t i = 0; i < s_count; ++i) map.insert(QString(s_functions[i].name), &s_functions[i]);
+        return map;
+    }();
+    return byName.value(name, nullptr);
+}
+
+QStringList FormulaFunctions::names() {
+    QStringList list;
+    for (size_t i = 0; i < s_count; ++i) list.append(QString(s_functions[i].name));
+    std::sort(list.begin(), list.end());
+    return list;
+}
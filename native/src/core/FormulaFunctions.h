@@ -0,0 +1,38 @@
+#ifndef FORMULAFUNCTIONS_H
+#define FORMULAFUNCTIONS_H
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "Value.h"
+
+class FormulaEngine;
+
+// Descriptor of one built-in function. The formula compiler resolves each
+// call to its descriptor, so evaluation checks the argument count and jumps
+// to the implementation without comparing names.
+struct FunctionInfo {
+    static constexpr int kVariadic = 255;
+
+    const char* name;
+    int minArgs;
+    int maxArgs;
+    bool isVolatile;  // result can change with no input changing (NOW, RAND)
+    Value (FormulaEngine::*impl)(const std::vector<Value>& args);
+};
+
+// The table of built-in functions: the single list behind formula
+// compilation, evaluation and the editor's autocompletion.
+class FormulaFunctions {
+public:
+    // nullptr for unknown functions; name is upper case, as the compiler emits it
+    static const FunctionInfo* find(const QString& name);
+    // All names, sorted, for autocompletion
+    static QStringList names();
+
+private:
+    static const FunctionInfo s_functions[];
+    static const size_t s_count;
+};
+
+#endif // FORMULAFUNCTIONS_H
@@ -0,0 +1,218 @@
+#include "LookupIndex.h"
+#include "Spreadsheet.h"
+#include "CriteriaMatcher.h"
+#include "RangeAggregate.h"
+#include <algorithm>
+#include <functional>
+
+LookupIndex::LookupIndex(const Spreadsheet& sheet, const CellRange& range, Kind kind) {
+    CellAddress start = range.getStart();
+    long long cols = std::max(0, range.getColumnCount());
+    long long size = std::max(0, range.getRowCount()) * cols;
+    auto offsetOf = [&](int row, int col) {
+        return static_cast<long long>(row - start.row) * cols + (col - start.col);
+    };
+
+    if (kind == Kind::Ordered) {
+        // Blank cells read as 0, like the scan does
+        m_sorted.assign(static_cast<size_t>(size), 0.0);
+        sheet.forEachCellInRange(range, [&](int row, int col, const Cell& cell) {
+            m_sorted[offsetOf(row, col)] = cell.getResult().toNumber();
+        });
+        m_ascending = std::is_sorted(m_sorted.begin(), m_sorted.end());
+        m_descending = std::is_sorted(m_sorted.begin(), m_sorted.end(), std::greater<double>());
+        return;
+    }
+
+    auto keep = [this](const QString& key, long long offset) {
+        long long current = m_text.value(key, -1);
+        if (current < 0 || offset < current) m_text.insert(key, offset);
+    };
+    std::vector<long long> stored;
+    sheet.forEachCellInRange(range, [&](int row, int col, const Cell& cell) {
+        long long offset = offsetOf(row, col);
+        const Value& v = cell.getResult();
+        keep(v.toString().toCaseFolded(), offset);
+        bool ok;
+        double d = v.toNumber(&ok);
+        if (ok) {
+            auto [it, inserted] = m_numbers.emplace(d, offset);
+            if (!inserted && offset < it->second) it->second = offset;
+        }
+        stored.push_back(offset);
+    });
+
+    // Cells that were never created match the empty string
+    if (static_cast<long long>(stored.size()) < size) {
+        std::sort(stored.begin(), stored.end());
+        long long firstBlank = 0;
+        while (firstBlank < static_cast<long long>(stored.size()) && stored[firstBlank] == firstBlank) firstBlank++;
+        keep(QString(), firstBlank);
+    }
+}
+
+long long LookupIndex::findExact(const Value& value) const {
+    long long found = m_text.value(value.toString().toCaseFolded(), -1);
+    bool ok;
+    double d = value.toNumber(&ok);
+    if (ok) {
+        auto it = m_numbers.find(d);
+        if (it != m_numbers.end() && (found < 0 || it->second < found)) found = it->second;
+    }
+    return found;
+}
+
+long long LookupIndex::findLastAtMost(double value) const {
+    auto it = std::upper_bound(m_sorted.begin(), m_sorted.end(), value);
+    return static_cast<long long>(it - m_sorted.begin()) - 1;
+}
+
+long long LookupIndex::findLastAtLeast(double value) const {
+    auto it = std::partition_point(m_sorted.begin(), m_sorted.end(), [value](double v) { return v >= value; });
+    return static_cast<long long>(it - m_sorted.begin()) - 1;
+}
+
+SortedValues::SortedValues(const Spreadsheet& sheet, const CellRange& range) {
+    sheet.forEachCellInRange(range, [&](int, int, const Cell& cell) {
+        bool ok;
+        double d = cell.getResult().toNumber(&ok);
+        if (ok) m_values.push_back(d);
+    });
+    std::sort(m_values.begin(), m_values.end());
+}
+
+size_t SortedValues::countBelow(double value) const {
+    return static_cast<size_t>(std::lower_bound(m_values.begin(), m_values.end(), value) - m_values.begin());
+}
+
+size_t SortedValues::countAbove(double value) const {
+    return static_cast<size_t>(m_values.end() - std::upper_bound(m_values.begin(), m_values.end(), value));
+}
+
+bool SortedValues::contains(double value) const {
+    return std::binary_search(m_values.begin(), m_values.end(), value);
+}
+
+LookupCache::Key LookupCache::makeKey(IndexType type, const std::vector<CellRange>& ranges) {
+    Key key{type, {}};
+    key.bounds.reserve(ranges.size() * 4);
+    for (const auto& range : ranges) {
+        key.bounds.insert(key.bounds.end(), {range.getStart().row, range.getStart().col,
+                                             range.getEnd().row, range.getEnd().col});
+    }
+    return key;
+}
+
+std::shared_ptr<const void> LookupCache::find(const Key& key) const {
+    QReadLocker locker(&m_lock);
+    auto it = m_slots.find(key);
+    return it != m_slots.end() ? m_entries[it->second].index : nullptr;
+}
+
+std::shared_ptr<const void> LookupCache::store(Key key, const std::vector<CellRange>& ranges,
+                                               std::shared_ptr<void> index) {
+    QWriteLocker locker(&m_lock);
+    auto it = m_slots.find(key);
+    if (it != m_slots.end()) return m_entries[it->second].index;
+    uint32_t slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(m_entries.size());
+        m_entries.emplace_back();
+    }
+    Entry& entry = m_entries[slot];
+    entry.key = key;
+    entry.handles.clear();
+    for (const auto& range : ranges) entry.handles.push_back(m_ranges.insert(range, slot));
+    entry.index = index;
+    m_slots.emplace(std::move(key), slot);
+    return index;
+}
+
+// Indexes are built outside the lock; two workers racing on the same key
+// both build, and the first one stored wins
+
+std::shared_ptr<const LookupIndex> LookupCache::get(const Spreadsheet& sheet, const CellRange& range, LookupIndex::Kind kind) {
+    Key key = makeKey(kind == LookupIndex::Kind::Exact ? IndexType::Exact : IndexType::Ordered, {range});
+    if (auto cached = find(key)) return std::static_pointer_cast<const LookupIndex>(cached);
+
+    long long cells = static_cast<long long>(std::max(0, range.getRowCount())) * std::max(0, range.getColumnCount());
+    if (kind == LookupIndex::Kind::Ordered && cells > kMaxOrderedCells) return nullptr;
+
+    auto index = std::make_shared<LookupIndex>(sheet, range, kind);
+    return std::static_pointer_cast<const LookupIndex>(store(std::move(key), {range}, index));
+}
+
+std::shared_ptr<const ConditionalIndex> LookupCache::getConditional(const Spreadsheet& sheet,
+                                                                    const std::vector<CellRange>& criteriaRanges,
+                                                                    const CellRange* valueRange) {
+    std::vector<CellRange> ranges = criteriaRanges;
+    if (valueRange) ranges.push_back(*valueRange);
+    Key key = makeKey(valueRange ? IndexType::ConditionalValues : IndexType::ConditionalCount, ranges);
+    if (auto cached = find(key)) return std::static_pointer_cast<const ConditionalIndex>(cached);
+
+    auto index = std::make_shared<ConditionalIndex>(sheet, criteriaRanges, valueRange);
+    return std::static_pointer_cast<const ConditionalIndex>(store(std::move(key), ranges, index));
+}
+
+std::shared_ptr<const RangeAggregate> LookupCache::getAggregate(const Spreadsheet& sheet, const CellRange& range) {
+    long long cells = static_cast<long long>(std::max(0, range.getRowCount())) * std::max(0, range.getColumnCount());
+    if (cells < kMinAggregateCells) return nullptr;
+    Key key = makeKey(IndexType::Aggregate, {range});
+    if (auto cached = find(key)) return std::static_pointer_cast<const RangeAggregate>(cached);
+
+    auto aggregate = std::make_shared<RangeAggregate>(sheet, range);
+    return std::static_pointer_cast<const RangeAggregate>(store(std::move(key), {range}, aggregate));
+}
+
+void LookupCache::update(const Spreadsheet& sheet, const CellAddress& addr, const Value& before, const Value& after) {
+    QWriteLocker locker(&m_lock);
+    if (m_slots.empty()) return;
+    std::vector<uint32_t> hit;
+    m_ranges.query(addr.row, addr.col, [&hit](uint32_t slot) { hit.push_back(slot); });
+    for (uint32_t slot : hit) {
+        Entry& entry = m_entries[slot];
+        if (!entry.index) continue;
+        if (entry.key.type == IndexType::Aggregate &&
+            static_cast<RangeAggregate*>(entry.index.get())->update(sheet, addr, before, after)) continue;
+        drop(slot);
+    }
+}
+
+void LookupCache::invalidate(const CellAddress& addr) {
+    QWriteLocker locker(&m_lock);
+    if (m_slots.empty()) return;
+    std::vector<uint32_t> stale;
+    m_ranges.query(addr.row, addr.col, [&stale](uint32_t slot) { stale.push_back(slot); });
+    for (uint32_t slot : stale) {
+        if (m_entries[slot].index) drop(slot);  // else reached through two of its ranges
+    }
+}
+
+void LookupCache::drop(uint32_t slot) {
+    Entry& entry = m_entries[slot];
+    for (RangeIndex::Handle handle : entry.handles) m_ranges.remove(handle);
+    m_slots.erase(entry.key);
+    entry.index.reset();
+    m_freeSlots.push_back(slot);
+}
+
+void LookupCache::clear() {
+    QWriteLocker locker(&m_lock);
+    m_slots.clear();
+    m_entries.clear();
+    m_freeSlots.clear();
+    m_ranges.clear();
+}
+
+std::shared_ptr<const SortedValues> LookupCache::getSorted(const Spreadsheet& sheet, const CellRange& range) {
+    long long cells = static_cast<long long>(std::max(0, range.getRowCount())) * std::max(0, range.getColumnCount());
+    if (cells < kMinSortedCells) return nullptr;
+    Key key = makeKey(IndexType::Sorted, {range});
+    if (auto cached = find(key)) return std::static_pointer_cast<const SortedValues>(cached);
+
+    auto sorted = std::make_shared<SortedValues>(sheet, range);
+    return std::static_pointer_cast<const SortedValues>(store(std::move(key), {range}, sorted));
+}
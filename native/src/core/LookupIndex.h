@@ -0,0 +1,139 @@
+#ifndef LOOKUPINDEX_H
+#define LOOKUPINDEX_H
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "CellRange.h"
+#include "RangeIndex.h"
+#include "Value.h"
+
+class Spreadsheet;
+class ConditionalIndex;
+class RangeAggregate;
+
+// Search structure over the cells of one lookup range (VLOOKUP's first
+// column, MATCH's range, ...). Offsets are row-major positions in the range,
+// as returned by the linear scans they replace.
+class LookupIndex {
+public:
+    enum class Kind : uint8_t {
+        Exact,   // case-folded text and numeric hash, first offset per key
+        Ordered  // the range's numbers in order, for binary search
+    };
+
+    LookupIndex(const Spreadsheet& sheet, const CellRange& range, Kind kind);
+
+    // Exact: first offset whose text equals value's case-insensitively, or
+    // whose number equals value's when both are numeric; -1 if none
+    long long findExact(const Value& value) const;
+
+    // Ordered: binary search only applies when the range is sorted; callers
+    // fall back to a scan otherwise (Excel's result on unsorted data is
+    // defined by that scan)
+    bool isAscending() const { return m_ascending; }
+    bool isDescending() const { return m_descending; }
+    // Last offset whose number is <= value (ascending ranges), or -1
+    long long findLastAtMost(double value) const;
+    // Last offset whose number is >= value (descending ranges), or -1
+    long long findLastAtLeast(double value) const;
+
+private:
+    QHash<QString, long long> m_text;
+    std::unordered_map<double, long long> m_numbers;
+    std::vector<double> m_sorted;
+    bool m_ascending = false;
+    bool m_descending = false;
+};
+
+// The numbers of one range (numeric text and booleans included, blanks and
+// other text skipped, as MEDIAN/LARGE/SMALL/RANK/PERCENTILE read it) in
+// ascending order. Sorted once and shared by every order statistic over the
+// range, so each of them is an index or a binary search.
+class SortedValues {
+public:
+    SortedValues(const Spreadsheet& sheet, const CellRange& range);
+
+    size_t size() const { return m_values.size(); }
+    // k-th smallest, 0-based
+    double at(size_t k) const { return m_values[k]; }
+    size_t countBelow(double value) const;
+    size_t countAbove(double value) const;
+    bool contains(double value) const;
+
+private:
+    std::vector<double> m_values;
+};
+
+// Per-sheet cache of lookup indexes, SUMIFS-family group indexes, sorted
+// snapshots and running range aggregates, keyed by the ranges they cover. Entries are built on
+// first use and dropped as soon as a cell inside any of their ranges
+// changes; a RangeIndex maps the changed cell to the affected entries.
+// Aggregates absorb plain value edits through update() instead. get() may
+// be called from recalc workers; invalidation and updates happen on the
+// sheet's thread between evaluations.
+class LookupCache {
+public:
+    // Ordered indexes are not built for ranges above this many cells
+    static constexpr long long kMaxOrderedCells = 1 << 22;
+    // Smaller ranges are cheaper to scan than to keep aggregates for
+    static constexpr long long kMinAggregateCells = 4096;
+    // Below this a one-off selection beats building and caching a snapshot
+    static constexpr long long kMinSortedCells = 64;
+
+    // nullptr when no index is worth building (Ordered over a huge range)
+    std::shared_ptr<const LookupIndex> get(const Spreadsheet& sheet, const CellRange& range, LookupIndex::Kind kind);
+    // valueRange may be null (COUNTIFS)
+    std::shared_ptr<const ConditionalIndex> getConditional(const Spreadsheet& sheet,
+                                                           const std::vector<CellRange>& criteriaRanges,
+                                                           const CellRange* valueRange);
+    // nullptr below kMinAggregateCells
+    std::shared_ptr<const RangeAggregate> getAggregate(const Spreadsheet& sheet, const CellRange& range);
+    // nullptr below kMinSortedCells
+    std::shared_ptr<const SortedValues> getSorted(const Spreadsheet& sheet, const CellRange& range);
+    // A value edit: aggregates over addr apply the delta, the rest are dropped
+    void update(const Spreadsheet& sheet, const CellAddress& addr, const Value& before, const Value& after);
+    void invalidate(const CellAddress& addr);
+    void clear();
+
+private:
+    enum class IndexType : uint8_t { Exact, Ordered, ConditionalCount, ConditionalValues, Aggregate, Sorted };
+
+    struct Key {
+        IndexType type;
+        std::vector<int> bounds;  // rowStart, colStart, rowEnd, colEnd per range
+        bool operator==(const Key& other) const { return type == other.type && bounds == other.bounds; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = static_cast<uint64_t>(k.type);
+            for (int b : k.bounds) h = (h ^ static_cast<uint32_t>(b)) * 0x100000001B3ull;
+            return std::hash<uint64_t>()(h);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::vector<RangeIndex::Handle> handles;
+        std::shared_ptr<void> index;  // LookupIndex, ConditionalIndex, RangeAggregate or SortedValues, per key.type
+    };
+
+    mutable QReadWriteLock m_lock;
+    std::unordered_map<Key, uint32_t, KeyHash> m_slots;  // key -> slot in m_entries
+    std::vector<Entry> m_entries;
+    std::vector<uint32_t> m_freeSlots;
+    RangeIndex m_ranges;  // owner = slot
+
+    static Key makeKey(IndexType type, const std::vector<CellRange>& ranges);
+    std::shared_ptr<const void> find(const Key& key) const;
+    // Stores index unless another thread got there first; returns the stored one
+    std::shared_ptr<const void> store(Key key, const std::vector<CellRange>& ranges, std::shared_ptr<void> index);
+    void drop(uint32_t slot);
+};
+
+#endif // LOOKUPINDEX_H
@@ -0,0 +1,75 @@
+#include "RangeAggregate.h"
+#include "Spreadsheet.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static constexpr double kInfinity = std::numeric_limits<double>::infinity();
+
+RangeAggregate::RangeAggregate(const Spreadsheet& sheet, const CellRange& range) : m_range(range) {
+    int rows = std::max(1, range.getRowCount());
+    int cols = std::max(1, range.getColumnCount());
+    m_bandRows = std::max(1, kBandCells / cols);
+    m_leaves = static_cast<size_t>((rows + m_bandRows - 1) / m_bandRows);
+    // Compensated deltas drift slowly; rebuilding after one edit per cell
+    // keeps the rebuild cost amortized to O(1) per edit
+    m_maxUpdates = std::max<long long>(1024, static_cast<long long>(rows) * cols);
+    m_min.assign(2 * m_leaves, kInfinity);
+    m_max.assign(2 * m_leaves, -kInfinity);
+
+    const int startRow = range.getStart().row;
+    sheet.forEachCellInRange(range, [&](int row, int, const Cell& cell) {
+        const Value& v = cell.getResult();
+        if (v.isEmpty()) return;
+        add(v, 1);
+        size_t leaf = m_leaves + static_cast<size_t>((row - startRow) / m_bandRows);
+        double d = v.toNumber();
+        m_min[leaf] = std::min(m_min[leaf], d);
+        m_max[leaf] = std::max(m_max[leaf], d);
+    });
+    for (size_t i = m_leaves - 1; i >= 1; --i) {
+        m_min[i] = std::min(m_min[2 * i], m_min[2 * i + 1]);
+        m_max[i] = std::max(m_max[2 * i], m_max[2 * i + 1]);
+    }
+}
+
+void RangeAggregate::add(const Value& value, int sign) {
+    if (value.isEmpty()) return;
+    bool ok;
+    double d = value.toNumber(&ok);
+    m_sum.add(sign * d);
+    m_values += sign;
+    if (ok) m_numbers += sign;
+    if (!value.isText() || !value.toString().isEmpty()) m_nonBlank += sign;
+}
+
+bool RangeAggregate::update(const Spreadsheet& sheet, const CellAddress& addr, const Value& before, const Value& after) {
+    if (++m_updates > m_maxUpdates) return false;
+    // inf - inf is NaN, so infinities can't be taken back out of the sum
+    if (!std::isfinite(before.toNumber()) || !std::isfinite(after.toNumber())) return false;
+    add(before, -1);
+    add(after, 1);
+    rebuildBand(sheet, static_cast<size_t>((addr.row - m_range.getStart().row) / m_bandRows));
+    return true;
+}
+
+void RangeAggregate::rebuildBand(const Spreadsheet& sheet, size_t band) {
+    int first = m_range.getStart().row + static_cast<int>(band) * m_bandRows;
+    int last = std::min(m_range.getEnd().row, first + m_bandRows - 1);
+    double min = kInfinity, max = -kInfinity;
+    sheet.forEachCellInRange(CellRange(first, m_range.getStart().col, last, m_range.getEnd().col),
+                             [&](int, int, const Cell& cell) {
+        const Value& v = cell.getResult();
+        if (v.isEmpty()) return;
+        double d = v.toNumber();
+        min = std::min(min, d);
+        max = std::max(max, d);
+    });
+    size_t i = m_leaves + band;
+    m_min[i] = min;
+    m_max[i] = max;
+    for (i /= 2; i >= 1; i /= 2) {
+        m_min[i] = std::min(m_min[2 * i], m_min[2 * i + 1]);
+        m_max[i] = std::max(m_max[2 * i], m_max[2 * i + 1]);
+    }
+}
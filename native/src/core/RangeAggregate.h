@@ -0,0 +1,54 @@
+#ifndef RANGEAGGREGATE_H
+#define RANGEAGGREGATE_H
+
+#include <vector>
+#include "AggregateKernels.h"
+#include "CellRange.h"
+#include "Value.h"
+
+class Spreadsheet;
+
+// Running SUM/COUNT/COUNTA/AVERAGE/MIN/MAX state over one large range, so
+// that a formula over it reads the answer instead of rescanning, and an
+// edit inside it applies a delta instead of throwing the state away.
+// Values count the way the scans in FormulaEngine count them: every
+// non-empty value contributes toNumber() to the sum, average and min/max.
+// MIN/MAX come from a segment tree whose leaves are bands of rows, so an
+// edit rescans one band (about kBandCells cells) and walks up the tree.
+class RangeAggregate {
+public:
+    static constexpr int kBandCells = 64;
+
+    RangeAggregate(const Spreadsheet& sheet, const CellRange& range);
+
+    double sum() const { return m_sum.value(); }
+    long long values() const { return m_values; }      // non-empty (AVERAGE divisor)
+    long long numbers() const { return m_numbers; }     // numeric (COUNT)
+    long long nonBlank() const { return m_nonBlank; }   // COUNTA
+    // Only meaningful when values() > 0
+    double min() const { return m_min[1]; }
+    double max() const { return m_max[1]; }
+
+    // Applies the edit of addr from before to after; the sheet already holds
+    // after. False when the state can't absorb it and must be rebuilt.
+    bool update(const Spreadsheet& sheet, const CellAddress& addr, const Value& before, const Value& after);
+
+private:
+    CellRange m_range;
+    int m_bandRows = 1;
+    size_t m_leaves = 1;
+    AggregateKernels::Sum m_sum;
+    long long m_values = 0;
+    long long m_numbers = 0;
+    long long m_nonBlank = 0;
+    long long m_updates = 0;
+    long long m_maxUpdates = 0;
+    // Implicit trees: node i covers 2i and 2i+1, leaf b sits at m_leaves + b
+    std::vector<double> m_min;
+    std::vector<double> m_max;
+
+    void add(const Value& value, int sign);
+    void rebuildBand(const Spreadsheet& sheet, size_t band);
+};
+
+#endif // RANGEAGGREGATE_H
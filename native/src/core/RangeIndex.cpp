@@ -0,0 +1,84 @@
+#include "RangeIndex.h"
+#include <algorithm>
+
+RangeIndex::Handle RangeIndex::insert(const CellRange& range, uint32_t owner) {
+    Entry e;
+    e.rowStart = range.getStart().row;
+    e.rowEnd = range.getEnd().row;
+    e.colStart = std::min(range.getStart().col, range.getEnd().col);
+    e.colEnd = std::max(range.getStart().col, range.getEnd().col);
+    e.owner = owner;
+    e.alive = true;
+    e.inTree = false;
+    e.pendingPos = static_cast<uint32_t>(m_pending.size());
+
+    Handle h;
+    if (!m_freeHandles.empty()) {
+        h = m_freeHandles.back();
+        m_freeHandles.pop_back();
+        m_entries[h] = e;
+    } else {
+        h = static_cast<Handle>(m_entries.size());
+        m_entries.push_back(e);
+    }
+    m_pending.push_back(h);
+    m_liveCount++;
+    return h;
+}
+
+void RangeIndex::remove(Handle handle) {
+    Entry& e = m_entries[handle];
+    if (!e.alive) return;
+    e.alive = false;
+    m_liveCount--;
+    if (e.inTree) {
+        m_deadInTree++; // slot recycled on next rebuild
+        return;
+    }
+    Handle moved = m_pending.back();
+    m_pending[e.pendingPos] = moved;
+    m_entries[moved].pendingPos = e.pendingPos;
+    m_pending.pop_back();
+    m_freeHandles.push_back(handle);
+}
+
+void RangeIndex::clear() {
+    m_entries.clear();
+    m_freeHandles.clear();
+    m_liveCount = 0;
+    m_sorted.clear();
+    m_maxRowEnd.clear();
+    m_pending.clear();
+    m_deadInTree = 0;
+}
+
+void RangeIndex::rebuild() const {
+    std::vector<Handle> live;
+    live.reserve(m_liveCount);
+    for (Handle h : m_sorted) {
+        if (m_entries[h].alive) live.push_back(h);
+        else m_freeHandles.push_back(h);
+    }
+    for (Handle h : m_pending) live.push_back(h);
+
+    std::sort(live.begin(), live.end(), [this](Handle a, Handle b) {
+        return m_entries[a].rowStart < m_entries[b].rowStart;
+    });
+    for (Handle h : live) m_entries[h].inTree = true;
+
+    m_sorted = std::move(live);
+    m_maxRowEnd.assign(m_sorted.size(), 0);
+    if (!m_sorted.empty()) buildMax(0, static_cast<int>(m_sorted.size()));
+    m_pending.clear();
+    m_deadInTree = 0;
+}
+
+int RangeIndex::buildMax(int lo, int hi) const {
+    if (lo >= hi) return -1;
+    int mid = (lo + hi) / 2;
+    int best = m_entries[m_sorted[mid]].rowEnd;
+    best = std::max(best, buildMax(lo, mid));
+    best = std::max(best, buildMax(mid + 1, hi));
+    m_maxRowEnd[mid] = best;
+    return best;
+}
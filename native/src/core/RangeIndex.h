@@ -0,0 +1,85 @@
+#ifndef RANGEINDEX_H
+#define RANGEINDEX_H
+
+#include <cstdint>
+#include <vector>
+#include "CellRange.h"
+
+// Spatial index of rectangular ranges answering "which ranges contain this
+// cell?" (or overlap this rectangle). Ranges are kept in an augmented interval tree over their row spans
+// (implicit, array-backed) and filtered by column on the way out. Inserts
+// go to a small pending list and removals leave tombstones; both are folded
+// into the tree by a lazy rebuild once they grow past a fraction of its size.
+class RangeIndex {
+public:
+    using Handle = uint32_t;
+
+    Handle insert(const CellRange& range, uint32_t owner);
+    void remove(Handle handle);
+    void clear();
+    size_t size() const { return m_liveCount; }
+
+    // Calls visit(owner) for every live range containing (row, col)
+    template <typename Visitor>
+    void query(int row, int col, Visitor&& visit) const {
+        queryOverlap(row, row, col, col, visit);
+    }
+
+    // Calls visit(owner) for every live range sharing a cell with the rectangle
+    template <typename Visitor>
+    void queryOverlap(int rowStart, int rowEnd, int colStart, int colEnd, Visitor&& visit) const {
+        if (m_liveCount == 0) return;
+        if (needsRebuild()) rebuild();
+        if (!m_sorted.empty()) queryTree(0, static_cast<int>(m_sorted.size()), rowStart, rowEnd, colStart, colEnd, visit);
+        for (Handle h : m_pending) {
+            const Entry& e = m_entries[h];
+            if (e.alive && e.overlaps(rowStart, rowEnd, colStart, colEnd)) visit(e.owner);
+        }
+    }
+
+private:
+    struct Entry {
+        int rowStart, rowEnd, colStart, colEnd;
+        uint32_t owner;
+        uint32_t pendingPos;    // index in m_pending while !inTree
+        bool alive;
+        bool inTree;
+        bool overlaps(int top, int bottom, int left, int right) const {
+            return rowStart <= bottom && rowEnd >= top && colStart <= right && colEnd >= left;
+        }
+    };
+
+    // Handles of removed tree entries are only recycled by rebuild(), so the
+    // lazily rebuilt state below is mutable along with the entry table.
+    mutable std::vector<Entry> m_entries;
+    mutable std::vector<Handle> m_freeHandles;
+    size_t m_liveCount = 0;
+
+    // Tree part: handles sorted by rowStart; m_maxRowEnd[mid] is the largest
+    // rowEnd in the subtree rooted at index mid of [lo, hi).
+    mutable std::vector<Handle> m_sorted;
+    mutable std::vector<int> m_maxRowEnd;
+    mutable std::vector<Handle> m_pending;
+    mutable size_t m_deadInTree = 0;
+
+    bool needsRebuild() const {
+        return m_pending.size() > 32 + m_sorted.size() / 8 || m_deadInTree > m_sorted.size() / 2 + 32;
+    }
+    void rebuild() const;
+    int buildMax(int lo, int hi) const;
+
+    template <typename Visitor>
+    void queryTree(int lo, int hi, int top, int bottom, int left, int right, Visitor& visit) const {
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (m_maxRowEnd[mid] < top) return;
+            queryTree(lo, mid, top, bottom, left, right, visit);
+            const Entry& e = m_entries[m_sorted[mid]];
+            if (e.rowStart > bottom) return; // everything to the right starts later
+            if (e.alive && e.overlaps(top, bottom, left, right)) visit(e.owner);
+            lo = mid + 1;
+        }
+    }
+};
+
+#endif // RANGEINDEX_H
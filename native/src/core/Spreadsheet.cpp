@@ -1,103 +1,159 @@
 #include "Spreadsheet.h"
 #include "PivotEngine.h"
+#include "Workbook.h"
 #include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <QThread>
+#include <QtConcurrent>
 
 Spreadsheet::Spreadsheet()
     : m_sheetName("Sheet1"), m_rowCount(1000), m_columnCount(256),
       m_autoRecalculate(true), m_inTransaction(false) {
     m_formulaEngine = std::make_unique<FormulaEngine>(this);
-    m_cells.reserve(4096);
 }
 
 Spreadsheet::~Spreadsheet() = default;
 
-std::shared_ptr<Cell> Spreadsheet::getCell(const CellAddress& addr) {
+Cell* Spreadsheet::getCell(const CellAddress& addr) {
     return getCell(addr.row, addr.col);
 }
 
-std::shared_ptr<Cell> Spreadsheet::getCell(int row, int col) {
-    CellKey key{row, col};
-    auto it = m_cells.find(key);
-    if (it != m_cells.end()) {
-        return it->second;
+Cell* Spreadsheet::getCell(int row, int col) {
+    // The caller may change the cell behind the sheet's back
+    if (!m_trackingStale) {
+        if (m_untrackedCells.size() < std::max<size_t>(1024, m_cells.size())) m_untrackedCells.emplace_back(row, col);
+        else m_trackingStale = true;
     }
-    auto cell = std::make_shared<Cell>();
-    m_cells.emplace(key, cell);
-    m_maxRowColDirty = true;
-    return cell;
+    return m_cells.getOrCreate(row, col);
 }
 
-std::shared_ptr<Cell> Spreadsheet::getCellIfExists(const CellAddress& addr) const {
+Cell* Spreadsheet::getCellIfExists(const CellAddress& addr) const {
     return getCellIfExists(addr.row, addr.col);
 }
 
-std::shared_ptr<Cell> Spreadsheet::getCellIfExists(int row, int col) const {
-    CellKey key{row, col};
-    auto it = m_cells.find(key);
-    return (it != m_cells.end()) ? it->second : nullptr;
+Cell* Spreadsheet::getCellIfExists(int row, int col) const {
+    return m_cells.peek(row, col);
 }
 
 QVariant Spreadsheet::getCellValue(const CellAddress& addr) {
-    auto cell = getCellIfExists(addr.row, addr.col);
+    const Cell* cell = m_cells.peek(addr.row, addr.col);
     if (!cell) return QVariant();
-    if (cell->getType() == CellType::Formula) {
-        return cell->getComputedValue();
-    }
-    return cell->getValue();
+    return cell->getResult().toVariant();
+}
+
+Value Spreadsheet::getCellResult(const CellAddress& addr) const {
+    const Cell* cell = m_cells.peek(addr.row, addr.col);
+    return cell ? cell->getResult() : Value();
 }
 
 void Spreadsheet::setCellValue(const CellAddress& addr, const QVariant& value) {
-    auto cell = getCell(addr);
-    cell->setValue(value);
-    m_maxRowColDirty = true;
+    HeldValue before = getCellResult(addr);  // its text may be freed by the write
+    m_cells.getOrCreate(addr.row, addr.col)->setValue(value);
+    valueChanged(addr, before);
+}
+
+void Spreadsheet::setCellText(const CellAddress& addr, uint32_t textId) {
+    HeldValue before = getCellResult(addr);
+    m_cells.getOrCreate(addr.row, addr.col)->setTextId(textId);
+    valueChanged(addr, before);
+}
+
+void Spreadsheet::valueChanged(const CellAddress& addr, const Value& before) {
+    trackCell(addr.row, addr.col, *m_cells.peek(addr.row, addr.col));
+    // Running aggregates over addr take the delta; indexes are rebuilt on next use
+    m_lookupCache.update(*this, addr, before, getCellResult(addr));
+
+    trackVolatile(addr, false);
+    if (!m_spills.empty() && m_spills.count({addr.row, addr.col})) spill(addr, nullptr);
 
     // Skip dependency graph work when autoRecalculate is off (bulk import mode)
     if (m_autoRecalculate) {
         m_depGraph.removeDependencies(addr);
-        if (!m_inTransaction) {
+        if (m_workbook) m_workbook->removeDependencies(this, addr);
+        // An edit inside a spill block also re-runs its array formula,
+        // which is now blocked, or free to spill again
+        std::vector<CellAddress> changed = m_depGraph.getSpillAnchors(addr);
+        if (changed.empty() && m_batchDepth == 0) {
             recalculateDependents(addr);
+        } else {
+            changed.push_back(addr);
+            recalculateChanged(changed);
         }
     }
 }
 
 void Spreadsheet::setCellFormula(const CellAddress& addr, const QString& formula) {
-    auto cell = getCell(addr);
+    auto cell = m_cells.getOrCreate(addr.row, addr.col);
     cell->setFormula(formula);
-    m_maxRowColDirty = true;
+    if (!cell->getCompiledFormula()) {
+        cell->setCompiledFormula(CompiledFormula::compile(formula, addr));
+    }
+    trackCell(addr.row, addr.col, *cell);
+    m_lookupCache.invalidate(addr);
     updateDependencies(addr);
 
-    if (m_depGraph.hasCircularDependency(addr)) {
-        cell->setComputedValue(QVariant("#CIRCULAR!"));
-        return;
+    if (m_autoRecalculate) {
+        // One topological pass covers this cell, its dependents and cycle
+        // detection, and any array formula whose block the cell lies in
+        std::vector<CellAddress> changed = m_depGraph.getSpillAnchors(addr);
+        changed.push_back(addr);
+        recalculateChanged(changed);
+    } else if (m_depGraph.hasCircularDependency(addr)) {
+        cell->setComputedValue(Value::error(ErrorCode::Circular));
     }
+}
+
+void Spreadsheet::beginBatch() { m_batchDepth++; }
 
-    if (m_autoRecalculate && !m_inTransaction) {
-        recalculate(addr);
-        recalculateDependents(addr);
+void Spreadsheet::endBatch() {
+    if (m_batchDepth == 0 || --m_batchDepth > 0) return;
+    std::vector<CellAddress> changed;
+    changed.swap(m_batchChanged);
+    if (!m_autoRecalculate || changed.empty()) return;
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    recalculateFrom(changed, true);
+}
+
+void Spreadsheet::applyBatch(const std::vector<CellEdit>& edits) {
+    beginBatch();
+    for (const auto& edit : edits) {
+        if (edit.formula.isEmpty()) setCellValue(edit.addr, edit.value);
+        else setCellFormula(edit.addr, edit.formula);
     }
+    endBatch();
 }
 
 void Spreadsheet::fillRange(const CellRange& range, const QVariant& value) {
+    beginBatch();
     for (const auto& addr : range.getCells()) {
         setCellValue(addr, value);
     }
+    endBatch();
 }
 
 void Spreadsheet::clearRange(const CellRange& range) {
-    for (int r = range.getStart().row; r <= range.getEnd().row; ++r) {
-        for (int c = range.getStart().col; c <= range.getEnd().col; ++c) {
-            CellKey key{r, c};
-            auto it = m_cells.find(key);
-            if (it != m_cells.end()) {
-                it->second->clear();
-            }
-        }
+    // Collected first: releasing a spill writes to cells of the range
+    std::vector<CellAddress> cleared;
+    m_cells.forEachInRange(range.getStart().row, range.getEnd().row,
+                           range.getStart().col, range.getEnd().col,
+                           [&cleared](int row, int col, Cell&) { cleared.emplace_back(row, col); });
+
+    // Each cell goes through the same bookkeeping as an edit (dependencies,
+    // volatile tracking, spills), with one recalculation for the whole range
+    beginBatch();
+    for (const auto& addr : cleared) {
+        Cell* cell = m_cells.peek(addr.row, addr.col);
+        HeldValue before = cell->getResult();
+        cell->clear();
+        valueChanged(addr, before);
     }
-    m_maxRowColDirty = true;
+    endBatch();
 }
 
-std::vector<std::shared_ptr<Cell>> Spreadsheet::getRange(const CellRange& range) {
-    std::vector<std::shared_ptr<Cell>> result;
+std::vector<Cell*> Spreadsheet::getRange(const CellRange& range) {
+    std::vector<Cell*> result;
     for (const auto& addr : range.getCells()) {
         result.push_back(getCell(addr));
     }
@@ -105,112 +161,229 @@ std::vector<std::shared_ptr<Cell>> Spreadsheet::getRange(const CellRange& range)
 }
 
 void Spreadsheet::insertRow(int row, int count) {
-    std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> toReinsert;
-    std::vector<CellKey> toRemove;
-    for (const auto& pair : m_cells) {
-        if (pair.first.row >= row) {
-            toRemove.push_back(pair.first);
-            toReinsert.push_back({CellKey{pair.first.row + count, pair.first.col}, pair.second});
-        }
-    }
-    for (const auto& key : toRemove) m_cells.erase(key);
-    for (auto& [key, cell] : toReinsert) m_cells.emplace(key, std::move(cell));
+    applyStructuralEdit(StructuralEdit{true, row, count}, [&]() {
+        for (int c = 0; c < m_cells.columnSpan(); ++c) m_cells.shiftRows(c, row, count);
+    });
     m_rowCount += count;
-    m_maxRowColDirty = true;
 }
 
 void Spreadsheet::insertColumn(int column, int count) {
-    std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> toReinsert;
-    std::vector<CellKey> toRemove;
-    for (const auto& pair : m_cells) {
-        if (pair.first.col >= column) {
-            toRemove.push_back(pair.first);
-            toReinsert.push_back({CellKey{pair.first.row, pair.first.col + count}, pair.second});
-        }
-    }
-    for (const auto& key : toRemove) m_cells.erase(key);
-    for (auto& [key, cell] : toReinsert) m_cells.emplace(key, std::move(cell));
+    applyStructuralEdit(StructuralEdit{false, column, count}, [&]() { m_cells.insertColumns(column, count); });
     m_columnCount += count;
-    m_maxRowColDirty = true;
 }
 
 void Spreadsheet::deleteRow(int row, int count) {
-    std::vector<CellKey> toRemove;
-    std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> toReinsert;
-    for (const auto& pair : m_cells) {
-        if (pair.first.row >= row && pair.first.row < row + count) {
-            toRemove.push_back(pair.first);
-        } else if (pair.first.row >= row + count) {
-            toRemove.push_back(pair.first);
-            toReinsert.push_back({CellKey{pair.first.row - count, pair.first.col}, pair.second});
-        }
-    }
-    for (const auto& key : toRemove) m_cells.erase(key);
-    for (auto& [key, cell] : toReinsert) m_cells.emplace(key, std::move(cell));
+    applyStructuralEdit(StructuralEdit{true, row, -count}, [&]() {
+        for (int c = 0; c < m_cells.columnSpan(); ++c) m_cells.shiftRows(c, row + count, -count);
+    });
     m_rowCount -= count;
-    m_maxRowColDirty = true;
 }
 
 void Spreadsheet::deleteColumn(int column, int count) {
-    std::vector<CellKey> toRemove;
-    std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> toReinsert;
-    for (const auto& pair : m_cells) {
-        if (pair.first.col >= column && pair.first.col < column + count) {
-            toRemove.push_back(pair.first);
-        } else if (pair.first.col >= column + count) {
-            toRemove.push_back(pair.first);
-            toReinsert.push_back({CellKey{pair.first.row, pair.first.col - count}, pair.second});
-        }
-    }
-    for (const auto& key : toRemove) m_cells.erase(key);
-    for (auto& [key, cell] : toReinsert) m_cells.emplace(key, std::move(cell));
+    applyStructuralEdit(StructuralEdit{false, column, -count}, [&]() { m_cells.removeColumns(column, count); });
     m_columnCount -= count;
-    m_maxRowColDirty = true;
 }
 
 QString Spreadsheet::getSheetName() const { return m_sheetName; }
 void Spreadsheet::setSheetName(const QString& name) { m_sheetName = name; }
 
-void Spreadsheet::updateMaxRowCol() const {
-    if (!m_maxRowColDirty) return;
-    m_cachedMaxRow = -1;
-    m_cachedMaxCol = -1;
-    for (const auto& pair : m_cells) {
-        if (pair.second && pair.second->getType() != CellType::Empty) {
-            if (pair.first.row > m_cachedMaxRow) m_cachedMaxRow = pair.first.row;
-            if (pair.first.col > m_cachedMaxCol) m_cachedMaxCol = pair.first.col;
+static void adjustOccupancy(std::map<int, int>& counts, int key, int delta) {
+    auto it = counts.try_emplace(key, 0).first;
+    if ((it->second += delta) == 0) counts.erase(it);
+}
+
+void Spreadsheet::trackCell(int row, int col, Cell& cell) const {
+    if (m_trackingStale) return;
+    bool occupied = cell.getType() != CellType::Empty;
+    if (occupied != cell.isCounted()) {
+        adjustOccupancy(m_rowOccupancy, row, occupied ? 1 : -1);
+        adjustOccupancy(m_columnOccupancy, col, occupied ? 1 : -1);
+        cell.setCounted(occupied);
+    }
+    if (cell.isDirty() && !cell.isDirtyListed()) {
+        cell.setDirtyListed(true);
+        m_dirtyCells.emplace_back(row, col);
+    }
+    bool formula = cell.getType() == CellType::Formula;
+    if (formula != cell.isFormulaListed()) {
+        if (formula) m_formulaCells.insert({row, col});
+        else m_formulaCells.erase({row, col});
+        cell.setFormulaListed(formula);
+    }
+}
+
+void Spreadsheet::syncTracking() const {
+    if (m_trackingStale) {
+        m_trackingStale = false;
+        m_rowOccupancy.clear();
+        m_columnOccupancy.clear();
+        m_dirtyCells.clear();
+        m_formulaCells.clear();
+        m_cells.forEach([this](int row, int col, Cell& cell) {
+            cell.setCounted(false);
+            cell.setDirtyListed(false);
+            cell.setFormulaListed(false);
+            trackCell(row, col, cell);
+        });
+    } else {
+        for (const auto& addr : m_untrackedCells) {
+            if (Cell* cell = m_cells.peek(addr.row, addr.col)) trackCell(addr.row, addr.col, *cell);
         }
     }
-    m_maxRowColDirty = false;
+    m_untrackedCells.clear();
+}
+
+// Moves the keys of counts at or after 'from' by delta
+static void shiftOccupancy(std::map<int, int>& counts, int from, int delta) {
+    auto first = counts.lower_bound(from);
+    std::vector<std::pair<int, int>> moved(first, counts.end());
+    counts.erase(first, counts.end());
+    for (const auto& [key, count] : moved) counts.emplace(key + delta, count);
+}
+
+// Listed formula cells inside range, row by row
+std::vector<CellAddress> Spreadsheet::formulaCellsIn(const CellRange& range) const {
+    std::vector<CellAddress> cells;
+    CellAddress start = range.getStart(), end = range.getEnd();
+    for (auto it = m_formulaCells.lower_bound({start.row, INT32_MIN});
+         it != m_formulaCells.end() && it->row <= end.row; ++it) {
+        if (it->col >= start.col && it->col <= end.col) cells.emplace_back(it->row, it->col);
+    }
+    return cells;
 }
 
-int Spreadsheet::getMaxRow() const { updateMaxRowCol(); return m_cachedMaxRow; }
-int Spreadsheet::getMaxColumn() const { updateMaxRowCol(); return m_cachedMaxCol; }
+// Row and column edits: deleted cells leave the counts, the lines after the
+// edit move with their cells and listed dirty, formula and volatile cells
+// follow them. Costs the deleted cells plus the occupied lines past the edit
+// (shift-cells edits: the cells moved within the band) rather than a rescan
+// of the sheet.
+void Spreadsheet::shiftTracking(const StructuralEdit& edit) {
+    if (!m_volatileCellsStale && !m_volatileCells.empty()) {
+        std::unordered_set<CellKey, CellKeyHash> shifted;
+        for (const auto& key : m_volatileCells) {
+            CellAddress addr(key.row, key.col);
+            if (edit.apply(addr)) shifted.insert({addr.row, addr.col});
+        }
+        m_volatileCells.swap(shifted);
+        m_volatilePlanGeneration = UINT64_MAX;
+    }
+    if (m_trackingStale) return;
+    syncTracking();
+
+    std::map<int, int>& along = edit.rows ? m_rowOccupancy : m_columnOccupancy;
+    std::map<int, int>& across = edit.rows ? m_columnOccupancy : m_rowOccupancy;
+    auto region = [&](int start, int end, auto&& fn) {
+        if (edit.rows) m_cells.forEachInRange(start, end, edit.bandStart, edit.bandEnd, fn);
+        else m_cells.forEachInRange(edit.bandStart, edit.bandEnd, start, end, fn);
+    };
+    if (edit.count < 0) {
+        region(edit.at, edit.at - edit.count - 1, [&](int row, int col, Cell& cell) {
+            if (!cell.isCounted()) return;
+            adjustOccupancy(along, edit.rows ? row : col, -1);
+            adjustOccupancy(across, edit.rows ? col : row, -1);
+        });
+    }
+    bool wholeLines = edit.bandStart <= 0 && edit.bandEnd == INT32_MAX;
+    if (wholeLines) {
+        shiftOccupancy(along, edit.at, edit.count);
+    } else {
+        int from = edit.count < 0 ? edit.at - edit.count : edit.at;
+        region(from, INT32_MAX, [&](int row, int col, Cell& cell) {
+            if (!cell.isCounted()) return;
+            int line = edit.rows ? row : col;
+            adjustOccupancy(along, line, -1);
+            adjustOccupancy(along, line + edit.count, 1);
+        });
+    }
+
+    std::vector<CellAddress> dirty;
+    dirty.reserve(m_dirtyCells.size());
+    for (CellAddress addr : m_dirtyCells) {
+        if (edit.apply(addr)) dirty.push_back(addr);
+    }
+    m_dirtyCells.swap(dirty);
+
+    std::vector<CellAddress> formulas = formulaCellsIn(edit.region());
+    for (const auto& addr : formulas) m_formulaCells.erase({addr.row, addr.col});
+    for (CellAddress addr : formulas) {
+        if (edit.apply(addr)) m_formulaCells.insert({addr.row, addr.col});
+    }
+}
+
+int Spreadsheet::getMaxRow() const {
+    syncTracking();
+    return m_rowOccupancy.empty() ? -1 : m_rowOccupancy.rbegin()->first;
+}
+
+int Spreadsheet::getMaxColumn() const {
+    syncTracking();
+    return m_columnOccupancy.empty() ? -1 : m_columnOccupancy.rbegin()->first;
+}
 
 std::vector<CellAddress> Spreadsheet::getDirtyCells() const {
+    syncTracking();
     std::vector<CellAddress> dirty;
-    for (const auto& pair : m_cells) {
-        if (pair.second->isDirty()) {
-            dirty.push_back(CellAddress(pair.first.row, pair.first.col));
-        }
+    for (const auto& addr : m_dirtyCells) {
+        const Cell* cell = m_cells.peek(addr.row, addr.col);
+        if (cell && cell->isDirty()) dirty.push_back(addr);
     }
+    // Cells listed before a sort moved them may be listed twice
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
     return dirty;
 }
 
 void Spreadsheet::clearDirtyFlag() {
-    for (auto& pair : m_cells) pair.second->setDirty(false);
+    syncTracking();
+    for (const auto& addr : m_dirtyCells) {
+        if (Cell* cell = m_cells.peek(addr.row, addr.col)) {
+            cell->setDirty(false);
+            cell->setDirtyListed(false);
+        }
+    }
+    m_dirtyCells.clear();
 }
 
-void Spreadsheet::startTransaction() { m_inTransaction = true; }
+void Spreadsheet::startTransaction() {
+    if (m_inTransaction) return;
+    m_inTransaction = true;
+    m_transactionStart = m_batchChanged.size();
+    beginBatch();
+}
 
 void Spreadsheet::commitTransaction() {
+    if (!m_inTransaction) return;
     m_inTransaction = false;
-    if (m_autoRecalculate) recalculateAll();
+    endBatch();
 }
 
-void Spreadsheet::rollbackTransaction() { m_inTransaction = false; }
+// Closes the transaction's batch without recalculating its edits; changes
+// recorded by an enclosing batch are kept
+void Spreadsheet::rollbackTransaction() {
+    if (!m_inTransaction) return;
+    m_inTransaction = false;
+    m_batchChanged.resize(std::min(m_transactionStart, m_batchChanged.size()));
+    if (m_batchDepth > 0) m_batchDepth--;
+}
 
 FormulaEngine& Spreadsheet::getFormulaEngine() { return *m_formulaEngine; }
+
+std::shared_ptr<const LookupIndex> Spreadsheet::getLookupIndex(const CellRange& range, LookupIndex::Kind kind) const {
+    return m_lookupCache.get(*this, range, kind);
+}
+
+std::shared_ptr<const ConditionalIndex> Spreadsheet::getConditionalIndex(const std::vector<CellRange>& criteriaRanges,
+                                                                         const CellRange* valueRange) const {
+    return m_lookupCache.getConditional(*this, criteriaRanges, valueRange);
+}
+
+std::shared_ptr<const RangeAggregate> Spreadsheet::getRangeAggregate(const CellRange& range) const {
+    return m_lookupCache.getAggregate(*this, range);
+}
+
+std::shared_ptr<const SortedValues> Spreadsheet::getSortedValues(const CellRange& range) const {
+    return m_lookupCache.getSorted(*this, range);
+}
 void Spreadsheet::setAutoRecalculate(bool enabled) { m_autoRecalculate = enabled; }
 bool Spreadsheet::getAutoRecalculate() const { return m_autoRecalculate; }
 
@@ -239,187 +412,627 @@ const SparklineConfig* Spreadsheet::getSparkline(const CellAddress& addr) const
 }
 
 CellSnapshot Spreadsheet::takeCellSnapshot(const CellAddress& addr) {
-    auto cell = getCell(addr);
+    auto cell = m_cells.getOrCreate(addr.row, addr.col);
     CellSnapshot snap;
     snap.addr = addr;
     snap.value = cell->getValue();
     snap.formula = cell->getFormula();
-    snap.style = cell->getStyle();
+    snap.styleId = cell->getStyleId();
     snap.type = cell->getType();
     return snap;
 }
 
 void Spreadsheet::forEachCell(std::function<void(int row, int col, const Cell&)> callback) const {
-    for (const auto& pair : m_cells) {
-        if (pair.second && pair.second->getType() != CellType::Empty) {
-            callback(pair.first.row, pair.first.col, *pair.second);
+    m_cells.forEach([&callback](int row, int col, const Cell& cell) {
+        if (cell.getType() != CellType::Empty) callback(row, col, cell);
+    });
+}
+
+const CompiledFormula& Spreadsheet::compiledFormula(Cell& cell, const CellAddress& addr) {
+    // Cells whose formula was set directly on the Cell (undo, import) compile lazily
+    if (!cell.getCompiledFormula()) {
+        cell.setCompiledFormula(CompiledFormula::compile(cell.getFormula(), addr));
+    }
+    return *cell.getCompiledFormula();
+}
+
+// Compiled references are relative to the cell's address, so formulas that
+// a sort moved recompile from their text (which still names the same cells)
+void Spreadsheet::invalidateCompiledFormulas(const CellRange& range) {
+    m_cells.forEachInRange(range.getStart().row, range.getEnd().row, range.getStart().col, range.getEnd().col,
+                           [](int, int, Cell& cell) {
+        if (cell.getType() == CellType::Formula) cell.setCompiledFormula(nullptr);
+    });
+    m_volatileCellsStale = true;
+}
+
+// Only formulas that move or read moved cells are touched: their text is
+// rewritten, they recompile (sharing programs through the R1C1 cache, so a
+// block that moved as a whole reuses its programs) and their edges are
+// re-registered. Of those, only ones whose references changed size or lost
+// their cells are recalculated; a reference that just moved along with its
+// cells reads the same values.
+void Spreadsheet::applyStructuralEdit(const StructuralEdit& edit, const std::function<void()>& moveCells) {
+    // Cells an open batch recorded move too; deleted ones are dropped
+    if (!m_batchChanged.empty()) {
+        std::vector<CellAddress> kept;
+        for (CellAddress addr : m_batchChanged) {
+            if (edit.apply(addr)) kept.push_back(addr);
         }
+        m_batchChanged.swap(kept);
+    }
+
+    // Spilled values don't move with their anchors, which spill again below
+    std::vector<CellAddress> recalc;
+    for (const auto& [key, entry] : m_spills) {
+        CellAddress anchor(key.row, key.col);
+        if (edit.apply(anchor)) recalc.push_back(anchor);
+    }
+    releaseSpills();
+
+    // The formulas touched are found through the formula cells and the
+    // references registered over the moved cells, before anything moves
+    syncTracking();
+    CellRange region = edit.region();
+    std::vector<CellAddress> formulas = formulaCellsIn(region);
+    std::vector<CellAddress> readers = m_depGraph.getReaders(region);
+    formulas.insert(formulas.end(), readers.begin(), readers.end());
+    std::unordered_map<Spreadsheet*, std::vector<CellAddress>> foreignReaders;
+    if (m_workbook) {
+        for (const auto& [sheet, cell] : m_workbook->getReaders(this, region)) foreignReaders[sheet].push_back(cell);
+    }
+
+    std::vector<CellAddress> rewritten = rewriteReferences(edit, *this, std::move(formulas), [&]() {
+        shiftTracking(edit);
+        moveCells();
+    });
+    recalc.insert(recalc.end(), rewritten.begin(), rewritten.end());
+    m_lookupCache.clear();
+
+    std::vector<std::pair<Spreadsheet*, std::vector<CellAddress>>> foreign;
+    if (m_workbook) {
+        for (const auto& sheet : m_workbook->sheets()) {
+            auto it = foreignReaders.find(sheet.get());
+            if (sheet.get() == this || it == foreignReaders.end()) continue;
+            std::vector<CellAddress> cells = sheet->rewriteReferences(edit, *this, std::move(it->second), nullptr);
+            if (!cells.empty()) foreign.emplace_back(sheet.get(), std::move(cells));
+        }
+    }
+
+    if (m_autoRecalculate) {
+        if (!recalc.empty()) recalculateChanged(recalc);
+        for (auto& [sheet, cells] : foreign) sheet->recalculateChanged(cells);
     }
 }
 
-void Spreadsheet::recalculate(const CellAddress& addr) {
-    auto cell = getCellIfExists(addr);
-    if (cell && cell->getType() == CellType::Formula) {
-        cell->setComputedValue(m_formulaEngine->evaluate(cell->getFormula()));
+std::vector<CellAddress> Spreadsheet::rewriteReferences(const StructuralEdit& edit, const Spreadsheet& edited,
+                                                        std::vector<CellAddress> formulas,
+                                                        const std::function<void()>& moveCells) {
+    struct Rewrite {
+        CellAddress from;
+        CellAddress to;
+        QString formula;
+        bool deleted;
+    };
+    std::vector<Rewrite> rewrites;
+    std::vector<CellAddress> recalc;
+    bool own = &edited == this;
+    QString sheet = edited.getSheetName();
+    std::sort(formulas.begin(), formulas.end());
+    formulas.erase(std::unique(formulas.begin(), formulas.end()), formulas.end());
+    for (const CellAddress& from : formulas) {
+        const Cell* cell = m_cells.peek(from.row, from.col);
+        if (!cell || cell->getType() != CellType::Formula) continue;
+        CellAddress to = from;
+        bool kept = !own || edit.apply(to);
+        bool resized = false;
+        QString formula = kept ? CompiledFormula::adjustReferences(cell->getFormula(), edit, sheet, own, &resized) : QString();
+        if (kept && to == from && formula == cell->getFormula()) {
+            // A range only partly inside a shift-cells band keeps its text
+            // but had cells moved through it
+            recalc.push_back(to);
+            continue;
+        }
+        rewrites.push_back({from, to, formula, !kept});
+        if (resized) recalc.push_back(to);
+    }
+
+    for (const auto& rewrite : rewrites) {
+        m_depGraph.removeDependencies(rewrite.from);
+        if (m_workbook) m_workbook->removeDependencies(this, rewrite.from);
+    }
+    if (moveCells) moveCells();
+    for (const auto& rewrite : rewrites) {
+        if (rewrite.deleted) continue;
+        auto cell = getCellIfExists(rewrite.to);
+        if (!cell) continue;
+        cell->setFormula(rewrite.formula);
+        cell->setCompiledFormula(CompiledFormula::compile(rewrite.formula, rewrite.to));
+        trackCell(rewrite.to.row, rewrite.to.col, *cell);
+        updateDependencies(rewrite.to);
     }
+    return recalc;
 }
 
-void Spreadsheet::recalculateAll() {
-    for (auto& pair : m_cells) {
-        if (pair.second->getType() == CellType::Formula) {
-            CellAddress addr(pair.first.row, pair.first.col);
-            pair.second->setComputedValue(m_formulaEngine->evaluate(pair.second->getFormula()));
-            updateDependencies(addr);
+void Spreadsheet::trackVolatile(const CellAddress& addr, bool isVolatile) {
+    bool changed = isVolatile ? m_volatileCells.insert({addr.row, addr.col}).second
+                              : m_volatileCells.erase({addr.row, addr.col}) > 0;
+    if (changed) m_volatilePlanGeneration = UINT64_MAX;
+}
+
+bool Spreadsheet::recalculateVolatile() {
+    if (m_volatileCellsStale) {
+        m_volatileCells.clear();
+        std::vector<CellAddress> formulas;
+        m_cells.forEach([&formulas](int row, int col, const Cell& cell) {
+            if (cell.getType() == CellType::Formula) formulas.emplace_back(row, col);
+        });
+        for (const auto& addr : formulas) {
+            if (compiledFormula(*getCellIfExists(addr), addr).isVolatile()) m_volatileCells.insert({addr.row, addr.col});
         }
+        m_volatileCellsStale = false;
+        m_volatilePlanGeneration = UINT64_MAX;
+    }
+    if (m_volatileCells.empty()) return false;
+
+    if (m_workbook && m_workbook->hasCrossSheetDependencies()) {
+        std::vector<CellAddress> roots;
+        for (const auto& key : m_volatileCells) roots.emplace_back(key.row, key.col);
+        m_workbook->recalculateFrom(this, roots, true);
+        return true;
+    }
+
+    if (m_volatilePlanGeneration != m_depGraph.generation()) {
+        std::vector<CellAddress> roots;
+        roots.reserve(m_volatileCells.size());
+        for (const auto& key : m_volatileCells) roots.emplace_back(key.row, key.col);
+        m_volatilePlan = m_depGraph.getRecalcPlan(roots, true);
+        m_volatilePlanGeneration = m_depGraph.generation();
+    }
+    runRecalcPlan(m_volatilePlan);
+    return true;
+}
+
+void Spreadsheet::recalculate(const CellAddress& addr) {
+    auto cell = getCellIfExists(addr);
+    if (cell && cell->getType() == CellType::Formula) {
+        cell->setComputedValue(m_formulaEngine->evaluate(compiledFormula(*cell, addr), addr));
+        m_lookupCache.invalidate(addr);
     }
 }
 
 void Spreadsheet::updateDependencies(const CellAddress& addr) {
     m_depGraph.removeDependencies(addr);
+    if (m_workbook) m_workbook->removeDependencies(this, addr);
     auto cell = getCellIfExists(addr);
     if (cell && cell->getType() == CellType::Formula) {
-        m_formulaEngine->evaluate(cell->getFormula());
-        for (const auto& dep : m_formulaEngine->getLastDependencies()) {
-            m_depGraph.addDependency(addr, dep);
+        // References are static in the compiled form, no evaluation needed
+        const CompiledFormula& formula = compiledFormula(*cell, addr);
+        trackVolatile(addr, formula.isVolatile());
+        // Qualified references go to the workbook, unless they name this
+        // sheet; ones naming no sheet evaluate to #REF! and need no edge
+        std::vector<Spreadsheet*> sheets{this};
+        for (const auto& name : formula.sheetNames()) sheets.push_back(m_workbook ? m_workbook->findSheet(name) : nullptr);
+        auto link = [&](uint8_t slot, const CellRange& range) {
+            Spreadsheet* target = sheets[slot];
+            if (target == this) m_depGraph.addRangeDependency(addr, range);
+            else if (target) m_workbook->addDependency(this, addr, target, range);
+        };
+        for (const auto& dep : formula.cellRefs()) {
+            if (dep.sheet == 0) m_depGraph.addDependency(addr, dep.resolve(addr));
+            else link(dep.sheet, CellRange(dep.resolve(addr), dep.resolve(addr)));
         }
+        for (const auto& range : formula.rangeRefs()) {
+            link(range.sheet(), range.resolve(addr));
+        }
+    } else {
+        trackVolatile(addr, false);
     }
 }
 
+std::vector<CellAddress> Spreadsheet::relinkSheetReferences() {
+    std::vector<CellAddress> formulas;
+    m_cells.forEach([&formulas](int row, int col, const Cell& cell) {
+        if (cell.getType() == CellType::Formula) formulas.emplace_back(row, col);
+    });
+    std::vector<CellAddress> relinked;
+    for (const auto& addr : formulas) {
+        if (compiledFormula(*getCellIfExists(addr), addr).sheetNames().empty()) continue;
+        updateDependencies(addr);
+        relinked.push_back(addr);
+    }
+    return relinked;
+}
+
 void Spreadsheet::recalculateDependents(const CellAddress& addr) {
-    auto order = m_depGraph.getRecalcOrder(addr);
-    for (const auto& depAddr : order) {
-        auto cell = getCellIfExists(depAddr);
+    recalculateFrom({addr}, false);
+}
+
+void Spreadsheet::recalculateChanged(const std::vector<CellAddress>& changed) {
+    if (m_batchDepth > 0) m_batchChanged.insert(m_batchChanged.end(), changed.begin(), changed.end());
+    else recalculateFrom(changed, true);
+}
+
+// Evaluates each dirty formula exactly once, inputs before dependents
+void Spreadsheet::recalculateFrom(const std::vector<CellAddress>& changed, bool includeChanged) {
+    if (m_workbook && m_workbook->hasCrossSheetDependencies()) {
+        m_workbook->recalculateFrom(this, changed, includeChanged);
+        return;
+    }
+    runRecalcPlan(m_depGraph.getRecalcPlan(changed, includeChanged));
+}
+
+void Spreadsheet::runRecalcPlan(const DependencyGraph::RecalcPlan& plan) {
+    // Every formula result below may change, so indexes over those cells go
+    // first. Edited values in the plan already updated theirs.
+    for (const auto& addr : plan.circular) m_lookupCache.invalidate(addr);
+
+    // Resolve and compile on this thread; workers only evaluate and store results
+    std::vector<Cell*> cells(plan.order.size(), nullptr);
+    for (size_t i = 0; i < plan.order.size(); ++i) {
+        auto cell = getCellIfExists(plan.order[i]);
+        if (cell && cell->getType() == CellType::Formula) {
+            m_lookupCache.invalidate(plan.order[i]);
+            compiledFormula(*cell, plan.order[i]);
+            cells[i] = cell;
+        }
+    }
+    m_arrayResults.assign(plan.order.size(), nullptr);
+    for (size_t level = 0; level + 1 < plan.levelStarts.size(); ++level) {
+        size_t begin = plan.levelStarts[level], end = plan.levelStarts[level + 1];
+        evaluateCells(cells, plan.order, begin, end);
+        // Array results land on the sheet before the next level reads them;
+        // anchors that no longer produce one give their block back
+        for (size_t i = begin; i < end; ++i) {
+            if (m_arrayResults[i]) spill(plan.order[i], m_arrayResults[i].get());
+            else if (cells[i] && !m_spills.empty() && m_spills.count({plan.order[i].row, plan.order[i].col})) spill(plan.order[i], nullptr);
+        }
+    }
+    m_arrayResults.clear();
+
+    for (const auto& addr : plan.circular) {
+        auto cell = getCellIfExists(addr);
         if (cell && cell->getType() == CellType::Formula) {
-            cell->setComputedValue(m_formulaEngine->evaluate(cell->getFormula()));
+            if (m_spills.count({addr.row, addr.col})) spill(addr, nullptr);
+            cell->setComputedValue(Value::error(ErrorCode::Circular));
         }
     }
+
+    // The plan only knew the blocks spills had before it ran; readers of
+    // cells that one newly filled or gave back are updated in one more pass
+    if (!m_spillMoved.empty() && !m_inSpillFollowUp) {
+        std::vector<CellAddress> moved;
+        moved.swap(m_spillMoved);
+        m_inSpillFollowUp = true;
+        recalculateFrom(moved, false);
+        m_inSpillFollowUp = false;
+    }
+}
+
+void Spreadsheet::spill(const CellAddress& anchor, const ValueArray* array) {
+    auto it = m_spills.find({anchor.row, anchor.col});
+    bool owned = it != m_spills.end() && !it->second.blocked;
+    CellRange known = it != m_spills.end() ? it->second.range : CellRange(anchor, anchor);  // as the plan saw it
+    CellRange before = owned ? known : CellRange(anchor, anchor);
+    CellRange after = array ? CellRange(anchor.row, anchor.col, anchor.row + array->rows - 1, anchor.col + array->cols - 1)
+                            : CellRange(anchor, anchor);
+
+    // Anything in the block other than this anchor's own spilled values is in the way
+    bool blocked = false;
+    if (array) {
+        forEachCellInRange(after, [&](int row, int col, const Cell& cell) {
+            if (row == anchor.row && col == anchor.col) return true;
+            if (cell.getType() == CellType::Empty) return true;
+            blocked = !(cell.isSpilled() && before.contains(row, col));
+            return !blocked;
+        });
+    }
+    bool placed = array && !blocked;
+
+    auto write = [&](int row, int col, Cell& cell, const Value& value) {
+        HeldValue old = cell.getResult();
+        if (cell.isSpilled() && old.get() == value) return;
+        cell.setValue(value);
+        cell.setSpilled(placed && value.type() != Value::Type::Empty);
+        trackCell(row, col, cell);
+        m_lookupCache.update(*this, CellAddress(row, col), old, value);
+    };
+    if (owned) {
+        m_cells.forEachInRange(before.getStart().row, before.getEnd().row, before.getStart().col, before.getEnd().col,
+                               [&](int row, int col, Cell& cell) {
+            if (!cell.isSpilled() || (placed && after.contains(row, col))) return;
+            write(row, col, cell, Value());
+            if (!after.contains(row, col)) m_spillMoved.emplace_back(row, col);
+        });
+    }
+    if (placed) {
+        for (int row = anchor.row; row <= after.getEnd().row; ++row) {
+            for (int col = anchor.col; col <= after.getEnd().col; ++col) {
+                if (row == anchor.row && col == anchor.col) continue;
+                const Value& value = array->at(row - anchor.row, col - anchor.col);
+                if (value.isEmpty() && !m_cells.peek(row, col)) continue;
+                write(row, col, *m_cells.getOrCreate(row, col), value);
+                if (!known.contains(row, col)) m_spillMoved.emplace_back(row, col);
+            }
+        }
+    }
+
+    if (array) {
+        if (blocked) {
+            if (auto cell = getCellIfExists(anchor)) cell->setComputedValue(Value::error(ErrorCode::Spill));
+        }
+        m_spills[{anchor.row, anchor.col}] = Spill{after, blocked};
+        m_depGraph.setSpillRange(anchor, after);
+    } else if (it != m_spills.end()) {
+        m_spills.erase(it);
+        m_depGraph.removeSpillRange(anchor);
+    }
+}
+
+// Gives back the blocks of anchors in range or spilling (or blocked) into
+// it, before a sort moves cells under them; returns those anchors
+std::vector<CellAddress> Spreadsheet::releaseSpills(const CellRange& range) {
+    std::vector<CellAddress> anchors;
+    for (const auto& [key, entry] : m_spills) {
+        if (range.contains(key.row, key.col) || range.intersects(entry.range)) anchors.emplace_back(key.row, key.col);
+    }
+    for (const auto& anchor : anchors) spill(anchor, nullptr);
+    return anchors;
+}
+
+// Structural edits move spilled values away from their anchors; they are
+// cleared and come back when the anchors are next evaluated
+void Spreadsheet::releaseSpills() {
+    if (m_spills.empty()) return;
+    for (const auto& [key, entry] : m_spills) m_depGraph.removeSpillRange(CellAddress(key.row, key.col));
+    m_spills.clear();
+    m_cells.forEach([this](int row, int col, Cell& cell) {
+        if (!cell.isSpilled()) return;
+        cell.setValue(Value());
+        trackCell(row, col, cell);
+    });
+}
+
+// Cells of one level never read each other, so large levels are shared out
+// to workers. Each worker has its own engine since engines keep state from
+// the last evaluation; workers pull small batches to balance uneven formulas.
+void Spreadsheet::evaluateCells(const std::vector<Cell*>& cells, const std::vector<CellAddress>& addrs,
+                                size_t begin, size_t end) {
+    static constexpr size_t kParallelMinCells = 256;
+    static constexpr size_t kBatchSize = 32;
+
+    int threads = m_recalcThreadCount > 0 ? m_recalcThreadCount : QThread::idealThreadCount();
+    if (threads <= 1 || end - begin < kParallelMinCells) {
+        for (size_t i = begin; i < end; ++i) {
+            if (!cells[i]) continue;
+            cells[i]->setComputedValue(m_formulaEngine->evaluate(*cells[i]->getCompiledFormula(), addrs[i]));
+            m_arrayResults[i] = m_formulaEngine->takeArrayResult();
+        }
+        return;
+    }
+
+    while (m_workerEngines.size() < static_cast<size_t>(threads)) {
+        m_workerEngines.push_back(std::make_unique<FormulaEngine>(this));
+    }
+    std::vector<int> workers(threads);
+    std::iota(workers.begin(), workers.end(), 0);
+    std::atomic<size_t> next{begin};
+    QtConcurrent::blockingMap(workers, [&](int& worker) {
+        FormulaEngine& engine = *m_workerEngines[worker];
+        for (size_t start = next.fetch_add(kBatchSize); start < end; start = next.fetch_add(kBatchSize)) {
+            size_t stop = std::min(start + kBatchSize, end);
+            for (size_t i = start; i < stop; ++i) {
+                if (!cells[i]) continue;
+                cells[i]->setComputedValue(engine.evaluate(*cells[i]->getCompiledFormula(), addrs[i]));
+                m_arrayResults[i] = engine.takeArrayResult();
+            }
+        }
+    });
+}
+
+// Sort key of one cell, computed once per sort. Numbers (and numeric
+// text) order before text, booleans and errors; blanks go last whichever
+// way the key sorts.
+struct SortValue {
+    enum Kind : uint8_t { Number, Text, Boolean, Error, Blank };
+    Kind kind = Blank;
+    double number = 0;  // Number, Boolean, Error (the code)
+    QString text;       // Text, case-folded
+};
+
+static SortValue sortValue(const Cell* cell) {
+    SortValue key;
+    if (!cell) return key;
+    const Value& value = cell->getResult();
+    switch (value.type()) {
+        case Value::Type::Number:
+            key.kind = SortValue::Number;
+            key.number = value.asNumber();
+            break;
+        case Value::Type::Boolean:
+            key.kind = SortValue::Boolean;
+            key.number = value.asBoolean() ? 1 : 0;
+            break;
+        case Value::Type::Error:
+            key.kind = SortValue::Error;
+            key.number = static_cast<int>(value.errorCode());
+            break;
+        case Value::Type::Text: {
+            QString text = value.toString();
+            if (text.isEmpty()) break;
+            bool ok = false;
+            key.number = text.toDouble(&ok);
+            key.kind = ok ? SortValue::Number : SortValue::Text;
+            if (!ok) key.text = text.toCaseFolded();
+            break;
+        }
+        default:
+            break;
+    }
+    return key;
+}
+
+static int compareSortValues(const SortValue& a, const SortValue& b) {
+    if (a.kind != b.kind) return a.kind < b.kind ? -1 : 1;
+    if (a.kind == SortValue::Text) return a.text.compare(b.text);
+    return a.number < b.number ? -1 : (a.number > b.number ? 1 : 0);
 }
 
 void Spreadsheet::sortRange(const CellRange& range, int sortColumn, bool ascending) {
+    sortRange(range, {SortKey{sortColumn, ascending}});
+}
+
+// Keys are read into typed arrays once, a permutation of row offsets is
+// merge sorted (runs sorted on workers, then merged pairwise) and each
+// column is then rearranged in one pass over its stored cells.
+void Spreadsheet::sortRange(const CellRange& range, const std::vector<SortKey>& keys) {
+    static constexpr size_t kParallelMinRows = 16384;
+
     int startRow = range.getStart().row;
     int endRow = range.getEnd().row;
     int startCol = range.getStart().col;
     int endCol = range.getEnd().col;
-    if (startRow >= endRow) return;
+    if (startRow >= endRow || keys.empty()) return;
+    const size_t rowCount = static_cast<size_t>(endRow - startRow) + 1;
+
+    // Spilled values don't move with the rows; anchors outside the range
+    // re-run at the end, ones inside move with their rows
+    std::vector<CellAddress> anchors = releaseSpills(range);
 
-    struct RowData {
-        QVariant sortValue;
-        std::vector<std::pair<int, std::shared_ptr<Cell>>> cells;
+    int threads = m_recalcThreadCount > 0 ? m_recalcThreadCount : QThread::idealThreadCount();
+    if (rowCount < kParallelMinRows) threads = 1;
+    // Runs of rows handed to workers; run r covers [bounds[r], bounds[r + 1])
+    std::vector<size_t> bounds;
+    for (int r = 0; r <= threads; ++r) bounds.push_back(rowCount * r / threads);
+    auto forEachRun = [&](auto&& fn) {
+        std::vector<int> runs(threads);
+        std::iota(runs.begin(), runs.end(), 0);
+        if (threads == 1) fn(runs[0]);
+        else QtConcurrent::blockingMap(runs, fn);
     };
 
-    std::vector<RowData> rows;
-    for (int r = startRow; r <= endRow; ++r) {
-        RowData rd;
-        rd.sortValue = getCellValue(CellAddress(r, sortColumn));
-        for (int c = startCol; c <= endCol; ++c) {
-            auto it = m_cells.find(CellKey{r, c});
-            if (it != m_cells.end()) rd.cells.push_back({c, it->second});
+    std::vector<std::vector<SortValue>> values(keys.size(), std::vector<SortValue>(rowCount));
+    forEachRun([&](int& run) {
+        for (size_t k = 0; k < keys.size(); ++k) {
+            for (size_t i = bounds[run]; i < bounds[run + 1]; ++i) {
+                values[k][i] = sortValue(m_cells.peek(startRow + static_cast<int>(i), keys[k].column));
+            }
+        }
+    });
+
+    auto less = [&](uint32_t a, uint32_t b) {
+        for (size_t k = 0; k < keys.size(); ++k) {
+            const SortValue& x = values[k][a];
+            const SortValue& y = values[k][b];
+            if ((x.kind == SortValue::Blank) != (y.kind == SortValue::Blank)) return y.kind == SortValue::Blank;
+            int cmp = compareSortValues(x, y);
+            if (cmp != 0) return keys[k].ascending ? cmp < 0 : cmp > 0;
         }
-        rows.push_back(std::move(rd));
-    }
-
-    std::sort(rows.begin(), rows.end(), [ascending](const RowData& a, const RowData& b) {
-        bool aEmpty = !a.sortValue.isValid() || a.sortValue.toString().isEmpty();
-        bool bEmpty = !b.sortValue.isValid() || b.sortValue.toString().isEmpty();
-        if (aEmpty && bEmpty) return false;
-        if (aEmpty) return false;
-        if (bEmpty) return true;
-        bool aOk, bOk;
-        double aNum = a.sortValue.toString().toDouble(&aOk);
-        double bNum = b.sortValue.toString().toDouble(&bOk);
-        if (aOk && bOk) return ascending ? (aNum < bNum) : (aNum > bNum);
-        int cmp = a.sortValue.toString().compare(b.sortValue.toString(), Qt::CaseInsensitive);
-        return ascending ? (cmp < 0) : (cmp > 0);
+        return false;
+    };
+    std::vector<uint32_t> order(rowCount);
+    std::iota(order.begin(), order.end(), 0u);
+    forEachRun([&](int& run) { std::stable_sort(order.begin() + bounds[run], order.begin() + bounds[run + 1], less); });
+    for (size_t width = 1; width < static_cast<size_t>(threads); width *= 2) {
+        std::vector<int> merges;
+        for (size_t r = 0; r + width < static_cast<size_t>(threads); r += 2 * width) merges.push_back(static_cast<int>(r));
+        QtConcurrent::blockingMap(merges, [&](int& r) {
+            size_t mid = bounds[r + width];
+            size_t last = bounds[std::min(r + 2 * width, static_cast<size_t>(threads))];
+            std::inplace_merge(order.begin() + bounds[r], order.begin() + mid, order.begin() + last, less);
+        });
+    }
+    values.clear();
+
+    // Formula cells are re-registered where they land
+    syncTracking();
+    std::vector<CellAddress> formulas;
+    forEachCellInRange(range, [&](int row, int col, const Cell& cell) {
+        if (cell.getType() == CellType::Formula) formulas.emplace_back(row, col);
+        return true;
     });
+    for (const auto& addr : formulas) {
+        m_depGraph.removeDependencies(addr);
+        if (m_workbook) m_workbook->removeDependencies(this, addr);
+        m_formulaCells.erase({addr.row, addr.col});
+    }
 
-    for (int r = startRow; r <= endRow; ++r)
-        for (int c = startCol; c <= endCol; ++c)
-            m_cells.erase(CellKey{r, c});
+    // Cells keep their column and occupancy, so only the range's row counts
+    // follow them; dirty and formula cells are listed again where they land
+    std::vector<uint32_t> target(rowCount);
+    for (size_t i = 0; i < rowCount; ++i) target[order[i]] = static_cast<uint32_t>(i);
+    std::vector<int> occupied(rowCount, 0);
+    std::vector<CellAddress> moved;
+    for (int col = startCol; col <= endCol; ++col) {
+        std::vector<int> rows;
+        m_cells.forEachInRange(startRow, endRow, col, col, [&](int row, int, Cell& cell) {
+            rows.push_back(row);
+            if (cell.isCounted()) occupied[row - startRow]++;
+        });
+        std::vector<std::pair<int, Cell>> cells;
+        cells.reserve(rows.size());
+        for (int row : rows) cells.emplace_back(startRow + static_cast<int>(target[row - startRow]), std::move(*m_cells.take(row, col)));
+        for (auto& [row, cell] : cells) {
+            if (cell.isDirtyListed() && !m_trackingStale) m_dirtyCells.emplace_back(row, col);
+            if (cell.isFormulaListed() && !m_trackingStale) m_formulaCells.insert({row, col});
+            m_cells.put(row, col, std::move(cell));
+            moved.emplace_back(row, col);
+        }
+    }
+    if (!m_trackingStale) {
+        for (size_t i = 0; i < rowCount; ++i) {
+            int delta = occupied[order[i]] - occupied[i];
+            if (delta != 0) adjustOccupancy(m_rowOccupancy, startRow + static_cast<int>(i), delta);
+        }
+        // Repeated sorts would otherwise keep growing the list
+        if (m_dirtyCells.size() > 2 * m_cells.size() + 1024) m_trackingStale = true;
+    }
+    invalidateCompiledFormulas(range);
+    m_lookupCache.clear();
 
-    for (int i = 0; i < static_cast<int>(rows.size()); ++i) {
-        int targetRow = startRow + i;
-        for (auto& [col, cell] : rows[i].cells)
-            m_cells[CellKey{targetRow, col}] = cell;
+    for (const auto& addr : moved) {
+        if (m_cells.peek(addr.row, addr.col)->getType() == CellType::Formula) updateDependencies(addr);
+    }
+    for (const auto& anchor : anchors) {
+        if (!range.contains(anchor)) moved.push_back(anchor);
     }
-    m_maxRowColDirty = true;
+    if (m_autoRecalculate && !moved.empty()) recalculateChanged(moved);
 }
 
 void Spreadsheet::insertCellsShiftRight(const CellRange& range) {
     int startRow = range.getStart().row, endRow = range.getEnd().row;
     int startCol = range.getStart().col;
     int colCount = range.getEnd().col - startCol + 1;
-    for (int r = startRow; r <= endRow; ++r) {
-        std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> ri;
-        std::vector<CellKey> rm;
-        for (const auto& p : m_cells) {
-            if (p.first.row == r && p.first.col >= startCol) {
-                rm.push_back(p.first);
-                ri.push_back({CellKey{r, p.first.col + colCount}, p.second});
-            }
-        }
-        for (const auto& k : rm) m_cells.erase(k);
-        for (auto& [k, c] : ri) m_cells.emplace(k, std::move(c));
-    }
-    m_maxRowColDirty = true;
+    applyStructuralEdit(StructuralEdit{false, startCol, colCount, startRow, endRow}, [&]() {
+        for (int r = startRow; r <= endRow; ++r) m_cells.shiftColumns(r, startCol, colCount);
+    });
 }
 
 void Spreadsheet::insertCellsShiftDown(const CellRange& range) {
     int startRow = range.getStart().row;
     int startCol = range.getStart().col, endCol = range.getEnd().col;
     int rowCount = range.getEnd().row - startRow + 1;
-    for (int c = startCol; c <= endCol; ++c) {
-        std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> ri;
-        std::vector<CellKey> rm;
-        for (const auto& p : m_cells) {
-            if (p.first.col == c && p.first.row >= startRow) {
-                rm.push_back(p.first);
-                ri.push_back({CellKey{p.first.row + rowCount, c}, p.second});
-            }
-        }
-        for (const auto& k : rm) m_cells.erase(k);
-        for (auto& [k, cl] : ri) m_cells.emplace(k, std::move(cl));
-    }
-    m_maxRowColDirty = true;
+    applyStructuralEdit(StructuralEdit{true, startRow, rowCount, startCol, endCol}, [&]() {
+        for (int c = startCol; c <= endCol; ++c) m_cells.shiftRows(c, startRow, rowCount);
+    });
 }
 
 void Spreadsheet::deleteCellsShiftLeft(const CellRange& range) {
     int startRow = range.getStart().row, endRow = range.getEnd().row;
     int startCol = range.getStart().col, endCol = range.getEnd().col;
     int colCount = endCol - startCol + 1;
-    for (int r = startRow; r <= endRow; ++r) {
-        for (int c = startCol; c <= endCol; ++c) m_cells.erase(CellKey{r, c});
-        std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> ri;
-        std::vector<CellKey> rm;
-        for (const auto& p : m_cells) {
-            if (p.first.row == r && p.first.col > endCol) {
-                rm.push_back(p.first);
-                ri.push_back({CellKey{r, p.first.col - colCount}, p.second});
-            }
-        }
-        for (const auto& k : rm) m_cells.erase(k);
-        for (auto& [k, c] : ri) m_cells.emplace(k, std::move(c));
-    }
-    m_maxRowColDirty = true;
+    applyStructuralEdit(StructuralEdit{false, startCol, -colCount, startRow, endRow}, [&]() {
+        for (int r = startRow; r <= endRow; ++r) m_cells.shiftColumns(r, endCol + 1, -colCount);
+    });
 }
 
 void Spreadsheet::deleteCellsShiftUp(const CellRange& range) {
     int startRow = range.getStart().row, endRow = range.getEnd().row;
     int startCol = range.getStart().col, endCol = range.getEnd().col;
     int rowCount = endRow - startRow + 1;
-    for (int c = startCol; c <= endCol; ++c) {
-        for (int r = startRow; r <= endRow; ++r) m_cells.erase(CellKey{r, c});
-        std::vector<std::pair<CellKey, std::shared_ptr<Cell>>> ri;
-        std::vector<CellKey> rm;
-        for (const auto& p : m_cells) {
-            if (p.first.col == c && p.first.row > endRow) {
-                rm.push_back(p.first);
-                ri.push_back({CellKey{p.first.row - rowCount, c}, p.second});
-            }
-        }
-        for (const auto& k : rm) m_cells.erase(k);
-        for (auto& [k, cl] : ri) m_cells.emplace(k, std::move(cl));
-    }
-    m_maxRowColDirty = true;
+    applyStructuralEdit(StructuralEdit{true, startRow, -rowCount, startCol, endCol}, [&]() {
+        for (int c = startCol; c <= endCol; ++c) m_cells.shiftRows(c, endRow + 1, -rowCount);
+    });
 }
 
 // ============== Table Support ==============
@@ -4,40 +4,65 @@
 #include <QString>
 #include <QVariant>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 #include <functional>
+#include <algorithm>
 #include "Cell.h"
+#include "CellStore.h"
 #include "CellRange.h"
 #include "TableStyle.h"
 #include "FormulaEngine.h"
 #include "UndoManager.h"
 #include "DependencyGraph.h"
+#include "LookupIndex.h"
 #include "ConditionalFormatting.h"
 #include "SparklineConfig.h"
 
 struct PivotConfig; // forward declaration
+class Workbook;
 
 class Spreadsheet {
 public:
     Spreadsheet();
     ~Spreadsheet();
 
-    // Cell access and modification
-    std::shared_ptr<Cell> getCell(const CellAddress& addr);
-    std::shared_ptr<Cell> getCell(int row, int col);
+    // Cell access and modification. The pointer is only good until the sheet
+    // next removes or moves cells (clear, row/column edits, sort); see CellStore.
+    Cell* getCell(const CellAddress& addr);
+    Cell* getCell(int row, int col);
     // Read-only cell access - returns nullptr for non-existent cells (no allocation)
-    std::shared_ptr<Cell> getCellIfExists(const CellAddress& addr) const;
-    std::shared_ptr<Cell> getCellIfExists(int row, int col) const;
+    Cell* getCellIfExists(const CellAddress& addr) const;
+    Cell* getCellIfExists(int row, int col) const;
     QVariant getCellValue(const CellAddress& addr);
+    // Typed value or formula result, as seen by formulas (no QVariant)
+    Value getCellResult(const CellAddress& addr) const;
     void setCellValue(const CellAddress& addr, const QVariant& value);
+    // Text already interned in StringPool::shared() and held by the caller (bulk import)
+    void setCellText(const CellAddress& addr, uint32_t textId);
     void setCellFormula(const CellAddress& addr, const QString& formula);
 
+    // Batch editing. Between beginBatch() and endBatch() the setters above
+    // and the row/column operations update cells and the dependency graph
+    // but only record what changed; endBatch() recalculates everything
+    // downstream of the whole batch once, in one topological pass. Results
+    // read inside a batch may be stale. Batches nest.
+    void beginBatch();
+    void endBatch();
+    struct CellEdit {
+        CellAddress addr;
+        QVariant value;   // used when formula is empty
+        QString formula;
+    };
+    void applyBatch(const std::vector<CellEdit>& edits);
+
     // Range operations
     void fillRange(const CellRange& range, const QVariant& value);
     void clearRange(const CellRange& range);
-    std::vector<std::shared_ptr<Cell>> getRange(const CellRange& range);
+    std::vector<Cell*> getRange(const CellRange& range);
 
     // Row/Column operations
     void insertRow(int row, int count = 1);
@@ -48,6 +73,9 @@ public:
     // Sheet properties
     QString getSheetName() const;
     void setSheetName(const QString& name);
+    // Resolves Sheet2!A1 style references; set by Workbook::setSheets()
+    Workbook* getWorkbook() const { return m_workbook; }
+    void setWorkbook(Workbook* workbook) { m_workbook = workbook; }
     int getMaxRow() const;
     int getMaxColumn() const;
     int getRowCount() const { return m_rowCount; }
@@ -59,7 +87,8 @@ public:
     std::vector<CellAddress> getDirtyCells() const;
     void clearDirtyFlag();
 
-    // Undo/Redo
+    // Undo/Redo (a transaction is a batch). Rollback reverts nothing: it
+    // drops the recalculation the transaction's edits were waiting for.
     void startTransaction();
     void commitTransaction();
     void rollbackTransaction();
@@ -69,12 +98,41 @@ public:
 
     // Cell iteration (for serialization)
     void forEachCell(std::function<void(int row, int col, const Cell&)> callback) const;
+    // Stored cells inside the range, column by column (contiguous scan);
+    // fn may return false to stop early
+    template <typename Fn>
+    void forEachCellInRange(const CellRange& range, Fn&& fn) const {
+        m_cells.forEachInRange(range.getStart().row, range.getEnd().row,
+                               range.getStart().col, range.getEnd().col,
+                               [&](int row, int col, const Cell& cell) { return fn(row, col, cell); });
+    }
+
+    // Lookup indexes for VLOOKUP/HLOOKUP/XLOOKUP/MATCH, built on first use
+    // and dropped when a cell inside their range changes
+    std::shared_ptr<const LookupIndex> getLookupIndex(const CellRange& range, LookupIndex::Kind kind) const;
+    // Group-by index for SUMIFS/COUNTIFS-style equality criteria, same lifetime
+    std::shared_ptr<const ConditionalIndex> getConditionalIndex(const std::vector<CellRange>& criteriaRanges,
+                                                                const CellRange* valueRange) const;
+    // Running SUM/COUNT/AVERAGE/MIN/MAX state for large ranges (nullptr for
+    // small ones); value edits inside the range update it in place
+    std::shared_ptr<const RangeAggregate> getRangeAggregate(const CellRange& range) const;
+    // Sorted numbers of a range for MEDIAN/LARGE/SMALL/RANK/PERCENTILE
+    // (nullptr for small ranges); dropped when a cell inside it changes
+    std::shared_ptr<const SortedValues> getSortedValues(const CellRange& range) const;
+    // For code that edits Cell objects directly instead of through setters
+    void invalidateLookupIndexes(const CellAddress& addr) { m_lookupCache.invalidate(addr); }
 
     // Undo/Redo
     UndoManager& getUndoManager() { return m_undoManager; }
     CellSnapshot takeCellSnapshot(const CellAddress& addr);
 
-    // Sorting
+    // Sorting. Rows of range are ordered by the first key, ties by the next
+    // and so on; rows equal on every key keep their order.
+    struct SortKey {
+        int column = 0;
+        bool ascending = true;
+    };
+    void sortRange(const CellRange& range, const std::vector<SortKey>& keys);
     void sortRange(const CellRange& range, int sortColumn, bool ascending);
 
     // Cell shift insert/delete
@@ -145,7 +203,13 @@ public:
     // Performance settings
     void setAutoRecalculate(bool enabled);
     bool getAutoRecalculate() const;
-    void reserveCells(size_t count) { m_cells.reserve(count); }
+    // Worker threads used for recalculation: 0 = one per core, 1 = serial
+    void setRecalcThreadCount(int count) { m_recalcThreadCount = std::max(0, count); }
+    int getRecalcThreadCount() const { return m_recalcThreadCount; }
+    // Recalculates cells calling volatile functions (NOW, TODAY, RAND,
+    // RANDBETWEEN) and everything downstream of them, nothing else. For
+    // explicit recalculation and clock ticks; false if the sheet has none.
+    bool recalculateVolatile();
 
     // Sparklines
     void setSparkline(const CellAddress& addr, const SparklineConfig& config);
@@ -158,6 +222,9 @@ public:
     bool showGridlines() const { return m_showGridlines; }
 
 private:
+    // Plans and runs recalculation across sheets
+    friend class Workbook;
+
     struct CellKey {
         int row, col;
         bool operator==(const CellKey& other) const {
@@ -177,7 +244,7 @@ private:
         }
     };
 
-    std::unordered_map<CellKey, std::shared_ptr<Cell>, CellKeyHash> m_cells;
+    CellStore m_cells;
     std::unique_ptr<FormulaEngine> m_formulaEngine;
     DependencyGraph m_depGraph;
     UndoManager m_undoManager;
@@ -186,11 +253,25 @@ private:
     int m_columnCount;
     bool m_autoRecalculate;
     bool m_inTransaction;
-    // Cached max row/col (avoids O(n) scan every call)
-    mutable int m_cachedMaxRow = -1;
-    mutable int m_cachedMaxCol = -1;
-    mutable bool m_maxRowColDirty = true;
-    void updateMaxRowCol() const;
+    int m_batchDepth = 0;
+    std::vector<CellAddress> m_batchChanged;  // cells edited in the open batch
+    size_t m_transactionStart = 0;  // m_batchChanged entries from before the transaction
+    // Stored non-empty cells per row and per column (getMaxRow/getMaxColumn),
+    // where cells became dirty (filtered by isDirty() when read) and which
+    // cells hold formulas. Setters keep them current through trackCell();
+    // cells getCell() hands out may be changed by the caller, so they are
+    // queued and looked at on the next query; structural edits shift them.
+    // A queue longer than the sheet leaves them to one full rescan.
+    mutable std::map<int, int> m_rowOccupancy;
+    mutable std::map<int, int> m_columnOccupancy;
+    mutable std::vector<CellAddress> m_dirtyCells;
+    mutable std::set<CellKey> m_formulaCells;
+    mutable std::vector<CellAddress> m_untrackedCells;
+    mutable bool m_trackingStale = false;
+    void trackCell(int row, int col, Cell& cell) const;
+    void syncTracking() const;
+    void shiftTracking(const StructuralEdit& edit);
+    std::vector<CellAddress> formulaCellsIn(const CellRange& range) const;
     std::vector<SpreadsheetTable> m_tables;
     ConditionalFormatting m_conditionalFormatting;
     std::vector<DataValidationRule> m_validationRules;
@@ -200,11 +281,61 @@ private:
     std::map<int, int> m_columnWidths;   // col -> width in pixels
     bool m_showGridlines = true;
     std::unordered_map<CellKey, SparklineConfig, CellKeyHash> m_sparklines;
+    int m_recalcThreadCount = 0;
+    std::vector<std::unique_ptr<FormulaEngine>> m_workerEngines; // one per recalc worker
+    mutable LookupCache m_lookupCache;
+    Workbook* m_workbook = nullptr;
+    // Formula cells whose compiled form isVolatile(), and the recalc plan
+    // covering them and their dependents. The plan is rebuilt when the set
+    // or the dependency graph changes; structural edits shift the set, and
+    // it is rebuilt by a scan after a sort drops compiled formulas.
+    std::unordered_set<CellKey, CellKeyHash> m_volatileCells;
+    bool m_volatileCellsStale = false;
+    DependencyGraph::RecalcPlan m_volatilePlan;
+    uint64_t m_volatilePlanGeneration = UINT64_MAX;
+    // Array formulas by anchor cell, with the block their result covers.
+    // A blocked anchor (#SPILL!) keeps the block it needs, so clearing a cell
+    // in the way re-runs it. Spilled cells carry Cell::isSpilled().
+    struct Spill {
+        CellRange range;
+        bool blocked = false;
+    };
+    std::unordered_map<CellKey, Spill, CellKeyHash> m_spills;
+    std::vector<std::shared_ptr<const ValueArray>> m_arrayResults;  // by index into the running plan
+    std::vector<CellAddress> m_spillMoved;  // cells a spill newly filled or gave back
+    bool m_inSpillFollowUp = false;
 
+    const CompiledFormula& compiledFormula(Cell& cell, const CellAddress& addr);
+    void invalidateCompiledFormulas(const CellRange& range);
+    // Row/column inserts and deletes: moveCells shifts the store, formulas
+    // here and on other sheets are patched to match
+    void applyStructuralEdit(const StructuralEdit& edit, const std::function<void()>& moveCells);
+    // Patches formulas on this sheet for an edit on 'edited' (this sheet or
+    // one they read), moving this sheet's cells in between when moveCells is
+    // set. 'formulas' are the cells that move or read moved cells; returns
+    // the ones to recalculate.
+    std::vector<CellAddress> rewriteReferences(const StructuralEdit& edit, const Spreadsheet& edited,
+                                               std::vector<CellAddress> formulas,
+                                               const std::function<void()>& moveCells);
     void recalculate(const CellAddress& addr);
-    void recalculateAll();
     void updateDependencies(const CellAddress& addr);
+    // Re-registers formulas with qualified references; returns their cells
+    std::vector<CellAddress> relinkSheetReferences();
     void recalculateDependents(const CellAddress& addr);
+    void valueChanged(const CellAddress& addr, const Value& before);
+    void trackVolatile(const CellAddress& addr, bool isVolatile);
+    void recalculateFrom(const std::vector<CellAddress>& changed, bool includeChanged);
+    // Recalculates changed cells and their dependents, or records them for
+    // endBatch() when a batch is open
+    void recalculateChanged(const std::vector<CellAddress>& changed);
+    void runRecalcPlan(const DependencyGraph::RecalcPlan& plan);
+    void evaluateCells(const std::vector<Cell*>& cells, const std::vector<CellAddress>& addrs,
+                       size_t begin, size_t end);
+    // Writes anchor's array result onto the sheet, or gives its block back
+    // when array is null
+    void spill(const CellAddress& anchor, const ValueArray* array);
+    std::vector<CellAddress> releaseSpills(const CellRange& range);
+    void releaseSpills();
 };
 
 #endif // SPREADSHEET_H
@@ -0,0 +1,111 @@
+#include "StringPool.h"
+
+static thread_local StringPool::Refs* t_scope = nullptr;
+
+StringPool::Refs::Refs(const Refs& other) {
+    for (uint32_t id : other.m_ids) hold(id);
+}
+
+uint32_t StringPool::Refs::intern(const QString& text) {
+    return StringPool::shared().intern(text, this);
+}
+
+void StringPool::Refs::hold(uint32_t id) {
+    StringPool::shared().acquire(id);
+    m_ids.push_back(id);
+}
+
+void StringPool::Refs::clear() {
+    if (m_ids.empty()) return;
+    StringPool& pool = StringPool::shared();
+    for (uint32_t id : m_ids) pool.release(id);
+    m_ids.clear();
+}
+
+StringPool::Scope::Scope(Refs& refs) : m_previous(t_scope) { t_scope = &refs; }
+StringPool::Scope::~Scope() { t_scope = m_previous; }
+
+StringPool& StringPool::shared() {
+    static StringPool s_pool;
+    return s_pool;
+}
+
+uint32_t StringPool::intern(const QString& text) {
+    return intern(text, t_scope);
+}
+
+// A held id is counted under the same lock that found it, so a release on
+// another thread can't free it in between
+uint32_t StringPool::intern(const QString& text, Refs* holder) {
+    {
+        QReadLocker locker(&m_lock);
+        uint32_t id = m_ids.value(text, kNoString);
+        if (id != kNoString) {
+            if (holder) {
+                m_entries[id].refs++;
+                holder->m_ids.push_back(id);
+            }
+            return id;
+        }
+    }
+
+    QWriteLocker locker(&m_lock);
+    uint32_t id = m_ids.value(text, kNoString);   // another thread may have added it
+    if (id == kNoString) {
+        if (!m_freeIds.empty()) {
+            id = m_freeIds.back();
+            m_freeIds.pop_back();
+        } else {
+            id = static_cast<uint32_t>(m_entries.size());
+            m_entries.emplace_back();
+        }
+        m_entries[id].text = text;
+        m_ids.insert(text, id);
+    }
+    if (holder) {
+        m_entries[id].refs++;
+        holder->m_ids.push_back(id);
+    }
+    return id;
+}
+
+uint32_t StringPool::find(const QString& text) const {
+    QReadLocker locker(&m_lock);
+    return m_ids.value(text, kNoString);
+}
+
+QString StringPool::text(uint32_t id) const {
+    QReadLocker locker(&m_lock);
+    return id < m_entries.size() ? m_entries[id].text : QString();
+}
+
+void StringPool::acquire(uint32_t id) {
+    QReadLocker locker(&m_lock);
+    if (id < m_entries.size()) m_entries[id].refs++;
+}
+
+// Counts only reach zero under the write lock, so an id can't be freed
+// (and reused) while a reader still sees its old count
+void StringPool::release(uint32_t id) {
+    {
+        QReadLocker locker(&m_lock);
+        if (id >= m_entries.size()) return;
+        std::atomic<uint32_t>& refs = m_entries[id].refs;
+        uint32_t count = refs.load(std::memory_order_relaxed);
+        while (count > 1) {
+            if (refs.compare_exchange_weak(count, count - 1)) return;
+        }
+    }
+
+    QWriteLocker locker(&m_lock);
+    Entry& entry = m_entries[id];
+    if (entry.refs == 0 || --entry.refs > 0) return;
+    m_ids.remove(entry.text);
+    entry.text = QString();
+    m_freeIds.push_back(id);
+}
+
+size_t StringPool::size() const {
+    QReadLocker locker(&m_lock);
+    return m_entries.size() - m_freeIds.size();
+}
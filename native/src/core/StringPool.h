@@ -0,0 +1,87 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QString>
+#include <QHash>
+#include <QReadWriteLock>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Interned cell text. Every distinct string is stored once and referred to
+// by a 32-bit id, so equal texts compare by id and repeated values (status,
+// region, SKU columns) share one buffer. Sheets move between windows,
+// templates and undo history freely, so there is a single application-wide
+// pool, but its strings are reference counted: whatever keeps an id (cell
+// contents and results, formula constants) holds it, and a string nothing
+// holds any more is freed and its id reused. Safe to use from the recalc
+// workers: lookups and counts take a read lock, new and freed strings a
+// write lock.
+class StringPool {
+public:
+    static constexpr uint32_t kNoString = UINT32_MAX;
+
+    // References to pooled strings, released together when cleared or
+    // destroyed
+    class Refs {
+    public:
+        Refs() = default;
+        Refs(const Refs& other);
+        Refs(Refs&& other) noexcept : m_ids(std::move(other.m_ids)) { other.m_ids.clear(); }
+        Refs& operator=(Refs other) noexcept { m_ids.swap(other.m_ids); return *this; }
+        ~Refs() { clear(); }
+
+        // Interns text and holds it
+        uint32_t intern(const QString& text);
+        void hold(uint32_t id);
+        void clear();
+
+    private:
+        friend class StringPool;
+        std::vector<uint32_t> m_ids;
+    };
+
+    // While a Scope is open on a thread, every string interned there is held
+    // by its Refs as well. Formula evaluation opens one, so text it produces
+    // stays valid until the engine clears the Refs for its next evaluation.
+    class Scope {
+    public:
+        explicit Scope(Refs& refs);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Refs* m_previous;
+    };
+
+    static StringPool& shared();
+
+    // Id of text, added if needed. Outside a Scope the id is not held: keep
+    // it only by acquiring it (or through a Refs).
+    uint32_t intern(const QString& text);
+    // Id of an already interned string, or kNoString (never inserts)
+    uint32_t find(const QString& text) const;
+    QString text(uint32_t id) const;
+    void acquire(uint32_t id);
+    // Frees the string when this was the last reference
+    void release(uint32_t id);
+    // Strings currently stored
+    size_t size() const;
+
+private:
+    struct Entry {
+        QString text;
+        std::atomic<uint32_t> refs{0};
+    };
+
+    uint32_t intern(const QString& text, Refs* holder);
+
+    mutable QReadWriteLock m_lock;
+    std::deque<Entry> m_entries;  // by id; a deque so entries never move
+    std::vector<uint32_t> m_freeIds;
+    QHash<QString, uint32_t> m_ids;
+};
+
+#endif // STRINGPOOL_H
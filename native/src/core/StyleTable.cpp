@@ -0,0 +1,58 @@
+#include "StyleTable.h"
+#include <QHash>
+
+StyleTable& StyleTable::shared() {
+    static StyleTable s_table;
+    return s_table;
+}
+
+StyleTable::StyleTable() {
+    m_styles.emplace_back();
+    m_idsByHash.emplace(hashStyle(m_styles.front()), kDefaultStyle);
+}
+
+size_t StyleTable::hashStyle(const CellStyle& s) {
+    auto border = [](const BorderStyle& b) {
+        return qHashMulti(0, b.enabled, b.color, b.width);
+    };
+    size_t h = qHashMulti(0, s.fontName, s.fontSize, s.bold, s.italic, s.underline, s.strikethrough,
+                          s.foregroundColor, s.backgroundColor, static_cast<int>(s.hAlign),
+                          static_cast<int>(s.vAlign), s.numberFormat, s.decimalPlaces);
+    return qHashMulti(h, s.useThousandsSeparator, s.currencyCode, s.dateFormatId, s.columnWidth,
+                      s.rowHeight, border(s.borderTop), border(s.borderBottom),
+                      border(s.borderLeft), border(s.borderRight), s.indentLevel);
+}
+
+uint32_t StyleTable::findLocked(const CellStyle& style, size_t hash) const {
+    auto [it, end] = m_idsByHash.equal_range(hash);
+    for (; it != end; ++it) {
+        if (m_styles[it->second] == style) return it->second;
+    }
+    return UINT32_MAX;
+}
+
+uint32_t StyleTable::intern(const CellStyle& style) {
+    size_t hash = hashStyle(style);
+    {
+        QReadLocker locker(&m_lock);
+        uint32_t id = findLocked(style, hash);
+        if (id != UINT32_MAX) return id;
+    }
+    QWriteLocker locker(&m_lock);
+    uint32_t id = findLocked(style, hash);
+    if (id != UINT32_MAX) return id;
+    id = static_cast<uint32_t>(m_styles.size());
+    m_styles.push_back(style);
+    m_idsByHash.emplace(hash, id);
+    return id;
+}
+
+const CellStyle& StyleTable::style(uint32_t id) const {
+    QReadLocker locker(&m_lock);
+    return id < m_styles.size() ? m_styles[id] : m_styles.front();
+}
+
+size_t StyleTable::size() const {
+    QReadLocker locker(&m_lock);
+    return m_styles.size();
+}
@@ -0,0 +1,35 @@
+#ifndef STYLETABLE_H
+#define STYLETABLE_H
+
+#include <QReadWriteLock>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include "Cell.h"
+
+// Hash-consed cell styles. Each distinct CellStyle is stored once and cells,
+// undo snapshots and conditional formats refer to it by id, so formatting a
+// column costs 4 bytes per cell. Id 0 is the default style. Entries are never
+// removed and never move, so references returned by style() stay valid.
+class StyleTable {
+public:
+    static constexpr uint32_t kDefaultStyle = 0;
+
+    static StyleTable& shared();
+
+    uint32_t intern(const CellStyle& style);
+    const CellStyle& style(uint32_t id) const;
+    size_t size() const;
+
+private:
+    StyleTable();
+
+    mutable QReadWriteLock m_lock;
+    std::deque<CellStyle> m_styles;
+    std::unordered_multimap<size_t, uint32_t> m_idsByHash;
+
+    static size_t hashStyle(const CellStyle& style);
+    uint32_t findLocked(const CellStyle& style, size_t hash) const;
+};
+
+#endif // STYLETABLE_H
@@ -2,17 +2,18 @@
 #include "Spreadsheet.h"
 
 static void restoreCell(Spreadsheet* sheet, const CellSnapshot& snap) {
+    // Formulas go through the sheet so their references are registered again
+    if (snap.type == CellType::Formula) sheet->setCellFormula(snap.addr, snap.formula);
     auto cell = sheet->getCell(snap.addr);
     if (snap.type == CellType::Formula) {
-        cell->setFormula(snap.formula);
-        QVariant result = sheet->getFormulaEngine().evaluate(snap.formula);
-        cell->setComputedValue(result);
+        cell->setComputedValue(sheet->getFormulaEngine().evaluate(*cell->getCompiledFormula(), snap.addr));
     } else if (snap.type == CellType::Empty) {
         cell->clear();
     } else {
         cell->setValue(snap.value);
     }
-    cell->setStyle(snap.style);
+    cell->setStyleId(snap.styleId);
+    sheet->invalidateLookupIndexes(snap.addr);
 }
 
 // CellEditCommand
@@ -64,14 +65,14 @@ StyleChangeCommand::StyleChangeCommand(const std::vector<CellSnapshot>& before,
 void StyleChangeCommand::undo(Spreadsheet* sheet) {
     for (const auto& snap : m_before) {
         auto cell = sheet->getCell(snap.addr);
-        cell->setStyle(snap.style);
+        cell->setStyleId(snap.styleId);
     }
 }
 
 void StyleChangeCommand::redo(Spreadsheet* sheet) {
     for (const auto& snap : m_after) {
         auto cell = sheet->getCell(snap.addr);
-        cell->setStyle(snap.style);
+        cell->setStyleId(snap.styleId);
     }
 }
 
@@ -14,7 +14,7 @@ struct CellSnapshot {
     CellAddress addr;
     QVariant value;
     QString formula;
-    CellStyle style;
+    uint32_t styleId = 0;   // StyleTable id
     CellType type;
 };
 
@@ -0,0 +1,105 @@
+#include "Value.h"
+#include <QDate>
+#include <QDateTime>
+#include <QLocale>
+
+Value Value::text(uint32_t textId) {
+    if (textId == StringPool::kNoString) return Value();
+    Value v;
+    v.m_type = Type::Text;
+    v.m_textId = textId;
+    return v;
+}
+
+Value Value::text(const QString& text) {
+    return Value::text(StringPool::shared().intern(text));
+}
+
+Value Value::fromVariant(const QVariant& value) {
+    if (value.isNull() || !value.isValid()) return Value();
+    switch (value.typeId()) {
+        case QMetaType::QString: return Value::text(value.toString());
+        case QMetaType::Bool: return Value::boolean(value.toBool());
+        case QMetaType::Double:
+        case QMetaType::Float:
+        case QMetaType::Int:
+        case QMetaType::UInt:
+        case QMetaType::LongLong:
+        case QMetaType::ULongLong:
+            return Value::number(value.toDouble());
+        case QMetaType::QDate: return Value::text(value.toDate().toString(Qt::ISODate));
+        case QMetaType::QDateTime: return Value::text(value.toDateTime().toString(Qt::ISODate));
+        default: return Value::text(value.toString());
+    }
+}
+
+double Value::toNumber(bool* ok) const {
+    if (ok) *ok = true;
+    switch (m_type) {
+        case Type::Number: return m_number;
+        case Type::Boolean: return m_bool ? 1.0 : 0.0;
+        case Type::Text: {
+            bool parsed = false;
+            double d = StringPool::shared().text(m_textId).toDouble(&parsed);
+            if (ok) *ok = parsed;
+            return parsed ? d : 0.0;
+        }
+        default:
+            if (ok) *ok = false;
+            return 0.0;
+    }
+}
+
+bool Value::toBoolean() const {
+    if (m_type == Type::Boolean) return m_bool;
+    return toNumber() != 0;
+}
+
+QString Value::toString() const {
+    switch (m_type) {
+        case Type::Number: return QString::number(m_number, 'g', QLocale::FloatingPointShortest);
+        case Type::Boolean: return m_bool ? QStringLiteral("true") : QStringLiteral("false");
+        case Type::Text: return StringPool::shared().text(m_textId);
+        case Type::Error: return errorText(m_error);
+        default: return QString();
+    }
+}
+
+QVariant Value::toVariant() const {
+    switch (m_type) {
+        case Type::Number: return QVariant(m_number);
+        case Type::Boolean: return QVariant(m_bool);
+        case Type::Text: return QVariant(StringPool::shared().text(m_textId));
+        case Type::Error: return QVariant(errorText(m_error));
+        default: return QVariant();
+    }
+}
+
+QString Value::errorText(ErrorCode code) {
+    switch (code) {
+        case ErrorCode::Div0: return QStringLiteral("#DIV/0!");
+        case ErrorCode::Value: return QStringLiteral("#VALUE!");
+        case ErrorCode::Ref: return QStringLiteral("#REF!");
+        case ErrorCode::Name: return QStringLiteral("#NAME?");
+        case ErrorCode::Num: return QStringLiteral("#NUM!");
+        case ErrorCode::NA: return QStringLiteral("#N/A");
+        case ErrorCode::Circular: return QStringLiteral("#CIRCULAR!");
+        case ErrorCode::Spill: return QStringLiteral("#SPILL!");
+        case ErrorCode::Error: return QStringLiteral("#ERROR!");
+    }
+    return QStringLiteral("#ERROR!");
+}
+
+bool Value::operator==(const Value& other) const {
+    if (m_type != other.m_type) return false;
+    switch (m_type) {
+        case Type::Empty: return true;
+        case Type::Number: return m_number == other.m_number;
+        case Type::Boolean: return m_bool == other.m_bool;
+        case Type::Text: return m_textId == other.m_textId;
+        case Type::Error: return m_error == other.m_error;
+        case Type::Range: return m_range == other.m_range;
+        case Type::Array: return m_array == other.m_array;
+    }
+    return false;
+}
@@ -0,0 +1,135 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <QString>
+#include <QVariant>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "CellRange.h"
+#include "StringPool.h"
+
+// Formula errors. Cells display them as "#DIV/0!", "#N/A", ...
+enum class ErrorCode : uint8_t {
+    Div0,
+    Value,
+    Ref,
+    Name,
+    Num,
+    NA,
+    Circular,
+    Spill,  // an array result with no room to spill into
+    Error
+};
+
+struct ValueArray;
+
+// Tagged value used by the formula evaluator and for stored cell contents.
+// Numbers, booleans and error codes are held inline, text as a StringPool id
+// and a range as a pointer to the CellRange it was read from (owned by the
+// evaluating engine, so only valid while that formula is being evaluated)
+// plus the slot of the sheet it lies on (0 for the formula's own sheet).
+// Array results (=B2:B9*C2:C9) point at a ValueArray with the same lifetime.
+// Trivially copyable; QVariant is only produced at the UI boundary.
+class Value {
+public:
+    enum class Type : uint8_t {
+        Empty,
+        Number,
+        Boolean,
+        Text,
+        Error,
+        Range,
+        Array
+    };
+
+    constexpr Value() : m_number(0.0) {}
+
+    static constexpr Value number(double d) { Value v; v.m_type = Type::Number; v.m_number = d; return v; }
+    static constexpr Value boolean(bool b) { Value v; v.m_type = Type::Boolean; v.m_bool = b; return v; }
+    static constexpr Value error(ErrorCode code) { Value v; v.m_type = Type::Error; v.m_error = code; return v; }
+    static constexpr Value range(const CellRange* range, uint8_t sheet = 0) {
+        Value v; v.m_type = Type::Range; v.m_range = range; v.m_sheet = sheet; return v;
+    }
+    static constexpr Value array(const ValueArray* array) { Value v; v.m_type = Type::Array; v.m_array = array; return v; }
+    static Value text(uint32_t textId);
+    static Value text(const QString& text);
+    // Strings become text, numeric types numbers; other types (dates) are
+    // stored as their ISO text
+    static Value fromVariant(const QVariant& value);
+
+    Type type() const { return m_type; }
+    bool isEmpty() const { return m_type == Type::Empty; }
+    bool isNumber() const { return m_type == Type::Number; }
+    bool isBoolean() const { return m_type == Type::Boolean; }
+    bool isText() const { return m_type == Type::Text; }
+    bool isError() const { return m_type == Type::Error; }
+    bool isRange() const { return m_type == Type::Range; }
+    bool isArray() const { return m_type == Type::Array; }
+
+    // Raw accessors, only meaningful for the matching type
+    double asNumber() const { return m_number; }
+    bool asBoolean() const { return m_bool; }
+    uint32_t textId() const { return m_textId; }
+    ErrorCode errorCode() const { return m_error; }
+    const CellRange* asRange() const { return m_range; }
+    uint8_t rangeSheet() const { return m_sheet; }
+    const ValueArray* asArray() const { return m_array; }
+
+    // Formula coercions. toNumber parses numeric text; ok is false for
+    // empty, error and non-numeric text values (like QVariant::toDouble).
+    double toNumber(bool* ok = nullptr) const;
+    bool toBoolean() const;
+    QString toString() const;
+    QVariant toVariant() const;
+
+    static QString errorText(ErrorCode code);
+
+    // Same type and payload; text compares by pool id
+    bool operator==(const Value& other) const;
+    bool operator!=(const Value& other) const { return !(*this == other); }
+
+private:
+    union {
+        double m_number;
+        bool m_bool;
+        uint32_t m_textId;
+        ErrorCode m_error;
+        const CellRange* m_range;
+        const ValueArray* m_array;
+    };
+    Type m_type = Type::Empty;
+    uint8_t m_sheet = 0;  // Range only; fits in the padding after m_type
+};
+
+// A Value kept beyond the evaluation that produced it (cell contents and
+// results, formula constants): holds its text in the pool while it lives
+class HeldValue {
+public:
+    HeldValue() = default;
+    HeldValue(const Value& value) : m_value(value) { hold(); }
+    HeldValue(const HeldValue& other) : m_value(other.m_value) { hold(); }
+    HeldValue(HeldValue&& other) noexcept : m_value(other.m_value) { other.m_value = Value(); }
+    HeldValue& operator=(HeldValue other) noexcept { std::swap(m_value, other.m_value); return *this; }
+    ~HeldValue() { if (m_value.isText()) StringPool::shared().release(m_value.textId()); }
+
+    const Value& get() const { return m_value; }
+    operator const Value&() const { return m_value; }
+
+private:
+    void hold() { if (m_value.isText()) StringPool::shared().acquire(m_value.textId()); }
+
+    Value m_value;
+};
+
+// Rows x columns of values, row-major: the result of an array formula
+// before it spills onto the sheet
+struct ValueArray {
+    int rows = 0;
+    int cols = 0;
+    std::vector<Value> values;
+
+    const Value& at(int row, int col) const { return values[static_cast<size_t>(row) * cols + col]; }
+};
+
+#endif // VALUE_H
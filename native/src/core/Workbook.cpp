@@ -0,0 +1,178 @@
+#include "Workbook.h"
+#include "Spreadsheet.h"
+#include <unordered_set>
+
+Workbook::~Workbook() {
+    for (const auto& sheet : m_sheets) sheet->setWorkbook(nullptr);
+}
+
+void Workbook::setSheets(const std::vector<std::shared_ptr<Spreadsheet>>& sheets) {
+    std::unordered_set<const Spreadsheet*> kept;
+    for (const auto& sheet : sheets) kept.insert(sheet.get());
+    for (const auto& sheet : m_sheets) {
+        if (!kept.count(sheet.get())) sheet->setWorkbook(nullptr);
+    }
+    m_sheets = sheets;
+    clearDependencies();
+    for (const auto& sheet : m_sheets) sheet->setWorkbook(this);
+
+    // Names may now resolve differently; relink and re-evaluate every
+    // formula with a qualified reference
+    std::vector<SheetCell> relinked;
+    for (const auto& sheet : m_sheets) {
+        for (const auto& cell : sheet->relinkSheetReferences()) relinked.emplace_back(sheet.get(), cell);
+    }
+    if (!relinked.empty()) recalculate(relinked, true);
+}
+
+Spreadsheet* Workbook::findSheet(const QString& name) const {
+    for (const auto& sheet : m_sheets) {
+        if (sheet->getSheetName().compare(name, Qt::CaseInsensitive) == 0) return sheet.get();
+    }
+    return nullptr;
+}
+
+void Workbook::addDependency(Spreadsheet* sheet, const CellAddress& cell, Spreadsheet* precedent, const CellRange& range) {
+    auto& ids = m_dependentIds[sheet];
+    auto [it, inserted] = ids.try_emplace(key(cell), 0);
+    if (inserted) {
+        if (!m_freeDependents.empty()) {
+            it->second = m_freeDependents.back();
+            m_freeDependents.pop_back();
+        } else {
+            it->second = static_cast<uint32_t>(m_dependents.size());
+            m_dependents.emplace_back();
+        }
+        m_dependents[it->second].sheet = sheet;
+        m_dependents[it->second].cell = cell;
+    }
+    Dependent& dependent = m_dependents[it->second];
+    dependent.edges.emplace_back(precedent, m_precedents[precedent].insert(range, it->second));
+    m_edgeCount++;
+}
+
+void Workbook::removeDependencies(Spreadsheet* sheet, const CellAddress& cell) {
+    auto sheetIt = m_dependentIds.find(sheet);
+    if (sheetIt == m_dependentIds.end()) return;
+    auto it = sheetIt->second.find(key(cell));
+    if (it == sheetIt->second.end()) return;
+
+    Dependent& dependent = m_dependents[it->second];
+    for (const auto& [precedent, handle] : dependent.edges) m_precedents[precedent].remove(handle);
+    m_edgeCount -= dependent.edges.size();
+    dependent = Dependent();
+    m_freeDependents.push_back(it->second);
+    sheetIt->second.erase(it);
+}
+
+void Workbook::clearDependencies() {
+    m_dependents.clear();
+    m_freeDependents.clear();
+    m_dependentIds.clear();
+    m_precedents.clear();
+    m_edgeCount = 0;
+}
+
+std::vector<std::pair<Spreadsheet*, CellAddress>> Workbook::getReaders(const Spreadsheet* sheet,
+                                                                     const CellRange& region) const {
+    std::vector<std::pair<Spreadsheet*, CellAddress>> readers;
+    auto it = m_precedents.find(sheet);
+    if (it == m_precedents.end()) return readers;
+    CellAddress start = region.getStart(), end = region.getEnd();
+    it->second.queryOverlap(start.row, end.row, start.col, end.col, [&](uint32_t owner) {
+        readers.emplace_back(m_dependents[owner].sheet, m_dependents[owner].cell);
+    });
+    return readers;
+}
+
+template <typename Fn>
+void Workbook::forEachDependent(Spreadsheet* sheet, const CellAddress& cell, Fn&& fn) const {
+    for (const auto& dependent : sheet->m_depGraph.getDependents(cell)) fn(sheet, dependent);
+    auto it = m_precedents.find(sheet);
+    if (it == m_precedents.end()) return;
+    auto visit = [&](uint32_t owner) { fn(m_dependents[owner].sheet, m_dependents[owner].cell); };
+    // An array formula's readers elsewhere may read any cell of its block
+    if (const CellRange* spill = sheet->m_depGraph.getSpillRange(cell)) {
+        CellAddress start = spill->getStart(), end = spill->getEnd();
+        it->second.queryOverlap(start.row, end.row, start.col, end.col, visit);
+    } else {
+        it->second.query(cell.row, cell.col, visit);
+    }
+}
+
+void Workbook::recalculateFrom(Spreadsheet* sheet, const std::vector<CellAddress>& changed, bool includeChanged) {
+    std::vector<SheetCell> cells;
+    cells.reserve(changed.size());
+    for (const auto& cell : changed) cells.emplace_back(sheet, cell);
+    recalculate(cells, includeChanged);
+}
+
+// Same Kahn levelling as DependencyGraph::getRecalcPlan, over (sheet, cell)
+// nodes. Each level is handed to the sheets it touches as a one-level plan,
+// so sheets still evaluate large levels in parallel.
+void Workbook::recalculate(const std::vector<SheetCell>& changed, bool includeChanged) {
+    std::vector<SheetCell> nodes;
+    std::unordered_map<const Spreadsheet*, std::unordered_map<uint64_t, uint32_t>> ids;
+    auto node = [&](Spreadsheet* sheet, const CellAddress& cell) {
+        auto [it, inserted] = ids[sheet].try_emplace(key(cell), static_cast<uint32_t>(nodes.size()));
+        if (inserted) nodes.emplace_back(sheet, cell);
+        return it->second;
+    };
+    for (const auto& [sheet, cell] : changed) {
+        if (includeChanged) node(sheet, cell);
+        else forEachDependent(sheet, cell, node);
+    }
+
+    std::vector<uint32_t> adjStart;
+    std::vector<uint32_t> adj;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        adjStart.push_back(static_cast<uint32_t>(adj.size()));
+        SheetCell current = nodes[i];  // node() may grow the vector
+        forEachDependent(current.first, current.second, [&](Spreadsheet* sheet, const CellAddress& cell) {
+            adj.push_back(node(sheet, cell));
+        });
+    }
+    adjStart.push_back(static_cast<uint32_t>(adj.size()));
+
+    std::vector<uint32_t> inDegree(nodes.size(), 0);
+    for (uint32_t target : adj) inDegree[target]++;
+    std::vector<uint32_t> ready;
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        if (inDegree[i] == 0) ready.push_back(i);
+    }
+
+    // Every formula result below may change, so indexes over those cells go first
+    for (const auto& [sheet, cell] : nodes) {
+        const Cell* stored = sheet->m_cells.peek(cell.row, cell.col);
+        if (stored && stored->getType() == CellType::Formula) sheet->m_lookupCache.invalidate(cell);
+    }
+
+    std::unordered_map<Spreadsheet*, DependencyGraph::RecalcPlan> levels;
+    auto runLevel = [&]() {
+        for (auto& [sheet, plan] : levels) {
+            plan.levelStarts = {0, plan.order.size()};
+            sheet->runRecalcPlan(plan);
+        }
+        levels.clear();
+    };
+    size_t levelEnd = ready.size();
+    for (size_t head = 0; head < ready.size(); ++head) {
+        if (head == levelEnd) {
+            runLevel();
+            levelEnd = ready.size();
+        }
+        uint32_t current = ready[head];
+        levels[nodes[current].first].order.push_back(nodes[current].second);
+        for (uint32_t e = adjStart[current]; e < adjStart[current + 1]; ++e) {
+            if (--inDegree[adj[e]] == 0) ready.push_back(adj[e]);
+        }
+    }
+    runLevel();
+
+    if (ready.size() < nodes.size()) {
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            if (inDegree[i] > 0) levels[nodes[i].first].circular.push_back(nodes[i].second);
+        }
+        for (auto& [sheet, plan] : levels) sheet->runRecalcPlan(plan);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef WORKBOOK_H
+#define WORKBOOK_H
+
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "CellRange.h"
+#include "RangeIndex.h"
+
+class Spreadsheet;
+
+// The sheets of one document and the references between them. Each sheet
+// keeps references within itself in its own DependencyGraph; references
+// into other sheets (Sheet2!A1) are recorded here, indexed by the sheet
+// they point into. Once any exist, recalculation is planned here over all
+// the sheets' graphs joined by those edges, so each cell is evaluated once
+// and after all of its inputs whichever sheets they are on.
+class Workbook {
+public:
+    Workbook() = default;
+    ~Workbook();
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+
+    // The document's sheets in tab order. Call again after sheets are added,
+    // removed or renamed: cross-sheet references are resolved by name, so
+    // they are rebuilt and the formulas holding them recalculated.
+    void setSheets(const std::vector<std::shared_ptr<Spreadsheet>>& sheets);
+    const std::vector<std::shared_ptr<Spreadsheet>>& sheets() const { return m_sheets; }
+    // nullptr if no sheet has that name (compared case-insensitively)
+    Spreadsheet* findSheet(const QString& name) const;
+
+    // A formula cell on 'sheet' reading 'range' of another sheet
+    void addDependency(Spreadsheet* sheet, const CellAddress& cell, Spreadsheet* precedent, const CellRange& range);
+    void removeDependencies(Spreadsheet* sheet, const CellAddress& cell);
+    bool hasCrossSheetDependencies() const { return m_edgeCount > 0; }
+    // Cells on other sheets reading some of region of 'sheet'; a cell may
+    // be listed once per reference
+    std::vector<std::pair<Spreadsheet*, CellAddress>> getReaders(const Spreadsheet* sheet, const CellRange& region) const;
+
+    // Evaluates everything downstream of 'changed' on 'sheet', on any sheet,
+    // in one topological order. With includeChanged the changed cells are
+    // evaluated too.
+    void recalculateFrom(Spreadsheet* sheet, const std::vector<CellAddress>& changed, bool includeChanged);
+
+private:
+    using SheetCell = std::pair<Spreadsheet*, CellAddress>;
+
+    struct Dependent {
+        Spreadsheet* sheet = nullptr;
+        CellAddress cell;
+        std::vector<std::pair<Spreadsheet*, RangeIndex::Handle>> edges;
+    };
+
+    static uint64_t key(const CellAddress& addr) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(addr.row)) << 32) | static_cast<uint32_t>(addr.col);
+    }
+
+    std::vector<std::shared_ptr<Spreadsheet>> m_sheets;
+    std::vector<Dependent> m_dependents;  // RangeIndex owners index this
+    std::vector<uint32_t> m_freeDependents;
+    std::unordered_map<const Spreadsheet*, std::unordered_map<uint64_t, uint32_t>> m_dependentIds;
+    std::unordered_map<const Spreadsheet*, RangeIndex> m_precedents;  // ranges read, by the sheet they lie on
+    size_t m_edgeCount = 0;
+
+    void clearDependencies();
+    void recalculate(const std::vector<SheetCell>& changed, bool includeChanged);
+    // Cells reading (sheet, cell): on its own sheet, then on other sheets
+    template <typename Fn>
+    void forEachDependent(Spreadsheet* sheet, const CellAddress& cell, Fn&& fn) const;
+};
+
+#endif // WORKBOOK_H
@@ -272,6 +272,7 @@ QJsonObject DocumentRepository::serializeSpreadsheet(const std::shared_ptr<Sprea
 
     QJsonArray cellsArray;
     spreadsheet->forEachCell([&](int row, int col, const Cell& cell) {
+        if (cell.isSpilled()) return;  // rebuilt by its array formula on load
         QJsonObject cellObj;
         cellObj["r"] = row;
         cellObj["c"] = col;
@@ -1,6 +1,7 @@
 #include "CsvService.h"
 #include <QFile>
 #include <QApplication>
+#include <QHash>
 #include <cstring>
 #include <cstdlib>
 
@@ -106,8 +107,11 @@ std::shared_ptr<Spreadsheet> CsvService::importFromFile(const QString& filePath)
     // Pre-estimate row count from file size (avg ~50 bytes/row)
     int estimatedRows = static_cast<int>(fileSize / 50) + 100;
     spreadsheet->setRowCount(std::max(1000, estimatedRows));
-    // Pre-reserve hash map to avoid rehashing during import (~10 cols avg)
-    spreadsheet->reserveCells(static_cast<size_t>(estimatedRows) * 10);
+
+    // Raw field bytes -> pooled string id, so repeated values skip UTF-8
+    // decoding and the shared pool's lock. The ids are held while cached.
+    StringPool::Refs heldTexts;
+    QHash<QByteArray, uint32_t> textIds;
 
     int row = 0;
     int maxCol = 0;
@@ -183,11 +187,15 @@ std::shared_ptr<Spreadsheet> CsvService::importFromFile(const QString& filePath)
                     }
 
                     if (!isNum) {
-                        QString strValue = QString::fromUtf8(fStart, fLen);
                         if (firstCh == '=') {
-                            spreadsheet->setCellFormula(addr, strValue);
+                            spreadsheet->setCellFormula(addr, QString::fromUtf8(fStart, fLen));
                         } else {
-                            spreadsheet->setCellValue(addr, strValue);
+                            QByteArray raw(fStart, fLen);
+                            auto it = textIds.find(raw);
+                            if (it == textIds.end()) {
+                                it = textIds.insert(raw, heldTexts.intern(QString::fromUtf8(fStart, fLen)));
+                            }
+                            spreadsheet->setCellText(addr, it.value());
                         }
                     }
                 }
@@ -1,4 +1,6 @@
 #include "XlsxService.h"
+#include "../core/FormulaAST.h"
+#include "../core/StyleTable.h"
 #include <QFile>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
@@ -8,6 +10,7 @@
 #include <QtCore/private/qzipreader_p.h>
 #include <QtCore/private/qzipwriter_p.h>
 #include <algorithm>
+#include <unordered_map>
 
 XlsxImportResult XlsxService::importFromFile(const QString& filePath) {
     XlsxImportResult result;
@@ -17,11 +20,15 @@ XlsxImportResult XlsxService::importFromFile(const QString& filePath) {
         return result;
     }
 
-    // Read shared strings
-    QStringList sharedStrings;
+    // Read shared strings and intern them once; cells just take the pool ids.
+    // They are held until the sheets are read, so ones no cell uses are freed.
+    std::vector<uint32_t> sharedStrings;
+    StringPool::Refs heldStrings;
     QByteArray ssData = zip.fileData("xl/sharedStrings.xml");
     if (!ssData.isEmpty()) {
-        sharedStrings = parseSharedStrings(ssData);
+        const QStringList strings = parseSharedStrings(ssData);
+        sharedStrings.reserve(strings.size());
+        for (const auto& str : strings) sharedStrings.push_back(heldStrings.intern(str));
     }
 
     // Parse styles
@@ -566,13 +573,23 @@ bool XlsxService::isDateFormatCode(const QString& formatCode) {
     return false;
 }
 
-void XlsxService::parseSheet(const QByteArray& xmlData, const QStringList& sharedStrings,
+void XlsxService::parseSheet(const QByteArray& xmlData, const std::vector<uint32_t>& sharedStrings,
                               const std::vector<CellStyle>& styles, Spreadsheet* sheet) {
     QXmlStreamReader xml(xmlData);
 
+    // Intern each xf once; cells then just take the id
+    std::vector<uint32_t> styleIds;
+    styleIds.reserve(styles.size());
+    for (const auto& style : styles) styleIds.push_back(StyleTable::shared().intern(style));
+
     static QRegularExpression cellRefRe("^([A-Z]+)(\\d+)$");
     static QRegularExpression rangeRefRe("^([A-Z]+)(\\d+):([A-Z]+)(\\d+)$");
 
+    // Shared formulas (<f t="shared" si="n">) carry their text only on the
+    // first cell; the others are rebased from it and end up sharing its
+    // compiled program
+    std::unordered_map<int, std::pair<QString, CellAddress>> sharedFormulas;
+
     while (!xml.atEnd()) {
         xml.readNext();
 
@@ -635,6 +652,7 @@ void XlsxService::parseSheet(const QByteArray& xmlData, const QStringList& share
             // Read child elements: <f> (formula), <v> (value), <is> (inline string)
             QString value;
             QString formula;
+            int sharedIndex = -1;
             QString inlineStr;
             bool hasInlineStr = false;
             int depth = 1; // track nesting depth within <c>
@@ -645,6 +663,9 @@ void XlsxService::parseSheet(const QByteArray& xmlData, const QStringList& share
                     if (xml.name() == u"v") {
                         value = xml.readElementText();
                     } else if (xml.name() == u"f") {
+                        if (xml.attributes().value("t") == u"shared") {
+                            sharedIndex = xml.attributes().value("si").toInt();
+                        }
                         formula = xml.readElementText();
                     } else if (xml.name() == u"is") {
                         // Inline string - read <t> children
@@ -666,6 +687,14 @@ void XlsxService::parseSheet(const QByteArray& xmlData, const QStringList& share
             CellAddress addr(row, col);
             bool cellSet = false;
 
+            if (sharedIndex >= 0) {
+                if (!formula.isEmpty()) {
+                    sharedFormulas[sharedIndex] = {formula, addr};
+                } else if (auto it = sharedFormulas.find(sharedIndex); it != sharedFormulas.end()) {
+                    formula = CompiledFormula::rebase(it->second.first, it->second.second, addr);
+                }
+            }
+
             // If the cell has a formula, set it via setCellFormula
             if (!formula.isEmpty()) {
                 QString f = formula;
@@ -690,8 +719,8 @@ void XlsxService::parseSheet(const QByteArray& xmlData, const QStringList& share
             // Handle shared string reference
             else if (type == "s" && !value.isEmpty()) {
                 int ssIdx = value.toInt();
-                if (ssIdx >= 0 && ssIdx < sharedStrings.size()) {
-                    sheet->setCellValue(addr, sharedStrings[ssIdx]);
+                if (ssIdx >= 0 && ssIdx < static_cast<int>(sharedStrings.size())) {
+                    sheet->setCellText(addr, sharedStrings[ssIdx]);
                     cellSet = true;
                 }
             }
@@ -737,15 +766,20 @@ void XlsxService::parseSheet(const QByteArray& xmlData, const QStringList& share
             if ((cellSet || styleIdx > 0) && styleIdx < static_cast<int>(styles.size())) {
                 auto cell = sheet->getCell(addr);
                 if (cell) {
-                    CellStyle cellStyle = styles[styleIdx];
-                    if ((cellStyle.numberFormat == "Date" || cellStyle.numberFormat == "Time")) {
+                    const CellStyle& xfStyle = styles[styleIdx];
+                    bool outOfDateRange = false;
+                    if ((xfStyle.numberFormat == "Date" || xfStyle.numberFormat == "Time")) {
                         bool ok;
                         double num = value.toDouble(&ok);
-                        if (ok && (num < 0 || num >= 2958466)) {
-                            cellStyle.numberFormat = "General";
-                        }
+                        outOfDateRange = ok && (num < 0 || num >= 2958466);
+                    }
+                    if (outOfDateRange) {
+                        CellStyle cellStyle = xfStyle;
+                        cellStyle.numberFormat = "General";
+                        cell->setStyle(cellStyle);
+                    } else {
+                        cell->setStyleId(styleIds[styleIdx]);
                     }
-                    cell->setStyle(cellStyle);
                 }
             }
         }
@@ -788,20 +822,27 @@ bool XlsxService::exportToFile(const std::vector<std::shared_ptr<Spreadsheet>>&
                                  const QString& filePath) {
     if (sheets.empty()) return false;
 
-    // Collect unique styles and build style index map
+    // Collect unique styles and build style index map. Cells carry StyleTable
+    // ids, so the export key is built once per distinct id, not once per cell.
     std::map<QString, int> styleIndexMap;
+    std::unordered_map<uint32_t, int> xfIndexById;
+    std::vector<CellStyle> xfStyles;
+    StyleTable& styleTable = StyleTable::shared();
+    auto xfIndexFor = [&](uint32_t styleId) {
+        auto it = xfIndexById.find(styleId);
+        if (it != xfIndexById.end()) return it->second;
+        const CellStyle& s = styleTable.style(styleId);
+        auto [keyIt, inserted] = styleIndexMap.try_emplace(cellStyleKey(s), static_cast<int>(xfStyles.size()));
+        if (inserted) xfStyles.push_back(s);
+        xfIndexById.emplace(styleId, keyIt->second);
+        return keyIt->second;
+    };
     // Index 0 is reserved for default style
-    CellStyle defaultStyle;
-    styleIndexMap[cellStyleKey(defaultStyle)] = 0;
+    xfIndexFor(StyleTable::kDefaultStyle);
 
     for (const auto& sheet : sheets) {
         sheet->forEachCell([&](int, int, const Cell& cell) {
-            const CellStyle& s = cell.getStyle();
-            QString key = cellStyleKey(s);
-            if (styleIndexMap.find(key) == styleIndexMap.end()) {
-                int idx = static_cast<int>(styleIndexMap.size());
-                styleIndexMap[key] = idx;
-            }
+            xfIndexFor(cell.getStyleId());
         });
     }
 
@@ -867,11 +908,8 @@ bool XlsxService::exportToFile(const std::vector<std::shared_ptr<Spreadsheet>>&
             for (int c = 0; c <= maxCol; ++c) {
                 auto val = sheet->getCellValue(CellAddress(r, c));
                 if (val.isValid() && !val.toString().isEmpty()) { hasData = true; break; }
-                auto cell = sheet->getCell(CellAddress(r, c));
-                if (cell) {
-                    QString key = cellStyleKey(cell->getStyle());
-                    if (styleIndexMap.count(key) && styleIndexMap[key] != 0) { hasData = true; break; }
-                }
+                auto cell = sheet->getCellIfExists(CellAddress(r, c));
+                if (cell && xfIndexFor(cell->getStyleId()) != 0) { hasData = true; break; }
             }
             if (!hasData) continue;
 
@@ -880,18 +918,17 @@ bool XlsxService::exportToFile(const std::vector<std::shared_ptr<Spreadsheet>>&
 
             for (int c = 0; c <= maxCol; ++c) {
                 CellAddress addr(r, c);
-                auto cell = sheet->getCell(addr);
+                auto cell = sheet->getCellIfExists(addr);
                 if (!cell) continue;
 
                 QVariant val = cell->getValue();
                 QString formula = cell->getFormula();
-                bool hasValue = val.isValid() && !val.toString().isEmpty();
+                // Spilled values are rebuilt by their array formula on load
+                bool hasValue = !cell->isSpilled() && val.isValid() && !val.toString().isEmpty();
                 bool hasFormula = !formula.isEmpty();
 
                 // Get style index
-                QString key = cellStyleKey(cell->getStyle());
-                int styleIdx = 0;
-                if (styleIndexMap.count(key)) styleIdx = styleIndexMap[key];
+                int styleIdx = xfIndexFor(cell->getStyleId());
 
                 if (!hasValue && !hasFormula && styleIdx == 0) continue;
 
@@ -977,7 +1014,7 @@ bool XlsxService::exportToFile(const std::vector<std::shared_ptr<Spreadsheet>>&
     zip.addFile("_rels/.rels", generateRels());
     zip.addFile("xl/workbook.xml", generateWorkbook(sheets));
     zip.addFile("xl/_rels/workbook.xml.rels", generateWorkbookRels(sheetCount));
-    zip.addFile("xl/styles.xml", generateStyles(sheets, styleIndexMap));
+    zip.addFile("xl/styles.xml", generateStyles(xfStyles));
 
     if (!sharedStrings.isEmpty()) {
         zip.addFile("xl/sharedStrings.xml", generateSharedStrings(sharedStrings));
@@ -1124,34 +1161,12 @@ QByteArray XlsxService::generateWorkbookRels(int sheetCount) {
     return data;
 }
 
-QByteArray XlsxService::generateStyles(const std::vector<std::shared_ptr<Spreadsheet>>& sheets,
-                                         std::map<QString, int>& styleIndexMap) {
+QByteArray XlsxService::generateStyles(const std::vector<CellStyle>& sortedStyles) {
     // Collect all unique fonts, fills, borders, numFmts from the style index map
     struct FontEntry { QString name; int size; bool bold, italic, underline, strikethrough; QString color; };
     struct FillEntry { QString bgColor; };
     struct BorderEntry { bool hasAny; };
 
-    // Build sorted style list by index
-    std::vector<CellStyle> sortedStyles(styleIndexMap.size());
-
-    // Collect all styles from sheets
-    std::map<QString, CellStyle> keyToStyle;
-    CellStyle defStyle;
-    keyToStyle[cellStyleKey(defStyle)] = defStyle;
-
-    for (const auto& sheet : sheets) {
-        sheet->forEachCell([&](int, int, const Cell& cell) {
-            const CellStyle& s = cell.getStyle();
-            keyToStyle[cellStyleKey(s)] = s;
-        });
-    }
-
-    for (const auto& [key, idx] : styleIndexMap) {
-        if (keyToStyle.count(key)) {
-            sortedStyles[idx] = keyToStyle[key];
-        }
-    }
-
     // Build unique fonts
     std::vector<FontEntry> fonts;
     std::map<QString, int> fontMap;
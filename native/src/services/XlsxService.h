@@ -48,8 +48,8 @@ private:
     static QByteArray generateRels();
     static QByteArray generateWorkbook(const std::vector<std::shared_ptr<Spreadsheet>>& sheets);
     static QByteArray generateWorkbookRels(int sheetCount);
-    static QByteArray generateStyles(const std::vector<std::shared_ptr<Spreadsheet>>& sheets,
-                                      std::map<QString, int>& styleIndexMap);
+    // sortedStyles[i] is the style written as cellXfs index i
+    static QByteArray generateStyles(const std::vector<CellStyle>& sortedStyles);
     static QByteArray generateSheet(Spreadsheet* sheet, const std::map<QString, int>& styleIndexMap,
                                      QStringList& sharedStrings);
     static QByteArray generateSharedStrings(const QStringList& sharedStrings);
@@ -113,7 +113,7 @@ private:
                                      const std::vector<XlsxBorder>& borders,
                                      int numFmtId,
                                      const std::map<int, QString>& customNumFmts);
-    static void parseSheet(const QByteArray& xmlData, const QStringList& sharedStrings,
+    static void parseSheet(const QByteArray& xmlData, const std::vector<uint32_t>& sharedStrings,
                            const std::vector<CellStyle>& styles, Spreadsheet* sheet);
     static int columnLetterToIndex(const QString& letters);
     static QString mapNumFmtId(int id, const std::map<int, QString>& customNumFmts);
@@ -1,4 +1,5 @@
 #include "CellDelegate.h"
+#include "../core/FormulaFunctions.h"
 #include <QLineEdit>
 #include <QPainter>
 #include <QPainterPath>
@@ -12,24 +13,6 @@
 #include <QTableView>
 #include <QTimer>
 
-// All supported formula function names
-static const QStringList s_formulaNames = {
-    "SUM", "AVERAGE", "COUNT", "COUNTA", "MIN", "MAX",
-    "IF", "IFERROR", "AND", "OR", "NOT",
-    "CONCAT", "CONCATENATE", "LEN", "UPPER", "LOWER", "TRIM",
-    "LEFT", "RIGHT", "MID", "FIND", "SUBSTITUTE", "TEXT",
-    "ROUND", "ABS", "SQRT", "POWER", "MOD", "INT", "CEILING", "FLOOR",
-    "COUNTIF", "SUMIF", "AVERAGEIF", "COUNTBLANK", "SUMPRODUCT",
-    "MEDIAN", "MODE", "STDEV", "VAR", "LARGE", "SMALL", "RANK", "PERCENTILE",
-    "NOW", "TODAY", "YEAR", "MONTH", "DAY",
-    "DATE", "HOUR", "MINUTE", "SECOND", "DATEDIF", "NETWORKDAYS", "WEEKDAY",
-    "EDATE", "EOMONTH", "DATEVALUE",
-    "VLOOKUP", "HLOOKUP", "XLOOKUP", "INDEX", "MATCH",
-    "ROUNDUP", "ROUNDDOWN", "LOG", "LN", "EXP", "RAND", "RANDBETWEEN",
-    "PROPER", "SEARCH", "REPT", "EXACT", "VALUE",
-    "ISBLANK", "ISERROR", "ISNUMBER", "ISTEXT", "CHOOSE", "SWITCH",
-};
-
 CellDelegate::CellDelegate(QObject* parent)
     : QStyledItemDelegate(parent) {
 }
@@ -86,7 +69,7 @@ QWidget* CellDelegate::createEditor(QWidget* parent, const QStyleOptionViewItem&
         "border: 2px solid #107C10; selection-background-color: #0078D4; }");
 
     // Formula autocomplete
-    auto* completer = new QCompleter(s_formulaNames, editor);
+    auto* completer = new QCompleter(FormulaFunctions::names(), editor);
     completer->setWidget(editor);
     completer->setCaseSensitivity(Qt::CaseInsensitive);
     completer->setCompletionMode(QCompleter::PopupCompletion);
@@ -15,6 +15,7 @@
 #include "ShapePropertiesDialog.h"
 #include "ChartPropertiesPanel.h"
 #include "../core/Spreadsheet.h"
+#include "../core/Workbook.h"
 #include "../core/UndoManager.h"
 #include "../core/CellRange.h"
 #include "../services/DocumentService.h"
@@ -45,6 +46,7 @@
 #include <QDockWidget>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QTimer>
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent) {
@@ -56,6 +58,8 @@ MainWindow::MainWindow(QWidget* parent)
     defaultSheet->setSheetName("Sheet1");
     m_sheets.push_back(defaultSheet);
     m_activeSheetIndex = 0;
+    m_workbook = std::make_shared<Workbook>();
+    m_workbook->setSheets(m_sheets);
 
     QWidget* centralWidget = new QWidget(this);
     QVBoxLayout* layout = new QVBoxLayout(centralWidget);
@@ -126,6 +130,14 @@ MainWindow::MainWindow(QWidget* parent)
     createStatusBar();
     connectSignals();
 
+    // Only volatile cells and their dependents are recomputed on each tick;
+    // the text results they replace are released, so ticking never grows the
+    // string pool
+    m_volatileTimer = new QTimer(this);
+    m_volatileTimer->setInterval(1000);
+    connect(m_volatileTimer, &QTimer::timeout, this, &MainWindow::onVolatileTick);
+    m_volatileTimer->start();
+
     // Deselect charts/shapes when clicking on the spreadsheet
     m_spreadsheetView->viewport()->installEventFilter(this);
 
@@ -267,6 +279,8 @@ void MainWindow::onSheetTabDoubleClicked(int index) {
     if (ok && !newName.isEmpty()) {
         m_sheetTabBar->setTabText(index, newName);
         m_sheets[index]->setSheetName(newName);
+        m_workbook->setSheets(m_sheets);
+        m_spreadsheetView->refreshView();
     }
 }
 
@@ -276,6 +290,7 @@ void MainWindow::onAddSheet() {
     auto sheet = std::make_shared<Spreadsheet>();
     sheet->setSheetName(name);
     m_sheets.push_back(sheet);
+    m_workbook->setSheets(m_sheets);
     m_sheetTabBar->addTab(name);
     m_sheetTabBar->setCurrentIndex(m_sheetTabBar->count() - 1);
     statusBar()->showMessage("Added: " + name);
@@ -336,6 +351,7 @@ void MainWindow::onDeleteSheet() {
     m_sheetTabBar->blockSignals(true);
     m_sheetTabBar->removeTab(idx);
     m_sheets.erase(m_sheets.begin() + idx);
+    m_workbook->setSheets(m_sheets);
     m_sheetTabBar->blockSignals(false);
 
     int newIdx = qMin(idx, static_cast<int>(m_sheets.size()) - 1);
@@ -370,6 +386,7 @@ void MainWindow::onDuplicateSheet() {
     copy->setAutoRecalculate(true);
 
     m_sheets.insert(m_sheets.begin() + idx + 1, copy);
+    m_workbook->setSheets(m_sheets);
     m_sheetTabBar->insertTab(idx + 1, copy->getSheetName());
     m_sheetTabBar->setCurrentIndex(idx + 1);
     statusBar()->showMessage("Duplicated sheet");
@@ -413,6 +430,7 @@ void MainWindow::setSheets(const std::vector<std::shared_ptr<Spreadsheet>>& shee
     m_images.clear();
 
     m_sheets = sheets;
+    m_workbook->setSheets(m_sheets);
     m_activeSheetIndex = 0;
 
     // Rebuild tab bar
@@ -511,6 +529,8 @@ void MainWindow::createMenuBar() {
     dataMenu->addAction("&Refresh Pivot Table", this, &MainWindow::onRefreshPivotTable,
                         QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_R));
     dataMenu->addSeparator();
+    dataMenu->addAction("Re&calculate Now", this, &MainWindow::onRecalculate, QKeySequence(Qt::Key_F9));
+    dataMenu->addSeparator();
     QAction* highlightAction = dataMenu->addAction("&Circle Invalid Data", this, &MainWindow::onHighlightInvalidCells);
     highlightAction->setCheckable(true);
 
@@ -655,6 +675,25 @@ void MainWindow::connectSignals() {
     reconnectDataChanged();
 }
 
+void MainWindow::onRecalculate() {
+    bool changed = false;
+    for (auto& sheet : m_sheets) changed |= sheet->recalculateVolatile();
+    if (changed) {
+        m_spreadsheetView->refreshView();
+        refreshActiveCharts();
+    }
+    statusBar()->showMessage("Recalculated", 2000);
+}
+
+void MainWindow::onVolatileTick() {
+    if (m_sheets.empty() || m_activeSheetIndex >= static_cast<int>(m_sheets.size())) return;
+    // Other sheets catch up on F9; ticking them would only burn time
+    if (m_sheets[m_activeSheetIndex]->recalculateVolatile()) {
+        m_spreadsheetView->refreshView();
+        refreshActiveCharts();
+    }
+}
+
 void MainWindow::refreshActiveCharts() {
     for (auto* chart : m_charts) {
         if (chart->isVisible() && chart->property("sheetIndex").toInt() == m_activeSheetIndex) {
@@ -1404,12 +1443,7 @@ void MainWindow::onChatActions(const QJsonArray& actions) {
             QString cellRef = action["cell"].toString();
             QJsonValue val = action["value"];
             CellAddress addr = parseCellRef(cellRef);
-            auto cell = sheet->getCell(addr);
-            if (val.isDouble()) {
-                cell->setValue(val.toDouble());
-            } else {
-                cell->setValue(val.toString());
-            }
+            sheet->setCellValue(addr, val.toVariant());
 
         } else if (type == "set_formula") {
             QString cellRef = action["cell"].toString();
@@ -2245,6 +2279,7 @@ void MainWindow::onCreatePivotTable() {
 
         // Add the pivot sheet
         m_sheets.push_back(pivotSheet);
+        m_workbook->setSheets(m_sheets);
         m_sheetTabBar->addTab(pivotSheet->getSheetName());
         int pivotSheetIdx = static_cast<int>(m_sheets.size()) - 1;
         m_sheetTabBar->setCurrentIndex(pivotSheetIdx);
@@ -24,6 +24,8 @@ class ShapeWidget;
 class ImageWidget;
 class ChartPropertiesPanel;
 class MacroEngine;
+class Workbook;
+class QTimer;
 struct TemplateResult;
 
 class MainWindow : public QMainWindow {
@@ -103,6 +105,10 @@ private slots:
     void onCreatePivotTable();
     void onRefreshPivotTable();
 
+    // Volatile functions (NOW, TODAY, RAND, RANDBETWEEN)
+    void onRecalculate();
+    void onVolatileTick();
+
     // Templates
     void onTemplateGallery();
 
@@ -132,8 +138,10 @@ private:
     QDockWidget* m_chartPropsDock = nullptr;
     QString m_currentFilePath;  // Track the file path for Ctrl+S
 
-    // Multi-sheet storage
+    // Multi-sheet storage. m_workbook mirrors m_sheets (call setSheets()
+    // after every change) and links formulas across them.
     std::vector<std::shared_ptr<Spreadsheet>> m_sheets;
+    std::shared_ptr<Workbook> m_workbook;
     int m_activeSheetIndex = 0;
     bool m_frozenPanes = false;
     QAction* m_gridlinesAction = nullptr;
@@ -156,6 +164,9 @@ private:
 
     // Macro engine
     MacroEngine* m_macroEngine = nullptr;
+
+    // Keeps NOW()/TODAY() on the active sheet current
+    QTimer* m_volatileTimer = nullptr;
 };
 
 #endif // MAINWINDOW_H
@@ -4,6 +4,7 @@
 #include "../core/UndoManager.h"
 #include "../core/TableStyle.h"
 #include "../core/ConditionalFormatting.h"
+#include "../core/StyleTable.h"
 #include "../core/SparklineConfig.h"
 #include <QFont>
 #include <QMessageBox>
@@ -89,10 +90,10 @@ QVariant SpreadsheetModel::data(const QModelIndex& index, int role) const {
             return m_spreadsheet->getCellValue(CellAddress(index.row(), index.column()));
         }
         case Qt::FontRole: {
-            const auto& baseStyle = cell->getStyle();
             CellAddress addr(index.row(), index.column());
             auto cellValue = m_spreadsheet->getCellValue(addr);
-            CellStyle style = m_spreadsheet->getConditionalFormatting().getEffectiveStyle(addr, cellValue, baseStyle);
+            const CellStyle& style = StyleTable::shared().style(
+                m_spreadsheet->getConditionalFormatting().getEffectiveStyleId(addr, cellValue, cell->getStyleId()));
 
             QFont font(style.fontName);
             font.setPointSize(style.fontSize);
@@ -108,10 +109,10 @@ QVariant SpreadsheetModel::data(const QModelIndex& index, int role) const {
             return font;
         }
         case Qt::ForegroundRole: {
-            const auto& baseStyle = cell->getStyle();
             CellAddress addr(index.row(), index.column());
             auto cellValue = m_spreadsheet->getCellValue(addr);
-            CellStyle style = m_spreadsheet->getConditionalFormatting().getEffectiveStyle(addr, cellValue, baseStyle);
+            const CellStyle& style = StyleTable::shared().style(
+                m_spreadsheet->getConditionalFormatting().getEffectiveStyleId(addr, cellValue, cell->getStyleId()));
             // Table header row: use header foreground
             auto* table = m_spreadsheet->getTableAt(index.row(), index.column());
             if (table && table->hasHeaderRow && index.row() == table->range.getStart().row) {
@@ -120,10 +121,10 @@ QVariant SpreadsheetModel::data(const QModelIndex& index, int role) const {
             return QColor(style.foregroundColor);
         }
         case Qt::BackgroundRole: {
-            const auto& baseStyle = cell->getStyle();
             CellAddress addr(index.row(), index.column());
             auto cellValue = m_spreadsheet->getCellValue(addr);
-            CellStyle style = m_spreadsheet->getConditionalFormatting().getEffectiveStyle(addr, cellValue, baseStyle);
+            const CellStyle& style = StyleTable::shared().style(
+                m_spreadsheet->getConditionalFormatting().getEffectiveStyleId(addr, cellValue, cell->getStyleId()));
             // Check if cell is in a table
             auto* table = m_spreadsheet->getTableAt(index.row(), index.column());
             if (table) {
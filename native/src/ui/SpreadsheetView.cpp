@@ -275,7 +275,7 @@ void SpreadsheetView::copy() {
         CellAddress addr(idx.row(), idx.column());
         auto cell = m_spreadsheet->getCell(addr);
         m_internalClipboard[r][c].value = cell->getValue();
-        m_internalClipboard[r][c].style = cell->getStyle();
+        m_internalClipboard[r][c].styleId = cell->getStyleId();
         m_internalClipboard[r][c].type = cell->getType();
         m_internalClipboard[r][c].formula = cell->getFormula();
     }
@@ -311,6 +311,7 @@ void SpreadsheetView::paste() {
 
     std::vector<CellSnapshot> before, after;
     m_model->setSuppressUndo(true);
+    m_spreadsheet->beginBatch();
 
     // Check if system clipboard matches our internal clipboard (same-app paste with formatting)
     bool useInternalClipboard = !m_internalClipboard.empty() && data == m_internalClipboardText;
@@ -329,7 +330,7 @@ void SpreadsheetView::paste() {
                 }
                 // Apply formatting
                 auto cell = m_spreadsheet->getCell(addr);
-                cell->setStyle(clipCell.style);
+                cell->setStyleId(clipCell.styleId);
 
                 after.push_back(m_spreadsheet->takeCellSnapshot(addr));
             }
@@ -350,6 +351,7 @@ void SpreadsheetView::paste() {
             }
         }
     }
+    m_spreadsheet->endBatch();
     m_model->setSuppressUndo(false);
 
     m_spreadsheet->getUndoManager().pushCommand(
@@ -367,13 +369,16 @@ void SpreadsheetView::deleteSelection() {
     std::vector<CellSnapshot> before, after;
 
     m_model->setSuppressUndo(true);
+    m_spreadsheet->beginBatch();
     for (const auto& index : selected) {
         CellAddress addr(index.row(), index.column());
         before.push_back(m_spreadsheet->takeCellSnapshot(addr));
         m_model->setData(index, "");
         after.push_back(m_spreadsheet->takeCellSnapshot(addr));
     }
+    m_spreadsheet->endBatch();
     m_model->setSuppressUndo(false);
+    viewport()->update();
 
     m_spreadsheet->getUndoManager().pushCommand(
         std::make_unique<MultiCellEditCommand>(before, after, "Delete"));
@@ -2203,6 +2208,7 @@ void SpreadsheetView::performFillSeries() {
     std::vector<CellSnapshot> before, after;
 
     m_model->setSuppressUndo(true);
+    m_spreadsheet->beginBatch();
 
     // Fill down
     if (dragTarget.row() > selMaxRow) {
@@ -2255,7 +2261,9 @@ void SpreadsheetView::performFillSeries() {
         }
     }
 
+    m_spreadsheet->endBatch();
     m_model->setSuppressUndo(false);
+    viewport()->update();
 
     if (!before.empty()) {
         m_spreadsheet->getUndoManager().pushCommand(
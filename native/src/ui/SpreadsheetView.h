@@ -150,7 +150,7 @@ private:
     // Internal clipboard (retains formatting)
     struct ClipboardCell {
         QVariant value;
-        CellStyle style;
+        uint32_t styleId = 0;
         CellType type;
         QString formula;
     };
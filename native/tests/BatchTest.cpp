@@ -0,0 +1,105 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+
+static double numberAt(Spreadsheet& sheet, int row, int col) {
+    return sheet.getCellResult(CellAddress(row, col)).toNumber();
+}
+
+// Edits inside a batch only record what changed; the outermost endBatch()
+// recalculates everything once
+static void testCoalescing() {
+    Spreadsheet sheet;
+    sheet.setCellFormula(CellAddress(0, 1), "=A1+1");
+    sheet.beginBatch();
+    sheet.setCellValue(CellAddress(0, 0), 5);
+    CHECK(numberAt(sheet, 0, 1) == 1);
+
+    sheet.beginBatch();
+    sheet.setCellFormula(CellAddress(0, 2), "=B1*10");
+    sheet.endBatch();
+    CHECK(numberAt(sheet, 0, 2) == 0);
+
+    sheet.insertRow(0, 2);  // recorded cells move with their rows
+    sheet.setCellFormula(CellAddress(5, 0), "=A6");
+    sheet.endBatch();
+    CHECK(numberAt(sheet, 2, 1) == 6);
+    CHECK(numberAt(sheet, 2, 2) == 60);
+    CHECK_TEXT(sheet.getCellResult(CellAddress(5, 0)).toString(), "#CIRCULAR!");
+}
+
+// Chain C(i) = C(i-1) + B(i), B(i) = A(i)*2, edited in every row at once
+static void testApplyBatch() {
+    Spreadsheet sheet;
+    const int rows = 500;
+    for (int i = 0; i < rows; ++i) {
+        sheet.setCellFormula(CellAddress(i, 1), QString("=A%1*2").arg(i + 1));
+        sheet.setCellFormula(CellAddress(i, 2), i == 0 ? QString("=B1") : QString("=C%1+B%2").arg(i).arg(i + 1));
+    }
+    sheet.setCellFormula(CellAddress(0, 4), "=SUM(A1:A1000)");
+
+    std::vector<Spreadsheet::CellEdit> edits;
+    for (int i = 0; i < rows; ++i) edits.push_back({CellAddress(i, 0), QVariant(1), QString()});
+    edits.push_back({CellAddress(rows, 0), QVariant(), "=E1"});
+    sheet.applyBatch(edits);
+    CHECK(numberAt(sheet, rows - 1, 2) == 2.0 * rows);
+    CHECK_TEXT(sheet.getCellResult(CellAddress(0, 4)).toString(), "#CIRCULAR!");
+
+    sheet.fillRange(CellRange(CellAddress(0, 0), CellAddress(rows - 1, 0)), 3);
+    CHECK(numberAt(sheet, rows - 1, 2) == 6.0 * rows);
+}
+
+static void testTransactions() {
+    Spreadsheet sheet;
+    sheet.setCellFormula(CellAddress(0, 1), "=A1*2");
+
+    sheet.startTransaction();
+    sheet.setCellValue(CellAddress(0, 0), 4);
+    CHECK(numberAt(sheet, 0, 1) == 0);
+    sheet.commitTransaction();
+    CHECK(numberAt(sheet, 0, 1) == 8);
+
+    // Rollback drops the pending recalculation instead of running it
+    sheet.startTransaction();
+    sheet.setCellValue(CellAddress(0, 0), 5);
+    sheet.rollbackTransaction();
+    CHECK(numberAt(sheet, 0, 1) == 8);
+    sheet.setCellValue(CellAddress(1, 0), 1);
+    CHECK(numberAt(sheet, 0, 1) == 8);
+
+    // ... but keeps what an enclosing batch recorded
+    sheet.beginBatch();
+    sheet.setCellValue(CellAddress(0, 0), 6);
+    sheet.startTransaction();
+    sheet.setCellValue(CellAddress(2, 0), 1);
+    sheet.rollbackTransaction();
+    CHECK(numberAt(sheet, 0, 1) == 8);
+    sheet.endBatch();
+    CHECK(numberAt(sheet, 0, 1) == 12);
+
+    // Without a transaction, nothing happens
+    sheet.rollbackTransaction();
+    sheet.setCellValue(CellAddress(0, 0), 7);
+    CHECK(numberAt(sheet, 0, 1) == 14);
+}
+
+// A clear inside a batch waits for the batch like any other edit
+static void testClearRangeBatches() {
+    Spreadsheet sheet;
+    for (int r = 0; r < 3; ++r) sheet.setCellValue(CellAddress(r, 0), r + 1);
+    sheet.setCellFormula(CellAddress(0, 1), "=SUM(A1:A3)");
+
+    sheet.beginBatch();
+    sheet.clearRange(CellRange(CellAddress(0, 0), CellAddress(1, 0)));
+    CHECK(numberAt(sheet, 0, 1) == 6);
+    sheet.setCellValue(CellAddress(2, 0), 10);
+    sheet.endBatch();
+    CHECK(numberAt(sheet, 0, 1) == 10);
+}
+
+int main() {
+    testCoalescing();
+    testApplyBatch();
+    testTransactions();
+    testClearRangeBatches();
+    return testResult();
+}
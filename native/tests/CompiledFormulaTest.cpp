@@ -0,0 +1,68 @@
+#include "TestCheck.h"
+#include "FormulaAST.h"
+#include "Spreadsheet.h"
+
+static QString evaluated(Spreadsheet& sheet, const QString& formula) {
+    sheet.setCellFormula(CellAddress(0, 5), formula);
+    return sheet.getCellValue(CellAddress(0, 5)).toString();
+}
+
+// Post-order node array: operands precede their operator, the root is last,
+// and references are collected without evaluating anything
+static void testCompiledShape() {
+    auto compiled = CompiledFormula::compile("=A1+SUM(B1:B3)*2");
+    CHECK(compiled);
+    CHECK(compiled->root() == static_cast<int>(compiled->nodes().size()) - 1);
+    CHECK(compiled->node(compiled->root()).op == FormulaOp::Add);
+    for (size_t i = 0; i < compiled->nodes().size(); ++i) {
+        const FormulaNode& node = compiled->nodes()[i];
+        if (node.op != FormulaOp::Call) CHECK(node.lhs < static_cast<int>(i) && node.rhs < static_cast<int>(i));
+    }
+    CHECK(compiled->cellRefs().size() == 1);
+    CHECK(compiled->rangeRefs().size() == 1);
+    CHECK(compiled->cellRefs()[0].resolve(CellAddress()) == CellAddress(0, 0));
+    CellRange range = compiled->rangeRefs()[0].resolve(CellAddress());
+    CHECK(range.getStart() == CellAddress(0, 1) && range.getEnd() == CellAddress(2, 1));
+    CHECK(!compiled->isVolatile());
+    CHECK(CompiledFormula::compile("=RAND()*10")->isVolatile());
+}
+
+// The compiled evaluator keeps the grammar's precedence and value rules
+static void testEvaluation() {
+    Spreadsheet sheet;
+    sheet.setCellValue(CellAddress(0, 0), 4);
+    sheet.setCellValue(CellAddress(0, 1), "x");
+    CHECK_TEXT(evaluated(sheet, "=1+2*3^2"), "19");
+    CHECK_TEXT(evaluated(sheet, "=(1+2)*3"), "9");
+    CHECK_TEXT(evaluated(sheet, "=-2^2"), "-4");
+    CHECK_TEXT(evaluated(sheet, "=A1*2>7"), "true");
+    CHECK_TEXT(evaluated(sheet, "=B1=\"X\""), "true");
+    CHECK_TEXT(evaluated(sheet, "=IF(A1<>4,\"no\",\"yes\")"), "yes");
+    CHECK_TEXT(evaluated(sheet, "=1/0"), "#DIV/0!");
+    CHECK_TEXT(evaluated(sheet, "=NOSUCHFUNCTION(1)"), "#NAME?");
+}
+
+// A cell compiles its formula once; recalculation reuses the program and only
+// new formula text replaces it
+static void testCompiledOncePerText() {
+    Spreadsheet sheet;
+    sheet.setCellValue(CellAddress(0, 0), 1);
+    sheet.setCellFormula(CellAddress(0, 1), "=A1*10");
+    auto compiled = sheet.getCell(CellAddress(0, 1))->getCompiledFormula();
+    CHECK(compiled);
+
+    for (int i = 2; i < 10; ++i) sheet.setCellValue(CellAddress(0, 0), i);
+    CHECK_TEXT(sheet.getCellValue(CellAddress(0, 1)).toString(), "90");
+    CHECK(sheet.getCell(CellAddress(0, 1))->getCompiledFormula() == compiled);
+
+    sheet.setCellFormula(CellAddress(0, 1), "=A1*100");
+    CHECK(sheet.getCell(CellAddress(0, 1))->getCompiledFormula() != compiled);
+    CHECK_TEXT(sheet.getCellValue(CellAddress(0, 1)).toString(), "900");
+}
+
+int main() {
+    testCompiledShape();
+    testEvaluation();
+    testCompiledOncePerText();
+    return testResult();
+}
@@ -0,0 +1,161 @@
+#include "TestCheck.h"
+#include "DependencyGraph.h"
+#include "Spreadsheet.h"
+#include <algorithm>
+
+static size_t positionOf(const std::vector<CellAddress>& order, const CellAddress& addr) {
+    return std::find(order.begin(), order.end(), addr) - order.begin();
+}
+
+// A1 -> B1 -> C1 and A1 -> C1: a breadth-first walk can reach C1 before B1,
+// the topological plan never does
+static void testDiamondLevels() {
+    DependencyGraph graph;
+    CellAddress a(0, 0), b(0, 1), c(0, 2);
+    graph.addDependency(b, a);
+    graph.addDependency(c, a);
+    graph.addDependency(c, b);
+
+    DependencyGraph::RecalcPlan plan = graph.getRecalcPlan({a}, true);
+    CHECK(plan.order.size() == 3);
+    CHECK(plan.circular.empty());
+    CHECK(positionOf(plan.order, a) < positionOf(plan.order, b));
+    CHECK(positionOf(plan.order, b) < positionOf(plan.order, c));
+    CHECK((plan.levelStarts == std::vector<size_t>{0, 1, 2, 3}));
+
+    // Without the changed cell, only what it feeds
+    plan = graph.getRecalcPlan({a}, false);
+    CHECK((plan.order == std::vector<CellAddress>{b, c}));
+}
+
+// Independent cells share a level; a range edge counts like a point edge
+static void testWideLevel() {
+    DependencyGraph graph;
+    CellAddress input(0, 0), total(0, 5);
+    for (int r = 1; r <= 4; ++r) graph.addDependency(CellAddress(r, 0), input);
+    graph.addRangeDependency(total, CellRange(CellAddress(1, 0), CellAddress(4, 0)));
+
+    DependencyGraph::RecalcPlan plan = graph.getRecalcPlan({input}, false);
+    CHECK(plan.order.size() == 5);
+    CHECK((plan.levelStarts == std::vector<size_t>{0, 4, 5}));
+    CHECK(plan.order.back() == total);
+}
+
+// Cells on a cycle, and cells fed by one, are reported instead of ordered
+static void testCycle() {
+    DependencyGraph graph;
+    CellAddress a(0, 0), b(0, 1), c(0, 2), d(0, 3);
+    graph.addDependency(b, a);
+    graph.addDependency(c, b);
+    graph.addDependency(b, c);
+    graph.addDependency(d, c);
+
+    DependencyGraph::RecalcPlan plan = graph.getRecalcPlan({a}, true);
+    CHECK((plan.order == std::vector<CellAddress>{a}));
+    CHECK(plan.circular.size() == 3);
+    for (const CellAddress& addr : {b, c, d}) {
+        CHECK(std::find(plan.circular.begin(), plan.circular.end(), addr) != plan.circular.end());
+    }
+    CHECK(graph.hasCircularDependency(b));
+    CHECK(!graph.hasCircularDependency(a));
+
+    graph.removeDependencies(b);
+    graph.addDependency(b, a);
+    plan = graph.getRecalcPlan({a}, true);
+    CHECK(plan.circular.empty());
+    CHECK(plan.order.size() == 4);
+}
+
+static void testSheetRecalc() {
+    Spreadsheet sheet;
+    sheet.setCellValue(CellAddress(0, 0), 1);
+    sheet.setCellFormula(CellAddress(0, 1), "=A1*2");
+    sheet.setCellFormula(CellAddress(0, 2), "=A1+B1");
+    sheet.setCellValue(CellAddress(0, 0), 5);
+    CHECK_TEXT(sheet.getCellValue(CellAddress(0, 2)).toString(), "15");
+
+    sheet.setCellFormula(CellAddress(1, 0), "=B2+1");
+    sheet.setCellFormula(CellAddress(1, 1), "=A2+1");
+    CHECK_TEXT(sheet.getCellValue(CellAddress(1, 0)).toString(), "#CIRCULAR!");
+    CHECK_TEXT(sheet.getCellValue(CellAddress(1, 1)).toString(), "#CIRCULAR!");
+
+    // Breaking the cycle recovers both cells
+    sheet.setCellValue(CellAddress(1, 1), 7);
+    CHECK_TEXT(sheet.getCellValue(CellAddress(1, 0)).toString(), "8");
+}
+
+// Readers of a region: point references inside it and ranges overlapping it
+static void testReaders() {
+    DependencyGraph graph;
+    graph.addDependency(CellAddress(0, 5), CellAddress(4, 0));     // F1 = A5
+    graph.addDependency(CellAddress(1, 5), CellAddress(4, 3));     // F2 = D5
+    graph.addDependency(CellAddress(2, 5), CellAddress(9, 1));     // F3 = B10
+    graph.addDependency(CellAddress(3, 5), CellAddress(2, 1));     // F4 = B3
+    graph.addRangeDependency(CellAddress(4, 5), CellRange(0, 0, 5, 0));  // F5 = SUM(A1:A6)
+    graph.addRangeDependency(CellAddress(5, 5), CellRange(0, 2, 3, 2));  // F6 = SUM(C1:C4)
+
+    std::vector<CellAddress> readers = graph.getReaders(CellRange(4, 0, INT32_MAX, 1));
+    std::sort(readers.begin(), readers.end());
+    CHECK((readers == std::vector<CellAddress>{CellAddress(0, 5), CellAddress(2, 5), CellAddress(4, 5)}));
+
+    readers = graph.getReaders(CellRange(INT32_MIN, 2, INT32_MAX, INT32_MAX));
+    std::sort(readers.begin(), readers.end());
+    CHECK((readers == std::vector<CellAddress>{CellAddress(1, 5), CellAddress(5, 5)}));
+
+    // A removed edge no longer counts
+    graph.removeDependencies(CellAddress(2, 5));
+    readers = graph.getReaders(CellRange(9, 0, 9, INT32_MAX));
+    CHECK(readers.empty());
+}
+
+static std::vector<CellAddress> sortedDependents(const DependencyGraph& graph, const CellAddress& cell) {
+    std::vector<CellAddress> dependents = graph.getDependents(cell);
+    std::sort(dependents.begin(), dependents.end());
+    return dependents;
+}
+
+// An anchor's dependents include readers of any cell of its block, kept as
+// edges come and go and as the block changes; the block is never walked
+// cell by cell, so a huge one costs no more than a small one
+static void testSpillReaders() {
+    DependencyGraph graph;
+    CellAddress anchor(0, 0), early(0, 3), late(1, 3), total(2, 3), anchorReader(3, 3);
+    graph.addDependency(early, CellAddress(2, 0));                   // D1 = A3
+    graph.setSpillRange(anchor, CellRange(0, 0, 4, 0));              // A1:A5
+    graph.addDependency(late, CellAddress(4, 0));                    // D2 = A5
+    graph.addDependency(late, CellAddress(3, 0));                    // and A4
+    graph.addRangeDependency(total, CellRange(3, 0, 9, 0));          // D3 = SUM(A4:A10)
+    graph.addDependency(anchorReader, anchor);                       // D4 = A1
+    CHECK((sortedDependents(graph, anchor) == std::vector<CellAddress>{early, late, total, anchorReader}));
+
+    // One of two edges into the block gone: still a reader
+    graph.removeDependencies(late);
+    graph.addDependency(late, CellAddress(3, 0));
+    CHECK((sortedDependents(graph, anchor) == std::vector<CellAddress>{early, late, total, anchorReader}));
+    graph.removeDependencies(late);
+    CHECK((sortedDependents(graph, anchor) == std::vector<CellAddress>{early, total, anchorReader}));
+
+    // A smaller block leaves A3 and A4 out
+    graph.setSpillRange(anchor, CellRange(0, 0, 1, 0));
+    CHECK((sortedDependents(graph, anchor) == std::vector<CellAddress>{anchorReader}));
+
+    graph.setSpillRange(anchor, CellRange(0, 0, 999999, 999));
+    graph.addDependency(late, CellAddress(500000, 900));
+    CHECK((sortedDependents(graph, anchor) == std::vector<CellAddress>{early, late, total, anchorReader}));
+    DependencyGraph::RecalcPlan plan = graph.getRecalcPlan({anchor}, true);
+    CHECK(plan.order.size() == 5);
+    CHECK(plan.circular.empty());
+
+    graph.removeSpillRange(anchor);
+    CHECK((sortedDependents(graph, anchor) == std::vector<CellAddress>{anchorReader}));
+}
+
+int main() {
+    testDiamondLevels();
+    testWideLevel();
+    testCycle();
+    testSheetRecalc();
+    testReaders();
+    testSpillReaders();
+    return testResult();
+}
@@ -0,0 +1,63 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+#include "FormulaAST.h"
+
+static QString valueAt(Spreadsheet& sheet, int row, int col) {
+    return sheet.getCellValue(CellAddress(row, col)).toString();
+}
+
+// Filled-down formulas share one compiled program and still read their own row
+static void testFilledColumnShares() {
+    Spreadsheet sheet;
+    for (int r = 0; r < 10; ++r) {
+        sheet.setCellValue(CellAddress(r, 0), r + 1);
+        sheet.setCellValue(CellAddress(r, 1), 10 * (r + 1));
+    }
+    sheet.setCellValue(CellAddress(0, 5), 100);
+    for (int r = 0; r < 10; ++r) {
+        QString row = QString::number(r + 1);
+        sheet.setCellFormula(CellAddress(r, 2), "=A" + row + "+B" + row + "*$F$1");
+        sheet.setCellFormula(CellAddress(r, 3), "=SUM($A$1:A" + row + ")");
+    }
+
+    auto first = sheet.getCell(CellAddress(0, 2))->getCompiledFormula();
+    CHECK(first);
+    CHECK(first == sheet.getCell(CellAddress(9, 2))->getCompiledFormula());
+    CHECK(sheet.getCell(CellAddress(0, 3))->getCompiledFormula() ==
+          sheet.getCell(CellAddress(5, 3))->getCompiledFormula());
+
+    CHECK_TEXT(valueAt(sheet, 0, 2), "1001");
+    CHECK_TEXT(valueAt(sheet, 9, 2), "10010");
+    CHECK_TEXT(valueAt(sheet, 2, 3), "6");
+    CHECK_TEXT(valueAt(sheet, 9, 3), "55");
+
+    sheet.setCellValue(CellAddress(4, 0), 50);
+    CHECK_TEXT(valueAt(sheet, 4, 2), "5050");
+    CHECK_TEXT(valueAt(sheet, 9, 3), "100");
+    sheet.setCellValue(CellAddress(0, 5), 1);
+    CHECK_TEXT(valueAt(sheet, 9, 2), "110");
+}
+
+static void testR1C1Key() {
+    CHECK(CompiledFormula::r1c1Key("=A1+1", CellAddress(0, 0)) ==
+          CompiledFormula::r1c1Key("=B7+1", CellAddress(6, 1)));
+    CHECK(CompiledFormula::r1c1Key("=A1+1", CellAddress(0, 0)) !=
+          CompiledFormula::r1c1Key("=$A$1+1", CellAddress(0, 0)));
+    CHECK(CompiledFormula::r1c1Key("=A1+1", CellAddress(0, 0)) !=
+          CompiledFormula::r1c1Key("=A2+1", CellAddress(0, 0)));
+    CHECK_TEXT(CompiledFormula::r1c1Key("=TRUE", CellAddress(0, 0)), "=TRUE");
+}
+
+// Relative references move, absolute ones and string literals don't
+static void testRebase() {
+    CHECK_TEXT(CompiledFormula::rebase("=SUM($A$1:A1)+B1*$C2+D$3+\"A1\"+ROUND(E1,0)",
+                                       CellAddress(0, 0), CellAddress(4, 2)),
+               "=SUM($A$1:C5)+D5*$C6+F$3+\"A1\"+ROUND(G5,0)");
+}
+
+int main() {
+    testFilledColumnShares();
+    testR1C1Key();
+    testRebase();
+    return testResult();
+}
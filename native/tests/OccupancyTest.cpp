@@ -0,0 +1,66 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+#include <algorithm>
+#include <random>
+
+static constexpr int kRows = 40;
+static constexpr int kCols = 12;
+
+// What the tracked occupancy and dirty list should say, found by looking at
+// every cell the edits below can reach
+static bool matchesScan(const Spreadsheet& sheet) {
+    int maxRow = -1, maxCol = -1;
+    std::vector<CellAddress> dirty;
+    for (int col = 0; col < 2 * kCols; ++col) {
+        for (int row = 0; row < 2 * kRows; ++row) {
+            auto cell = sheet.getCellIfExists(row, col);
+            if (!cell) continue;
+            if (cell->getType() != CellType::Empty) {
+                maxRow = std::max(maxRow, row);
+                maxCol = std::max(maxCol, col);
+            }
+            if (cell->isDirty()) dirty.emplace_back(row, col);
+        }
+    }
+    std::sort(dirty.begin(), dirty.end());
+    return sheet.getMaxRow() == maxRow && sheet.getMaxColumn() == maxCol && sheet.getDirtyCells() == dirty;
+}
+
+static void testStructuralEditsKeepTracking() {
+    Spreadsheet sheet;
+    std::mt19937 rng(7);
+    auto pick = [&](int n) { return static_cast<int>(rng() % n); };
+    int mismatches = 0;
+    for (int step = 0; step < 3000; ++step) {
+        int row = pick(kRows), col = pick(kCols), count = 1 + pick(3);
+        CellRange band(row, col, row + pick(3), col + pick(3));
+        switch (pick(12)) {
+        case 0: case 1: case 2: sheet.setCellValue(CellAddress(row, col), step); break;
+        case 3: sheet.setCellValue(CellAddress(row, col), QVariant()); break;
+        case 4: sheet.insertRow(row, count); break;
+        case 5: sheet.deleteRow(row, count); break;
+        case 6: sheet.insertColumn(col, count); break;
+        case 7: sheet.deleteColumn(col, count); break;
+        case 8: sheet.insertCellsShiftDown(band); break;
+        case 9: sheet.deleteCellsShiftUp(band); break;
+        case 10: pick(2) ? sheet.insertCellsShiftRight(band) : sheet.deleteCellsShiftLeft(band); break;
+        case 11: sheet.clearDirtyFlag(); break;
+        }
+        // Keep everything tracked inside the scanned area
+        std::vector<CellAddress> dirty = sheet.getDirtyCells();
+        bool outside = std::any_of(dirty.begin(), dirty.end(), [](const CellAddress& addr) {
+            return addr.row >= kRows || addr.col >= kCols;
+        });
+        if (outside || sheet.getMaxRow() >= kRows || sheet.getMaxColumn() >= kCols) {
+            sheet.clearRange(CellRange(0, 0, 2 * kRows, 2 * kCols));
+            sheet.clearDirtyFlag();
+        }
+        if (!matchesScan(sheet) && mismatches++ < 5) std::printf("tracking differs after step %d\n", step);
+    }
+    CHECK(mismatches == 0);
+}
+
+int main() {
+    testStructuralEditsKeepTracking();
+    return testResult();
+}
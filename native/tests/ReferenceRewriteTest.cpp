@@ -0,0 +1,166 @@
+#include "TestCheck.h"
+#include "FormulaAST.h"
+#include "Spreadsheet.h"
+#include "Workbook.h"
+
+static QString formulaAt(Spreadsheet& sheet, int row, int col) {
+    auto cell = sheet.getCellIfExists(row, col);
+    return cell ? cell->getFormula() : QString();
+}
+
+static QString valueAt(Spreadsheet& sheet, int row, int col) {
+    return sheet.getCellValue(CellAddress(row, col)).toString();
+}
+
+static QString adjusted(const QString& formula, const StructuralEdit& edit, bool* resized = nullptr) {
+    return CompiledFormula::adjustReferences(formula, edit, "Sheet1", true, resized);
+}
+
+static void testAdjustReferences() {
+    StructuralEdit insertRows{true, 4, 2};
+    bool resized = false;
+    CHECK_TEXT(adjusted("=A4+A5+$B$9", insertRows, &resized), "=A4+A7+$B$11");
+    CHECK(!resized);
+    CHECK_TEXT(adjusted("=SUM(A1:A10)", insertRows, &resized), "=SUM(A1:A12)");
+    CHECK(resized);
+    // Text that only looks like a reference stays as it is
+    CHECK_TEXT(adjusted("=CONCAT(\"A9\",A9)", insertRows), "=CONCAT(\"A9\",A11)");
+
+    StructuralEdit deleteRows{true, 4, -2};  // rows 5 and 6
+    CHECK_TEXT(adjusted("=A5*2", deleteRows, &resized), "=#REF!*2");
+    CHECK(resized);
+    CHECK_TEXT(adjusted("=SUM(A1:A10)+A7", deleteRows), "=SUM(A1:A8)+A5");
+    CHECK_TEXT(adjusted("=SUM(A5:A6)", deleteRows), "=SUM(#REF!)");
+
+    StructuralEdit insertColumns{false, 1, 1};
+    CHECK_TEXT(adjusted("=A1+B1+$C$2", insertColumns), "=A1+C1+$D$2");
+
+    // Qualified references follow only the sheet they name
+    CHECK_TEXT(CompiledFormula::adjustReferences("=Sheet1!A9+Other!A9+A9", insertRows, "Sheet1", false),
+               "=Sheet1!A11+Other!A9+A9");
+
+    // Shift-cells edits move only the band they cover
+    StructuralEdit shiftDown{true, 0, 2, 0, 0};
+    CHECK_TEXT(adjusted("=A1+B1", shiftDown), "=A3+B1");
+}
+
+static void testRowEdits() {
+    Spreadsheet sheet;
+    for (int r = 0; r < 10; ++r) sheet.setCellValue(CellAddress(r, 0), r + 1);
+    sheet.setCellFormula(CellAddress(0, 1), "=SUM(A1:A10)");
+    sheet.setCellFormula(CellAddress(0, 2), "=A5*2");
+    sheet.setCellFormula(CellAddress(19, 3), "=A10+$A$1");
+
+    sheet.insertRow(4);
+    CHECK_TEXT(formulaAt(sheet, 0, 1), "=SUM(A1:A11)");
+    CHECK_TEXT(formulaAt(sheet, 0, 2), "=A6*2");
+    CHECK_TEXT(formulaAt(sheet, 20, 3), "=A11+$A$1");
+    CHECK_TEXT(valueAt(sheet, 20, 3), "11");
+
+    // Dependencies follow the rewritten references
+    sheet.setCellValue(CellAddress(4, 0), 100);
+    CHECK_TEXT(valueAt(sheet, 0, 1), "155");
+    CHECK_TEXT(valueAt(sheet, 0, 2), "10");
+    sheet.setCellValue(CellAddress(5, 0), 7);
+    CHECK_TEXT(valueAt(sheet, 0, 2), "14");
+
+    sheet.deleteRow(5);
+    CHECK_TEXT(formulaAt(sheet, 0, 2), "=#REF!*2");
+    CHECK_TEXT(valueAt(sheet, 0, 2), "#REF!");
+    CHECK_TEXT(formulaAt(sheet, 0, 1), "=SUM(A1:A10)");
+    CHECK_TEXT(valueAt(sheet, 0, 1), "150");
+    CHECK_TEXT(formulaAt(sheet, 19, 3), "=A10+$A$1");
+
+    // A formula on a deleted row goes with it
+    sheet.setCellFormula(CellAddress(30, 5), "=A1");
+    sheet.deleteRow(30);
+    auto cell = sheet.getCellIfExists(30, 5);
+    CHECK(!cell || cell->getType() != CellType::Formula);
+    sheet.setCellValue(CellAddress(0, 0), 2);
+    CHECK_TEXT(valueAt(sheet, 0, 1), "151");
+}
+
+static void testColumnAndShiftEdits() {
+    Spreadsheet sheet;
+    for (int r = 0; r < 10; ++r) sheet.setCellValue(CellAddress(r, 0), r + 1);
+    sheet.setCellFormula(CellAddress(0, 1), "=SUM(A1:A10)");
+
+    sheet.insertColumn(0);
+    CHECK_TEXT(formulaAt(sheet, 0, 2), "=SUM(B1:B10)");
+    CHECK_TEXT(valueAt(sheet, 0, 2), "55");
+    sheet.deleteColumn(0);
+    CHECK_TEXT(formulaAt(sheet, 0, 1), "=SUM(A1:A10)");
+
+    sheet.insertCellsShiftDown(CellRange(0, 0, 1, 0));
+    CHECK_TEXT(formulaAt(sheet, 0, 1), "=SUM(A3:A12)");
+    CHECK_TEXT(valueAt(sheet, 0, 1), "55");
+    sheet.deleteCellsShiftUp(CellRange(0, 0, 1, 0));
+    CHECK_TEXT(formulaAt(sheet, 0, 1), "=SUM(A1:A10)");
+    CHECK_TEXT(valueAt(sheet, 0, 1), "55");
+}
+
+// Formulas that neither move nor read moved cells are left compiled as
+// they were; moved ones keep their volatility
+static void testUntouchedFormulas() {
+    Spreadsheet sheet;
+    for (int r = 0; r < 10; ++r) sheet.setCellValue(CellAddress(r, 0), r + 1);
+    sheet.setCellFormula(CellAddress(0, 1), "=A1+A2");
+    sheet.setCellFormula(CellAddress(0, 2), "=C5*0+RAND()*0+1");
+    sheet.setCellFormula(CellAddress(6, 2), "=RAND()*0+A7");
+    sheet.setCellFormula(CellAddress(8, 3), "=1+1");
+    auto above = sheet.getCellIfExists(0, 1)->getCompiledFormula();
+
+    sheet.insertRow(4, 2);
+    CHECK(sheet.getCellIfExists(0, 1)->getCompiledFormula() == above);
+    CHECK_TEXT(formulaAt(sheet, 0, 2), "=C7*0+RAND()*0+1");
+    CHECK_TEXT(formulaAt(sheet, 8, 2), "=RAND()*0+A9");
+    CHECK_TEXT(formulaAt(sheet, 10, 3), "=1+1");
+    CHECK_TEXT(valueAt(sheet, 10, 3), "2");
+
+    // The volatile formula is recalculated where it landed
+    sheet.setAutoRecalculate(false);
+    sheet.getCell(8, 0)->setValue(40);
+    CHECK(sheet.recalculateVolatile());
+    CHECK_TEXT(valueAt(sheet, 8, 2), "40");
+    sheet.setAutoRecalculate(true);
+
+    // Moved formulas are found again by the next edit
+    sheet.deleteRow(0);
+    CHECK_TEXT(formulaAt(sheet, 9, 3), "=1+1");
+    CHECK_TEXT(formulaAt(sheet, 7, 2), "=RAND()*0+A8");
+    sheet.insertColumn(0);
+    CHECK_TEXT(formulaAt(sheet, 7, 3), "=RAND()*0+B8");
+    CHECK_TEXT(formulaAt(sheet, 9, 4), "=1+1");
+}
+
+// Other sheets' references into the edited sheet are rewritten as well
+static void testCrossSheet() {
+    auto first = std::make_shared<Spreadsheet>();
+    first->setSheetName("Sheet1");
+    auto other = std::make_shared<Spreadsheet>();
+    other->setSheetName("Other Sheet");
+    Workbook workbook;
+    workbook.setSheets({first, other});
+
+    for (int r = 0; r < 5; ++r) first->setCellValue(CellAddress(r, 0), r + 1);
+    first->setCellValue(CellAddress(0, 1), 50);
+    other->setCellFormula(CellAddress(0, 0), "=Sheet1!A3+'Sheet1'!B1");
+    CHECK_TEXT(valueAt(*other, 0, 0), "53");
+
+    first->insertRow(4);
+    CHECK_TEXT(formulaAt(*other, 0, 0), "=Sheet1!A3+'Sheet1'!B1");
+    first->insertColumn(0);
+    CHECK_TEXT(formulaAt(*other, 0, 0), "=Sheet1!B3+'Sheet1'!C1");
+    CHECK_TEXT(valueAt(*other, 0, 0), "53");
+    first->setCellValue(CellAddress(2, 1), 10);
+    CHECK_TEXT(valueAt(*other, 0, 0), "60");
+}
+
+int main() {
+    testAdjustReferences();
+    testRowEdits();
+    testColumnAndShiftEdits();
+    testUntouchedFormulas();
+    testCrossSheet();
+    return testResult();
+}
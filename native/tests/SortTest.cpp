@@ -0,0 +1,117 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+#include <random>
+
+// Column C holds each row's original position, so the order reads off it
+static QString rowOrder(Spreadsheet& sheet, int rows) {
+    QString order;
+    for (int r = 0; r < rows; ++r) order += sheet.getCellValue(CellAddress(r, 2)).toString() + ",";
+    return order;
+}
+
+// Numbers sort before text, text case-insensitively, blanks last whatever
+// the direction; ties keep their order
+static void testTypedKeys() {
+    Spreadsheet sheet;
+    const char* names[] = {"pear", "Apple", "fig", "apple", "", "Fig", "10", "9"};
+    const int quantities[] = {3, 5, 1, 2, 7, 1, 4, 4};
+    for (int r = 0; r < 8; ++r) {
+        if (names[r][0]) sheet.setCellValue(CellAddress(r, 0), QVariant(QString(names[r])));
+        sheet.setCellValue(CellAddress(r, 1), quantities[r]);
+        sheet.setCellValue(CellAddress(r, 2), r);
+    }
+    sheet.setCellFormula(CellAddress(0, 4), "=SUM(B1:B3)");
+    CHECK_TEXT(sheet.getCellValue(CellAddress(0, 4)).toString(), "9");
+
+    sheet.sortRange(CellRange(0, 0, 7, 2), 0, true);
+    CHECK_TEXT(rowOrder(sheet, 8), "7,6,1,3,2,5,0,4,");
+    CHECK_TEXT(sheet.getCellValue(CellAddress(0, 4)).toString(), "13");
+
+    sheet.sortRange(CellRange(0, 0, 7, 2), {{0, true}, {1, false}});
+    CHECK_TEXT(rowOrder(sheet, 8), "7,6,1,3,2,5,0,4,");
+
+    sheet.sortRange(CellRange(0, 0, 7, 2), {{1, false}, {0, false}});
+    CHECK_TEXT(rowOrder(sheet, 8), "4,1,6,7,0,3,2,5,");
+}
+
+// Large enough to take the parallel path; checked against the keys directly
+static void testLargeStableSort() {
+    Spreadsheet sheet;
+    sheet.setAutoRecalculate(false);
+    sheet.setRecalcThreadCount(4);
+    std::mt19937 rng(3);
+    const int rows = 50000;
+    for (int r = 0; r < rows; ++r) {
+        sheet.setCellValue(CellAddress(r, 0), static_cast<int>(rng() % 100));
+        sheet.setCellValue(CellAddress(r, 1), QVariant(QString("k%1").arg(rng() % 500)));
+        sheet.setCellValue(CellAddress(r, 2), r);
+    }
+    sheet.sortRange(CellRange(0, 0, rows - 1, 2), {{0, true}, {1, false}});
+
+    int misordered = 0;
+    for (int r = 1; r < rows; ++r) {
+        double a = sheet.getCellResult(CellAddress(r - 1, 0)).toNumber();
+        double b = sheet.getCellResult(CellAddress(r, 0)).toNumber();
+        if (a != b) {
+            misordered += a > b;
+            continue;
+        }
+        QString x = sheet.getCellResult(CellAddress(r - 1, 1)).toString().toCaseFolded();
+        QString y = sheet.getCellResult(CellAddress(r, 1)).toString().toCaseFolded();
+        if (x != y) {
+            misordered += x < y;
+            continue;
+        }
+        misordered += sheet.getCellResult(CellAddress(r - 1, 2)).toNumber() >
+                      sheet.getCellResult(CellAddress(r, 2)).toNumber();
+    }
+    CHECK(misordered == 0);
+}
+
+// A sort gives back only the spills it moves cells under; others stay put
+static void testSpillsAroundSortedRange() {
+    Spreadsheet sheet;
+    for (int r = 0; r < 5; ++r) {
+        sheet.setCellValue(CellAddress(r, 0), 5 - r);
+        sheet.setCellValue(CellAddress(r, 1), 10 * (5 - r));
+        sheet.setCellValue(CellAddress(r, 23), r + 1);
+    }
+    sheet.setCellFormula(CellAddress(0, 7), "=X1:X5");      // H1, inputs and block off the range
+    sheet.setCellFormula(CellAddress(0, 8), "=H3*2");       // reads the block
+    sheet.setCellFormula(CellAddress(0, 9), "=A1:A5*10");   // J1 spills from the sorted cells
+
+    sheet.sortRange(CellRange(0, 0, 4, 2), 0, true);
+    for (int r = 0; r < 5; ++r) {
+        CHECK(sheet.getCellResult(CellAddress(r, 7)).toNumber() == r + 1);
+        CHECK(sheet.getCellIfExists(CellAddress(r, 7))->isSpilled() == (r > 0));
+        CHECK(sheet.getCellResult(CellAddress(r, 9)).toNumber() == 10.0 * (r + 1));
+    }
+    CHECK(sheet.getCellResult(CellAddress(0, 8)).toNumber() == 6);
+    sheet.setCellValue(CellAddress(2, 23), 30);
+    CHECK(sheet.getCellResult(CellAddress(0, 8)).toNumber() == 60);
+
+    // With recalculation off, spills clear of the range keep their values
+    sheet.setAutoRecalculate(false);
+    sheet.sortRange(CellRange(0, 0, 4, 2), 0, false);
+    CHECK(sheet.getCellResult(CellAddress(4, 7)).toNumber() == 5);
+
+    // A1 spills into A1:B2 but B2 is in the way until the sort moves it off
+    Spreadsheet blocked;
+    blocked.setCellValue(CellAddress(1, 1), "x");
+    for (int r = 1; r < 6; ++r) blocked.setCellValue(CellAddress(r, 2), r == 1 ? 9 : r);
+    blocked.setCellValue(CellAddress(0, 23), 1);
+    blocked.setCellValue(CellAddress(1, 24), 4);
+    blocked.setCellFormula(CellAddress(0, 0), "=X1:Y2");
+    CHECK_TEXT(blocked.getCellResult(CellAddress(0, 0)).toString(), "#SPILL!");
+    blocked.sortRange(CellRange(1, 1, 5, 2), {{2, true}});
+    CHECK_TEXT(blocked.getCellResult(CellAddress(5, 1)).toString(), "x");
+    CHECK(blocked.getCellResult(CellAddress(0, 0)).toNumber() == 1);
+    CHECK(blocked.getCellResult(CellAddress(1, 1)).toNumber() == 4);
+}
+
+int main() {
+    testTypedKeys();
+    testSpillsAroundSortedRange();
+    testLargeStableSort();
+    return testResult();
+}
@@ -0,0 +1,123 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+
+static double numberAt(Spreadsheet& sheet, int row, int col) {
+    return sheet.getCellResult(CellAddress(row, col)).toNumber();
+}
+
+static QString textAt(Spreadsheet& sheet, int row, int col) {
+    return sheet.getCellResult(CellAddress(row, col)).toString();
+}
+
+// A1:A5 = 1..5, B1:B5 = 10..50, D1 spills A*B into D1:D5
+static void fillProducts(Spreadsheet& sheet) {
+    for (int r = 0; r < 5; ++r) {
+        sheet.setCellValue(CellAddress(r, 0), r + 1);
+        sheet.setCellValue(CellAddress(r, 1), 10 * (r + 1));
+    }
+    sheet.setCellFormula(CellAddress(0, 3), "=A1:A5*B1:B5");
+}
+
+static void testPlacement() {
+    Spreadsheet sheet;
+    fillProducts(sheet);
+    for (int r = 0; r < 5; ++r) CHECK(numberAt(sheet, r, 3) == 10.0 * (r + 1) * (r + 1));
+    CHECK(sheet.getCellIfExists(CellAddress(2, 3))->isSpilled());
+
+    // Readers of spilled cells follow the anchor's inputs
+    sheet.setCellFormula(CellAddress(0, 5), "=D4+1");
+    sheet.setCellFormula(CellAddress(1, 5), "=SUM(D1:D5)");
+    sheet.setCellValue(CellAddress(3, 0), 2);
+    CHECK(numberAt(sheet, 3, 3) == 80);
+    CHECK(numberAt(sheet, 0, 5) == 81);
+    CHECK(numberAt(sheet, 1, 5) == 10 + 40 + 90 + 80 + 250);
+
+    // Growing the block reaches readers of newly covered cells
+    sheet.setCellFormula(CellAddress(10, 1), "=H13*2");
+    sheet.setCellFormula(CellAddress(10, 7), "=A1:A2");
+    CHECK(numberAt(sheet, 11, 7) == 2);
+    sheet.setCellFormula(CellAddress(10, 7), "=A1:A5");
+    CHECK(numberAt(sheet, 12, 7) == 3);
+    CHECK(numberAt(sheet, 10, 1) == 6);
+}
+
+static void testBlocking() {
+    Spreadsheet sheet;
+    fillProducts(sheet);
+    sheet.setCellFormula(CellAddress(0, 5), "=D4+1");
+
+    sheet.setCellValue(CellAddress(2, 3), 7);
+    CHECK_TEXT(textAt(sheet, 0, 3), "#SPILL!");
+    CHECK(sheet.getCellResult(CellAddress(3, 3)).isEmpty());
+    CHECK(numberAt(sheet, 0, 5) == 1);
+
+    sheet.setCellValue(CellAddress(2, 3), QVariant());
+    CHECK(numberAt(sheet, 0, 3) == 10);
+    CHECK(numberAt(sheet, 3, 3) == 160);
+    CHECK(numberAt(sheet, 0, 5) == 161);
+}
+
+static void testRelease() {
+    Spreadsheet sheet;
+    fillProducts(sheet);
+    sheet.setCellFormula(CellAddress(0, 5), "=D4+1");
+
+    sheet.setCellFormula(CellAddress(0, 3), "=5");
+    CHECK(sheet.getCellResult(CellAddress(3, 3)).isEmpty());
+    CHECK(!sheet.getCellIfExists(CellAddress(3, 3))->isSpilled());
+    CHECK(numberAt(sheet, 0, 5) == 1);
+
+    sheet.setCellFormula(CellAddress(0, 3), "=A1:A5*B1:B5");
+    sheet.setCellValue(CellAddress(0, 3), 1);
+    CHECK(sheet.getCellResult(CellAddress(3, 3)).isEmpty());
+    CHECK(numberAt(sheet, 0, 5) == 1);
+}
+
+// Clearing goes through the same bookkeeping as an edit
+static void testClearRange() {
+    Spreadsheet sheet;
+    fillProducts(sheet);
+    sheet.setCellFormula(CellAddress(0, 5), "=D4+1");
+    sheet.setCellFormula(CellAddress(1, 5), "=SUM(D1:D5)");
+
+    // Clearing the anchor releases its block and updates readers
+    sheet.clearRange(CellRange(CellAddress(0, 3), CellAddress(0, 3)));
+    CHECK(sheet.getCellResult(CellAddress(3, 3)).isEmpty());
+    CHECK(numberAt(sheet, 0, 5) == 1);
+    CHECK(numberAt(sheet, 1, 5) == 0);
+
+    // A cleared formula no longer follows its inputs
+    sheet.setCellFormula(CellAddress(0, 3), "=A1:A5*B1:B5");
+    sheet.setCellFormula(CellAddress(6, 0), "=A1*100");
+    sheet.clearRange(CellRange(CellAddress(6, 0), CellAddress(6, 0)));
+    sheet.setCellValue(CellAddress(0, 0), 9);
+    CHECK(sheet.getCellResult(CellAddress(6, 0)).isEmpty());
+    CHECK(numberAt(sheet, 0, 3) == 90);
+
+    // Clearing an obstruction lets the anchor spill again
+    sheet.setCellValue(CellAddress(2, 3), "x");
+    CHECK_TEXT(textAt(sheet, 0, 3), "#SPILL!");
+    sheet.clearRange(CellRange(CellAddress(2, 3), CellAddress(2, 4)));
+    CHECK(numberAt(sheet, 0, 3) == 90);
+    CHECK(numberAt(sheet, 3, 3) == 160);
+    CHECK(numberAt(sheet, 0, 5) == 161);
+
+    // Inputs cleared together recalculate their dependents once, as blanks
+    sheet.clearRange(CellRange(CellAddress(0, 0), CellAddress(4, 1)));
+    CHECK(numberAt(sheet, 0, 3) == 0);
+    CHECK(numberAt(sheet, 1, 5) == 0);
+
+    // Volatile cells stop ticking once cleared
+    sheet.setCellFormula(CellAddress(8, 0), "=RAND()");
+    CHECK(sheet.recalculateVolatile());
+    sheet.clearRange(CellRange(CellAddress(8, 0), CellAddress(8, 0)));
+    CHECK(!sheet.recalculateVolatile());
+}
+
+int main() {
+    testPlacement();
+    testBlocking();
+    testRelease();
+    testClearRange();
+    return testResult();
+}
@@ -0,0 +1,72 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+#include "StringPool.h"
+
+static QString resultAt(Spreadsheet& sheet, int row, int col) {
+    return sheet.getCellResult(CellAddress(row, col)).toString();
+}
+
+static void testRefsAndIdReuse() {
+    StringPool& pool = StringPool::shared();
+    size_t base = pool.size();
+    uint32_t id;
+    {
+        StringPool::Refs refs;
+        id = refs.intern("pool-test");
+        CHECK(pool.find("pool-test") == id);
+        StringPool::Refs copy = refs;
+        refs.clear();
+        CHECK(pool.find("pool-test") == id);  // the copy still holds it
+    }
+    CHECK(pool.find("pool-test") == StringPool::kNoString);
+    CHECK(pool.size() == base);
+
+    StringPool::Refs refs;
+    CHECK(refs.intern("pool-test-2") == id);
+}
+
+// Cell text, formula results and literals hold their strings; overwriting a
+// cell or dropping the sheet releases them
+static void testCellsReleaseText() {
+    StringPool& pool = StringPool::shared();
+    size_t base = pool.size();
+    {
+        Spreadsheet sheet;
+        sheet.setCellValue(CellAddress(0, 0), "alpha");
+        CHECK(pool.size() == base + 1);
+        sheet.setCellValue(CellAddress(0, 0), 5);
+        CHECK(pool.size() == base);
+
+        sheet.setCellValue(CellAddress(0, 0), "x");
+        sheet.setCellFormula(CellAddress(0, 1), "=CONCAT(\"p\", A1, \"q\")");
+        sheet.setCellFormula(CellAddress(0, 2), "=UPPER(B1)");
+        CHECK_TEXT(resultAt(sheet, 0, 2), "PXQ");
+        size_t settled = pool.size();
+        for (int i = 0; i < 1000; ++i) sheet.setCellValue(CellAddress(0, 0), QString("v%1").arg(i));
+        CHECK_TEXT(resultAt(sheet, 0, 2), "PV999Q");
+        CHECK(pool.size() <= settled + 2);
+
+        // Spilled text outlives the evaluation that produced the array
+        sheet.setCellValue(CellAddress(10, 0), "r3");
+        sheet.setCellValue(CellAddress(11, 0), "r1");
+        sheet.setCellValue(CellAddress(12, 0), "r2");
+        sheet.setCellFormula(CellAddress(10, 2), "=SORT(A11:A13)");
+        sheet.setCellFormula(CellAddress(10, 6), "=LOWER(\"ZZ\")");
+        CHECK_TEXT(resultAt(sheet, 11, 2), "r2");
+        CHECK_TEXT(resultAt(sheet, 12, 2), "r3");
+
+        // A literal keeps its text while no cell holds it
+        sheet.setCellValue(CellAddress(20, 0), "lit");
+        sheet.setCellFormula(CellAddress(20, 1), "=IF(A21=\"lit\", 1, 0)");
+        sheet.setCellValue(CellAddress(20, 0), 1);
+        sheet.setCellValue(CellAddress(20, 0), "lit");
+        CHECK_TEXT(resultAt(sheet, 20, 1), "1");
+    }
+    CHECK(pool.size() == base);
+}
+
+int main() {
+    testRefsAndIdReuse();
+    testCellsReleaseText();
+    return testResult();
+}
@@ -0,0 +1,35 @@
+#ifndef TESTCHECK_H
+#define TESTCHECK_H
+
+#include <QString>
+#include <cstdio>
+
+// Minimal checks for the core tests: a failure is printed and counted, and
+// main() returns testResult()
+static int s_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++s_failures; \
+        } \
+    } while (0)
+
+#define CHECK_TEXT(actual, expected) \
+    do { \
+        const QString actualText = (actual); \
+        const QString expectedText = (expected); \
+        if (actualText != expectedText) { \
+            std::printf("%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #actual, \
+                        qPrintable(actualText), qPrintable(expectedText)); \
+            ++s_failures; \
+        } \
+    } while (0)
+
+static int testResult() {
+    if (s_failures) std::printf("%d check(s) failed\n", s_failures);
+    return s_failures ? 1 : 0;
+}
+
+#endif // TESTCHECK_H
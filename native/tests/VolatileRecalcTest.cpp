@@ -0,0 +1,45 @@
+#include "TestCheck.h"
+#include "Spreadsheet.h"
+#include "StringPool.h"
+
+static void testOnlyVolatileSheetsTick() {
+    Spreadsheet sheet;
+    sheet.setCellValue(CellAddress(0, 0), 2);
+    sheet.setCellFormula(CellAddress(0, 1), "=A1*3");
+    CHECK(!sheet.recalculateVolatile());
+
+    sheet.setCellFormula(CellAddress(1, 0), "=RAND()");
+    sheet.setCellFormula(CellAddress(1, 1), "=A2+1");
+    CHECK(sheet.recalculateVolatile());
+    double rand = sheet.getCellValue(CellAddress(1, 0)).toDouble();
+    CHECK(sheet.getCellValue(CellAddress(1, 1)).toDouble() == rand + 1);
+
+    // No longer volatile once overwritten
+    sheet.setCellValue(CellAddress(1, 0), 5);
+    CHECK(!sheet.recalculateVolatile());
+    CHECK_TEXT(sheet.getCellValue(CellAddress(1, 1)).toString(), "6");
+}
+
+// Every tick replaces the text of volatile results; the replaced strings
+// must be freed, or a clock ticking once a second grows the pool forever
+static void testTicksDoNotGrowPool() {
+    StringPool& pool = StringPool::shared();
+    Spreadsheet sheet;
+    sheet.setCellFormula(CellAddress(0, 0), "=CONCAT(\"r\",RAND())");
+    sheet.setCellFormula(CellAddress(0, 1), "=UPPER(A1)");
+    sheet.setCellFormula(CellAddress(1, 0), "=NOW()");
+    sheet.setCellFormula(CellAddress(1, 1), "=TODAY()");
+    sheet.recalculateVolatile();
+
+    size_t before = pool.size();
+    for (int i = 0; i < 1000; ++i) sheet.recalculateVolatile();
+    CHECK(pool.size() <= before + 2);
+    CHECK(sheet.getCellValue(CellAddress(0, 1)).toString() ==
+          sheet.getCellValue(CellAddress(0, 0)).toString().toUpper());
+}
+
+int main() {
+    testOnlyVolatileSheetsTick();
+    testTicksDoNotGrowPool();
+    return testResult();
+}